@@ -0,0 +1,91 @@
+-- Benchmark runner
+-- Every result is printed as one JSON object per line
+-- Usage: lua bench.lua [scale [suite...]]
+--   scale multiplies every iteration count (default 1)
+--   suites default to buffer, struct, queue, pool and map
+local void = require "void"
+
+local bench = {}
+
+local scale = tonumber(arg and arg[1]) or 1
+local repeats = 5
+
+local function encode(value)
+	local t = type(value)
+	if t == "number" then
+		if value ~= value or value == math.huge or value == -math.huge then
+			return "null"
+		elseif math.type and math.type(value) == "integer" then
+			return tostring(value)
+		end
+		return ("%.17g"):format(value)
+	elseif t == "string" then
+		return '"'..value:gsub('[%c"\\]', function(c)
+			return ("\\u%04x"):format(c:byte())
+		end)..'"'
+	elseif t == "boolean" then
+		return tostring(value)
+	end
+
+	local keys = {}
+	for k in pairs(value) do keys[#keys+1] = k end
+	table.sort(keys)
+
+	local fields = {}
+	for i, k in ipairs(keys) do
+		fields[i] = encode(k)..":"..encode(value[k])
+	end
+	return "{"..table.concat(fields, ",").."}"
+end
+
+-- Prints a result, params and metrics are merged into one object
+function bench.report(name, params, metrics)
+	local result = {bench = name}
+	for k, v in pairs(params) do result[k] = v end
+	for k, v in pairs(metrics) do result[k] = v end
+	print(encode(result))
+	io.stdout:flush()
+end
+
+function bench.iterations(n)
+	return math.max(1, math.floor(n*scale))
+end
+
+-- Runs fn(iterations) repeats times and reports the median operations per second
+function bench.run(name, params, iterations, fn)
+	iterations = bench.iterations(iterations)
+	fn(math.max(1, iterations//10)) -- Warm up
+
+	local rates = {}
+	for i=1, repeats do
+		collectgarbage()
+		local start = void.clock()
+		fn(iterations)
+		rates[i] = iterations/(void.clock()-start)
+	end
+	table.sort(rates)
+
+	bench.report(name, params, {
+		iterations = iterations,
+		opsPerSec = rates[(repeats+1)//2],
+		minOpsPerSec = rates[1],
+		maxOpsPerSec = rates[repeats]
+	})
+end
+
+-- Returns the value at percentile p (0 to 100) of a sorted array
+function bench.percentile(sorted, p)
+	return sorted[math.max(1, math.ceil(#sorted*p/100))]
+end
+
+local suites = {select(2, ...)}
+if arg then
+	suites = {table.unpack(arg, 2)}
+end
+if #suites == 0 then
+	suites = {"buffer", "struct", "queue", "pool", "map"}
+end
+
+for _, suite in ipairs(suites) do
+	dofile(suite..".lua")(bench)
+end
@@ -0,0 +1,292 @@
+-- Buffer accessors and allocation
+local void = require "void"
+
+local types = {
+	{"U8", 1}, {"S8", 1},
+	{"U16", 2}, {"U16LE", 2}, {"U16BE", 2},
+	{"U32", 4}, {"U32LE", 4}, {"U32BE", 4},
+	{"U64", 8}, {"U64LE", 8}, {"U64BE", 8},
+	{"F32", 4}, {"F32LE", 4}, {"F32BE", 4},
+	{"F64", 8}, {"F64LE", 8}, {"F64BE", 8}
+}
+
+-- A partner thread answers every turn, through the word at 0 of a shared buffer or through two queues
+local waitPartner = [[
+	local void = require "void"
+	local queue, rounds = void.queue.get((...)), tonumber((select(2, ...)))
+	local shared = void.queue.await(queue, -1)
+	for i=1, rounds do
+		local turn = void.buffer.atomicLoad(shared, 0)
+		while turn ~= 2*i-1 do
+			void.buffer.wait(shared, 0, turn)
+			turn = void.buffer.atomicLoad(shared, 0)
+		end
+		void.buffer.atomicStore(shared, 0, 2*i)
+		void.buffer.wake(shared, 0)
+	end
+]]
+
+local queuePartner = [[
+	local void = require "void"
+	local requests, rounds, replies = ...
+	requests, replies = void.queue.get(requests), void.queue.get(replies)
+	for i=1, tonumber(rounds) do
+		void.queue.enqueue(replies, void.queue.await(requests, -1), true)
+	end
+]]
+
+local function pingpong(bench, sync, partner, fn)
+	local thread = require "llthreads2"
+	local rounds = bench.iterations(100000)
+	local shared = void.buffer.create(4)
+	local requests, requestsName = void.queue.create(1)
+	local replies, repliesName = void.queue.create(1)
+
+	if sync == "wait" then
+		void.queue.enqueue(requests, void.buffer.share(shared))
+	end
+	local worker = thread.new(partner, requestsName, tostring(rounds), repliesName)
+	worker:start()
+
+	local start = void.clock()
+	fn(shared, rounds, requests, replies)
+	local elapsed = void.clock()-start
+
+	worker:join()
+	void.queue.destroy(requests)
+	void.queue.destroy(replies)
+
+	bench.report("buffer_pingpong", {sync = sync}, {
+		rounds = rounds,
+		roundsPerSec = rounds/elapsed
+	})
+end
+
+return function(bench)
+	local buffer = void.buffer.create(4096)
+
+	for _, t in ipairs(types) do
+		local name, size = t[1], t[2]
+		local get, set = void.buffer["get"..name], void.buffer["set"..name]
+		local slots = 4096//size
+
+		bench.run("buffer_get", {type = name}, 1000000, function(n)
+			for i=0, n-1 do
+				get(buffer, (i%slots)*size)
+			end
+		end)
+
+		bench.run("buffer_set", {type = name}, 1000000, function(n)
+			for i=0, n-1 do
+				set(buffer, (i%slots)*size, 1)
+			end
+		end)
+	end
+
+	-- The same four field message through pack/unpack and through one accessor per field
+	local fmt = "<I4 i2 d B"
+	bench.run("buffer_pack", {fields = 4}, 500000, function(n)
+		for i=1, n do
+			void.buffer.pack(buffer, 0, fmt, i, -2, 0.5, 7)
+		end
+	end)
+
+	bench.run("buffer_unpack", {fields = 4}, 500000, function(n)
+		for i=1, n do
+			void.buffer.unpack(buffer, 0, fmt)
+		end
+	end)
+
+	local getU32LE, getS16LE, getF64LE, getU8 = void.buffer.getU32LE, void.buffer.getS16LE, void.buffer.getF64LE, void.buffer.getU8
+	bench.run("buffer_get_fields", {fields = 4}, 500000, function(n)
+		for i=1, n do
+			getU32LE(buffer, 0) getS16LE(buffer, 4) getF64LE(buffer, 6) getU8(buffer, 14)
+		end
+	end)
+
+	for _, size in ipairs {16, 256, 4096, 65536} do
+		local source = void.buffer.create(size)
+
+		bench.run("buffer_create", {size = size}, 100000, function(n)
+			for i=1, n do
+				void.buffer.invalidate(void.buffer.create(size))
+			end
+		end)
+
+		bench.run("buffer_clone", {size = size}, 100000, function(n)
+			for i=1, n do
+				void.buffer.invalidate(void.buffer.clone(source))
+			end
+		end)
+
+		bench.run("buffer_concat", {size = size*2}, 100000, function(n)
+			for i=1, n do
+				void.buffer.invalidate(void.buffer.concat(source, source))
+			end
+		end)
+	end
+
+	-- 64MiB staging buffers that get filled right away
+	local large = 64*1024*1024
+	local function staging(name, threshold, options)
+		local previous = void.buffer.mapThreshold(threshold)
+		bench.run("buffer_create_fill", {size = large, mode = name}, 20, function(n)
+			for i=1, n do
+				local buffer = void.buffer.create(large, options)
+				void.buffer.fill(buffer, 1)
+				void.buffer.invalidate(buffer)
+			end
+		end)
+		void.buffer.mapThreshold(previous)
+	end
+
+	staging("malloc_zero", 0)
+	staging("malloc", 0, {zero = false})
+	staging("mapped", 4*1024*1024)
+	staging("mapped_prefault", 4*1024*1024, {prefault = true})
+
+	-- Atomic counter updates against a plain read and write of the same word
+	local counter = void.buffer.create(8)
+	local getU32, setU32 = void.buffer.getU32, void.buffer.setU32
+	bench.run("buffer_atomic", {op = "getset"}, 1000000, function(n)
+		for i=1, n do
+			setU32(counter, 0, getU32(counter, 0)+1)
+		end
+	end)
+
+	local fetchAdd, compareExchange = void.buffer.fetchAdd, void.buffer.compareExchange
+	bench.run("buffer_atomic", {op = "fetchAdd"}, 1000000, function(n)
+		for i=1, n do
+			fetchAdd(counter, 0, 1)
+		end
+	end)
+
+	bench.run("buffer_atomic", {op = "fetchAdd", order = "relaxed"}, 1000000, function(n)
+		for i=1, n do
+			fetchAdd(counter, 0, 1, "u32", "relaxed")
+		end
+	end)
+
+	bench.run("buffer_atomic", {op = "compareExchange"}, 1000000, function(n)
+		for i=1, n do
+			local _, current = compareExchange(counter, 0, 0, 0)
+			compareExchange(counter, 0, current, current+1)
+		end
+	end)
+
+	-- Parsing a frame of three fields at increasing offsets
+	bench.run("frame_parse", {path = "get"}, 500000, function(n)
+		for i=1, n do
+			local at = 0
+			local size = getU32LE(buffer, at) at = at+4
+			local kind = void.buffer.getU16BE(buffer, at) at = at+2
+			local value = getF64LE(buffer, at)
+		end
+	end)
+
+	bench.run("frame_parse", {path = "reader"}, 500000, function(n)
+		for i=1, n do
+			local size, kind, value = void.buffer.reader(buffer):read("u32le", "u16be", "f64le")
+		end
+	end)
+
+	bench.run("frame_parse", {path = "typed"}, 500000, function(n)
+		for i=1, n do
+			local reader = void.buffer.reader(buffer)
+			local size, kind, value = reader:u32le(), reader:u16be(), reader:f64le()
+		end
+	end)
+
+	-- Splitting 4KiB of CRLF separated lines
+	local lines = {}
+	for i=1, 128 do
+		lines[i] = ("line %03d of the message ..."):format(i)
+	end
+	local text = table.concat(lines, "\r\n")
+	local textbuffer = void.buffer.fromString(text)
+
+	bench.run("split", {path = "string.find"}, 2000, function(n)
+		for i=1, n do
+			local str = void.buffer.asString(textbuffer)
+			local at = 1
+			repeat
+				local found = str:find("\r\n", at, true)
+				at = found and found+2
+			until not found
+		end
+	end)
+
+	bench.run("split", {path = "buffer.find"}, 2000, function(n)
+		for i=1, n do
+			local at = 0
+			repeat
+				local found = void.buffer.find(textbuffer, "\r\n", at)
+				at = found and found+2
+			until not found
+		end
+	end)
+
+	-- Checksums over 4KiB, the getU8 loop only sums bytes and is a lower bound for a Lua checksum
+	local block = void.buffer.create(4096)
+	bench.run("checksum", {kind = "crc32c", size = 4096}, 20000, function(n)
+		for i=1, n do
+			void.buffer.crc32c(block)
+		end
+	end)
+
+	bench.run("checksum", {kind = "xxh64", size = 4096}, 20000, function(n)
+		for i=1, n do
+			void.buffer.xxh64(block)
+		end
+	end)
+
+	local getU8 = void.buffer.getU8
+	bench.run("checksum", {kind = "lua_sum", size = 4096}, 200, function(n)
+		for i=1, n do
+			local sum = 0
+			for j=0, 4095 do
+				sum = sum+getU8(block, j)
+			end
+		end
+	end)
+
+	local message = {id = 1, method = "add", args = {1, 2, 3, 4}, tags = {a = true, b = false}}
+	local into = void.buffer.create(256)
+
+	bench.run("serialize", {}, 200000, function(n)
+		for i=1, n do
+			void.serialize(message, into)
+		end
+	end)
+
+	bench.run("deserialize", {}, 200000, function(n)
+		for i=1, n do
+			void.deserialize(into)
+		end
+	end)
+
+	local hasThreads = pcall(require, "llthreads2")
+	if not hasThreads then
+		io.stderr:write("llthreads2 not found, skipping buffer_pingpong\n")
+		return
+	end
+
+	pingpong(bench, "wait", waitPartner, function(shared, rounds)
+		for i=1, rounds do
+			void.buffer.atomicStore(shared, 0, 2*i-1)
+			void.buffer.wake(shared, 0)
+			local turn = void.buffer.atomicLoad(shared, 0)
+			while turn ~= 2*i do
+				void.buffer.wait(shared, 0, turn)
+				turn = void.buffer.atomicLoad(shared, 0)
+			end
+		end
+	end)
+
+	pingpong(bench, "queue", queuePartner, function(shared, rounds, requests, replies)
+		for i=1, rounds do
+			void.queue.enqueue(requests, void.buffer.create(1), true)
+			void.queue.await(replies, -1)
+		end
+	end)
+end
@@ -0,0 +1,110 @@
+-- Shared map lookups across threads and the memory the map uses per entry
+local void = require "void"
+
+local entries = 100000
+
+local function fill(map, size)
+	for i=1, entries do
+		void.map.put(map, "key"..i, void.buffer.create(size))
+	end
+end
+
+local function single(bench, map)
+	local keys = {}
+	for i=1, 1024 do
+		keys[i] = "key"..math.random(entries)
+	end
+	local view = void.buffer.create(0)
+
+	bench.run("map_lookup", {threads = 1}, 1000000, function(n)
+		for i=1, n do
+			void.map.lookup(map, keys[i%1024+1], view)
+		end
+	end)
+
+	bench.run("map_put", {}, 200000, function(n)
+		for i=1, n do
+			void.map.put(map, keys[i%1024+1], void.buffer.create(64))
+		end
+	end)
+end
+
+local reader = [[
+	local void = require "void"
+	local name, results, entries, lookups = ...
+	entries, lookups = tonumber(entries), tonumber(lookups)
+	local map = void.map.get(name)
+	local keys = {}
+	for i=1, 1024 do
+		keys[i] = "key"..math.random(entries)
+	end
+	local view = void.buffer.create(0)
+
+	local start = void.clock()
+	for i=1, lookups do
+		void.map.lookup(map, keys[i%1024+1], view)
+	end
+	local elapsed = void.buffer.create(8)
+	void.buffer.setF64(elapsed, 0, void.clock()-start)
+	void.queue.enqueue(void.queue.get(results), elapsed, true)
+	void.map.destroy(map)
+]]
+
+-- Every thread looks up random keys, the slowest thread's time counts
+local function threaded(bench, name, threads)
+	local thread = require "llthreads2"
+	local lookups = bench.iterations(1000000)
+
+	local results, resultsName = void.queue.create(threads)
+
+	local readers = {}
+	for i=1, threads do
+		readers[i] = thread.new(reader, name, resultsName, tostring(entries), tostring(lookups))
+		readers[i]:start()
+	end
+
+	local slowest = 0
+	for i=1, threads do
+		slowest = math.max(slowest, void.buffer.getF64(void.queue.await(results, -1), 0))
+	end
+	for i=1, threads do
+		readers[i]:join()
+	end
+	void.queue.destroy(results)
+
+	bench.report("map_lookup_threads", {threads = threads}, {
+		lookups = lookups*threads,
+		lookupsPerSec = lookups*threads/slowest
+	})
+end
+
+return function(bench)
+	local map, name = void.map.create()
+	fill(map, 64)
+
+	local stats = void.map.stats(map)
+	bench.report("map_memory", {entries = entries, valueSize = 64}, {
+		keyBytes = stats.keyBytes,
+		valueBytes = stats.valueBytes,
+		tableBytes = stats.tableBytes,
+		overheadPerEntry = stats.tableBytes/entries
+	})
+
+	single(bench, map)
+
+	local hasThreads = pcall(require, "llthreads2")
+	if not hasThreads then
+		io.stderr:write("llthreads2 not found, skipping map_lookup_threads\n")
+	else
+		local counts = {1, 2, 4}
+		if void.pool.cores() > 4 then
+			counts[#counts+1] = void.pool.cores()
+		end
+
+		for _, threads in ipairs(counts) do
+			threaded(bench, name, threads)
+		end
+	end
+
+	void.map.destroy(map)
+end
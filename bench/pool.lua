@@ -0,0 +1,130 @@
+-- Worker pool throughput against the hand rolled pool of threads sharing one queue
+local void = require "void"
+
+-- Each task spins for a few microseconds, every tenth one ten times longer
+local work = [[
+	local void = require "void"
+	return function(buffer)
+		local spin = void.buffer.getU32(buffer, 0)
+		local x = 0
+		for i=1, spin do
+			x = x+i
+		end
+		return buffer
+	end
+]]
+
+local function spin(i)
+	return i%10 == 0 and 20000 or 2000
+end
+
+local function pool(bench, threads)
+	local tasks = bench.iterations(20000)
+	local workers = void.pool.create(threads, work)
+	local replies = void.pool.replies(workers)
+
+	local start = void.clock()
+	local received = 0
+	for i=1, tasks do
+		local buffer = void.buffer.create(4)
+		void.buffer.setU32(buffer, 0, spin(i))
+		-- Bursts of submits, draining replies in between
+		while not void.pool.submit(workers, buffer) do
+			void.queue.await(replies, -1)
+			received = received+1
+		end
+	end
+	for i=received+1, tasks do
+		void.queue.await(replies, -1)
+	end
+	local elapsed = void.clock()-start
+
+	local busy = 0
+	for _, worker in ipairs(void.pool.stats(workers).workers) do
+		busy = busy+worker.busy
+	end
+	void.pool.destroy(workers)
+
+	bench.report("pool", {impl = "void.pool", threads = threads}, {
+		tasks = tasks,
+		tasksPerSec = tasks/elapsed,
+		utilization = busy/(elapsed*threads)
+	})
+end
+
+local sharedWorker = [[
+	local void = require "void"
+	local input, output = ...
+	input, output = void.queue.get(input), void.queue.get(output)
+	local handler = assert(load((select(3, ...))))()
+	while true do
+		local buffer = void.queue.await(input, -1)
+		if void.buffer.length(buffer) == 0 then
+			break
+		end
+		void.queue.enqueue(output, handler(buffer), true)
+	end
+]]
+
+local function shared(bench, threads)
+	local thread = require "llthreads2"
+	local tasks = bench.iterations(20000)
+	local input, inputName = void.queue.create(threads*64)
+	local output, outputName = void.queue.create(0, nil, {mode = "growable"})
+
+	local workers = {}
+	for i=1, threads do
+		workers[i] = thread.new(sharedWorker, inputName, outputName, work)
+		workers[i]:start()
+	end
+
+	local start = void.clock()
+	local received = 0
+	for i=1, tasks do
+		local buffer = void.buffer.create(4)
+		void.buffer.setU32(buffer, 0, spin(i))
+		while not void.queue.enqueue(input, buffer) do
+			void.queue.await(output, -1)
+			received = received+1
+		end
+	end
+	for i=received+1, tasks do
+		void.queue.await(output, -1)
+	end
+	local elapsed = void.clock()-start
+
+	for i=1, threads do
+		void.queue.enqueue(input, void.buffer.create(0), true)
+	end
+	for i=1, threads do
+		workers[i]:join()
+	end
+	void.queue.destroy(input)
+	void.queue.destroy(output)
+
+	bench.report("pool", {impl = "shared_queue", threads = threads}, {
+		tasks = tasks,
+		tasksPerSec = tasks/elapsed
+	})
+end
+
+return function(bench)
+	local counts = {1, 2, 4}
+	if void.pool.cores() > 4 then
+		counts[#counts+1] = void.pool.cores()
+	end
+
+	for _, threads in ipairs(counts) do
+		pool(bench, threads)
+	end
+
+	local hasThreads = pcall(require, "llthreads2")
+	if not hasThreads then
+		io.stderr:write("llthreads2 not found, skipping the shared queue pool\n")
+		return
+	end
+
+	for _, threads in ipairs(counts) do
+		shared(bench, threads)
+	end
+end
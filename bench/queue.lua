@@ -0,0 +1,241 @@
+-- Queue throughput and handoff latency
+local void = require "void"
+
+local modes = {"ring", "growable", "spsc"}
+
+-- Keeps a backlog in the queue and measures enqueue+await pairs on one thread
+-- With traced, void.trace records both calls, what tracing costs per event is the difference
+local function steady(bench, mode, traced)
+	local backlog = 32
+	local queue = void.queue.create(mode == "growable" and 0 or backlog+1, nil, {mode = mode})
+
+	for i=1, backlog do
+		void.queue.enqueue(queue, void.buffer.create(16))
+	end
+
+	if traced then
+		void.trace.start()
+	end
+
+	bench.run("queue_steady", {mode = mode, trace = traced and "on" or "off"}, 1000000, function(n)
+		for i=1, n do
+			void.queue.enqueue(queue, void.queue.await(queue))
+		end
+	end)
+
+	if traced then
+		void.trace.stop()
+	end
+
+	void.queue.destroy(queue)
+end
+
+-- Records written and read in place against a buffer created and moved through a ring per message
+local function stream(bench, size)
+	local queue = void.queue.create(64*1024, nil, {mode = "stream"})
+	-- One view each for writing and reading, reused for every record
+	local writer = void.queue.reserve(queue, size)
+	void.queue.commit(queue, writer)
+	local reader = void.queue.read(queue)
+	void.queue.release(queue, reader)
+
+	bench.run("queue_stream", {size = size, api = "reserve"}, 1000000, function(n)
+		for i=1, n do
+			void.queue.reserve(queue, size, false, writer)
+			void.buffer.setU32(writer, 0, i)
+			void.queue.commit(queue, writer)
+			void.queue.read(queue, 0, reader)
+			void.buffer.getU32(reader, 0)
+			void.queue.release(queue, reader)
+		end
+	end)
+	void.queue.destroy(queue)
+
+	queue = void.queue.create(32)
+	bench.run("queue_stream", {size = size, api = "ring"}, 1000000, function(n)
+		for i=1, n do
+			local buffer = void.buffer.create(size)
+			void.buffer.setU32(buffer, 0, i)
+			void.queue.enqueue(queue, buffer)
+			void.buffer.getU32(void.queue.await(queue), 0)
+		end
+	end)
+	void.queue.destroy(queue)
+end
+
+local producer = [[
+	local void = require "void"
+	local name, messages = ...
+	local queue = void.queue.get(name)
+	for i=1, tonumber(messages) do
+		local buffer = void.buffer.create(8)
+		void.buffer.setF64(buffer, 0, void.clock())
+		void.queue.enqueue(queue, buffer, true)
+	end
+]]
+
+-- Producer threads send timestamped buffers to this thread
+local function handoff(bench, mode, threads)
+	local thread = require "llthreads2"
+	local messages = bench.iterations(100000)
+	local perThread = messages//threads
+	messages = perThread*threads
+
+	local queue, name = void.queue.create(1024, nil, {mode = mode})
+	local producers = {}
+	for i=1, threads do
+		producers[i] = thread.new(producer, name, tostring(perThread))
+	end
+
+	local latencies = {}
+	local start = void.clock()
+	for i=1, threads do
+		producers[i]:start(false, false)
+	end
+
+	for i=1, messages do
+		local buffer = void.queue.await(queue, -1)
+		latencies[i] = void.clock()-void.buffer.getF64(buffer, 0)
+	end
+	local elapsed = void.clock()-start
+
+	for i=1, threads do
+		producers[i]:join()
+	end
+	void.queue.destroy(queue)
+
+	table.sort(latencies)
+	bench.report("queue_handoff", {mode = mode, threads = threads}, {
+		messages = messages,
+		msgPerSec = messages/elapsed,
+		p50Us = bench.percentile(latencies, 50)*1e6,
+		p99Us = bench.percentile(latencies, 99)*1e6
+	})
+end
+
+-- Delayed buffers, inserted while many others are pending and drained once they are due
+local function delayed(bench, pending)
+	local queue = void.queue.create(0, nil, {mode = "growable"})
+	for i=1, pending do
+		void.queue.enqueueAfter(queue, void.buffer.create(8), math.random(3600000))
+	end
+
+	bench.run("queue_delay_insert", {pending = pending}, 200000, function(n)
+		for i=1, n do
+			void.queue.enqueueAfter(queue, void.buffer.create(8), math.random(3600000))
+		end
+	end)
+	void.queue.destroy(queue)
+
+	-- Due within 100ms, the drain starts once all of them are
+	local messages = bench.iterations(200000)
+	queue = void.queue.create(0, nil, {mode = "growable"})
+	local sleep = void.queue.create(1)
+	local start = void.clock()
+	for i=1, messages do
+		void.queue.enqueueAt(queue, void.buffer.create(8), start+math.random(100)/1000)
+	end
+	void.queue.await(sleep, math.max(0, math.ceil((start+0.1-void.clock())*1000))+1)
+
+	start = void.clock()
+	for i=1, messages do
+		void.queue.await(queue, -1)
+	end
+	local elapsed = void.clock()-start
+	void.queue.destroy(queue)
+	void.queue.destroy(sleep)
+
+	bench.report("queue_delay_expire", {}, {
+		messages = messages,
+		msgPerSec = messages/elapsed
+	})
+end
+
+local journalProducer = [[
+	local void = require "void"
+	local name, messages = ...
+	local queue = void.queue.get(name)
+	for i=1, tonumber(messages) do
+		void.queue.enqueue(queue, void.buffer.create(256), true)
+	end
+]]
+
+-- Producer threads enqueue into a journaled queue, this thread drains and acknowledges
+-- syncInterval 0 makes every enqueue durable, with one producer that is one fdatasync per message
+local function journal(bench, syncInterval, threads)
+	local thread = require "llthreads2"
+	local messages = bench.iterations(syncInterval == 0 and 2000 or 100000)
+	local perThread = messages//threads
+	messages = perThread*threads
+
+	local path = os.tmpname()
+	os.remove(path)
+	local queue, name = void.queue.create(1024, nil, {journal = path, syncInterval = syncInterval})
+	local producers = {}
+	for i=1, threads do
+		producers[i] = thread.new(journalProducer, name, tostring(perThread))
+	end
+
+	local start = void.clock()
+	for i=1, threads do
+		producers[i]:start(false, false)
+	end
+
+	for i=1, messages do
+		void.queue.await(queue, -1)
+		if i%64 == 0 then
+			void.queue.ack(queue)
+		end
+	end
+	local elapsed = void.clock()-start
+
+	for i=1, threads do
+		producers[i]:join()
+	end
+	local syncs = void.queue.stats(queue).syncs
+	void.queue.ack(queue)
+	void.queue.destroy(queue)
+	os.execute("rm -rf '"..path.."'")
+
+	bench.report("queue_journal", {syncInterval = syncInterval, threads = threads}, {
+		messages = messages,
+		msgPerSec = messages/elapsed,
+		msgPerSync = syncs > 0 and messages/syncs or nil
+	})
+end
+
+return function(bench)
+	for _, mode in ipairs(modes) do
+		steady(bench, mode)
+	end
+	steady(bench, "ring", true)
+
+	for _, size in ipairs {16, 64, 256, 1024} do
+		stream(bench, size)
+	end
+
+	for _, pending in ipairs {0, 100000} do
+		delayed(bench, pending)
+	end
+
+	local hasThreads = pcall(require, "llthreads2")
+	if not hasThreads then
+		io.stderr:write("llthreads2 not found, skipping queue_handoff\n")
+		return
+	end
+
+	for _, mode in ipairs(modes) do
+		for _, threads in ipairs {1, 2, 4} do
+			-- Only one producer may use an spsc queue
+			if mode ~= "spsc" or threads == 1 then
+				handoff(bench, mode, threads)
+			end
+		end
+	end
+
+	for _, syncInterval in ipairs {0, 10, -1} do
+		for _, threads in ipairs {1, 4} do
+			journal(bench, syncInterval, threads)
+		end
+	end
+end
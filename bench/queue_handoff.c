@@ -0,0 +1,120 @@
+// Queue handoff benchmark
+// One producer thread sends timestamped buffers to one consumer thread
+// and the consumer records how long each buffer took to arrive
+// Usage: queue_handoff [messages [slots]]
+
+#include "../src/void_queue.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct handoff handoff;
+
+struct handoff {
+	void_queue queue;
+	unsigned int messages;
+	uint64_t *latencies;
+};
+
+static uint64_t now_ns(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec*1000000000+time.tv_nsec;
+}
+
+static int enqueue(void_queue *queue, void_buffer *buffer) {
+	if (void_queue_lockfree(queue))
+		return void_queue_enqueue(queue, buffer, 1);
+
+	void_queue_lock(queue);
+	int result = void_queue_enqueue(queue, buffer, 1);
+	void_queue_unlock(queue);
+	return result;
+}
+
+static int await(void_queue *queue, void_buffer *buffer) {
+	if (void_queue_lockfree(queue))
+		return void_queue_await(queue, -1, buffer);
+
+	void_queue_lock(queue);
+	int result = void_queue_await(queue, -1, buffer);
+	void_queue_unlock(queue);
+	return result;
+}
+
+static void *producer(void *ud) {
+	handoff *h = ud;
+	void_buffer buffer;
+	void_buffer_init(&buffer);
+
+	unsigned int i;
+	for (i=0; i<h->messages; i++) {
+		uint64_t *stamp = malloc(sizeof(uint64_t));
+		void_buffer_set(&buffer, stamp, sizeof(uint64_t));
+		*stamp = now_ns();
+		enqueue(&h->queue, &buffer);
+	}
+
+	return 0;
+}
+
+static int compare(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void run(const char *name, int mode, unsigned int messages, unsigned int slots) {
+	handoff h;
+	void_queue_options options;
+	memset(&options, 0, sizeof(void_queue_options));
+	options.mode = mode;
+
+	if (!void_queue_init_options(&h.queue, slots, name, &options)) {
+		fprintf(stderr, "could not create %s queue\n", name);
+		exit(1);
+	}
+
+	h.messages = messages;
+	h.latencies = malloc(sizeof(uint64_t)*messages);
+
+	void_buffer buffer;
+	void_buffer_init(&buffer);
+
+	pthread_t thread;
+	uint64_t start = now_ns();
+	pthread_create(&thread, 0, producer, &h);
+
+	unsigned int i;
+	for (i=0; i<messages; i++) {
+		await(&h.queue, &buffer);
+		h.latencies[i] = now_ns()-*(uint64_t*)void_buffer_data(&buffer);
+		void_buffer_invalidate(&buffer);
+	}
+
+	uint64_t elapsed = now_ns()-start;
+	pthread_join(thread, 0);
+
+	qsort(h.latencies, messages, sizeof(uint64_t), compare);
+
+	printf("{\"bench\":\"queue_handoff\",\"mode\":\"%s\",\"slots\":%u,\"messages\":%u,"
+		"\"msgPerSec\":%.0f,\"p50Ns\":%llu,\"p99Ns\":%llu}\n",
+		name, slots, messages, messages/(elapsed/1e9),
+		(unsigned long long)h.latencies[messages/2],
+		(unsigned long long)h.latencies[(uint64_t)messages*99/100]);
+
+	free(h.latencies);
+	void_queue_destroy(&h.queue);
+}
+
+int main(int argc, char **argv) {
+	unsigned int messages = argc > 1 ? atoi(argv[1]) : 1000000;
+	unsigned int slots = argc > 2 ? atoi(argv[2]) : 1024;
+
+	run("ring", VOID_QUEUE_RING, messages, slots);
+	run("growable", VOID_QUEUE_GROWABLE, messages, slots);
+	run("spsc", VOID_QUEUE_SPSC, messages, slots);
+
+	return 0;
+}
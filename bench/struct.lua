@@ -0,0 +1,139 @@
+-- struct.read and struct.write by field count
+local void = require "void"
+
+return function(bench)
+	for _, fields in ipairs {1, 4, 16} do
+		local def = {}
+		local data = {}
+		for i=1, fields do
+			def[i] = {"field"..i, "u32le"}
+			data["field"..i] = i
+		end
+
+		local struct = void.struct.create(def)
+		local buffer = void.struct.write(struct, data)
+
+		bench.run("struct_read", {fields = fields}, 100000, function(n)
+			for i=1, n do
+				void.struct.read(struct, buffer)
+			end
+		end)
+
+		bench.run("struct_write", {fields = fields}, 100000, function(n)
+			for i=1, n do
+				void.struct.write(struct, buffer, 0, data)
+			end
+		end)
+	end
+
+	-- Decoding an RPC request: the tag then the body, or once through a variant
+	local header = void.struct.create {{"method", "u32"}, {"id", "u64"}}
+	local add = void.struct.create {{"", "inherit", header}, {"a", "f64"}, {"b", "f64"}}
+	local message = void.struct.variant(header, "method", {[1] = add})
+	local buffer = void.struct.write(add, {method = 1, id = 1, a = 1, b = 2})
+	local handlers = {[1] = function(buffer, method, id, a, b) return a+b end}
+
+	bench.run("struct_decode", {path = "twice"}, 100000, function(n)
+		for i=1, n do
+			if void.struct.read(header, buffer).method == 1 then
+				void.struct.read(add, buffer)
+			end
+		end
+	end)
+
+	bench.run("struct_decode", {path = "variant"}, 100000, function(n)
+		for i=1, n do
+			void.struct.read(message, buffer)
+		end
+	end)
+
+	bench.run("struct_decode", {path = "dispatch"}, 100000, function(n)
+		for i=1, n do
+			void.struct.dispatch(message, buffer, handlers)
+		end
+	end)
+
+	-- Summing one field of 1000 records
+	local records = 1000
+	local sample = void.struct.create {{"id", "u32le"}, {"value", "f64le"}, {"flags", "u16le"}}
+	local columns = {id = {}, value = {}, flags = {}}
+	for i=1, records do
+		columns.id[i], columns.value[i], columns.flags[i] = i, i/2, i%7
+	end
+	local batch = void.struct.writeColumns(sample, nil, 0, columns)
+
+	bench.run("struct_batch", {path = "read", records = records}, 100, function(n)
+		for i=1, n do
+			local sum = 0
+			for j=0, records-1 do
+				sum = sum+void.struct.read(sample, batch, j*sample.size).value
+			end
+		end
+	end)
+
+	local into = {}
+	bench.run("struct_batch", {path = "readColumns", records = records}, 100, function(n)
+		for i=1, n do
+			local sum = 0
+			local value = void.struct.readColumns(sample, batch, 0, records, into).value
+			for j=1, records do
+				sum = sum+value[j]
+			end
+		end
+	end)
+
+	local column = {}
+	bench.run("struct_batch", {path = "readColumn", records = records}, 100, function(n)
+		for i=1, n do
+			local sum = 0
+			void.struct.readColumn(sample, batch, 0, records, "value", column)
+			for j=1, records do
+				sum = sum+column[j]
+			end
+		end
+	end)
+
+	-- A message of small integers and flags, with fixed width fields, packed, and with varints and bit fields
+	local layouts = {
+		fixed = void.struct.create {
+			{"method", "u32"}, {"id", "u64"}, {"seq", "u32"}, {"delta", "s32"},
+			{"priority", "u8"}, {"urgent", "u8"}, {"acked", "u8"}, {"retries", "u8"}
+		},
+		packed = void.struct.create {
+			alignment = 1,
+			{"method", "u32"}, {"id", "u64"}, {"seq", "u32"}, {"delta", "s32"},
+			{"priority", "u8"}, {"urgent", "u8"}, {"acked", "u8"}, {"retries", "u8"}
+		},
+		compact = void.struct.create {
+			{"method", "varint"}, {"id", "varint"}, {"seq", "varint"}, {"delta", "zigzag"},
+			{"priority", "bits", 3}, {"urgent", "bool"}, {"acked", "bool"}, {"retries", "bits", 3}
+		}
+	}
+	local message = {method = 3, id = 123456, seq = 42, delta = -7, priority = 2, urgent = 1, acked = 0, retries = 1}
+
+	for _, layout in ipairs {"fixed", "packed", "compact"} do
+		local struct = layouts[layout]
+		local data = {}
+		for name, value in pairs(message) do
+			data[name] = value
+		end
+		if layout == "compact" then
+			data.urgent, data.acked = data.urgent == 1, data.acked == 1
+		end
+
+		local encoded = void.struct.write(struct, data)
+		bench.report("struct_compact_size", {layout = layout}, {bytes = void.buffer.length(encoded)})
+
+		bench.run("struct_compact", {layout = layout, path = "read"}, 100000, function(n)
+			for i=1, n do
+				void.struct.read(struct, encoded)
+			end
+		end)
+
+		bench.run("struct_compact", {layout = layout, path = "write"}, 100000, function(n)
+			for i=1, n do
+				void.struct.write(struct, encoded, 0, data)
+			end
+		end)
+	end
+end
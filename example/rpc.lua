@@ -5,9 +5,10 @@ local socket = require "socket"
 local struct = dofile("rpc_struct.lua")
 
 local request, requestID = void.queue.create(16)
-local reply, replyID = void.queue.create(16)
+-- Replies come back through the client, each to the future of its call
+local client = void.rpc.client()
 
-print(requestID, replyID)
+print(requestID)
 
 local function loadfile_thread(fname, ...)
 	local fh = io.open(fname, "r")
@@ -16,7 +17,7 @@ local function loadfile_thread(fname, ...)
 	return thread.new(code, ...)
 end
 
-local rpcthread = loadfile_thread("rpc_thread.lua", requestID, replyID)
+local rpcthread = loadfile_thread("rpc_thread.lua", requestID)
 rpcthread:start(false, false)
 
 socket.sleep(1)
@@ -39,38 +40,30 @@ local function sendKill()
 	return requestID
 end
 
+-- Returns a future for the reply
 local function sendAddRequest(a, b)
 	local requestID = nextRequestID
 	nextRequestID = requestID+1
 
-	void.queue.enqueue(request, 
+	local future = void.rpc.call(client, request,
         void.struct.write(struct.method_add, {
             method = 1,
             id = requestID,
             a = a,
             b = b
-        })    
+        })
     )
     print("Sent add request")
 
-	return requestID
-end
-
-local function waitResponse(id)
-	while true do
-		local buffer = void.queue.await(reply, 1)
-		print(buffer)
-		if buffer and void.buffer.type(buffer) ~= "invalid" then
-			-- TODO: Compare ID
-			return buffer
-		end
-	end
+	return future
 end
 
-local id = sendAddRequest(5.5, 10.3)
-local response = void.struct.read(struct.method_add, waitResponse(id))
+local first = sendAddRequest(5.5, 10.3)
+local second = sendAddRequest(1, 2)
 
-print(response.a)
+-- Waiting in any order gets each call its own reply
+print(void.struct.read(struct.method_add, second:wait()).a)
+print(void.struct.read(struct.method_add, first:wait()).a)
 
 sendKill()
 rpcthread:join()
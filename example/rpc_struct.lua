@@ -16,4 +16,10 @@ struct.method_add = void.struct.create {
     {"b", "f64"}
 }
 
+-- Decodes a request as the method it names in one pass
+struct.message = void.struct.variant(struct.method, "method", {
+    [0] = struct.method_kill,
+    [1] = struct.method_add
+})
+
 return struct
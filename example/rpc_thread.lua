@@ -2,29 +2,32 @@ local void = require "void"
 
 local struct = dofile("rpc_struct.lua")
 
-local request, reply = ...
-print(request, reply)
-request, reply = void.queue.get(request), void.queue.get(reply)
-print(request, reply)
+local request = ...
+print(request)
+request = void.queue.get(request)
+print(request)
 
-while true do
+local running = true
+
+local handlers = {
+	[0] = function()
+		running = false
+	end,
+	[1] = function(buffer, method, id, a, b)
+		local c = a+b
+		print(a, b, c)
+		void.struct.write(struct.method_add, buffer, {method = method, id = id, a = c, b = b})
+		-- The request buffer still says who asked, so it can go straight back
+		void.rpc.reply(buffer)
+	end
+}
+
+while running do
 	local buffer = void.queue.await(request, -1)
 	print(buffer)
 
 	if buffer and void.buffer.type(buffer) ~= "invalid" then
-        print("Got")
-        local request = void.struct.read(struct.method, buffer)
-
-		print(request.method, request.id)
-
-		if request.method == 0 then
-			break
-		elseif request.method == 1 then
-            request = void.struct.read(struct.method_add, buffer)
-			local c = request.a+request.b
-			print(request.a, request.b, c)
-            request.a = c
-			void.queue.enqueue(reply, void.struct.write(struct.method_add, buffer, request))
-		end
+		print("Got")
+		void.struct.dispatch(struct.message, buffer, handlers)
 	end
 end
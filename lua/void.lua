@@ -1,3 +1,12 @@
 local void = require "void.core"
+
+-- Under LuaJIT the FFI accessors replace the C ones (see void/ffi.lua)
+local backend = require "void.ffi"
+if type(backend) == "table" then
+    for name, func in pairs(backend.accessors) do
+        void.buffer[name] = func
+    end
+end
+
 void.struct = require "void.struct"
 return void
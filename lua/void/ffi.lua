@@ -0,0 +1,247 @@
+-- LuaJIT FFI backend for buffer accessors and structs
+-- The accessors and struct readers in here are plain Lua functions doing loads and stores
+-- through FFI pointers, so the JIT can compile them instead of stopping at a C API call
+-- Returns nil when FFI is not available, callers then keep using the C functions
+local hasffi, ffi = pcall(require, "ffi")
+if not hasffi then
+    return nil
+end
+
+local bit = require "bit"
+local void = require "void.core"
+
+local backend = {}
+
+-- Must match struct void_buffer in src/void_buffer.h
+ffi.cdef [[
+typedef struct void_buffer void_buffer;
+struct void_buffer {
+    int type;
+    size_t length;
+    union {
+        struct {
+            void *data;
+            size_t attachLength;
+            void_buffer **attached;
+            int origin;
+            void *sample;
+            void *shared;
+            int flags;
+        } normal;
+
+        struct {
+            ptrdiff_t start;
+            void_buffer *buffer;
+            int attachPoint;
+        } view;
+    };
+};
+]]
+
+local NORMAL, VIEW = 0, 1
+local READONLY = 1
+
+-- void_trace_active in src/void_trace.c, set for the whole process while a trace runs
+-- Reading it is a plain load, so checking it does not stop the JIT like a C call does
+local traceActive = ffi.cast("int*", debug.getregistry()["void::trace"])
+function backend.tracing()
+    return traceActive[0] ~= 0
+end
+
+local bufferptr = ffi.typeof("void_buffer*")
+local byteptr = ffi.typeof("uint8_t*")
+local metatable = debug.getregistry()["void::buffer"]
+local little = ffi.abi("le")
+
+-- Returns a pointer to the buffer's data and its length
+local function data(buffer, writable)
+    if getmetatable(buffer) ~= metatable then
+        error("bad argument #1 (void::buffer expected)", 3)
+    end
+
+    local b = ffi.cast(bufferptr, buffer)
+    local parent = b
+    local start = 0
+
+    if b.type == VIEW then
+        parent = b.view.buffer
+        start = b.view.start
+    elseif b.type ~= NORMAL then
+        error("no data associated with buffer", 3)
+    end
+
+    if writable and bit.band(parent.normal.flags, READONLY) ~= 0 then
+        error("no writable data associated with buffer", 3)
+    end
+
+    return ffi.cast(byteptr, parent.normal.data)+start, tonumber(b.length)
+end
+backend.data = data
+
+local types = {
+    U8 = "uint8_t", S8 = "int8_t",
+    U16 = "uint16_t", S16 = "int16_t",
+    U32 = "uint32_t", S32 = "int32_t",
+    U64 = "uint64_t", S64 = "int64_t",
+    F32 = "float", F64 = "double"
+}
+
+-- Bytes of reversed values are gathered here before being read as the real type
+local scratch = ffi.new("uint8_t[8]")
+
+local function makeAccessors(ctype, reversed)
+    local ptr = ffi.typeof(ctype.."*")
+    local size = ffi.sizeof(ctype)
+    -- 64 bit integers come out as boxed cdata, convert them like the C API would
+    local convert = size == 8 and ctype ~= "double" and tonumber or function(v) return v end
+
+    local get, set
+
+    if not reversed then
+        function get(buffer, offset)
+            local p, length = data(buffer)
+            if offset < 0 or offset+size > length then
+                error("offset "..offset.." out of range", 2)
+            end
+            return convert(ffi.cast(ptr, p+offset)[0])
+        end
+
+        function set(buffer, offset, value)
+            local p, length = data(buffer, true)
+            if offset < 0 or offset+size > length then
+                error("offset "..offset.." out of range", 2)
+            end
+            ffi.cast(ptr, p+offset)[0] = value
+        end
+    else
+        local scratchptr = ffi.cast(ptr, scratch)
+
+        function get(buffer, offset)
+            local p, length = data(buffer)
+            if offset < 0 or offset+size > length then
+                error("offset "..offset.." out of range", 2)
+            end
+            p = p+offset
+            for i=0, size-1 do
+                scratch[i] = p[size-1-i]
+            end
+            return convert(scratchptr[0])
+        end
+
+        function set(buffer, offset, value)
+            local p, length = data(buffer, true)
+            if offset < 0 or offset+size > length then
+                error("offset "..offset.." out of range", 2)
+            end
+            scratchptr[0] = value
+            p = p+offset
+            for i=0, size-1 do
+                p[i] = scratch[size-1-i]
+            end
+        end
+    end
+
+    return get, set
+end
+
+-- Same names as the C accessors in void.buffer
+local accessors = {}
+backend.accessors = accessors
+
+for name, ctype in pairs(types) do
+    local get, set = makeAccessors(ctype, false)
+    local rget, rset = makeAccessors(ctype, true)
+
+    accessors["get"..name], accessors["set"..name] = get, set
+    if name ~= "U8" and name ~= "S8" then
+        accessors["get"..name..(little and "LE" or "BE")] = get
+        accessors["set"..name..(little and "LE" or "BE")] = set
+        accessors["get"..name..(little and "BE" or "LE")] = rget
+        accessors["set"..name..(little and "BE" or "LE")] = rset
+    end
+end
+
+-- struct.lua type names of fields that can be read straight out of an FFI struct
+local ctypes = {}
+for name, ctype in pairs(types) do
+    local lower = name:lower()
+    ctypes[lower] = ctype
+    ctypes[lower..(little and "le" or "be")] = ctype
+end
+
+-- Generates FFI backed reader and writer functions for a void.struct
+-- Native endian numbers become fields of a packed FFI struct with the same layout,
+-- everything else goes through the field's own getter and setter
+-- Returns reader(buffer, index) and writer(buffer, index, src)
+function backend.compile(struct)
+    local layout = struct.layout
+    local decl = {}
+    local read = {}
+    local write = {}
+    local position = 0
+
+    for i=1, #layout do
+        local field = layout[i]
+        local ctype = ctypes[field.type]
+        local key = ("%q"):format(field[4])
+
+        if ctype and field[3] >= position then
+            if field[3] > position then
+                decl[#decl+1] = ("uint8_t pad%d[%d];"):format(i, field[3]-position)
+            end
+            decl[#decl+1] = ("%s f%d;"):format(ctype, i)
+            position = field[3]+ffi.sizeof(ctype)
+
+            local value = ("p.f%d"):format(i)
+            if ffi.sizeof(ctype) == 8 and ctype ~= "double" then
+                value = ("tonumber(%s)"):format(value)
+            end
+            read[#read+1] = ("dest[%s] = %s"):format(key, value)
+            write[#write+1] = ("v = src[%s] if v then p.f%d = v end"):format(key, i)
+        else
+            read[#read+1] = ("dest[%s] = layout[%d][1](buffer, index+%d)"):format(key, i, field[3])
+            -- Checksums are filled in by struct.write once everything else is written
+            if field[2] and field.type ~= "crc32c" then
+                -- Only bools and bit fields take false, like struct.write
+                local test = field.group and "v ~= nil" or "v"
+                write[#write+1] = ("v = src[%s] if %s then layout[%d][2](buffer, index+%d, v) end"):format(key, test, i, field[3])
+            end
+        end
+    end
+
+    if struct.size > position then
+        decl[#decl+1] = ("uint8_t pad[%d];"):format(struct.size-position)
+    end
+
+    local ctype = ffi.typeof("struct __attribute__((packed)) { "..table.concat(decl, " ").." }*")
+
+    local source = [[
+        local ffi, data, ctype, layout, size = ...
+        local cast = ffi.cast
+
+        local function pointer(buffer, index, writable)
+            local p, length = data(buffer, writable)
+            if index < 0 or index+size > length then
+                error("struct at offset "..index.." out of range", 3)
+            end
+            return cast(ctype, p+index)
+        end
+
+        return function(buffer, index)
+            local p = pointer(buffer, index)
+            local dest = {}
+            ]]..table.concat(read, "\n            ")..[[
+
+            return dest
+        end, function(buffer, index, src)
+            local p = pointer(buffer, index, true)
+            local v
+            ]]..table.concat(write, "\n            ")..[[
+
+        end
+    ]]
+
+    return assert(loadstring(source, "=void.struct"))(ffi, data, ctype, layout, struct.size)
+end
+
+return backend
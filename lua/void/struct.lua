@@ -1,14 +1,38 @@
 local struct = {}
 
 local void = require "void.core"
+local unpack = void.buffer.unpack
+local traceBegin, traceFinish = void.trace.begin, void.trace.finish
+
+-- Under LuaJIT the FFI accessors are used instead of the C ones (see void/ffi.lua)
+local backend = require "void.ffi"
+if type(backend) ~= "table" then
+    backend = nil
+end
+
+-- traceBegin returns nil while no trace runs, under LuaJIT the process wide flag is
+-- checked through FFI first, so the untraced path makes no C call the JIT stops at
+if backend then
+    local tracing = backend.tracing
+    traceBegin = function()
+        return tracing() and void.trace.begin()
+    end
+end
+local accessors = backend and backend.accessors or void.buffer
 
 local getter = {}
 local setter = {}
 local endians = {native = "", reverse = "re", little = "le", big = "be"}
 local sizeof = {}
+-- void.buffer.unpack codes for plain number fields
+local packcode = {}
+-- Codes of the variable width types, their smallest size is one byte
+local varcode = {varint = "V", zigzag = "v"}
+local floor = math.floor
+local loadstring = loadstring or load
 
 do
-    for i, func in pairs(void.buffer) do
+    for i, func in pairs(accessors) do
         if i:find("^get[USF]") then
             getter[i:sub(4):lower()] = func
         elseif i:find("^set[USF]") then
@@ -16,20 +40,20 @@ do
         end
     end
     
+    local probe = void.buffer.create(2)
+    void.buffer.setU16(probe, 0, 1)
+    local little = void.buffer.getU8(probe, 0) == 1
+    local endiancode = {[""] = "=", le = "<", be = ">", re = little and ">" or "<"}
+
     local function typesiz(s, f, noed)
         local siz = math.floor(s/8) -- Keeps it as an int in Lua 5.3
-        if f then
-            sizeof["f"..s] = siz
-        else
-            sizeof["u"..s] = siz
-            sizeof["s"..s] = siz
-            if not noed then
-                sizeof["u"..s.."le"] = siz
-                sizeof["s"..s.."le"] = siz
-                sizeof["u"..s.."be"] = siz
-                sizeof["s"..s.."be"] = siz
-                sizeof["u"..s.."re"] = siz
-                sizeof["s"..s.."re"] = siz
+        local kinds = f and {f = siz == 4 and "f" or "d"} or {u = "I"..siz, s = "i"..siz}
+        for kind, code in pairs(kinds) do
+            for ed, edcode in pairs(endiancode) do
+                if ed == "" or not noed then
+                    sizeof[kind..s..ed] = siz
+                    packcode[kind..s..ed] = edcode..code
+                end
             end
         end
     end
@@ -39,9 +63,167 @@ do
     typesiz(32, true) typesiz(64, true)
 end
 
+-- Values of a varint below varintLimits[n] take up n bytes
+local varintLimits = {}
+for n=1, 9 do
+    varintLimits[n] = 2^(7*n)
+end
+
+local function varintSize(value)
+    -- Lua 5.3 integers above 2^63 are negative
+    if value < 0 then
+        return 10
+    end
+    for n=1, 9 do
+        if value < varintLimits[n] then
+            return n
+        end
+    end
+    return 10
+end
+
+local function zigzagSize(value)
+    for n=1, 9 do
+        local half = varintLimits[n]/2
+        if value < half and value >= -half then
+            return n
+        end
+    end
+    return 10
+end
+
+-- Getter and setter of a bit field, the group's word accessors are known once the group is complete
+local function bitAccessors(group, shift, width, bool)
+    local scale, mask = floor(2^shift), floor(2^width)
+    
+    if bool then
+        return function(buffer, index)
+            return floor(group.get(buffer, index)/scale)%2 == 1
+        end, function(buffer, index, value)
+            local word = group.get(buffer, index)
+            group.set(buffer, index, word+((value and 1 or 0)-floor(word/scale)%2)*scale)
+        end
+    end
+    
+    return function(buffer, index)
+        return floor(group.get(buffer, index)/scale)%mask
+    end, function(buffer, index, value)
+        local word = group.get(buffer, index)
+        group.set(buffer, index, word+((value or 0)%mask-floor(word/scale)%mask)*scale)
+    end
+end
+
+-- Generates the functions of a struct with varint or zigzag fields
+-- Every field goes through one void.buffer.unpack or void.buffer.pack call, offsets
+-- past a varint are only known while reading or writing
+local function compileVariable(result, format)
+    local layout = result.layout
+    local words = {}
+    local values = {}
+    local fields = {}
+    local sizes = {}
+    local extra = 0
+    -- Index in words of each group's word
+    local wordOf = {}
+    
+    for i=1, #layout do
+        local lyt = layout[i]
+        local key = ("%q"):format(lyt[4])
+        local group = lyt.group
+        local n = group and wordOf[group]
+        
+        if not n then
+            n = #words+1
+            words[n] = "w"..n
+            if group then
+                wordOf[group] = n
+                values[n] = "0"
+            else
+                values[n] = ("src[%s] or 0"):format(key)
+            end
+            
+            if varcode[lyt.type] then
+                sizes[#sizes+1] = ("%sSize(%s)"):format(lyt.type, words[n])
+                extra = extra+1
+            end
+        end
+        
+        local word = words[n]
+        local value
+        if group then
+            local scale, mask = floor(2^lyt.shift), floor(2^lyt.width)
+            
+            if lyt.type == "bool" then
+                value = ("floor(%s/%d)%%2 == 1"):format(word, scale)
+                values[n] = values[n]..("+(src[%s] and %d or 0)"):format(key, scale)
+            else
+                value = ("floor(%s/%d)%%%d"):format(word, scale, mask)
+                values[n] = values[n]..("+((src[%s] or 0)%%%d)*%d"):format(key, mask, scale)
+            end
+        else
+            value = word
+        end
+        
+        fields[#fields+1] = {key, value}
+    end
+    
+    local locals = {}
+    local positional = {}
+    local named = {}
+    for i=1, #words do
+        locals[i] = ("local %s = %s"):format(words[i], values[i])
+    end
+    for i=1, #fields do
+        positional[i] = fields[i][2]
+        named[i] = ("[%s] = %s"):format(fields[i][1], fields[i][2])
+    end
+    
+    local wordList = table.concat(words, ", ")
+    local size = #sizes > 0 and ("size+%s-%d"):format(table.concat(sizes, "+"), extra) or "size"
+    
+    local source = [[
+        local unpack, pack, create, floor, varintSize, zigzagSize, format, size = ...
+        
+        local function measure(src)
+            ]]..table.concat(locals, "\n            ")..[[
+            
+            return ]]..size..[[
+        end
+        
+        return function(buffer, index)
+            local ]]..wordList..[[, after = unpack(buffer, index, format)
+            return {]]..table.concat(named, ", ")..[[}, after
+        end, function(buffer, index)
+            local ]]..wordList..[[, after = unpack(buffer, index, format)
+            return ]]..table.concat(positional, ", ")..[[, after
+        end, function(buffer, index, src)
+            ]]..table.concat(locals, "\n            ")..[[
+            
+            if buffer == nil then
+                buffer = create(index+]]..size..[[)
+            end
+            return buffer, pack(buffer, index, format, ]]..wordList..[[)
+        end, measure
+    ]]
+    
+    return assert(loadstring(source, "=void.struct"))(
+        unpack, void.buffer.pack, void.buffer.create, floor, varintSize, zigzagSize, format, result.size)
+end
+
 function struct.create(structdef)
     local endian = (structdef.endian or "native"):lower()
-    local alignment = (structdef.alignment or 8)
+    
+    -- Offsets past a varint depend on the values, so these structs have no padding
+    local variable = false
+    for _, field in ipairs(structdef) do
+        local typ = field[2]:lower()
+        if varcode[typ] or (typ == "inherit" and field[3].variable) then
+            variable = true
+        end
+    end
+    assert(not variable or (structdef.alignment or 1) <= 1, "Structs with varint or zigzag fields can not be aligned")
+    
+    local alignment = (structdef.alignment or (variable and 1 or 8))
     
     local function align(x)
         local y = alignment - (x % alignment)
@@ -53,6 +235,12 @@ function struct.create(structdef)
     
     local layout = {}
     local index = 0
+    -- Checksum fields, filled in after the rest of the struct is written
+    local checksums = {}
+    -- Set once a varint was laid out, offsets of the fields after it are the smallest they can be
+    local varying = false
+    -- Bit fields and booleans next to each other share the word of a group
+    local group
     
     local function getLayoutFromType(field)
         local lyt, size
@@ -65,7 +253,38 @@ function struct.create(structdef)
                 function(buffer, index) return index end, nil, index, field[1]
             }
             size = 0
+        elseif typ == "crc32c" then
+            -- CRC-32C of every byte in the struct before this field, stored as a u32
+            -- write fills it in and read raises an error if it does not match
+            local name, offset = field[1], index
+            local get, set = getter["u32"..endians[endian]], setter["u32"..endians[endian]]
+            local crc32c = void.buffer.crc32c
+            lyt = {
+                name = name, type = typ,
+                function(buffer, index)
+                    local value = get(buffer, index)
+                    if value ~= crc32c(buffer, index-offset, offset) then
+                        error("checksum mismatch for field "..name, 3)
+                    end
+                    return value
+                end,
+                function(buffer, index)
+                    set(buffer, index, crc32c(buffer, index-offset, offset))
+                end, index, name
+            }
+            size = 4
+        elseif varcode[typ] then
+            -- Unsigned LEB128 and zigzag signed varints
+            local code = varcode[typ]
+            lyt = {
+                name = field[1], type = typ,
+                function(buffer, index)
+                    return (unpack(buffer, index, code))
+                end, nil, index, field[1]
+            }
+            size = 1
         elseif typ == "struct" then
+            assert(not field[3].variable, "Struct field "..field[1].." has varint or zigzag fields")
             lyt = {
                 name = field[1], type = typ, struct = field[3],
                 function(buffer, index)
@@ -122,8 +341,45 @@ function struct.create(structdef)
         return lyt, size
     end
     
+    -- The word of a group is the smallest of u8, u16 and u32 that holds its bits
+    local function closeGroup()
+        if group then
+            local size = group.used <= 8 and 1 or group.used <= 16 and 2 or 4
+            local word = size == 1 and "u8" or "u"..(size*8)..endians[endian]
+            group.get, group.set, group.code, group.size = getter[word], setter[word], packcode[word], size
+            index = align(index+size)
+            group = nil
+        end
+    end
+    
     for _, field in ipairs(structdef) do
-        if field[2] == "inherit" then
+        local typ = field[2]:lower()
+        if typ ~= "bits" and typ ~= "bool" then
+            closeGroup()
+        end
+        
+        if typ == "bits" or typ == "bool" then
+            if layout[field[1]] then error("Duplicate field "..field[1]) end
+            
+            local width = typ == "bool" and 1 or field[3]
+            if type(width) ~= "number" or width < 1 or width > 32 or width%1 ~= 0 then
+                error("Invalid bit width for field "..field[1])
+            end
+            
+            if group and group.used+width > 32 then
+                closeGroup()
+            end
+            group = group or {used = 0}
+            
+            local get, set = bitAccessors(group, group.used, width, typ == "bool")
+            local lyt = {
+                name = field[1], type = typ, group = group, shift = group.used, width = width,
+                get, set, index, field[1], varying = varying or nil
+            }
+            group.used = group.used+width
+            layout[field[1]] = lyt
+            layout[#layout+1] = lyt
+        elseif field[2] == "inherit" then
             -- inherit fields from another struct
             local struct = field[3]
             local slayout = struct.layout
@@ -134,11 +390,16 @@ function struct.create(structdef)
                 local nlyt = {}
                 for i, v in pairs(lyt) do nlyt[i] = v end
                 nlyt[3] = nlyt[3]+index
+                nlyt.varying = nlyt.varying or varying or nil
                 
                 layout[lyt.name] = nlyt
                 layout[#layout+1] = nlyt
+                if nlyt.type == "crc32c" then
+                    checksums[#checksums+1] = nlyt
+                end
             end
             
+            varying = varying or struct.variable
             index = index+struct.size
         elseif field[2] == "padding" then
             index = index+field[3]
@@ -146,39 +407,165 @@ function struct.create(structdef)
             if layout[field[1]] then error("Duplicate field "..field[1]) end
         
             local lyt, siz = getLayoutFromType(field)
+            lyt.varying = varying or nil
+            varying = varying or varcode[lyt.type] ~= nil
             index = index+siz
             layout[field[1]] = lyt
             layout[#layout+1] = lyt
+            if lyt.type == "crc32c" then
+                checksums[#checksums+1] = lyt
+            end
         end
         
-        index = align(index)
+        if not group then
+            index = align(index)
+        end
     end
+    closeGroup()
     
-    return {
+    -- Structs made of only numbers also get a format for void.buffer.unpack
+    -- The words of bit groups are one value each, varints count as one byte
+    local format = {}
+    local position = 0
+    local previous
+    local hasBits = false
+    for i=1, #layout do
+        local lyt = layout[i]
+        local group = lyt.group
+        if not group or group ~= previous then
+            local code = group and group.code or packcode[lyt.type] or varcode[lyt.type]
+            if not code or lyt[3] < position then
+                format = nil
+                break
+            end
+            format[#format+1] = ("x"):rep(lyt[3]-position)..code
+            position = lyt[3]+(group and group.size or sizeof[lyt.type] or 1)
+        end
+        hasBits = hasBits or group ~= nil
+        previous = group
+    end
+    format = format and table.concat(format)..("x"):rep(index-position)
+    
+    local result = {
         layout = layout,
-        size = index
+        checksums = #checksums > 0 and checksums or nil,
+        size = index,
+        variable = variable or nil,
+        -- The values unpacked with it are the fields only without bit groups
+        format = not hasBits and format or nil
     }
+    
+    if variable then
+        if not format then
+            error("Structs with varint or zigzag fields can only hold numbers, bits and bools")
+        end
+        result.decode, result.values, result.encode, result.measure = compileVariable(result, format)
+    elseif backend then
+        result.reader, result.writer = backend.compile(result)
+    end
+    
+    return result
 end
 
-function struct.read(struct, buffer, index)
-    local dest = {}
+-- Creates a variant from a header struct, the name of the header field that tells
+-- which case follows and a table of case structs by tag value
+-- Cases usually inherit the header, struct.read and struct.write use the case
+-- picked by the tag and fall back to the header for unknown tags
+function struct.variant(header, tag, cases)
+    local field = header.layout[tag]
+    assert(field and packcode[field.type] and not field.varying, "Invalid tag field "..tostring(tag))
+    
+    return {
+        header = header,
+        tag = tag,
+        cases = cases,
+        getTag = field[1],
+        tagIndex = field[3],
+        layout = header.layout,
+        size = header.size
+    }
+end
+
+-- Returns the struct used for a variant at index in buffer
+local function variantCase(variant, buffer, index)
+    return variant.cases[variant.getTag(buffer, index+variant.tagIndex)] or variant.header
+end
+
+-- Calls handlers[tag](buffer, field values..., index after the struct) for the case the tag selects
+-- Field values are passed in layout order, so no table is built for them
+-- handlers.default is called for tags without a handler
+function struct.dispatch(variant, buffer, handlers, index)
     index = index or 0
+    local tag = variant.getTag(buffer, index+variant.tagIndex)
+    local handler = handlers[tag] or handlers.default
+    if not handler then
+        return
+    end
     
-    local layout = struct.layout
-    for i=1, #layout do
+    local case = variant.cases[tag] or variant.header
+    if case.values then
+        return handler(buffer, case.values(buffer, index))
+    end
+    
+    if case.format then
+        return handler(buffer, unpack(buffer, index, case.format))
+    end
+    
+    local layout = case.layout
+    local count = #layout
+    if count == 0 then
+        return handler(buffer, index+case.size)
+    end
+    
+    -- The index after the struct is appended after the last field
+    local function values(i)
         local field = layout[i]
-        dest[field[4]] = field[1](buffer, index+field[3])
+        if i == count then
+            return field[1](buffer, index+field[3]), index+case.size
+        end
+        return field[1](buffer, index+field[3]), values(i+1)
+    end
+    return handler(buffer, values(1))
+end
+
+function struct.readNext(struct, buffer, index)
+    local traced = traceBegin()
+    local dest
+    index = index or 0
+    
+    if struct.cases then
+        struct = variantCase(struct, buffer, index)
+    end
+    
+    local after
+    if struct.decode then
+        dest, after = struct.decode(buffer, index)
+    elseif struct.reader then
+        dest = struct.reader(buffer, index)
+    else
+        dest = {}
+        local layout = struct.layout
+        for i=1, #layout do
+            local field = layout[i]
+            dest[field[4]] = field[1](buffer, index+field[3])
+        end
+    end
+    
+    after = after or index+struct.size
+    
+    if traced then
+        traceFinish("struct_decode", traced, nil, after-index)
     end
     
-    return dest
+    return dest, after
 end
 
-function struct.write(struct, buffer, index, src)
+function struct.writeNext(struct, buffer, index, src)
     if src == nil then
         if index == nil then
             src = buffer
             index = 0
-            buffer = void.buffer.create(struct.size)
+            buffer = nil
         else
             src = index
             index = 0
@@ -187,15 +574,211 @@ function struct.write(struct, buffer, index, src)
         index = 0
     end
     
+    local traced = traceBegin()
+    
+    if struct.cases then
+        struct = struct.cases[src[struct.tag]] or struct.header
+    end
+    
+    if struct.encode then
+        local after
+        buffer, after = struct.encode(buffer, index, src)
+        if traced then
+            traceFinish("struct_encode", traced, nil, after-index)
+        end
+        return buffer, after
+    end
+    
+    if buffer == nil then
+        buffer = void.buffer.create(struct.size)
+    end
+    
+    if struct.writer then
+        struct.writer(buffer, index, src)
+    else
+        local layout = struct.layout
+        for i=1, #layout do
+            local field = layout[i]
+            local value = src[field[4]]
+            -- false is a value too for bools and bit fields, other setters skip it like nil
+            if field[2] and (value or value == false and field.group) and field.type ~= "crc32c" then
+                field[2](buffer, index+field[3], value)
+            end
+        end
+    end
+    
+    -- In layout order, so a checksum can cover the checksums before it
+    local checksums = struct.checksums
+    if checksums then
+        for i=1, #checksums do
+            local field = checksums[i]
+            field[2](buffer, index+field[3])
+        end
+    end
+    
+    if traced then
+        traceFinish("struct_encode", traced, nil, struct.size)
+    end
+    
+    return buffer, index+struct.size
+end
+
+-- read and write return only the table and the buffer, so a call can be passed on as one argument
+local readNext, writeNext = struct.readNext, struct.writeNext
+
+function struct.read(struct, buffer, index)
+    return (readNext(struct, buffer, index))
+end
+
+function struct.write(struct, buffer, index, src)
+    return (writeNext(struct, buffer, index, src))
+end
+
+-- Bytes src takes up once written, which only depends on src for structs with varint or zigzag fields
+function struct.length(struct, src)
+    if struct.cases then
+        struct = src and struct.cases[src[struct.tag]] or struct.header
+    end
+    
+    if struct.measure then
+        return struct.measure(src)
+    end
+    
+    return struct.size
+end
+
+-- Columnar access to count records laid out back to back from index
+-- Every field becomes one array, which saves building a table per record
+
+-- Struct parameters below shadow the module
+local read = struct.read
+
+-- Reads one field of every record into an array
+local function readColumn(struct, buffer, index, count, name, into)
+    local field = struct.layout[name]
+    assert(field, "Unknown field "..tostring(name))
+    assert(not struct.variable, "Records with varint or zigzag fields are not laid out back to back")
+    
+    local column = into or {}
+    local get, size = field[1], struct.size
+    local at = index+field[3]
+    for i=1, count do
+        column[i] = get(buffer, at)
+        at = at+size
+    end
+    
+    -- Values left over from a longer read would look like records
+    for i=count+1, #column do
+        column[i] = nil
+    end
+    
+    return column
+end
+struct.readColumn = readColumn
+
+-- Reads every field of count records into into[name], reusing the arrays already in into
+function struct.readColumns(struct, buffer, index, count, into)
+    local columns = into or {}
+    
+    local layout = struct.layout
+    for i=1, #layout do
+        local name = layout[i][4]
+        columns[name] = readColumn(struct, buffer, index, count, name, columns[name])
+    end
+    
+    return columns
+end
+
+-- Writes columns[name][1..count] as records, count defaults to the length of the first column
+-- A new buffer is made if buffer is nil
+function struct.writeColumns(struct, buffer, index, columns, count)
+    assert(not struct.variable, "Records with varint or zigzag fields are not laid out back to back")
     local layout = struct.layout
+    index = index or 0
+    
+    if count == nil then
+        count = 0
+        for i=1, #layout do
+            local column = columns[layout[i][4]]
+            if column then
+                count = #column
+                break
+            end
+        end
+    end
+    
+    if buffer == nil then
+        buffer = void.buffer.create(index+count*struct.size)
+    end
+    
+    local size = struct.size
     for i=1, #layout do
         local field = layout[i]
-        if field[2] and src[field[4]] then
-            field[2](buffer, index+field[3], src[field[4]])
+        local set, column = field[2], columns[field[4]]
+        if set and column and field.type ~= "crc32c" then
+            local at = index+field[3]
+            for j=1, count do
+                set(buffer, at, column[j])
+                at = at+size
+            end
+        end
+    end
+    
+    local checksums = struct.checksums
+    if checksums then
+        for j=0, count-1 do
+            for i=1, #checksums do
+                local field = checksums[i]
+                field[2](buffer, index+j*size+field[3])
+            end
         end
     end
     
     return buffer
 end
 
+local compare = {
+    ["=="] = function(a, b) return a == b end,
+    ["~="] = function(a, b) return a ~= b end,
+    ["<"] = function(a, b) return a < b end,
+    ["<="] = function(a, b) return a <= b end,
+    [">"] = function(a, b) return a > b end,
+    [">="] = function(a, b) return a >= b end
+}
+
+-- Reads only the records whose field passes a test into an array of tables
+-- The test is either predicate(value, recordNumber) or an operator string and a value
+-- Only the tested field is decoded for records that do not pass
+function struct.scan(struct, buffer, index, count, name, predicate, value, into)
+    local field = struct.layout[name]
+    assert(field, "Unknown field "..tostring(name))
+    assert(not struct.variable, "Records with varint or zigzag fields are not laid out back to back")
+    
+    if type(predicate) == "string" then
+        local op = compare[predicate]
+        assert(op, "Unknown operator "..predicate)
+        predicate = function(v) return op(v, value) end
+    else
+        into = value
+    end
+    
+    local records = into or {}
+    local found = 0
+    local get, size = field[1], struct.size
+    
+    for i=1, count do
+        local at = index+(i-1)*size
+        if predicate(get(buffer, at+field[3]), i) then
+            found = found+1
+            records[found] = read(struct, buffer, at)
+        end
+    end
+    
+    for i=found+1, #records do
+        records[i] = nil
+    end
+    
+    return records
+end
+
 return struct
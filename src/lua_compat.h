@@ -0,0 +1,79 @@
+#ifndef LUA_COMPAT_H
+#define LUA_COMPAT_H
+
+#include <lua.h>
+#include <lauxlib.h>
+
+// The parts of the Lua 5.2 and 5.3 API the wrappers use, for Lua 5.1 and LuaJIT
+#if LUA_VERSION_NUM < 502
+
+#define LUA_OK 0
+
+#define lua_rawlen lua_objlen
+#define luaL_len lua_objlen
+
+static inline int lua_absindex(lua_State *L, int idx) {
+	return idx > 0 || idx <= LUA_REGISTRYINDEX ? idx : lua_gettop(L)+idx+1;
+}
+
+static inline void lua_rawgetp(lua_State *L, int idx, const void *p) {
+	idx = lua_absindex(L, idx);
+	lua_pushlightuserdata(L, (void*)p);
+	lua_rawget(L, idx);
+}
+
+static inline void lua_rawsetp(lua_State *L, int idx, const void *p) {
+	idx = lua_absindex(L, idx);
+	lua_pushlightuserdata(L, (void*)p);
+	lua_insert(L, -2);
+	lua_rawset(L, idx);
+}
+
+// Numbers are doubles, the integral ones in the range of lua_Integer count as integers
+static inline int lua_isinteger(lua_State *L, int idx) {
+	if (lua_type(L, idx) != LUA_TNUMBER)
+		return 0;
+
+	lua_Number n = lua_tonumber(L, idx);
+	return n >= -0x1p63 && n < 0x1p63 && n == (lua_Number)(lua_Integer)n;
+}
+
+// The environment of a userdata has to be a table, so the value is kept at index 1 of one
+static inline void lua_setuservalue(lua_State *L, int idx) {
+	idx = lua_absindex(L, idx);
+	lua_createtable(L, 1, 0);
+	lua_insert(L, -2);
+	lua_rawseti(L, -2, 1);
+	lua_setfenv(L, idx);
+}
+
+static inline void lua_getuservalue(lua_State *L, int idx) {
+	lua_getfenv(L, idx);
+	lua_rawgeti(L, -1, 1);
+	lua_remove(L, -2);
+}
+
+static inline void luaL_requiref(lua_State *L, const char *name, lua_CFunction open, int global) {
+	lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+	lua_getfield(L, -1, name);
+
+	if (!lua_toboolean(L, -1)) {
+		lua_pop(L, 1);
+		lua_pushcfunction(L, open);
+		lua_pushstring(L, name);
+		lua_call(L, 1, 1);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -3, name);
+	}
+
+	lua_remove(L, -2);
+
+	if (global) {
+		lua_pushvalue(L, -1);
+		lua_setglobal(L, name);
+	}
+}
+
+#endif
+
+#endif
@@ -33,6 +33,16 @@ typedef CONDITION_VARIABLE pthread_cond_t;
 #define pthread_cond_destroy(c) (void)c
 #define pthread_cond_wait(c,m) SleepConditionVariableCS(c,m,INFINITE)
 #define pthread_cond_broadcast(c) WakeAllConditionVariable(c)
+
+// Slim reader/writer locks have to be released in the mode they were taken in,
+// see VOID_RWLOCK_RDUNLOCK and VOID_RWLOCK_WRUNLOCK
+typedef SRWLOCK pthread_rwlock_t;
+#define pthread_rwlock_init(l,a) InitializeSRWLock(l)
+#define pthread_rwlock_destroy(l) (void)l
+#define pthread_rwlock_rdlock(l) AcquireSRWLockShared(l)
+#define pthread_rwlock_wrlock(l) AcquireSRWLockExclusive(l)
+#define VOID_RWLOCK_RDUNLOCK(l) ReleaseSRWLockShared(l)
+#define VOID_RWLOCK_WRUNLOCK(l) ReleaseSRWLockExclusive(l)
 #define ERRNO WSAGetLastError()
 #else
 #include <errno.h>
@@ -40,6 +50,11 @@ typedef CONDITION_VARIABLE pthread_cond_t;
 #include <time.h>
 
 #define ERRNO errno
+#define VOID_RWLOCK_RDUNLOCK(l) pthread_rwlock_unlock(l)
+#define VOID_RWLOCK_WRUNLOCK(l) pthread_rwlock_unlock(l)
 #endif
 
+// Data written by different threads is kept this far apart so they do not share a cache line
+#define VOID_CACHE_LINE 64
+
 #endif
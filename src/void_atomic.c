@@ -0,0 +1,155 @@
+// syscall is an extension
+#define _GNU_SOURCE
+
+#include "thread_compat.h"
+#include "void_atomic.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define VOID_ATOMIC_FUTEX 1
+#endif
+
+#ifdef VOID_ATOMIC_FUTEX
+
+int void_atomic_wait(uint32_t *address, uint32_t expected, int64_t timeout) {
+	struct timespec relative;
+	struct timespec *timeoutPtr = 0;
+
+	if (timeout >= 0) {
+		relative.tv_sec = timeout/1000;
+		relative.tv_nsec = (timeout%1000)*1000000;
+		timeoutPtr = &relative;
+	}
+
+	// Buffers are only shared within the process, so the futex can be private
+	if (syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, timeoutPtr, 0, 0) == -1 && errno == ETIMEDOUT)
+		return 0;
+
+	// Woken, interrupted or the word did not hold expected
+	return 1;
+}
+
+int void_atomic_wake(uint32_t *address, int count) {
+	long woken = syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count, 0, 0, 0);
+	return woken < 0 ? 0 : (int)woken;
+}
+
+#else
+
+// Without futexes, waiters park in one of a fixed set of buckets picked by address
+// Each waiter has its own node, so wake knows how many of the bucket's waiters wait on its address
+
+#define BUCKETS 64
+
+typedef struct waiter waiter;
+
+struct waiter {
+	waiter *next;
+	uint32_t *address;
+	int woken;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	waiter *waiters;
+} buckets[BUCKETS];
+
+static pthread_mutex_t bucketsLock = PTHREAD_MUTEX_INITIALIZER;
+static int bucketsReady;
+
+static void buckets_init(void) {
+	pthread_mutex_lock(&bucketsLock);
+
+	if (!__atomic_load_n(&bucketsReady, __ATOMIC_RELAXED)) {
+		int i;
+		for (i = 0; i < BUCKETS; i++) {
+			pthread_mutex_init(&buckets[i].lock, 0);
+			pthread_cond_init(&buckets[i].cond, 0);
+			buckets[i].waiters = 0;
+		}
+
+		__atomic_store_n(&bucketsReady, 1, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&bucketsLock);
+}
+
+static unsigned int bucket_of(uint32_t *address) {
+	if (!__atomic_load_n(&bucketsReady, __ATOMIC_ACQUIRE))
+		buckets_init();
+
+	return ((uintptr_t)address >> 2) % BUCKETS;
+}
+
+int void_atomic_wait(uint32_t *address, uint32_t expected, int64_t timeout) {
+	unsigned int bucket = bucket_of(address);
+	struct timespec timeoutTime;
+
+	if (timeout > 0) {
+		clock_gettime(CLOCK_REALTIME, &timeoutTime);
+		timeoutTime.tv_sec += timeout / 1000;
+		timeoutTime.tv_nsec += (timeout % 1000) * 1000000;
+		if (timeoutTime.tv_nsec >= 1000000000) {
+			timeoutTime.tv_sec++;
+			timeoutTime.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&buckets[bucket].lock);
+
+	// Wakers take the bucket lock after changing the word, so checking it here does not miss a wake
+	if (__atomic_load_n(address, __ATOMIC_SEQ_CST) != expected) {
+		pthread_mutex_unlock(&buckets[bucket].lock);
+		return 1;
+	}
+
+	waiter self = {buckets[bucket].waiters, address, 0};
+	buckets[bucket].waiters = &self;
+
+	int timedOut = 0;
+	while (!self.woken && !timedOut) {
+		if (timeout == 0) {
+			timedOut = 1;
+		} else if (timeout > 0) {
+			timedOut = pthread_cond_timedwait(&buckets[bucket].cond, &buckets[bucket].lock, &timeoutTime) == ETIMEDOUT;
+		} else {
+			pthread_cond_wait(&buckets[bucket].cond, &buckets[bucket].lock);
+		}
+	}
+
+	waiter **link = &buckets[bucket].waiters;
+	while (*link != &self)
+		link = &(*link)->next;
+	*link = self.next;
+
+	pthread_mutex_unlock(&buckets[bucket].lock);
+
+	return self.woken;
+}
+
+int void_atomic_wake(uint32_t *address, int count) {
+	unsigned int bucket = bucket_of(address);
+	int woken = 0;
+
+	pthread_mutex_lock(&buckets[bucket].lock);
+
+	waiter *node;
+	for (node = buckets[bucket].waiters; node && woken < count; node = node->next) {
+		if (node->address == address && !node->woken) {
+			node->woken = 1;
+			woken++;
+		}
+	}
+
+	if (woken)
+		pthread_cond_broadcast(&buckets[bucket].cond);
+
+	pthread_mutex_unlock(&buckets[bucket].lock);
+
+	return woken;
+}
+
+#endif
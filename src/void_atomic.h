@@ -0,0 +1,17 @@
+#ifndef VOID_ATOMIC_H
+#define VOID_ATOMIC_H
+
+#include <stdint.h>
+
+// Futex style waiting on 32 bit words of buffer memory
+// Only threads of this process can wake each other, like every other way buffers are shared
+
+// Waits while the word at address holds expected, until a wake on the same address
+// or timeout milliseconds pass, a negative timeout waits forever
+// Returns 1 if woken or the word did not hold expected, 0 on timeout
+// Wakeups can be spurious, callers check the word again
+int void_atomic_wait(uint32_t *address, uint32_t expected, int64_t timeout);
+// Wakes up to count threads waiting on address, returns how many were woken
+int void_atomic_wake(uint32_t *address, int count);
+
+#endif
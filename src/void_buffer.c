@@ -1,8 +1,138 @@
+// mremap, MAP_ANONYMOUS and the madvise hints are extensions
+#define _GNU_SOURCE
+
 #include "void_buffer.h"
+#include "void_memory.h"
+#include "void_trace.h"
 
 #include <string.h>
 #include <malloc.h>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#define VOID_BUFFER_CAN_MAP 1
+#endif
+
+// Below this size malloc is already good at reusing memory
+static size_t mapThreshold = 4*1024*1024;
+
+size_t void_buffer_get_map_threshold(void) {
+	return __atomic_load_n(&mapThreshold, __ATOMIC_RELAXED);
+}
+
+void void_buffer_set_map_threshold(size_t threshold) {
+	__atomic_store_n(&mapThreshold, threshold, __ATOMIC_RELAXED);
+}
+
+static size_t pageSize(void) {
+#ifdef VOID_BUFFER_CAN_MAP
+	return sysconf(_SC_PAGESIZE);
+#else
+	return 4096;
+#endif
+}
+
+// Writes to one byte per page so the kernel backs every page now
+static void prefault(void *data, size_t length) {
+	volatile char *bytes = data;
+	size_t page = pageSize();
+	size_t i;
+
+	for (i=0; i<length; i+=page) {
+		bytes[i] = bytes[i];
+	}
+}
+
+#ifdef VOID_BUFFER_CAN_MAP
+// A mapping always keeps at least one page, so it can be resized and unmapped at length 0
+static size_t mapLength(size_t length) {
+	return length ? length : 1;
+}
+
+static void *mapData(size_t length, int options) {
+	void *data = mmap(0, mapLength(length), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (data == MAP_FAILED)
+		return 0;
+
+#ifdef MADV_HUGEPAGE
+	// Only a hint, the kernel may not have transparent huge pages turned on
+	madvise(data, mapLength(length), MADV_HUGEPAGE);
+#endif
+
+	if (options & VOID_ALLOC_PREFAULT) {
+#ifdef MADV_POPULATE_WRITE
+		if (madvise(data, mapLength(length), MADV_POPULATE_WRITE) != 0)
+#endif
+		prefault(data, length);
+	}
+
+	return data;
+}
+
+static void unmapData(void *data, size_t length) {
+	munmap(data, mapLength(length));
+}
+
+static void *remapData(void *data, size_t oldLength, size_t newLength) {
+#ifdef MREMAP_MAYMOVE
+	data = mremap(data, mapLength(oldLength), mapLength(newLength), MREMAP_MAYMOVE);
+	return data == MAP_FAILED ? 0 : data;
+#else
+	void *newData = mapData(newLength, 0);
+	if (!newData)
+		return 0;
+	memcpy(newData, data, oldLength < newLength ? oldLength : newLength);
+	unmapData(data, oldLength);
+	return newData;
+#endif
+}
+#endif
+
+int void_buffer_allocate(void_buffer *buffer, size_t length, int options) {
+	void *data;
+	int flags = 0;
+
+	void_buffer_invalidate(buffer);
+
+#ifdef VOID_BUFFER_CAN_MAP
+	size_t threshold = void_buffer_get_map_threshold();
+
+	if (threshold && length >= threshold) {
+		data = mapData(length, options);
+		flags = VOID_BUFFER_MAPPED;
+	} else
+#endif
+	{
+		data = malloc(length);
+
+		if (data && options & VOID_ALLOC_ZERO) {
+			memset(data, 0, length);
+		} else if (data && options & VOID_ALLOC_PREFAULT) {
+			prefault(data, length);
+		}
+	}
+
+	if (!data)
+		return VOID_ENOMEM;
+
+	void_buffer_set(buffer, data, length);
+	buffer->normal.flags = flags;
+
+	return VOID_SUCCESS;
+}
+
+static void releaseData(void *data, size_t length, int flags) {
+#ifdef VOID_BUFFER_CAN_MAP
+	if (flags & VOID_BUFFER_MAPPED) {
+		unmapData(data, length);
+		return;
+	}
+#endif
+	free(data);
+}
+
 // Initializes a buffer as an invalid buffer
 void void_buffer_init(void_buffer *buffer) {
 	memset(buffer, 0, sizeof(void_buffer));
@@ -36,10 +166,35 @@ static void attach(void_buffer *buffer, void_buffer *to) {
 	buffer->view.attachPoint = oldLength;
 }
 
+// Trace points for buffers created through Lua, which are the ones with an origin
+static void untrack(int origin, size_t length) {
+	void_memory_untrack(origin, length);
+
+	if (origin == VOID_ORIGIN_NONE)
+		return;
+
+	VOID_PROBE2(buffer_free, void_memory_origin_names[origin], length);
+
+	if (void_trace_enabled())
+		void_trace_instant("buffer", "buffer_free", void_memory_origin_names[origin], "bytes", (int64_t)length);
+}
+
 static void freeData(void_buffer *buffer) {
-	if (buffer->type == NORMAL && buffer->normal.data) {
-        free(buffer->normal.data);
+	if (buffer->type == NORMAL && buffer->normal.shared) {
+		void_buffer_shared_release(buffer->normal.shared);
+		buffer->normal.shared = 0;
 		buffer->normal.data = 0;
+	} else if (buffer->type == NORMAL && buffer->normal.data) {
+		releaseData(buffer->normal.data, buffer->length, buffer->normal.flags);
+		buffer->normal.data = 0;
+
+		untrack(buffer->normal.origin, buffer->length);
+		buffer->normal.origin = VOID_ORIGIN_NONE;
+
+		if (buffer->normal.sample) {
+			void_memory_sample_remove(buffer->normal.sample);
+			buffer->normal.sample = 0;
+		}
 	}
 }
 
@@ -78,9 +233,71 @@ void void_buffer_set(void_buffer *buffer, void *data, size_t length) {
 	void_buffer_invalidate(buffer);
 	buffer->type = NORMAL;
 	buffer->length = length;
+	memset(&buffer->normal, 0, sizeof(buffer->normal));
 	buffer->normal.data = data;
 }
 
+void_buffer_shared *void_buffer_share(void_buffer *buffer) {
+	if (buffer->type != NORMAL || !buffer->normal.data)
+		return 0;
+
+	if (buffer->normal.shared)
+		return buffer->normal.shared;
+
+	void_buffer_shared *shared = malloc(sizeof(void_buffer_shared));
+
+	if (!shared)
+		return 0;
+
+	// The storage takes over the data and its accounting
+	shared->refcount = 1;
+	shared->length = buffer->length;
+	shared->data = buffer->normal.data;
+	shared->origin = buffer->normal.origin;
+	shared->sample = buffer->normal.sample;
+	shared->flags = buffer->normal.flags & VOID_BUFFER_MAPPED;
+
+	buffer->normal.origin = VOID_ORIGIN_NONE;
+	buffer->normal.sample = 0;
+	buffer->normal.shared = shared;
+
+	return shared;
+}
+
+void void_buffer_set_shared(void_buffer *buffer, void_buffer_shared *shared, int flags) {
+	void_buffer_shared_retain(shared);
+	void_buffer_set(buffer, shared->data, shared->length);
+	buffer->normal.shared = shared;
+	buffer->normal.flags = flags;
+}
+
+void void_buffer_set_window(void_buffer *buffer, void_buffer_shared *shared, size_t offset, size_t length, int flags) {
+	void_buffer_set_shared(buffer, shared, flags);
+	buffer->normal.data = (char*)shared->data+offset;
+	buffer->length = length;
+}
+
+int void_buffer_window(const void_buffer *buffer) {
+	void_buffer_shared *shared = buffer->type == NORMAL ? buffer->normal.shared : 0;
+	return shared && (shared->data != buffer->normal.data || shared->length != buffer->length);
+}
+
+void void_buffer_shared_retain(void_buffer_shared *shared) {
+	__atomic_add_fetch(&shared->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void void_buffer_shared_release(void_buffer_shared *shared) {
+	if (__atomic_sub_fetch(&shared->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		untrack(shared->origin, shared->length);
+
+		if (shared->sample)
+			void_memory_sample_remove(shared->sample);
+
+		releaseData(shared->data, shared->length, shared->flags);
+		free(shared);
+	}
+}
+
 // Creates a view of the buffer and attaches itself to the parent buffer
 // If buffer is a view of another buffer, it attaches to the parent buffer
 int void_buffer_view(void_buffer *buffer, void_buffer *of, ptrdiff_t start, size_t length) {
@@ -147,6 +364,16 @@ int void_buffer_move(void_buffer *dest, void_buffer *source) {
 	return VOID_EWRONGTYPE;
 }
 
+void *void_buffer_writable(const void_buffer *buffer) {
+	if (buffer->type == NORMAL && buffer->normal.flags & VOID_BUFFER_READONLY) {
+		return 0;
+	} else if (buffer->type == VIEW && buffer->view.buffer->normal.flags & VOID_BUFFER_READONLY) {
+		return 0;
+	}
+
+	return void_buffer_data(buffer);
+}
+
 void *void_buffer_data(const void_buffer *buffer) {
 	if (buffer->type == NORMAL) {
 		return buffer->normal.data;
@@ -157,11 +384,46 @@ void *void_buffer_data(const void_buffer *buffer) {
 	}
 }
 
+void void_buffer_track(void_buffer *buffer, int origin, struct void_memory_sample *sample) {
+	if (buffer->type != NORMAL || buffer->normal.shared)
+		return;
+
+	buffer->normal.origin = origin;
+	buffer->normal.sample = sample;
+	void_memory_track(origin, buffer->length);
+
+	if (origin == VOID_ORIGIN_NONE)
+		return;
+
+	VOID_PROBE2(buffer_create, void_memory_origin_names[origin], buffer->length);
+
+	if (void_trace_enabled())
+		void_trace_instant("buffer", "buffer_create", void_memory_origin_names[origin], "bytes", (int64_t)buffer->length);
+}
+
+static void resized(void_buffer *buffer, size_t oldLength) {
+	void_memory_resize(buffer->normal.origin, oldLength, buffer->length);
+
+	if (buffer->normal.sample)
+		void_memory_sample_resize(buffer->normal.sample, buffer->length);
+}
+
 int void_buffer_grow(void_buffer *buffer, size_t newLength) {
-    if (buffer->type == NORMAL) {
+    if (buffer->type == NORMAL && !buffer->normal.shared) {
         if (buffer->length < newLength) {
-            buffer->normal.data = realloc(buffer->normal.data, newLength);
+            size_t oldLength = buffer->length;
+            void *data;
+#ifdef VOID_BUFFER_CAN_MAP
+            if (buffer->normal.flags & VOID_BUFFER_MAPPED)
+                data = remapData(buffer->normal.data, oldLength, newLength);
+            else
+#endif
+            data = realloc(buffer->normal.data, newLength);
+            if (!data)
+                return VOID_ENOMEM;
+            buffer->normal.data = data;
             buffer->length = newLength;
+            resized(buffer, oldLength);
         }
         return 0;
     } else {
@@ -170,10 +432,22 @@ int void_buffer_grow(void_buffer *buffer, size_t newLength) {
 }
 
 int void_buffer_shrink(void_buffer *buffer, size_t newLength) {
-    if (buffer->type == NORMAL) {
+    if (buffer->type == NORMAL && !buffer->normal.shared) {
         if (buffer->length > newLength) {
-            buffer->normal.data = realloc(buffer->normal.data, newLength);
+            size_t oldLength = buffer->length;
+            void *data;
+#ifdef VOID_BUFFER_CAN_MAP
+            if (buffer->normal.flags & VOID_BUFFER_MAPPED)
+                data = remapData(buffer->normal.data, oldLength, newLength);
+            else
+#endif
+            data = realloc(buffer->normal.data, newLength);
+            // Keeping the larger allocation is fine if it could not be shrunk,
+            // realloc to 0 bytes may have freed it and returned null though
+            if (data || newLength == 0)
+                buffer->normal.data = data;
             buffer->length = newLength;
+            resized(buffer, oldLength);
         }
         return 0;
     } else {
@@ -6,6 +6,20 @@
 #define VOID_SUCCESS 0
 #define VOID_EOUTOFRANGE -1
 #define VOID_EWRONGTYPE -2
+#define VOID_ENOMEM -3
+#define VOID_EIO -4
+
+// Buffer flags
+// Writes through the buffer and its views are refused
+#define VOID_BUFFER_READONLY 1
+// The data is an anonymous memory mapping rather than a malloc allocation
+#define VOID_BUFFER_MAPPED 2
+
+// Options for void_buffer_allocate
+// Clears the data, mapped data always comes cleared from the kernel
+#define VOID_ALLOC_ZERO 1
+// Touches every page up front so the first writes do not take page faults
+#define VOID_ALLOC_PREFAULT 2
 
 enum void_buffer_type {
 	NORMAL,
@@ -14,7 +28,22 @@ enum void_buffer_type {
 };
 
 typedef struct void_buffer void_buffer;
+typedef struct void_buffer_shared void_buffer_shared;
+struct void_memory_sample;
+
+// Reference counted storage that several buffers point at
+// The data is freed once the last buffer releases it
+struct void_buffer_shared {
+	unsigned int refcount;
+	size_t length;
+	void *data;
+	int origin;
+	struct void_memory_sample *sample;
+	// VOID_BUFFER_MAPPED if the data has to be unmapped instead of freed
+	int flags;
+};
 
+// lua/void/ffi.lua declares the same layout for LuaJIT, keep them in sync
 struct void_buffer {
 	int type;
 	size_t length;
@@ -23,6 +52,12 @@ struct void_buffer {
 			void *data;
 			size_t attachLength;
 			void_buffer **attached;
+			// Memory accounting (see void_memory.h)
+			int origin;
+			struct void_memory_sample *sample;
+			// Non null if data is owned by shared storage
+			void_buffer_shared *shared;
+			int flags;
 		} normal;
 
 		struct {
@@ -37,6 +72,13 @@ struct void_buffer {
 	};
 };
 
+// Allocates length bytes for the buffer and changes the type to normal
+// Allocations of at least the map threshold are made with mmap and asked to use transparent huge pages
+// Returns VOID_ENOMEM if the allocation failed, the buffer is left invalid in that case
+int void_buffer_allocate(void_buffer *buffer, size_t length, int options);
+// Smallest allocation void_buffer_allocate maps, 0 turns mapping off
+size_t void_buffer_get_map_threshold(void);
+void void_buffer_set_map_threshold(size_t threshold);
 // Initializes a buffer as an invalid buffer
 void void_buffer_init(void_buffer *buffer);
 // Sets the data in the buffer and changes the type to normal
@@ -52,6 +94,28 @@ void void_buffer_copy(void_buffer *dest, const void_buffer *source);
 int void_buffer_move(void_buffer *dest, void_buffer *source);
 // Returns a pointer to the buffer's data or null if no data is attached
 void *void_buffer_data(const void_buffer *buffer);
+// Returns a pointer to the buffer's data or null if no data is attached
+// or the buffer is read only
+void *void_buffer_writable(const void_buffer *buffer);
+// Moves the buffer's data into shared storage, the buffer keeps a reference to it
+// If the data is already shared, the existing storage is returned
+// Returns null if the buffer is not a normal buffer or memory ran out
+void_buffer_shared *void_buffer_share(void_buffer *buffer);
+// Points the buffer at shared storage and takes a reference to it
+void void_buffer_set_shared(void_buffer *buffer, void_buffer_shared *shared, int flags);
+// Same as void_buffer_set_shared, for length bytes of the storage at offset
+void void_buffer_set_window(void_buffer *buffer, void_buffer_shared *shared, size_t offset, size_t length, int flags);
+// Returns non zero if the buffer covers only part of its shared storage, like a stream record
+// Sharing a window shares all of the storage, so windows cannot be handed on without copying
+int void_buffer_window(const void_buffer *buffer);
+void void_buffer_shared_retain(void_buffer_shared *shared);
+void void_buffer_shared_release(void_buffer_shared *shared);
+// Starts accounting for the buffer's data under the given origin
+// The sample is owned by the buffer and is removed when the data is freed
+void void_buffer_track(void_buffer *buffer, int origin, struct void_memory_sample *sample);
+// Grows or shrinks the buffer's allocation
+// Mapped buffers are resized with mremap, so growing them does not copy
+// Buffers with shared storage cannot be resized
 int void_buffer_grow(void_buffer *buffer, size_t newLength);
 int void_buffer_shrink(void_buffer *buffer, size_t newLength);
 
@@ -0,0 +1,251 @@
+#include "thread_compat.h"
+#include "void_hash.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC32C_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+// Reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78u
+
+// Slicing by 8 tables for the portable version, built on first use
+static uint32_t crcTable[8][256];
+static int crcTableReady;
+static pthread_mutex_t crcTableLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void crc32c_table_init(void) {
+	pthread_mutex_lock(&crcTableLock);
+
+	if (!__atomic_load_n(&crcTableReady, __ATOMIC_RELAXED)) {
+		int i, j;
+		for (i=0; i<256; i++) {
+			uint32_t crc = i;
+			for (j=0; j<8; j++) {
+				crc = (crc >> 1)^(CRC32C_POLY & -(crc & 1));
+			}
+			crcTable[0][i] = crc;
+		}
+
+		for (i=0; i<256; i++) {
+			for (j=1; j<8; j++) {
+				crcTable[j][i] = (crcTable[j-1][i] >> 8)^crcTable[0][crcTable[j-1][i] & 0xFF];
+			}
+		}
+
+		__atomic_store_n(&crcTableReady, 1, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&crcTableLock);
+}
+
+static uint32_t crc32c_portable(uint32_t crc, const unsigned char *data, size_t length) {
+	if (!__atomic_load_n(&crcTableReady, __ATOMIC_ACQUIRE)) {
+		crc32c_table_init();
+	}
+
+	while (length >= 8) {
+		// Bytes are combined one by one so this does not depend on host byte order
+		uint32_t low = crc^((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+		crc = crcTable[7][low & 0xFF]^crcTable[6][(low >> 8) & 0xFF]^
+			crcTable[5][(low >> 16) & 0xFF]^crcTable[4][low >> 24]^
+			crcTable[3][data[4]]^crcTable[2][data[5]]^
+			crcTable[1][data[6]]^crcTable[0][data[7]];
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		crc = (crc >> 8)^crcTable[0][(crc^*data++) & 0xFF];
+	}
+
+	return crc;
+}
+
+#ifdef CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t length) {
+	uint64_t crc64 = crc;
+
+	while (length >= 8) {
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		data += 8;
+		length -= 8;
+	}
+
+	crc = (uint32_t)crc64;
+	while (length--) {
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+
+	return crc;
+}
+#endif
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const unsigned char *data, size_t length);
+
+// Picked on the first call, every choice computes the same thing so racing here is harmless
+static crc32c_fn crcImplementation;
+
+static crc32c_fn crc32c_select(void) {
+#ifdef CRC32C_SSE42
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		return crc32c_sse42;
+	}
+#endif
+	return crc32c_portable;
+}
+
+uint32_t void_crc32c(uint32_t crc, const void *data, size_t length) {
+	crc32c_fn fn = __atomic_load_n(&crcImplementation, __ATOMIC_RELAXED);
+
+	if (!fn) {
+		fn = crc32c_select();
+		__atomic_store_n(&crcImplementation, fn, __ATOMIC_RELAXED);
+	}
+
+	return ~fn(~crc, data, length);
+}
+
+#define PRIME64_1 0x9E3779B185EBCA87ull
+#define PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define PRIME64_3 0x165667B19E3779F9ull
+#define PRIME64_4 0x85EBCA77C2B2AE63ull
+#define PRIME64_5 0x27D4EB2F165667C5ull
+
+static uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64-r));
+}
+
+// XXH64 is defined on little endian words
+static uint64_t read64(const unsigned char *p) {
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+		(uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static uint32_t read32(const unsigned char *p) {
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+	acc += input*PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc*PRIME64_1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t value) {
+	acc ^= xxh64_round(0, value);
+	return acc*PRIME64_1+PRIME64_4;
+}
+
+void void_xxh64_init(void_xxh64_state *state, uint64_t seed) {
+	memset(state, 0, sizeof(*state));
+	state->seed = seed;
+	state->v[0] = seed+PRIME64_1+PRIME64_2;
+	state->v[1] = seed+PRIME64_2;
+	state->v[2] = seed;
+	state->v[3] = seed-PRIME64_1;
+}
+
+// Consumes as many 32 byte stripes as there are, returns the number of bytes used
+static size_t xxh64_stripes(uint64_t *v, const unsigned char *p, size_t length) {
+	const unsigned char *start = p;
+
+	while (length >= 32) {
+		v[0] = xxh64_round(v[0], read64(p));
+		v[1] = xxh64_round(v[1], read64(p+8));
+		v[2] = xxh64_round(v[2], read64(p+16));
+		v[3] = xxh64_round(v[3], read64(p+24));
+		p += 32;
+		length -= 32;
+	}
+
+	return p-start;
+}
+
+void void_xxh64_update(void_xxh64_state *state, const void *data, size_t length) {
+	const unsigned char *p = data;
+	state->total += length;
+
+	if (state->buffered) {
+		size_t fill = 32-state->buffered;
+
+		if (length < fill) {
+			memcpy(state->buffer+state->buffered, p, length);
+			state->buffered += length;
+			return;
+		}
+
+		memcpy(state->buffer+state->buffered, p, fill);
+		xxh64_stripes(state->v, state->buffer, 32);
+		state->buffered = 0;
+		p += fill;
+		length -= fill;
+	}
+
+	size_t used = xxh64_stripes(state->v, p, length);
+	p += used;
+	length -= used;
+
+	memcpy(state->buffer, p, length);
+	state->buffered = length;
+}
+
+uint64_t void_xxh64_digest(const void_xxh64_state *state) {
+	uint64_t hash;
+	const uint64_t *v = state->v;
+
+	if (state->total >= 32) {
+		hash = rotl64(v[0], 1)+rotl64(v[1], 7)+rotl64(v[2], 12)+rotl64(v[3], 18);
+		hash = xxh64_merge(hash, v[0]);
+		hash = xxh64_merge(hash, v[1]);
+		hash = xxh64_merge(hash, v[2]);
+		hash = xxh64_merge(hash, v[3]);
+	} else {
+		hash = state->seed+PRIME64_5;
+	}
+
+	hash += state->total;
+
+	const unsigned char *p = state->buffer;
+	size_t length = state->buffered;
+
+	while (length >= 8) {
+		hash ^= xxh64_round(0, read64(p));
+		hash = rotl64(hash, 27)*PRIME64_1+PRIME64_4;
+		p += 8;
+		length -= 8;
+	}
+
+	if (length >= 4) {
+		hash ^= (uint64_t)read32(p)*PRIME64_1;
+		hash = rotl64(hash, 23)*PRIME64_2+PRIME64_3;
+		p += 4;
+		length -= 4;
+	}
+
+	while (length--) {
+		hash ^= (*p++)*PRIME64_5;
+		hash = rotl64(hash, 11)*PRIME64_1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+uint64_t void_xxh64(const void *data, size_t length, uint64_t seed) {
+	void_xxh64_state state;
+	void_xxh64_init(&state, seed);
+	void_xxh64_update(&state, data, length);
+	return void_xxh64_digest(&state);
+}
@@ -0,0 +1,30 @@
+#ifndef VOID_HASH_H
+#define VOID_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli) of length bytes, continuing from crc
+// Pass 0 for the first block and the previous result for following blocks,
+// so checksumming a message in pieces gives the same result as checksumming it whole
+// Uses the SSE 4.2 crc32 instruction when the CPU has it
+uint32_t void_crc32c(uint32_t crc, const void *data, size_t length);
+
+typedef struct void_xxh64_state void_xxh64_state;
+
+// Streaming state for XXH64
+struct void_xxh64_state {
+	uint64_t total;
+	uint64_t v[4];
+	unsigned char buffer[32];
+	unsigned int buffered;
+	uint64_t seed;
+};
+
+void void_xxh64_init(void_xxh64_state *state, uint64_t seed);
+void void_xxh64_update(void_xxh64_state *state, const void *data, size_t length);
+uint64_t void_xxh64_digest(const void_xxh64_state *state);
+// XXH64 of a single block
+uint64_t void_xxh64(const void *data, size_t length, uint64_t seed);
+
+#endif
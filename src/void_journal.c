@@ -0,0 +1,640 @@
+// flock is an extension
+#define _GNU_SOURCE
+
+#include "void_journal.h"
+#include "void_hash.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define DEFAULT_SEGMENT_BYTES (64*1024*1024)
+#define CHECKPOINT_FILE "checkpoint"
+// 16 hex digits and ".log"
+#define SEGMENT_NAME_LENGTH 20
+
+typedef struct record_header record_header;
+
+struct record_header {
+	uint32_t length;
+	uint32_t crc;
+	uint64_t sequence;
+};
+
+static void deadline(struct timespec *time, int64_t timeout) {
+	clock_gettime(CLOCK_REALTIME, time);
+	time->tv_sec += timeout / 1000;
+	time->tv_nsec += (timeout % 1000) * 1000000;
+	if (time->tv_nsec >= 1000000000) {
+		time->tv_sec++;
+		time->tv_nsec -= 1000000000;
+	}
+}
+
+static uint32_t record_crc(const void *data, size_t length, uint64_t sequence) {
+	return void_crc32c(void_crc32c(0, data, length), &sequence, sizeof(sequence));
+}
+
+static void file_path(const void_journal *journal, const char *name, char *path, size_t size) {
+	snprintf(path, size, "%s/%s", journal->path, name);
+}
+
+static void segment_path(const void_journal *journal, uint64_t first, char *path, size_t size) {
+	snprintf(path, size, "%s/%016llx.log", journal->path, (unsigned long long)first);
+}
+
+static int write_all(int fd, struct iovec *iov, int count) {
+	while (count) {
+		ssize_t written = writev(fd, iov, count);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		while (count && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count) {
+			iov->iov_base = (char*)iov->iov_base+written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return 0;
+}
+
+static int read_all(int fd, void *data, size_t length) {
+	size_t done = 0;
+
+	while (done < length) {
+		ssize_t got = read(fd, (char*)data+done, length-done);
+
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return -1;
+
+		done += got;
+	}
+
+	return 0;
+}
+
+// Makes created segment files survive a crash
+static int sync_directory(const void_journal *journal) {
+	int fd = open(journal->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+
+	int result = fsync(fd);
+	close(fd);
+	return result;
+}
+
+static int add_segment(void_journal *journal, uint64_t first) {
+	if (journal->segmentCount == journal->segmentCapacity) {
+		unsigned int capacity = journal->segmentCapacity ? journal->segmentCapacity*2 : 8;
+		uint64_t *segments = realloc(journal->segments, sizeof(uint64_t)*capacity);
+
+		if (!segments)
+			return VOID_ENOMEM;
+
+		journal->segments = segments;
+		journal->segmentCapacity = capacity;
+	}
+
+	journal->segments[journal->segmentCount++] = first;
+	return VOID_SUCCESS;
+}
+
+// Deletes segments from index on
+static void drop_segments(void_journal *journal, unsigned int index) {
+	char path[4096];
+
+	while (journal->segmentCount > index) {
+		segment_path(journal, journal->segments[--journal->segmentCount], path, sizeof(path));
+		unlink(path);
+	}
+}
+
+// Deletes the oldest segments while the next one starts at or behind the saved checkpoint
+// The newest segment is kept since it is being appended to
+static void remove_segments(void_journal *journal) {
+	char path[4096];
+	unsigned int removed = 0;
+
+	while (journal->segmentCount-removed >= 2 && journal->segments[removed+1] <= journal->savedCheckpoint) {
+		segment_path(journal, journal->segments[removed], path, sizeof(path));
+		unlink(path);
+		removed++;
+	}
+
+	if (removed) {
+		journal->segmentCount -= removed;
+		memmove(journal->segments, journal->segments+removed, sizeof(uint64_t)*journal->segmentCount);
+	}
+}
+
+static int compare_segments(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static int list_segments(void_journal *journal) {
+	DIR *dir = opendir(journal->path);
+
+	if (!dir)
+		return VOID_EIO;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir))) {
+		const char *name = entry->d_name;
+		char *end;
+
+		if (strlen(name) != SEGMENT_NAME_LENGTH || strcmp(name+16, ".log") != 0)
+			continue;
+
+		uint64_t first = strtoull(name, &end, 16);
+		if (end != name+16)
+			continue;
+
+		if (add_segment(journal, first) != VOID_SUCCESS) {
+			closedir(dir);
+			return VOID_ENOMEM;
+		}
+	}
+
+	closedir(dir);
+	qsort(journal->segments, journal->segmentCount, sizeof(uint64_t), compare_segments);
+	return VOID_SUCCESS;
+}
+
+// Hands the records at or past the checkpoint to replay and sets writeSequence past the last record
+// A torn or corrupt record ends the journal, the segment is cut there and later segments are deleted
+static int replay_segments(void_journal *journal, void_journal_replay replay, void *context) {
+	char path[4096];
+	uint64_t expected = journal->checkpoint;
+	int replayed = 0;
+	unsigned int i;
+
+	// Segments that only hold acknowledged records
+	while (journal->segmentCount >= 2 && journal->segments[1] <= journal->checkpoint) {
+		segment_path(journal, journal->segments[0], path, sizeof(path));
+		unlink(path);
+		journal->segmentCount--;
+		memmove(journal->segments, journal->segments+1, sizeof(uint64_t)*journal->segmentCount);
+	}
+
+	for (i = 0; i < journal->segmentCount; i++) {
+		segment_path(journal, journal->segments[i], path, sizeof(path));
+
+		int fd = open(path, O_RDWR | O_CLOEXEC);
+		struct stat info;
+
+		if (fd < 0 || fstat(fd, &info) != 0) {
+			if (fd >= 0)
+				close(fd);
+			return VOID_EIO;
+		}
+
+		size_t size = info.st_size;
+		char *data = malloc(size ? size : 1);
+
+		if (!data) {
+			close(fd);
+			return VOID_ENOMEM;
+		}
+
+		if (read_all(fd, data, size) != 0) {
+			free(data);
+			close(fd);
+			return VOID_EIO;
+		}
+
+		// Every segment is named after its first record
+		expected = journal->segments[i];
+
+		size_t at = 0;
+		while (size-at >= sizeof(record_header)) {
+			record_header header;
+			memcpy(&header, data+at, sizeof(record_header));
+			const char *payload = data+at+sizeof(record_header);
+
+			if (header.length > size-at-sizeof(record_header) || header.sequence != expected ||
+				header.crc != record_crc(payload, header.length, header.sequence))
+				break;
+
+			if (header.sequence >= journal->checkpoint) {
+				// Records before the first one left were lost, start the checkpoint at it
+				if (!replayed)
+					journal->checkpoint = header.sequence;
+				replayed = 1;
+
+				if (replay(context, payload, header.length)) {
+					free(data);
+					close(fd);
+					return VOID_ENOMEM;
+				}
+			}
+
+			expected++;
+			at += sizeof(record_header)+header.length;
+		}
+
+		free(data);
+
+		if (at < size) {
+			// Torn write at the end of the journal
+			int result = ftruncate(fd, at) == 0 && fdatasync(fd) == 0;
+			close(fd);
+
+			if (!result)
+				return VOID_EIO;
+
+			drop_segments(journal, i+1);
+			break;
+		}
+
+		close(fd);
+	}
+
+	journal->writeSequence = expected > journal->checkpoint ? expected : journal->checkpoint;
+	return VOID_SUCCESS;
+}
+
+// Starts a new segment at writeSequence
+static int open_segment(void_journal *journal) {
+	char path[4096];
+	segment_path(journal, journal->writeSequence, path, sizeof(path));
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+
+	if (fd < 0)
+		return VOID_EIO;
+
+	// An empty segment left at the end of the journal is reused
+	int reused = journal->segmentCount && journal->segments[journal->segmentCount-1] == journal->writeSequence;
+
+	if (!reused && add_segment(journal, journal->writeSequence) != VOID_SUCCESS) {
+		close(fd);
+		unlink(path);
+		return VOID_ENOMEM;
+	}
+
+	if (journal->syncInterval != VOID_JOURNAL_SYNC_NEVER && sync_directory(journal) != 0) {
+		close(fd);
+		return VOID_EIO;
+	}
+
+	journal->fd = fd;
+	journal->segmentLength = 0;
+	return VOID_SUCCESS;
+}
+
+// Syncs everything appended so far and saves the checkpoint
+// Runs with the lock held and no other sync running, the lock is dropped around the syscalls
+// so appends keep going and join the next sync
+static int sync_locked(void_journal *journal) {
+	uint64_t target = journal->writeSequence;
+	uint64_t checkpoint = journal->checkpoint;
+	int syncData = target != journal->syncedSequence;
+	int syncCheckpoint = checkpoint != journal->savedCheckpoint;
+	int durable = journal->syncInterval != VOID_JOURNAL_SYNC_NEVER;
+	int fd = journal->fd;
+	int failed = 0;
+
+	if (!syncData && !syncCheckpoint)
+		return journal->failed ? VOID_EIO : VOID_SUCCESS;
+
+	journal->syncing = 1;
+	pthread_mutex_unlock(&journal->lock);
+
+	if (syncData && durable && fdatasync(fd) != 0)
+		failed = 1;
+
+	if (!failed && syncCheckpoint) {
+		if (pwrite(journal->checkpointFd, &checkpoint, sizeof(checkpoint), 0) != sizeof(checkpoint) ||
+			(durable && fdatasync(journal->checkpointFd) != 0))
+			failed = 1;
+	}
+
+	pthread_mutex_lock(&journal->lock);
+	journal->syncing = 0;
+
+	if (failed) {
+		journal->failed = 1;
+	} else {
+		journal->syncedSequence = target;
+		journal->savedCheckpoint = checkpoint;
+		journal->syncs++;
+		remove_segments(journal);
+	}
+
+	pthread_cond_broadcast(&journal->cond);
+	return journal->failed ? VOID_EIO : VOID_SUCCESS;
+}
+
+// Closes the full segment and starts the next one, the lock is held
+static int rotate(void_journal *journal) {
+	while (journal->syncing)
+		pthread_cond_wait(&journal->cond, &journal->lock);
+
+	if (journal->fd >= 0) {
+		if (journal->syncInterval != VOID_JOURNAL_SYNC_NEVER && fdatasync(journal->fd) != 0) {
+			journal->failed = 1;
+			return VOID_EIO;
+		}
+
+		close(journal->fd);
+		journal->fd = -1;
+		journal->syncedSequence = journal->writeSequence;
+		pthread_cond_broadcast(&journal->cond);
+	}
+
+	return open_segment(journal);
+}
+
+static void *flusher_main(void *arg) {
+	void_journal *journal = arg;
+	struct timespec wakeTime;
+
+	pthread_mutex_lock(&journal->lock);
+
+	while (!journal->stopping) {
+		deadline(&wakeTime, journal->syncInterval);
+
+		while (!journal->stopping && pthread_cond_timedwait(&journal->flusherCond, &journal->lock, &wakeTime) != ETIMEDOUT);
+
+		if (journal->stopping)
+			break;
+
+		while (journal->syncing)
+			pthread_cond_wait(&journal->cond, &journal->lock);
+
+		sync_locked(journal);
+	}
+
+	pthread_mutex_unlock(&journal->lock);
+	return NULL;
+}
+
+static void release(void_journal *journal) {
+	if (journal->fd >= 0)
+		close(journal->fd);
+	// Also drops the lock on the directory
+	if (journal->checkpointFd >= 0)
+		close(journal->checkpointFd);
+
+	free(journal->path);
+	free(journal->segments);
+	free(journal->acked);
+	pthread_mutex_destroy(&journal->lock);
+	pthread_cond_destroy(&journal->cond);
+	pthread_cond_destroy(&journal->flusherCond);
+}
+
+int void_journal_open(void_journal *journal, const char *path, int64_t syncInterval, size_t segmentBytes,
+	void_journal_replay replay, void *context) {
+	char file[4096];
+	int result = VOID_EIO;
+
+	memset(journal, 0, sizeof(void_journal));
+	journal->fd = -1;
+	journal->checkpointFd = -1;
+	journal->syncInterval = syncInterval;
+	journal->segmentBytes = segmentBytes ? segmentBytes : DEFAULT_SEGMENT_BYTES;
+
+	pthread_mutex_init(&journal->lock, 0);
+	pthread_cond_init(&journal->cond, 0);
+	pthread_cond_init(&journal->flusherCond, 0);
+
+	size_t length = strlen(path);
+	journal->path = malloc(length+1);
+	journal->ackCapacity = 64;
+	journal->acked = calloc(journal->ackCapacity, 1);
+
+	if (!journal->path || !journal->acked) {
+		result = VOID_ENOMEM;
+		goto fail;
+	}
+
+	memcpy(journal->path, path, length+1);
+
+	if (mkdir(path, 0777) != 0 && errno != EEXIST)
+		goto fail;
+
+	file_path(journal, CHECKPOINT_FILE, file, sizeof(file));
+	journal->checkpointFd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+
+	if (journal->checkpointFd < 0)
+		goto fail;
+
+	if (flock(journal->checkpointFd, LOCK_EX | LOCK_NB) != 0) {
+		if (errno == EWOULDBLOCK)
+			errno = EBUSY;
+		goto fail;
+	}
+
+	uint64_t checkpoint;
+	if (pread(journal->checkpointFd, &checkpoint, sizeof(checkpoint), 0) == sizeof(checkpoint))
+		journal->checkpoint = checkpoint;
+
+	if ((result = list_segments(journal)) != VOID_SUCCESS)
+		goto fail;
+
+	if ((result = replay_segments(journal, replay, context)) != VOID_SUCCESS)
+		goto fail;
+
+	journal->readSequence = journal->checkpoint;
+	journal->savedCheckpoint = journal->checkpoint;
+	journal->syncedSequence = journal->writeSequence;
+
+	if ((result = open_segment(journal)) != VOID_SUCCESS)
+		goto fail;
+
+	if (syncInterval > 0) {
+		if (pthread_create(&journal->flusher, NULL, flusher_main, journal) != 0) {
+			result = VOID_ENOMEM;
+			goto fail;
+		}
+		journal->hasFlusher = 1;
+	}
+
+	return VOID_SUCCESS;
+
+fail:
+	{
+		int error = errno;
+		release(journal);
+		errno = error;
+	}
+	return result;
+}
+
+void void_journal_close(void_journal *journal) {
+	pthread_mutex_lock(&journal->lock);
+	journal->stopping = 1;
+	pthread_cond_broadcast(&journal->flusherCond);
+	pthread_mutex_unlock(&journal->lock);
+
+	if (journal->hasFlusher)
+		pthread_join(journal->flusher, NULL);
+
+	pthread_mutex_lock(&journal->lock);
+	while (journal->syncing)
+		pthread_cond_wait(&journal->cond, &journal->lock);
+	sync_locked(journal);
+	pthread_mutex_unlock(&journal->lock);
+
+	release(journal);
+}
+
+int void_journal_append(void_journal *journal, const void *data, size_t length, uint64_t *sequence) {
+	if (length > UINT32_MAX)
+		return VOID_EOUTOFRANGE;
+
+	record_header header;
+	header.length = length;
+	// Only the sequence number is added under the lock
+	uint32_t crc = void_crc32c(0, data, length);
+
+	pthread_mutex_lock(&journal->lock);
+
+	if (journal->fd < 0 || (journal->segmentLength && journal->segmentLength+sizeof(record_header)+length > journal->segmentBytes)) {
+		if (rotate(journal) != VOID_SUCCESS) {
+			pthread_mutex_unlock(&journal->lock);
+			return VOID_EIO;
+		}
+	}
+
+	header.sequence = journal->writeSequence;
+	header.crc = void_crc32c(crc, &header.sequence, sizeof(header.sequence));
+
+	struct iovec iov[2];
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(record_header);
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = length;
+
+	if (write_all(journal->fd, iov, 2) != 0) {
+		// Cut off whatever part of the record made it
+		if (ftruncate(journal->fd, journal->segmentLength) != 0)
+			journal->failed = 1;
+		pthread_mutex_unlock(&journal->lock);
+		return VOID_EIO;
+	}
+
+	journal->segmentLength += sizeof(record_header)+length;
+	*sequence = journal->writeSequence++;
+
+	pthread_mutex_unlock(&journal->lock);
+	return VOID_SUCCESS;
+}
+
+int void_journal_wait(void_journal *journal, uint64_t sequence) {
+	if (journal->syncInterval != VOID_JOURNAL_SYNC_EACH)
+		return VOID_SUCCESS;
+
+	pthread_mutex_lock(&journal->lock);
+
+	while (journal->syncedSequence <= sequence && !journal->failed) {
+		if (journal->syncing) {
+			pthread_cond_wait(&journal->cond, &journal->lock);
+		} else {
+			sync_locked(journal);
+		}
+	}
+
+	int result = journal->syncedSequence > sequence ? VOID_SUCCESS : VOID_EIO;
+	pthread_mutex_unlock(&journal->lock);
+
+	return result;
+}
+
+int void_journal_sync(void_journal *journal) {
+	pthread_mutex_lock(&journal->lock);
+
+	while (journal->syncing)
+		pthread_cond_wait(&journal->cond, &journal->lock);
+
+	int result = sync_locked(journal);
+	pthread_mutex_unlock(&journal->lock);
+
+	return result;
+}
+
+// Doubles the acknowledged flags, the lock is held
+static void grow_acked(void_journal *journal) {
+	size_t capacity = journal->ackCapacity*2;
+	unsigned char *acked = calloc(capacity, 1);
+
+	if (!acked)
+		abort();
+
+	uint64_t sequence;
+	for (sequence = journal->checkpoint; sequence < journal->readSequence; sequence++) {
+		acked[sequence & (capacity-1)] = journal->acked[sequence & (journal->ackCapacity-1)];
+	}
+
+	free(journal->acked);
+	journal->acked = acked;
+	journal->ackCapacity = capacity;
+}
+
+uint64_t void_journal_dequeued(void_journal *journal) {
+	pthread_mutex_lock(&journal->lock);
+
+	if (journal->readSequence-journal->checkpoint >= journal->ackCapacity)
+		grow_acked(journal);
+
+	uint64_t sequence = journal->readSequence++;
+
+	pthread_mutex_unlock(&journal->lock);
+	return sequence;
+}
+
+int void_journal_ack(void_journal *journal, uint64_t sequence) {
+	pthread_mutex_lock(&journal->lock);
+
+	size_t mask = journal->ackCapacity-1;
+
+	if (sequence < journal->checkpoint || sequence >= journal->readSequence || journal->acked[sequence & mask]) {
+		pthread_mutex_unlock(&journal->lock);
+		return VOID_EOUTOFRANGE;
+	}
+
+	journal->acked[sequence & mask] = 1;
+
+	while (journal->checkpoint < journal->readSequence && journal->acked[journal->checkpoint & mask]) {
+		journal->acked[journal->checkpoint & mask] = 0;
+		journal->checkpoint++;
+	}
+
+	pthread_mutex_unlock(&journal->lock);
+	return VOID_SUCCESS;
+}
+
+void void_journal_ack_all(void_journal *journal) {
+	pthread_mutex_lock(&journal->lock);
+
+	size_t mask = journal->ackCapacity-1;
+
+	while (journal->checkpoint < journal->readSequence) {
+		journal->acked[journal->checkpoint & mask] = 0;
+		journal->checkpoint++;
+	}
+
+	pthread_mutex_unlock(&journal->lock);
+}
@@ -0,0 +1,100 @@
+#ifndef VOID_JOURNAL
+#define VOID_JOURNAL
+
+#include "thread_compat.h"
+#include "void_buffer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct void_journal void_journal;
+
+// syncInterval values
+// Appends are durable once void_journal_wait returns, concurrent waiters share one fdatasync
+#define VOID_JOURNAL_SYNC_EACH 0
+// Never sync, the kernel writes the segments back when it wants to
+#define VOID_JOURNAL_SYNC_NEVER -1
+// A positive syncInterval starts a flusher thread that syncs every syncInterval milliseconds,
+// a crash loses at most the records appended in that window
+
+// Called for every record that was not acknowledged yet when the journal is opened, oldest first
+// Returns non zero to stop opening the journal
+typedef int (*void_journal_replay)(void *context, const void *data, size_t length);
+
+// A journal is a directory of segment files named after the sequence number of their first record,
+// and a checkpoint file that holds the sequence number of the oldest record that was not acknowledged
+// Records are {u32 length, u32 crc32c, u64 sequence, payload} in native byte order
+// The crc32c covers the payload and then the sequence number, replay stops at the first record that does not match
+struct void_journal {
+	pthread_mutex_t lock;
+	// Group commit waiters wait here for syncedSequence to pass their record
+	pthread_cond_t cond;
+	// The flusher waits here between syncs
+	pthread_cond_t flusherCond;
+	char *path;
+	int64_t syncInterval;
+	size_t segmentBytes;
+	// Segment being appended to
+	int fd;
+	size_t segmentLength;
+	int checkpointFd;
+	// First sequence number of every segment on disk, oldest first
+	uint64_t *segments;
+	unsigned int segmentCount;
+	unsigned int segmentCapacity;
+	// Sequence number of the next appended record
+	uint64_t writeSequence;
+	// Every record below this is on disk
+	uint64_t syncedSequence;
+	// Sequence number of the next dequeued record
+	uint64_t readSequence;
+	// Every record below this was acknowledged
+	uint64_t checkpoint;
+	// Checkpoint that is on disk
+	uint64_t savedCheckpoint;
+	// Acknowledged flags of the records from checkpoint to readSequence, indexed by sequence number
+	unsigned char *acked;
+	size_t ackCapacity;
+	// Set while a thread runs fdatasync without the lock
+	int syncing;
+	// Set once a sync failed, every later wait fails too
+	int failed;
+	int stopping;
+	int hasFlusher;
+	pthread_t flusher;
+	// Number of syncs that wrote anything
+	uint64_t syncs;
+};
+
+// Opens the journal in directory path, creating it if it does not exist, and replays it
+// Only one journal can have a directory open at a time
+// segmentBytes of 0 picks the default of 64MiB
+// Returns VOID_SUCCESS, VOID_ENOMEM, or VOID_EIO with errno set
+int void_journal_open(void_journal *journal, const char *path, int64_t syncInterval, size_t segmentBytes,
+	void_journal_replay replay, void *context);
+// Stops the flusher, syncs the records and the checkpoint, and closes the files
+void void_journal_close(void_journal *journal);
+
+// Writes a record and returns its sequence number through sequence
+// The record is not durable yet, see void_journal_wait
+// Returns VOID_SUCCESS, VOID_EOUTOFRANGE if length does not fit in 32 bits, or VOID_EIO
+// A failed append leaves nothing behind on disk
+int void_journal_append(void_journal *journal, const void *data, size_t length, uint64_t *sequence);
+// Waits until the record with the given sequence number is on disk
+// Returns right away unless syncInterval is VOID_JOURNAL_SYNC_EACH
+// The first waiter syncs for everyone that appended before it, the others wait for it
+// Returns VOID_SUCCESS or VOID_EIO
+int void_journal_wait(void_journal *journal, uint64_t sequence);
+// Syncs the records appended so far and the checkpoint, whatever syncInterval is
+int void_journal_sync(void_journal *journal);
+
+// Returns the sequence number of the next record handed out, records are handed out in order
+uint64_t void_journal_dequeued(void_journal *journal);
+// Acknowledges a handed out record, the checkpoint moves past every acknowledged record at its front
+// The checkpoint is saved by the next sync, segments behind it are deleted then
+// Returns VOID_EOUTOFRANGE if the record was not handed out or already acknowledged
+int void_journal_ack(void_journal *journal, uint64_t sequence);
+// Acknowledges every record handed out so far
+void void_journal_ack_all(void_journal *journal);
+
+#endif
@@ -0,0 +1,360 @@
+#include "void_map.h"
+#include "void_hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_STRIPES 64
+#define INITIAL_BUCKETS 8
+
+typedef struct void_map_entry void_map_entry;
+
+struct void_map_entry {
+	void_map_entry *next;
+	uint64_t hash;
+	// Read only, every lookup takes a reference to it
+	void_buffer_shared *value;
+	size_t keyLength;
+	char key[];
+};
+
+// A chained hash table of its own behind a reader/writer lock
+// Stripes are cache line aligned, so readers of different stripes do not touch the same lines
+struct void_map_stripe {
+	pthread_rwlock_t lock;
+	// bucketCount is a power of two, the table doubles once it holds more entries than buckets
+	void_map_entry **buckets;
+	size_t bucketCount;
+	size_t count;
+	size_t keyBytes;
+	size_t valueBytes;
+} __attribute__((aligned(VOID_CACHE_LINE)));
+
+// Global Map List
+// Map reference counts change under this lock too, so get never returns a map that is being destroyed
+static pthread_mutex_t gml_lock = PTHREAD_MUTEX_INITIALIZER;
+static void_map **gml = 0;
+static unsigned int gml_count = 0;
+
+static void_map_stripe *stripe_of(void_map *map, uint64_t hash) {
+	return &map->stripes[(hash >> 32) & (map->stripeCount-1)];
+}
+
+static void_map_entry **bucket_of(void_map_stripe *stripe, uint64_t hash) {
+	return &stripe->buckets[hash & (stripe->bucketCount-1)];
+}
+
+static void_map_entry *find(void_map_stripe *stripe, uint64_t hash, const void *key, size_t keyLength) {
+	void_map_entry *entry;
+
+	for (entry = *bucket_of(stripe, hash); entry; entry = entry->next) {
+		if (entry->hash == hash && entry->keyLength == keyLength && memcmp(entry->key, key, keyLength) == 0)
+			return entry;
+	}
+
+	return 0;
+}
+
+// Doubles the buckets of the stripe, the stripe keeps its chains if there is not enough memory
+static void grow(void_map_stripe *stripe) {
+	size_t bucketCount = stripe->bucketCount*2;
+	void_map_entry **buckets = calloc(bucketCount, sizeof(void_map_entry*));
+
+	if (!buckets)
+		return;
+
+	size_t i;
+	for (i = 0; i < stripe->bucketCount; i++) {
+		void_map_entry *entry = stripe->buckets[i];
+
+		while (entry) {
+			void_map_entry *next = entry->next;
+			void_map_entry **bucket = &buckets[entry->hash & (bucketCount-1)];
+			entry->next = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+
+	free(stripe->buckets);
+	stripe->buckets = buckets;
+	stripe->bucketCount = bucketCount;
+}
+
+static void stripe_free(void_map_stripe *stripe) {
+	size_t i;
+
+	if (!stripe->buckets)
+		return;
+
+	for (i = 0; i < stripe->bucketCount; i++) {
+		void_map_entry *entry = stripe->buckets[i];
+
+		while (entry) {
+			void_map_entry *next = entry->next;
+			void_buffer_shared_release(entry->value);
+			free(entry);
+			entry = next;
+		}
+	}
+
+	free(stripe->buckets);
+	stripe->buckets = 0;
+}
+
+int void_map_init(void_map *map, unsigned int stripes, const char *name) {
+	memset(map, 0, sizeof(void_map));
+
+	map->refcount = 1;
+	map->stripeCount = 1;
+	if (!stripes)
+		stripes = DEFAULT_STRIPES;
+	while (map->stripeCount < stripes)
+		map->stripeCount *= 2;
+
+	void *memory;
+	if (posix_memalign(&memory, VOID_CACHE_LINE, sizeof(void_map_stripe)*map->stripeCount)) {
+		fprintf(stderr, "Could not initialize map stripes\n");
+		return 0;
+	}
+	memset(memory, 0, sizeof(void_map_stripe)*map->stripeCount);
+	map->stripes = memory;
+
+	unsigned int i;
+	for (i = 0; i < map->stripeCount; i++) {
+		void_map_stripe *stripe = &map->stripes[i];
+		stripe->bucketCount = INITIAL_BUCKETS;
+		stripe->buckets = calloc(INITIAL_BUCKETS, sizeof(void_map_entry*));
+
+		if (!stripe->buckets || pthread_rwlock_init(&stripe->lock, 0)) {
+			fprintf(stderr, "Could not initialize map stripe\n");
+			free(stripe->buckets);
+			break;
+		}
+	}
+
+	size_t len = strlen(name);
+	char *copy = i == map->stripeCount ? malloc(len+1) : 0;
+
+	if (!copy) {
+		if (i == map->stripeCount)
+			fprintf(stderr, "Could not initialize name copy\n");
+
+		while (i--) {
+			pthread_rwlock_destroy(&map->stripes[i].lock);
+			free(map->stripes[i].buckets);
+		}
+		free(map->stripes);
+		return 0;
+	}
+
+	memcpy(copy, name, len+1);
+	map->name = copy;
+
+	pthread_mutex_lock(&gml_lock);
+
+	if (!gml) {
+		gml_count = 4;
+		gml = malloc(sizeof(void_map*)*gml_count);
+		if (!gml) abort();
+		memset(gml, 0, sizeof(void_map*)*gml_count);
+	}
+
+	// find a spot in the gml
+	int found = 0;
+	for (i = 0; i < gml_count; i++) {
+		if (!gml[i]) {
+			found = 1;
+			gml[i] = map;
+			break;
+		}
+	}
+
+	if (!found) {
+		gml = realloc(gml, sizeof(void_map*)*gml_count*2);
+		if (!gml) abort();
+		memset(gml+gml_count, 0, sizeof(void_map*)*gml_count);
+		gml[gml_count] = map;
+		gml_count *= 2;
+	}
+
+	pthread_mutex_unlock(&gml_lock);
+
+	return 1;
+}
+
+int void_map_destroy(void_map *map) {
+	pthread_mutex_lock(&gml_lock);
+	map->refcount--;
+
+	if (map->refcount) {
+		pthread_mutex_unlock(&gml_lock);
+		return 0;
+	}
+
+	unsigned int i;
+	for (i = 0; i < gml_count; i++) {
+		if (gml[i] == map) {
+			gml[i] = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&gml_lock);
+
+	for (i = 0; i < map->stripeCount; i++) {
+		stripe_free(&map->stripes[i]);
+		pthread_rwlock_destroy(&map->stripes[i].lock);
+	}
+
+	free(map->stripes);
+	free(map->name);
+	return 1;
+}
+
+void_map *void_map_get(const char *name) {
+	void_map *map = 0;
+
+	pthread_mutex_lock(&gml_lock);
+	if (gml) {
+		unsigned int i;
+		for (i = 0; i < gml_count; i++) {
+			if (gml[i] && strcmp(gml[i]->name, name) == 0) {
+				map = gml[i];
+				map->refcount++;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&gml_lock);
+
+	return map;
+}
+
+int void_map_put(void_map *map, const void *key, size_t keyLength, void_buffer *buffer) {
+	if (buffer->type != NORMAL || !buffer->normal.data)
+		return VOID_EWRONGTYPE;
+
+	// Other buffers for the storage, like a writable share, could still change the value
+	void_buffer_shared *storage = buffer->normal.shared;
+	if (void_buffer_window(buffer) || (storage && __atomic_load_n(&storage->refcount, __ATOMIC_ACQUIRE) > 1))
+		return VOID_EWRONGTYPE;
+
+	uint64_t hash = void_xxh64(key, keyLength, 0);
+	void_map_entry *entry = malloc(sizeof(void_map_entry)+keyLength);
+
+	if (!entry)
+		return VOID_ENOMEM;
+
+	void_buffer_shared *shared = void_buffer_share(buffer);
+
+	if (!shared) {
+		free(entry);
+		return VOID_ENOMEM;
+	}
+
+	// The map takes the buffer's reference
+	void_buffer_shared_retain(shared);
+	void_buffer_invalidate(buffer);
+
+	void_map_stripe *stripe = stripe_of(map, hash);
+	pthread_rwlock_wrlock(&stripe->lock);
+
+	void_map_entry *existing = find(stripe, hash, key, keyLength);
+
+	if (existing) {
+		void_buffer_shared *previous = existing->value;
+		existing->value = shared;
+		stripe->valueBytes += shared->length-previous->length;
+		VOID_RWLOCK_WRUNLOCK(&stripe->lock);
+
+		void_buffer_shared_release(previous);
+		free(entry);
+		return 0;
+	}
+
+	entry->hash = hash;
+	entry->value = shared;
+	entry->keyLength = keyLength;
+	memcpy(entry->key, key, keyLength);
+
+	if (stripe->count >= stripe->bucketCount)
+		grow(stripe);
+
+	void_map_entry **bucket = bucket_of(stripe, hash);
+	entry->next = *bucket;
+	*bucket = entry;
+
+	stripe->count++;
+	stripe->keyBytes += keyLength;
+	stripe->valueBytes += shared->length;
+
+	VOID_RWLOCK_WRUNLOCK(&stripe->lock);
+	return 1;
+}
+
+int void_map_lookup(void_map *map, const void *key, size_t keyLength, void_buffer *buffer) {
+	uint64_t hash = void_xxh64(key, keyLength, 0);
+	void_map_stripe *stripe = stripe_of(map, hash);
+
+	// Whatever the buffer held is freed outside of the lock
+	void_buffer_invalidate(buffer);
+
+	pthread_rwlock_rdlock(&stripe->lock);
+
+	void_map_entry *entry = find(stripe, hash, key, keyLength);
+
+	if (entry)
+		void_buffer_set_shared(buffer, entry->value, VOID_BUFFER_READONLY);
+
+	VOID_RWLOCK_RDUNLOCK(&stripe->lock);
+
+	return entry ? 1 : 0;
+}
+
+int void_map_remove(void_map *map, const void *key, size_t keyLength) {
+	uint64_t hash = void_xxh64(key, keyLength, 0);
+	void_map_stripe *stripe = stripe_of(map, hash);
+
+	pthread_rwlock_wrlock(&stripe->lock);
+
+	void_map_entry **link = bucket_of(stripe, hash);
+
+	while (*link) {
+		void_map_entry *entry = *link;
+
+		if (entry->hash == hash && entry->keyLength == keyLength && memcmp(entry->key, key, keyLength) == 0) {
+			*link = entry->next;
+			stripe->count--;
+			stripe->keyBytes -= keyLength;
+			stripe->valueBytes -= entry->value->length;
+			VOID_RWLOCK_WRUNLOCK(&stripe->lock);
+
+			void_buffer_shared_release(entry->value);
+			free(entry);
+			return 1;
+		}
+
+		link = &entry->next;
+	}
+
+	VOID_RWLOCK_WRUNLOCK(&stripe->lock);
+	return 0;
+}
+
+void void_map_stats_get(void_map *map, void_map_stats *stats) {
+	memset(stats, 0, sizeof(void_map_stats));
+	stats->tableBytes = sizeof(void_map_stripe)*map->stripeCount;
+
+	unsigned int i;
+	for (i = 0; i < map->stripeCount; i++) {
+		void_map_stripe *stripe = &map->stripes[i];
+
+		pthread_rwlock_rdlock(&stripe->lock);
+		stats->count += stripe->count;
+		stats->keyBytes += stripe->keyBytes;
+		stats->valueBytes += stripe->valueBytes;
+		stats->tableBytes += stripe->bucketCount*sizeof(void_map_entry*)+stripe->count*sizeof(void_map_entry);
+		VOID_RWLOCK_RDUNLOCK(&stripe->lock);
+	}
+}
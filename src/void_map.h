@@ -0,0 +1,61 @@
+#ifndef VOID_MAP
+#define VOID_MAP
+
+#include "thread_compat.h"
+#include "void_buffer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct void_map void_map;
+typedef struct void_map_stripe void_map_stripe;
+typedef struct void_map_stats void_map_stats;
+
+// Process wide hash map from byte string keys to immutable buffers
+// A key's stripe is picked by the high half of its hash and its bucket by the low half,
+// lookups of keys in different stripes never wait for each other
+struct void_map {
+	unsigned int refcount;
+	// Power of two
+	unsigned int stripeCount;
+	// Defined in void_map.c, where the reader/writer lock type is known
+	void_map_stripe *stripes;
+	char *name;
+};
+
+struct void_map_stats {
+	size_t count;
+	size_t keyBytes;
+	// Bytes of the values, values shared with other buffers are counted in full
+	size_t valueBytes;
+	// Bytes of the stripes, buckets and entries
+	size_t tableBytes;
+};
+
+// stripes is rounded up to a power of two, 0 for the default
+// Returns 0 if there was not enough memory
+int void_map_init(void_map *map, unsigned int stripes, const char *name);
+// Drops a reference to the map, returns 1 if the map was destroyed
+int void_map_destroy(void_map *map);
+
+// Finds a map by name and takes a reference to it, returns 0 if it does not exist
+void_map *void_map_get(const char *name);
+
+// Map functions lock the map themselves
+
+// Moves the buffer's data into shared storage under key and invalidates the buffer
+// The previous value of the key is released, buffers that look it up keep it
+// Returns 1 if the key is new, 0 if its value was replaced
+// Errors:
+	// VOID_EWRONGTYPE - Buffer is not a normal buffer, or other buffers share its storage
+	// VOID_ENOMEM - Not enough memory, the buffer is left as it was
+int void_map_put(void_map *map, const void *key, size_t keyLength, void_buffer *buffer);
+// Points buffer at the value of key, read only
+// Returns 1 if found, 0 if not, the buffer is invalidated in that case
+int void_map_lookup(void_map *map, const void *key, size_t keyLength, void_buffer *buffer);
+// Returns 1 if the key was removed, 0 if it was not in the map
+int void_map_remove(void_map *map, const void *key, size_t keyLength);
+
+void void_map_stats_get(void_map *map, void_map_stats *stats);
+
+#endif
@@ -0,0 +1,222 @@
+#include "void_memory.h"
+#include "thread_compat.h"
+
+#include <malloc.h>
+#include <string.h>
+
+// Counters are updated with atomic builtins so tracking never takes a lock
+#define ATOMIC_ADD(ptr, value) __atomic_add_fetch(ptr, value, __ATOMIC_RELAXED)
+#define ATOMIC_SUB(ptr, value) __atomic_sub_fetch(ptr, value, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+
+const char *void_memory_origin_names[VOID_ORIGIN_COUNT] = {
+	"none",
+	"create",
+	"fromString",
+	"clone",
+	"concat",
+	"serialize"
+};
+
+static void_memory_counter origins[VOID_ORIGIN_COUNT];
+static size_t liveBytes = 0;
+static size_t liveCount = 0;
+static size_t peakBytes = 0;
+static size_t queuedBytes = 0;
+static size_t queuedCount = 0;
+
+static unsigned int sampleInterval = 0;
+static unsigned int sampleCounter = 0;
+static pthread_mutex_t sampleLock = PTHREAD_MUTEX_INITIALIZER;
+static void_memory_sample *samples = 0;
+
+static void updatePeak(size_t bytes) {
+	size_t peak = ATOMIC_LOAD(&peakBytes);
+	while (bytes > peak) {
+		if (__atomic_compare_exchange_n(&peakBytes, &peak, bytes, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+	}
+}
+
+void void_memory_track(int origin, size_t length) {
+	if (origin <= VOID_ORIGIN_NONE || origin >= VOID_ORIGIN_COUNT)
+		return;
+
+	void_memory_counter *counter = &origins[origin];
+	ATOMIC_ADD(&counter->bytes, length);
+	ATOMIC_ADD(&counter->count, 1);
+	ATOMIC_ADD(&counter->totalBytes, length);
+	ATOMIC_ADD(&counter->totalCount, 1);
+
+	ATOMIC_ADD(&liveCount, 1);
+	updatePeak(ATOMIC_ADD(&liveBytes, length));
+}
+
+void void_memory_untrack(int origin, size_t length) {
+	if (origin <= VOID_ORIGIN_NONE || origin >= VOID_ORIGIN_COUNT)
+		return;
+
+	void_memory_counter *counter = &origins[origin];
+	ATOMIC_SUB(&counter->bytes, length);
+	ATOMIC_SUB(&counter->count, 1);
+
+	ATOMIC_SUB(&liveCount, 1);
+	ATOMIC_SUB(&liveBytes, length);
+}
+
+void void_memory_resize(int origin, size_t oldLength, size_t newLength) {
+	if (origin <= VOID_ORIGIN_NONE || origin >= VOID_ORIGIN_COUNT || oldLength == newLength)
+		return;
+
+	void_memory_counter *counter = &origins[origin];
+	if (newLength > oldLength) {
+		size_t delta = newLength-oldLength;
+		ATOMIC_ADD(&counter->bytes, delta);
+		ATOMIC_ADD(&counter->totalBytes, delta);
+		updatePeak(ATOMIC_ADD(&liveBytes, delta));
+	} else {
+		size_t delta = oldLength-newLength;
+		ATOMIC_SUB(&counter->bytes, delta);
+		ATOMIC_SUB(&liveBytes, delta);
+	}
+}
+
+void void_memory_enqueued(size_t length) {
+	ATOMIC_ADD(&queuedBytes, length);
+	ATOMIC_ADD(&queuedCount, 1);
+}
+
+void void_memory_dequeued(size_t length) {
+	ATOMIC_SUB(&queuedBytes, length);
+	ATOMIC_SUB(&queuedCount, 1);
+}
+
+size_t void_memory_queued(void) {
+	return ATOMIC_LOAD(&queuedBytes);
+}
+
+void void_memory_stats_get(void_memory_stats *stats) {
+	int i;
+	for (i=0; i<VOID_ORIGIN_COUNT; i++) {
+		stats->origins[i].bytes = ATOMIC_LOAD(&origins[i].bytes);
+		stats->origins[i].count = ATOMIC_LOAD(&origins[i].count);
+		stats->origins[i].totalBytes = ATOMIC_LOAD(&origins[i].totalBytes);
+		stats->origins[i].totalCount = ATOMIC_LOAD(&origins[i].totalCount);
+	}
+
+	stats->bytes = ATOMIC_LOAD(&liveBytes);
+	stats->count = ATOMIC_LOAD(&liveCount);
+	stats->peak = ATOMIC_LOAD(&peakBytes);
+	stats->queuedBytes = ATOMIC_LOAD(&queuedBytes);
+	stats->queuedCount = ATOMIC_LOAD(&queuedCount);
+}
+
+void void_memory_set_sample_interval(unsigned int interval) {
+	__atomic_store_n(&sampleInterval, interval, __ATOMIC_RELAXED);
+}
+
+unsigned int void_memory_get_sample_interval(void) {
+	return ATOMIC_LOAD(&sampleInterval);
+}
+
+int void_memory_should_sample(void) {
+	unsigned int interval = ATOMIC_LOAD(&sampleInterval);
+
+	if (!interval)
+		return 0;
+
+	return ATOMIC_ADD(&sampleCounter, 1) % interval == 0;
+}
+
+void_memory_sample *void_memory_sample_add(int origin, size_t length, const char *trace) {
+	void_memory_sample *sample = malloc(sizeof(void_memory_sample));
+
+	if (!sample)
+		return 0;
+
+	size_t traceLength = trace ? strlen(trace) : 0;
+	sample->trace = malloc(traceLength+1);
+
+	if (!sample->trace) {
+		free(sample);
+		return 0;
+	}
+
+	memcpy(sample->trace, trace ? trace : "", traceLength+1);
+	sample->origin = origin;
+	sample->length = length;
+	sample->prev = 0;
+
+	pthread_mutex_lock(&sampleLock);
+	sample->next = samples;
+	if (samples)
+		samples->prev = sample;
+	samples = sample;
+	pthread_mutex_unlock(&sampleLock);
+
+	return sample;
+}
+
+void void_memory_sample_remove(void_memory_sample *sample) {
+	pthread_mutex_lock(&sampleLock);
+	if (sample->prev)
+		sample->prev->next = sample->next;
+	else
+		samples = sample->next;
+	if (sample->next)
+		sample->next->prev = sample->prev;
+	pthread_mutex_unlock(&sampleLock);
+
+	free(sample->trace);
+	free(sample);
+}
+
+void void_memory_sample_resize(void_memory_sample *sample, size_t length) {
+	pthread_mutex_lock(&sampleLock);
+	sample->length = length;
+	pthread_mutex_unlock(&sampleLock);
+}
+
+void_memory_sample *void_memory_sample_snapshot(size_t *count) {
+	pthread_mutex_lock(&sampleLock);
+
+	size_t n = 0;
+	void_memory_sample *sample;
+	for (sample = samples; sample; sample = sample->next) {
+		n++;
+	}
+
+	void_memory_sample *snapshot = malloc(sizeof(void_memory_sample)*(n ? n : 1));
+
+	if (!snapshot) {
+		pthread_mutex_unlock(&sampleLock);
+		*count = 0;
+		return 0;
+	}
+
+	size_t i = 0;
+	for (sample = samples; sample; sample = sample->next) {
+		memcpy(&snapshot[i], sample, sizeof(void_memory_sample));
+		snapshot[i].prev = 0;
+		snapshot[i].next = 0;
+
+		size_t traceLength = strlen(sample->trace);
+		snapshot[i].trace = malloc(traceLength+1);
+		if (snapshot[i].trace)
+			memcpy(snapshot[i].trace, sample->trace, traceLength+1);
+		i++;
+	}
+
+	pthread_mutex_unlock(&sampleLock);
+
+	*count = n;
+	return snapshot;
+}
+
+void void_memory_sample_snapshot_free(void_memory_sample *snapshot, size_t count) {
+	size_t i;
+	for (i=0; i<count; i++) {
+		free(snapshot[i].trace);
+	}
+	free(snapshot);
+}
@@ -0,0 +1,84 @@
+#ifndef VOID_MEMORY_H
+#define VOID_MEMORY_H
+
+#include <stddef.h>
+
+// Where a buffer's storage was allocated
+// VOID_ORIGIN_NONE means the storage is not tracked
+enum void_memory_origin {
+	VOID_ORIGIN_NONE,
+	VOID_ORIGIN_CREATE,
+	VOID_ORIGIN_FROMSTRING,
+	VOID_ORIGIN_CLONE,
+	VOID_ORIGIN_CONCAT,
+	VOID_ORIGIN_SERIALIZE,
+	VOID_ORIGIN_COUNT
+};
+
+typedef struct void_memory_counter void_memory_counter;
+
+struct void_memory_counter {
+	size_t bytes; // Live bytes
+	size_t count; // Live allocations
+	size_t totalBytes; // Bytes ever allocated
+	size_t totalCount; // Allocations ever made
+};
+
+typedef struct void_memory_stats void_memory_stats;
+
+struct void_memory_stats {
+	void_memory_counter origins[VOID_ORIGIN_COUNT];
+	size_t bytes;
+	size_t count;
+	size_t peak;
+	// Buffers currently parked inside of queues
+	size_t queuedBytes;
+	size_t queuedCount;
+};
+
+typedef struct void_memory_sample void_memory_sample;
+
+// A sampled allocation, kept in a global list until its storage is freed
+struct void_memory_sample {
+	void_memory_sample *prev;
+	void_memory_sample *next;
+	int origin;
+	size_t length;
+	char *trace;
+};
+
+extern const char *void_memory_origin_names[VOID_ORIGIN_COUNT];
+
+// Accounts for a new allocation of length bytes
+void void_memory_track(int origin, size_t length);
+// Accounts for an allocation of length bytes being freed
+void void_memory_untrack(int origin, size_t length);
+// Accounts for an allocation changing size in place (grow, shrink)
+void void_memory_resize(int origin, size_t oldLength, size_t newLength);
+
+// Accounts for a buffer entering or leaving a queue
+void void_memory_enqueued(size_t length);
+void void_memory_dequeued(size_t length);
+// Returns the number of bytes currently parked inside of queues
+size_t void_memory_queued(void);
+
+// Takes a snapshot of all counters
+// Counters are updated independently, so the snapshot is not atomic as a whole
+void void_memory_stats_get(void_memory_stats *stats);
+
+// Samples 1 out of every interval allocations, 0 disables sampling
+void void_memory_set_sample_interval(unsigned int interval);
+unsigned int void_memory_get_sample_interval(void);
+// Returns non zero if the next allocation should be sampled
+int void_memory_should_sample(void);
+// Records a sampled allocation, the trace is copied
+// Returns null if the sample could not be allocated
+void_memory_sample *void_memory_sample_add(int origin, size_t length, const char *trace);
+void void_memory_sample_remove(void_memory_sample *sample);
+void void_memory_sample_resize(void_memory_sample *sample, size_t length);
+// Copies every live sample into a new array so it can be read without the lock
+// Returns null and sets count to 0 if the copy could not be allocated
+void_memory_sample *void_memory_sample_snapshot(size_t *count);
+void void_memory_sample_snapshot_free(void_memory_sample *snapshot, size_t count);
+
+#endif
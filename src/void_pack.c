@@ -0,0 +1,246 @@
+#include "void_pack.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NATIVE_LITTLE 1
+#else
+#define NATIVE_LITTLE 0
+#endif
+
+// Alignment used by the ! option when no size is given
+struct native_align {
+	char c;
+	union {
+		double d;
+		void *p;
+		int64_t i;
+		long l;
+	} u;
+};
+#define NATIVE_MAXALIGN offsetof(struct native_align, u)
+
+static int isdigit_(char c) {
+	return c >= '0' && c <= '9';
+}
+
+// Reads an optional size after an option
+static size_t read_size(const char **fmt, const char *end, size_t def) {
+	if (*fmt >= end || !isdigit_(**fmt))
+		return def;
+
+	size_t size = 0;
+	while (*fmt < end && isdigit_(**fmt) && size <= ((size_t)-1-9)/10) {
+		size = size*10+(*((*fmt)++)-'0');
+	}
+	return size;
+}
+
+#define FAIL(...) { snprintf(err, errLength, __VA_ARGS__); return -1; }
+
+// Reads one option, returns 0 for options that only change the state
+static int read_option(const char **fmt, const char *end, void_pack_op *op, int *little, size_t *maxalign, char *err, size_t errLength) {
+	char option = *((*fmt)++);
+	size_t size;
+
+	memset(op, 0, sizeof(void_pack_op));
+	op->align = 1;
+
+	switch (option) {
+		case 'b': op->kind = VOID_PACK_INT; op->size = 1; break;
+		case 'B': op->kind = VOID_PACK_UINT; op->size = 1; break;
+		case 'h': op->kind = VOID_PACK_INT; op->size = sizeof(short); break;
+		case 'H': op->kind = VOID_PACK_UINT; op->size = sizeof(short); break;
+		case 'l': op->kind = VOID_PACK_INT; op->size = sizeof(long); break;
+		case 'L': op->kind = VOID_PACK_UINT; op->size = sizeof(long); break;
+		case 'j': op->kind = VOID_PACK_INT; op->size = sizeof(int64_t); break;
+		case 'J': op->kind = VOID_PACK_UINT; op->size = sizeof(int64_t); break;
+		case 'T': op->kind = VOID_PACK_UINT; op->size = sizeof(size_t); break;
+		case 'f': op->kind = VOID_PACK_FLOAT; op->size = sizeof(float); break;
+		case 'd': case 'n': op->kind = VOID_PACK_DOUBLE; op->size = sizeof(double); break;
+		case 'i': case 'I':
+			size = read_size(fmt, end, sizeof(int));
+			if (size < 1 || size > VOID_PACK_MAXINTSIZE)
+				FAIL("integral size (%zu) out of limits [1,%d]", size, VOID_PACK_MAXINTSIZE);
+			op->kind = option == 'i' ? VOID_PACK_INT : VOID_PACK_UINT;
+			op->size = size;
+			break;
+		case 's':
+			size = read_size(fmt, end, sizeof(size_t));
+			if (size < 1 || size > VOID_PACK_MAXINTSIZE)
+				FAIL("integral size (%zu) out of limits [1,%d]", size, VOID_PACK_MAXINTSIZE);
+			op->kind = VOID_PACK_STRING;
+			op->size = size;
+			break;
+		case 'c':
+			if (*fmt >= end || !isdigit_(**fmt))
+				FAIL("missing size for format option 'c'");
+			op->kind = VOID_PACK_CHARS;
+			op->length = read_size(fmt, end, 0);
+			return 1;
+		case 'z': op->kind = VOID_PACK_ZSTRING; return 1;
+		// Varints are never aligned, size is their smallest size
+		case 'V': op->kind = VOID_PACK_VARINT; op->size = 1; return 1;
+		case 'v': op->kind = VOID_PACK_ZIGZAG; op->size = 1; return 1;
+		case 'x': op->kind = VOID_PACK_PADDING; op->size = 1; return 1;
+		case 'X': {
+			void_pack_op next;
+			if (*fmt >= end || read_option(fmt, end, &next, little, maxalign, err, errLength) <= 0 ||
+				next.kind == VOID_PACK_CHARS || next.size == 0)
+				FAIL("invalid next option for option 'X'");
+			op->kind = VOID_PACK_ALIGN;
+			size = next.size;
+			break;
+		}
+		case ' ': return 0;
+		case '<': *little = 1; return 0;
+		case '>': *little = 0; return 0;
+		case '=': *little = NATIVE_LITTLE; return 0;
+		case '!':
+			size = read_size(fmt, end, NATIVE_MAXALIGN);
+			if (size < 1 || size > VOID_PACK_MAXINTSIZE)
+				FAIL("integral size (%zu) out of limits [1,%d]", size, VOID_PACK_MAXINTSIZE);
+			*maxalign = size;
+			return 0;
+		default:
+			FAIL("invalid format option '%c'", option);
+	}
+
+	if (op->kind != VOID_PACK_ALIGN)
+		size = op->size;
+
+	op->reverse = *little != NATIVE_LITTLE;
+
+	// Only options with a size are aligned, and never past the maximum alignment
+	size_t align = size < *maxalign ? size : *maxalign;
+	if (align > 1) {
+		if (align & (align-1))
+			FAIL("format asks for alignment not power of 2");
+		op->align = align;
+	}
+
+	return 1;
+}
+
+int void_pack_parse(const char *fmt, size_t fmtLength, void_pack_format *format, char *err, size_t errLength) {
+	const char *end = fmt+fmtLength;
+	int little = NATIVE_LITTLE;
+	size_t maxalign = 1;
+	int count = 0;
+	int fixed = 1;
+	size_t size = 0;
+
+	while (fmt < end) {
+		void_pack_op op;
+		int result = read_option(&fmt, end, &op, &little, &maxalign, err, errLength);
+
+		if (result < 0)
+			return -1;
+		if (result == 0)
+			continue;
+
+		size += void_pack_padding(size, op.align);
+
+		switch (op.kind) {
+			case VOID_PACK_CHARS:
+				size += op.length;
+				break;
+			case VOID_PACK_STRING:
+				fixed = 0;
+				size += op.size;
+				break;
+			case VOID_PACK_ZSTRING:
+			case VOID_PACK_VARINT:
+			case VOID_PACK_ZIGZAG:
+				fixed = 0;
+				size += 1;
+				break;
+			default:
+				size += op.size;
+		}
+
+		if (format)
+			format->ops[count] = op;
+		count++;
+	}
+
+	if (format) {
+		format->count = count;
+		format->fixed = fixed;
+		format->size = size;
+	}
+
+	return count;
+}
+
+void void_pack_bytes(unsigned char *dest, const unsigned char *source, size_t size, int reverse) {
+	if (reverse) {
+		source += size;
+		while (size--) {
+			*(dest++) = *(--source);
+		}
+	} else {
+		memcpy(dest, source, size);
+	}
+}
+
+void void_pack_int(unsigned char *dest, uint64_t value, unsigned int size, int reverse, int negative) {
+	unsigned int i;
+	for (i=0; i<size; i++) {
+		unsigned char byte = i < sizeof(uint64_t) ? (unsigned char)(value >> (i*8)) : (negative ? 0xff : 0);
+		// Bytes are produced least significant first
+		dest[(reverse ^ NATIVE_LITTLE) ? i : size-1-i] = byte;
+	}
+}
+
+int void_unpack_int(const unsigned char *source, unsigned int size, int reverse, int issigned, uint64_t *value) {
+	uint64_t result = 0;
+	unsigned int limit = size < sizeof(uint64_t) ? size : sizeof(uint64_t);
+	int little = reverse ^ NATIVE_LITTLE;
+
+	unsigned int i;
+	for (i=0; i<limit; i++) {
+		result |= (uint64_t)source[little ? i : size-1-i] << (i*8);
+	}
+
+	if (size < sizeof(uint64_t)) {
+		if (issigned) {
+			uint64_t mask = (uint64_t)1 << (size*8-1);
+			result = (result^mask)-mask;
+		}
+	} else if (size > sizeof(uint64_t)) {
+		// The extra bytes must only extend the sign
+		unsigned char extension = (issigned && (int64_t)result < 0) ? 0xff : 0;
+		for (i=limit; i<size; i++) {
+			if (source[little ? i : size-1-i] != extension)
+				return 0;
+		}
+	}
+
+	*value = result;
+	return 1;
+}
+
+size_t void_pack_varint(unsigned char *dest, uint64_t value) {
+	size_t count = 0;
+	while (value >= 0x80) {
+		dest[count++] = (unsigned char)value | 0x80;
+		value >>= 7;
+	}
+	dest[count++] = (unsigned char)value;
+	return count;
+}
+
+size_t void_unpack_varint(const unsigned char *source, size_t length, uint64_t *value) {
+	uint64_t result = 0;
+	size_t i;
+	for (i=0; i<length && i<VOID_PACK_MAXVARINT; i++) {
+		result |= (uint64_t)(source[i] & 0x7f) << (i*7);
+		if (!(source[i] & 0x80)) {
+			*value = result;
+			return i+1;
+		}
+	}
+	return 0;
+}
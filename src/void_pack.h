@@ -0,0 +1,93 @@
+#ifndef VOID_PACK_H
+#define VOID_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest integer size a format can ask for
+#define VOID_PACK_MAXINTSIZE 16
+
+// Operations of a compiled string.pack style format
+enum void_pack_kind {
+	// Signed and unsigned integers of size bytes
+	VOID_PACK_INT,
+	VOID_PACK_UINT,
+	VOID_PACK_FLOAT,
+	VOID_PACK_DOUBLE,
+	// String of exactly length bytes
+	VOID_PACK_CHARS,
+	// String prefixed by its length as a size byte unsigned integer
+	VOID_PACK_STRING,
+	// Zero terminated string
+	VOID_PACK_ZSTRING,
+	// One zero byte
+	VOID_PACK_PADDING,
+	// Only aligns the position
+	VOID_PACK_ALIGN,
+	// Not part of string.pack, see void_pack_varint
+	// Unsigned LEB128 varint
+	VOID_PACK_VARINT,
+	// Zigzag encoded signed varint
+	VOID_PACK_ZIGZAG
+};
+
+typedef struct void_pack_op void_pack_op;
+typedef struct void_pack_format void_pack_format;
+
+struct void_pack_op {
+	unsigned char kind;
+	unsigned char size;
+	// Non zero if the bytes are stored in the reverse of host order
+	unsigned char reverse;
+	// The position is padded up to a multiple of align, relative to the start of the format
+	unsigned char align;
+	// Length of VOID_PACK_CHARS strings
+	size_t length;
+};
+
+struct void_pack_format {
+	unsigned int count;
+	// Non zero if the format has no variable length strings
+	int fixed;
+	// Bytes taken up by a fixed format, or its smallest size otherwise
+	size_t size;
+	void_pack_op ops[];
+};
+
+// Parses a Lua 5.3 string.pack format, with V and v for unsigned and zigzag varints
+// Returns the number of operations, or -1 with a message written to err
+// If format is not null it must have room for that many operations and is filled in
+int void_pack_parse(const char *fmt, size_t fmtLength, void_pack_format *format, char *err, size_t errLength);
+
+// Bytes of padding needed to move position up to a multiple of align
+static inline size_t void_pack_padding(size_t position, unsigned int align) {
+	return (align-(position&(align-1)))&(align-1);
+}
+
+// Largest number of bytes a varint takes up
+#define VOID_PACK_MAXVARINT 10
+
+// Writes value as an unsigned LEB128 varint, returns the number of bytes written
+size_t void_pack_varint(unsigned char *dest, uint64_t value);
+// Reads a varint from at most length bytes
+// Returns the number of bytes read, or 0 if the varint is truncated or too long
+size_t void_unpack_varint(const unsigned char *source, size_t length, uint64_t *value);
+
+// Zigzag encoding maps signed integers of small magnitude to small unsigned integers
+static inline uint64_t void_zigzag_encode(int64_t value) {
+	return ((uint64_t)value << 1)^(uint64_t)(value >> 63);
+}
+
+static inline int64_t void_zigzag_decode(uint64_t value) {
+	return (int64_t)(value >> 1)^-(int64_t)(value & 1);
+}
+
+// Copies size bytes, reversing them if asked to
+void void_pack_bytes(unsigned char *dest, const unsigned char *source, size_t size, int reverse);
+// Writes an integer of size bytes, sign extending negative values past 8 bytes
+void void_pack_int(unsigned char *dest, uint64_t value, unsigned int size, int reverse, int negative);
+// Reads an integer of size bytes, sign extending signed values smaller than 8 bytes
+// Returns 0 if the value does not fit in 8 bytes
+int void_unpack_int(const unsigned char *source, unsigned int size, int reverse, int issigned, uint64_t *value);
+
+#endif
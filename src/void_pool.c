@@ -0,0 +1,346 @@
+#include "void_pool.h"
+#include "void_memory.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static uint64_t nanoseconds(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec*1000000000ull+time.tv_nsec;
+}
+
+// The worker must be locked for all of the deque functions
+// count is also read without the lock to skip empty deques, so it is only stored atomically
+
+static void set_count(void_pool_worker *worker, unsigned int count) {
+	__atomic_store_n(&worker->count, count, __ATOMIC_RELAXED);
+}
+
+static int deque_push(void_pool_worker *worker, void_buffer *buffer) {
+	void_pool *pool = worker->pool;
+
+	if (worker->count == pool->depth)
+		return 0;
+
+	void_buffer_move(&worker->tasks[(worker->head+worker->count)%pool->depth], buffer);
+	set_count(worker, worker->count+1);
+	return 1;
+}
+
+static int deque_pop(void_pool_worker *worker, void_buffer *buffer) {
+	if (worker->count == 0)
+		return 0;
+
+	void_buffer_move(buffer, &worker->tasks[worker->head]);
+	worker->head = (worker->head+1)%worker->pool->depth;
+	set_count(worker, worker->count-1);
+	return 1;
+}
+
+// Moves up to half of the victim's tasks from the back of its deque to the back of the thief's
+// Both workers must be locked
+static unsigned int deque_steal(void_pool_worker *thief, void_pool_worker *victim) {
+	unsigned int depth = thief->pool->depth;
+	unsigned int take = (victim->count+1)/2;
+
+	if (take > depth-thief->count)
+		take = depth-thief->count;
+
+	// Oldest of the stolen tasks first, so they keep their order
+	unsigned int first = victim->count-take;
+	unsigned int i;
+	for (i=0; i<take; i++) {
+		void_buffer *slot = &victim->tasks[(victim->head+first+i)%depth];
+		void_buffer_move(&thief->tasks[(thief->head+thief->count+i)%depth], slot);
+	}
+
+	set_count(thief, thief->count+take);
+	set_count(victim, victim->count-take);
+	return take;
+}
+
+// Takes the next task for a worker, from its own deque or stolen from another
+static int next_task(void_pool_worker *worker, void_buffer *task) {
+	void_pool *pool = worker->pool;
+
+	pthread_mutex_lock(&worker->lock);
+	int found = deque_pop(worker, task);
+	pthread_mutex_unlock(&worker->lock);
+
+	if (found)
+		return 1;
+
+	unsigned int i;
+	for (i=1; i<pool->size; i++) {
+		void_pool_worker *victim = &pool->workers[(worker->index+i)%pool->size];
+
+		if (__atomic_load_n(&victim->count, __ATOMIC_RELAXED) == 0)
+			continue;
+
+		// Lock in index order so two thieves robbing each other do not deadlock
+		void_pool_worker *first = worker < victim ? worker : victim;
+		void_pool_worker *second = worker < victim ? victim : worker;
+		pthread_mutex_lock(&first->lock);
+		pthread_mutex_lock(&second->lock);
+
+		unsigned int taken = deque_steal(worker, victim);
+		found = deque_pop(worker, task);
+
+		pthread_mutex_unlock(&second->lock);
+		pthread_mutex_unlock(&first->lock);
+
+		if (taken)
+			__atomic_add_fetch(&worker->stolen, taken, __ATOMIC_RELAXED);
+
+		if (found)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void task_taken(void_pool *pool, const void_buffer *task) {
+	void_memory_dequeued(task->length);
+	__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+
+	// Pairs with the submitWaiting increment in void_pool_submit
+	if (__atomic_load_n(&pool->submitWaiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->spaceCond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+static void *worker_main(void *arg) {
+	void_pool_worker *worker = arg;
+	void_pool *pool = worker->pool;
+
+	int failed = pool->callbacks.init(worker);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->started++;
+	if (failed)
+		pool->startFailed = 1;
+	pthread_cond_broadcast(&pool->startCond);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (failed) {
+		pool->callbacks.finish(worker);
+		return 0;
+	}
+
+	void_buffer task;
+	void_buffer_init(&task);
+
+	for (;;) {
+		if (next_task(worker, &task)) {
+			task_taken(pool, &task);
+
+			uint64_t start = nanoseconds();
+			pool->callbacks.run(worker, &task);
+			__atomic_add_fetch(&worker->busyNanos, nanoseconds()-start, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&worker->executed, 1, __ATOMIC_RELAXED);
+
+			void_buffer_invalidate(&task);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		// Pairs with the pending increment in void_pool_submit
+		__atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+
+		while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0 && !pool->stopping) {
+			pthread_cond_wait(&pool->workCond, &pool->lock);
+		}
+
+		__atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+		int stop = pool->stopping && __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (stop)
+			break;
+	}
+
+	pool->callbacks.finish(worker);
+	return 0;
+}
+
+// Stops and joins the first count workers and frees the pool's memory
+static void pool_shutdown(void_pool *pool, unsigned int count) {
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->workCond);
+	pthread_cond_broadcast(&pool->spaceCond);
+	pthread_mutex_unlock(&pool->lock);
+
+	unsigned int i;
+	for (i=0; i<count; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+
+	for (i=0; i<pool->size; i++) {
+		void_pool_worker *worker = &pool->workers[i];
+		void_buffer task;
+		void_buffer_init(&task);
+
+		// Only left over if the worker never started
+		while (deque_pop(worker, &task)) {
+			task_taken(pool, &task);
+			void_buffer_invalidate(&task);
+		}
+
+		free(worker->tasks);
+		pthread_mutex_destroy(&worker->lock);
+	}
+
+	free(pool->workers);
+	pool->workers = 0;
+
+	pthread_cond_destroy(&pool->workCond);
+	pthread_cond_destroy(&pool->spaceCond);
+	pthread_cond_destroy(&pool->startCond);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+int void_pool_init(void_pool *pool, unsigned int size, unsigned int depth, const void_pool_callbacks *callbacks, void *userdata) {
+	memset(pool, 0, sizeof(void_pool));
+	pool->size = size;
+	pool->depth = depth;
+	pool->callbacks = *callbacks;
+	pool->userdata = userdata;
+
+	pool->workers = malloc(sizeof(void_pool_worker)*size);
+
+	if (!pool->workers)
+		return VOID_ENOMEM;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->workCond, NULL);
+	pthread_cond_init(&pool->spaceCond, NULL);
+	pthread_cond_init(&pool->startCond, NULL);
+
+	unsigned int i;
+	int err = VOID_SUCCESS;
+
+	for (i=0; i<size; i++) {
+		void_pool_worker *worker = &pool->workers[i];
+		memset(worker, 0, sizeof(void_pool_worker));
+		pthread_mutex_init(&worker->lock, NULL);
+		worker->pool = pool;
+		worker->index = i;
+		worker->tasks = malloc(sizeof(void_buffer)*depth);
+
+		if (!worker->tasks) {
+			err = VOID_ENOMEM;
+		} else {
+			unsigned int j;
+			for (j=0; j<depth; j++) {
+				void_buffer_init(&worker->tasks[j]);
+			}
+		}
+	}
+
+	unsigned int created = 0;
+
+	if (err == VOID_SUCCESS) {
+		for (; created<size; created++) {
+			if (pthread_create(&pool->workers[created].thread, NULL, worker_main, &pool->workers[created]) != 0) {
+				err = VOID_ENOMEM;
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->started < created) {
+		pthread_cond_wait(&pool->startCond, &pool->lock);
+	}
+	if (err == VOID_SUCCESS && pool->startFailed)
+		err = VOID_EWRONGTYPE;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (err != VOID_SUCCESS)
+		pool_shutdown(pool, created);
+
+	return err;
+}
+
+void void_pool_destroy(void_pool *pool) {
+	if (pool->workers)
+		pool_shutdown(pool, pool->size);
+}
+
+// Tries every worker once, starting with the next one in turn
+static int try_submit(void_pool *pool, void_buffer *buffer) {
+	unsigned int start = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+	size_t length = buffer->length;
+	unsigned int i;
+
+	for (i=0; i<pool->size; i++) {
+		void_pool_worker *worker = &pool->workers[(start+i)%pool->size];
+
+		pthread_mutex_lock(&worker->lock);
+		int pushed = deque_push(worker, buffer);
+
+		// Counted before the unlock, as the task can be popped or stolen as soon as the lock is free
+		// and task_taken's decrement must not run first
+		if (pushed) {
+			void_memory_enqueued(length);
+			__atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+		}
+
+		pthread_mutex_unlock(&worker->lock);
+
+		if (pushed) {
+			// Pairs with the sleeping increment in worker_main
+			if (__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST)) {
+				pthread_mutex_lock(&pool->lock);
+				pthread_cond_signal(&pool->workCond);
+				pthread_mutex_unlock(&pool->lock);
+			}
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int void_pool_submit(void_pool *pool, void_buffer *buffer, int block) {
+	if (buffer->type != NORMAL || __atomic_load_n(&pool->stopping, __ATOMIC_RELAXED))
+		return VOID_EWRONGTYPE;
+
+	for (;;) {
+		if (try_submit(pool, buffer))
+			return 1;
+
+		if (!block)
+			return 0;
+
+		pthread_mutex_lock(&pool->lock);
+		__atomic_add_fetch(&pool->submitWaiting, 1, __ATOMIC_SEQ_CST);
+
+		// A worker taking a task after this check will see submitWaiting and wake us
+		if (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) >= pool->size*pool->depth && !pool->stopping) {
+			pthread_cond_wait(&pool->spaceCond, &pool->lock);
+		}
+
+		__atomic_sub_fetch(&pool->submitWaiting, 1, __ATOMIC_SEQ_CST);
+		int stopping = pool->stopping;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (stopping)
+			return VOID_EWRONGTYPE;
+	}
+}
+
+unsigned int void_pool_pending(void_pool *pool) {
+	return __atomic_load_n(&pool->pending, __ATOMIC_RELAXED);
+}
+
+unsigned int void_pool_worker_queued(void_pool_worker *worker) {
+	return __atomic_load_n(&worker->count, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,87 @@
+#ifndef VOID_POOL
+#define VOID_POOL
+
+#include "thread_compat.h"
+#include "void_buffer.h"
+
+#include <stdint.h>
+
+typedef struct void_pool void_pool;
+typedef struct void_pool_worker void_pool_worker;
+typedef struct void_pool_callbacks void_pool_callbacks;
+
+// What a pool's threads do, called on the worker's own thread
+struct void_pool_callbacks {
+	// Called once when the worker starts, returns non zero if the worker could not be set up
+	int (*init)(void_pool_worker *worker);
+	// Runs a task, the callback owns the buffer and has to invalidate or move it
+	void (*run)(void_pool_worker *worker, void_buffer *task);
+	// Called once before the worker exits, also after a failed init
+	void (*finish)(void_pool_worker *worker);
+};
+
+// A worker thread and its deque of tasks
+// The owner takes tasks from the front, idle workers steal half of the back
+struct void_pool_worker {
+	pthread_mutex_t lock;
+	void_pool *pool;
+	unsigned int index;
+	pthread_t thread;
+	// Circular buffer of depth slots
+	void_buffer *tasks;
+	unsigned int head;
+	unsigned int count;
+	// Stats, updated atomically
+	uint64_t executed;
+	uint64_t stolen;
+	uint64_t errors;
+	uint64_t busyNanos;
+	void *userdata;
+	// Keeps workers that sit next to each other in the array off each other's cache lines
+	char pad[64];
+};
+
+struct void_pool {
+	pthread_mutex_t lock;
+	// Idle workers wait for tasks here
+	pthread_cond_t workCond;
+	// Blocked submitters wait for free slots here
+	pthread_cond_t spaceCond;
+	// void_pool_init waits for the workers to start here
+	pthread_cond_t startCond;
+	unsigned int size;
+	unsigned int depth;
+	// Tasks waiting in all deques
+	unsigned int pending;
+	// Worker the next submit tries first
+	unsigned int next;
+	int sleeping;
+	int submitWaiting;
+	int stopping;
+	unsigned int started;
+	int startFailed;
+	void_pool_callbacks callbacks;
+	void_pool_worker *workers;
+	void *userdata;
+};
+
+// Starts size worker threads, each with a deque of depth tasks
+// Returns once every worker ran its init callback
+// Returns VOID_ENOMEM if memory or threads ran out and VOID_EWRONGTYPE if an init callback failed,
+// in both cases every started worker has already been stopped
+int void_pool_init(void_pool *pool, unsigned int size, unsigned int depth, const void_pool_callbacks *callbacks, void *userdata);
+// Waits for the queued tasks to finish and stops the workers
+void void_pool_destroy(void_pool *pool);
+
+// Moves the buffer into the deque of a worker with room and invalidates the buffer
+// Returns 1 if submitted, and 0 if every deque is full and not blocking
+// Errors:
+	// VOID_EWRONGTYPE - Buffer is not a normal buffer or the pool is stopping
+int void_pool_submit(void_pool *pool, void_buffer *buffer, int block);
+
+// Tasks waiting in all deques
+unsigned int void_pool_pending(void_pool *pool);
+// Tasks waiting in a worker's deque
+unsigned int void_pool_worker_queued(void_pool_worker *worker);
+
+#endif
@@ -1,4 +1,6 @@
 #include "void_queue.h"
+#include "void_memory.h"
+#include "void_trace.h"
 
 #include <malloc.h>
 #include <string.h>
@@ -10,11 +12,152 @@ static pthread_mutex_t gql_lock = PTHREAD_MUTEX_INITIALIZER;
 static void_queue **gql = 0;
 static unsigned int gql_count = 0;
 
+// Process wide limit on queued bytes
+static size_t budget = 0;
+
+// How long a producer sleeps before rechecking the process wide budget
+// Space freed in another queue does not signal this queue's condition
+#define BUDGET_RECHECK_MS 10
+
+#define DEFAULT_SEGMENT_SIZE 64
+
+// Fills out the absolute time timeout milliseconds from now
+static void deadline(struct timespec *time, int64_t timeout) {
+	clock_gettime(CLOCK_REALTIME, time);
+	time->tv_sec += timeout / 1000;
+	time->tv_nsec += (timeout % 1000) * 1000000;
+	if (time->tv_nsec >= 1000000000) {
+		time->tv_sec++;
+		time->tv_nsec -= 1000000000;
+	}
+}
+
+static void_queue_segment *segment_new(unsigned int segmentSize) {
+	void_queue_segment *segment = malloc(sizeof(void_queue_segment)+sizeof(void_buffer)*segmentSize);
+
+	if (!segment)
+		return 0;
+
+	segment->next = 0;
+	segment->readIndex = 0;
+	segment->writeIndex = 0;
+
+	int i;
+	for (i=0; i<segmentSize; i++) {
+		void_buffer_init(&segment->buffers[i]);
+	}
+
+	return segment;
+}
+
+static void segment_free(void_queue_segment *segment) {
+	unsigned int i;
+	for (i = segment->readIndex; i < segment->writeIndex; i++) {
+		void_buffer *buffer = &segment->buffers[i];
+		if (buffer->type != INVALID)
+			void_memory_dequeued(buffer->length);
+		void_buffer_invalidate(buffer);
+	}
+
+	free(segment);
+}
+
+// Stream mode
+// Every record starts with a header and is padded to STREAM_ALIGN bytes
+// The low bits of the stride hold the state of the record
+#define STREAM_ALIGN 8
+#define STREAM_STATE_MASK (STREAM_ALIGN-1)
+
+enum stream_state {
+	// Being written by a producer
+	STREAM_RESERVED = 1,
+	// Waiting for a consumer
+	STREAM_COMMITTED,
+	// Being read by a consumer
+	STREAM_READING,
+	// Its space can be reused
+	STREAM_RELEASED,
+	// Padding up to the end of the ring, a record that did not fit there starts over at 0
+	STREAM_SKIP
+};
+
+typedef struct stream_header stream_header;
+
+struct stream_header {
+	// Bytes from this header to the next one, with the state in the low bits
+	uint32_t stride;
+	uint32_t length;
+};
+
+static void_buffer_shared *stream_new(size_t size) {
+	void_buffer ring;
+	void_buffer_init(&ring);
+
+	if (void_buffer_allocate(&ring, size, VOID_ALLOC_PREFAULT) != VOID_SUCCESS)
+		return 0;
+
+	void_buffer_shared *stream = void_buffer_share(&ring);
+
+	if (stream)
+		void_buffer_shared_retain(stream);
+
+	void_buffer_invalidate(&ring);
+	return stream;
+}
+
+static void_buffer *segment_write_slot(void_queue *queue);
+
+// Enqueues a buffer left in the journal, replayed buffers do not count against the size of the queue
+static int replay(void *context, const void *data, size_t length) {
+	void_queue *queue = context;
+	void_buffer buffer;
+	void_buffer_init(&buffer);
+
+	if (void_buffer_allocate(&buffer, length, 0) != VOID_SUCCESS)
+		return VOID_ENOMEM;
+
+	memcpy(void_buffer_data(&buffer), data, length);
+
+	void_buffer *slot = segment_write_slot(queue);
+	if (!slot) {
+		void_buffer_invalidate(&buffer);
+		return VOID_ENOMEM;
+	}
+
+	queue->count++;
+	queue->bytes += length;
+	void_memory_enqueued(length);
+	void_buffer_move(slot, &buffer);
+	return VOID_SUCCESS;
+}
+
+static void free_segments(void_queue *queue) {
+	while (queue->head) {
+		void_queue_segment *next = queue->head->next;
+		segment_free(queue->head);
+		queue->head = next;
+	}
+	free(queue->spare);
+}
+
 int void_queue_init(void_queue *queue, unsigned int size, const char *name) {
+	return void_queue_init_options(queue, size, name, NULL);
+}
+
+int void_queue_init_options(void_queue *queue, unsigned int size, const char *name, const void_queue_options *options) {
 	memset(queue, 0, sizeof(void_queue));
 
 	queue->refcount = 1;
 
+	if (options) {
+		queue->mode = options->mode;
+		queue->maxBytes = options->maxBytes;
+		queue->segmentSize = options->segmentSize;
+	}
+
+	if (!queue->segmentSize)
+		queue->segmentSize = DEFAULT_SEGMENT_SIZE;
+
 	if (pthread_mutex_init(&queue->lock, 0)) {
 		fprintf(stderr, "Could not initialize mutex\n");
 		return 0;
@@ -27,16 +170,58 @@ int void_queue_init(void_queue *queue, unsigned int size, const char *name) {
 	}
 
 	queue->size = size;
-	queue->buffers = malloc(sizeof(void_buffer)*size);
 
-	if (!queue->buffers) {
-		fprintf(stderr, "Could not initialize buffer of buffers\n");
+	if (options && options->journal && queue->mode != VOID_QUEUE_GROWABLE) {
+		fprintf(stderr, "Only growable queues can be journaled\n");
 		pthread_mutex_destroy(&queue->lock);
 		pthread_cond_destroy(&queue->cond);
 		return 0;
 	}
 
-	{
+	if (queue->mode == VOID_QUEUE_GROWABLE) {
+		queue->head = queue->tail = segment_new(queue->segmentSize);
+
+		if (!queue->head) {
+			fprintf(stderr, "Could not initialize queue segment\n");
+			pthread_mutex_destroy(&queue->lock);
+			pthread_cond_destroy(&queue->cond);
+			return 0;
+		}
+	} else if (queue->mode == VOID_QUEUE_STREAM) {
+		// Records are aligned, so the ring is too
+		queue->size = size = (size < 2*STREAM_ALIGN ? 2*STREAM_ALIGN : size+STREAM_ALIGN-1) & ~(STREAM_ALIGN-1);
+		queue->stream = stream_new(size);
+
+		if (!queue->stream) {
+			fprintf(stderr, "Could not initialize stream\n");
+			pthread_mutex_destroy(&queue->lock);
+			pthread_cond_destroy(&queue->cond);
+			return 0;
+		}
+	} else {
+		if (queue->mode == VOID_QUEUE_SPSC) {
+			void *spsc;
+			if (!size || posix_memalign(&spsc, VOID_CACHE_LINE, sizeof(void_queue_spsc))) {
+				fprintf(stderr, "Could not initialize queue indices\n");
+				pthread_mutex_destroy(&queue->lock);
+				pthread_cond_destroy(&queue->cond);
+				return 0;
+			}
+
+			memset(spsc, 0, sizeof(void_queue_spsc));
+			queue->spsc = spsc;
+		}
+
+		queue->buffers = malloc(sizeof(void_buffer)*size);
+
+		if (!queue->buffers) {
+			fprintf(stderr, "Could not initialize buffer of buffers\n");
+			pthread_mutex_destroy(&queue->lock);
+			pthread_cond_destroy(&queue->cond);
+			free(queue->spsc);
+			return 0;
+		}
+
 		int i;
 		for (i=0; i<size; i++) {
 			void_buffer_init(&queue->buffers[i]);
@@ -54,12 +239,33 @@ int void_queue_init(void_queue *queue, unsigned int size, const char *name) {
 		pthread_mutex_destroy(&queue->lock);
 		pthread_cond_destroy(&queue->cond);
 		free(queue->buffers);
+		free(queue->head);
+		free(queue->spsc);
+		if (queue->stream)
+			void_buffer_shared_release(queue->stream);
 		return 0;
 	}
 
 	memcpy(copy, name, len+1);
 	queue->name = copy;
 
+	if (options && options->journal) {
+		queue->journal = malloc(sizeof(void_journal));
+
+		if (!queue->journal || void_journal_open(queue->journal, options->journal, options->syncInterval,
+			options->journalSegmentBytes, replay, queue) != VOID_SUCCESS) {
+			int error = errno;
+			fprintf(stderr, "Could not open queue journal %s: %s\n", options->journal, strerror(error));
+			pthread_mutex_destroy(&queue->lock);
+			pthread_cond_destroy(&queue->cond);
+			free_segments(queue);
+			free(queue->journal);
+			free(copy);
+			errno = error;
+			return 0;
+		}
+	}
+
 	pthread_mutex_lock(&gql_lock);
 
 	if (!gql) {
@@ -81,7 +287,7 @@ int void_queue_init(void_queue *queue, unsigned int size, const char *name) {
 	}
 
 	if (!found) {
-		gql = realloc(gql, sizeof(void_queue*)*gql_count);
+		gql = realloc(gql, sizeof(void_queue*)*gql_count*2);
 		if (!gql) abort();
 		memset(gql+gql_count, 0, sizeof(void_queue*)*gql_count);
 		gql[gql_count] = queue;
@@ -110,16 +316,37 @@ int void_queue_destroy(void_queue *queue) {
 		}
 		pthread_mutex_unlock(&gql_lock);
 
-		int i;
-		for (i = 0; i < queue->size; i++) {
-			void_buffer *buffer = &queue->buffers[i];
-			void_buffer_invalidate(buffer);
+		if (queue->wheel) {
+			void_wheel_destroy(queue->wheel);
+			free(queue->wheel);
+		}
+
+		if (queue->journal) {
+			// The buffers still in the queue stay in the journal
+			void_journal_close(queue->journal);
+			free(queue->journal);
+		}
+
+		if (queue->mode == VOID_QUEUE_GROWABLE) {
+			free_segments(queue);
+		} else if (queue->mode == VOID_QUEUE_STREAM) {
+			// Views handed out keep the ring alive
+			void_buffer_shared_release(queue->stream);
+		} else {
+			int i;
+			for (i = 0; i < queue->size; i++) {
+				void_buffer *buffer = &queue->buffers[i];
+				if (buffer->type != INVALID)
+					void_memory_dequeued(buffer->length);
+				void_buffer_invalidate(buffer);
+			}
 		}
 
 		pthread_mutex_unlock(&queue->lock);
 		pthread_mutex_destroy(&queue->lock);
 		pthread_cond_destroy(&queue->cond);
 		free(queue->buffers);
+		free(queue->spsc);
 		free(queue->name);
 		return 1;
 	} else {
@@ -128,33 +355,200 @@ int void_queue_destroy(void_queue *queue) {
 	}
 }
 
+int void_queue_lockfree(const void_queue *queue) {
+	return queue->mode == VOID_QUEUE_SPSC;
+}
+
+static void deliver_due(void_queue *queue);
+
+unsigned int void_queue_count(void_queue *queue) {
+	if (queue->mode == VOID_QUEUE_SPSC) {
+		uint64_t head = __atomic_load_n(&queue->spsc->head, __ATOMIC_ACQUIRE);
+		uint64_t tail = __atomic_load_n(&queue->spsc->tail, __ATOMIC_ACQUIRE);
+		return tail-head;
+	}
+
+	deliver_due(queue);
+	return queue->count;
+}
+
 static int is_empty(void_queue *queue) {
 	return queue->count == 0;
 }
 
 static int is_full(void_queue *queue) {
+	if (queue->mode == VOID_QUEUE_GROWABLE)
+		return queue->size && queue->count >= queue->size;
+
 	return queue->count >= queue->size;
 }
 
-static int push(void_queue *queue, void_buffer *buffer) {
-	if (is_full(queue))
+static int over_budget(size_t length) {
+	size_t limit = __atomic_load_n(&budget, __ATOMIC_RELAXED);
+
+	if (!limit)
 		return 0;
 
+	size_t queued = void_memory_queued();
+	return queued && queued+length > limit;
+}
+
+static int over_limit(void_queue *queue, size_t length) {
+	return queue->maxBytes && queue->count && queue->bytes+length > queue->maxBytes;
+}
+
+static int stream_fits(void_queue *queue, size_t length);
+
+int void_queue_full(void_queue *queue, size_t length) {
+	if (queue->mode == VOID_QUEUE_STREAM)
+		return !stream_fits(queue, length);
+
+	return is_full(queue) || over_limit(queue, length) || over_budget(length);
+}
+
+void void_queue_set_budget(size_t bytes) {
+	__atomic_store_n(&budget, bytes, __ATOMIC_RELAXED);
+}
+
+size_t void_queue_get_budget(void) {
+	return __atomic_load_n(&budget, __ATOMIC_RELAXED);
+}
+
+// Returns the slot the next buffer is written to, or null if no segment could be allocated
+static void_buffer *segment_write_slot(void_queue *queue) {
+	void_queue_segment *tail = queue->tail;
+
+	if (tail->writeIndex == queue->segmentSize) {
+		void_queue_segment *segment = queue->spare;
+
+		if (segment) {
+			queue->spare = 0;
+			segment->next = 0;
+			segment->readIndex = 0;
+			segment->writeIndex = 0;
+		} else {
+			segment = segment_new(queue->segmentSize);
+			if (!segment)
+				return 0;
+		}
+
+		tail->next = segment;
+		queue->tail = tail = segment;
+	}
+
+	return &tail->buffers[tail->writeIndex++];
+}
+
+// Returns the slot the next buffer is read from
+// Drained segments are recycled once reading moves past them
+static void_buffer *segment_read_slot(void_queue *queue) {
+	void_queue_segment *head = queue->head;
+
+	if (head->readIndex == queue->segmentSize) {
+		queue->head = head->next;
+
+		if (queue->spare)
+			free(head);
+		else
+			queue->spare = head;
+
+		head = queue->head;
+	}
+
+	void_buffer *slot = &head->buffers[head->readIndex++];
+
+	if (head->readIndex == head->writeIndex && head == queue->tail) {
+		// Drained the last segment, start it over
+		head->readIndex = head->writeIndex = 0;
+	}
+
+	return slot;
+}
+
+// Moves the buffer into the next slot, a ring must have a free slot
+// Returns the journal sequence number of the buffer through sequence for journaled queues
+static int store(void_queue *queue, void_buffer *buffer, uint64_t *sequence) {
+	void_buffer *slot;
+	if (queue->mode == VOID_QUEUE_GROWABLE) {
+		slot = segment_write_slot(queue);
+		if (!slot)
+			return 0;
+
+		if (queue->journal && void_journal_append(queue->journal, void_buffer_data(buffer), buffer->length, sequence) != VOID_SUCCESS) {
+			// Give the slot back
+			queue->tail->writeIndex--;
+			return VOID_EIO;
+		}
+	} else {
+		slot = &queue->buffers[queue->writeIndex];
+		queue->writeIndex = (queue->writeIndex+1)%queue->size;
+	}
+
 	queue->count++;
-	void_buffer_move(&queue->buffers[queue->writeIndex], buffer);
-	queue->writeIndex = (queue->writeIndex+1)%queue->size;
+	queue->bytes += buffer->length;
+	void_memory_enqueued(buffer->length);
+	void_buffer_move(slot, buffer);
 	return 1;
 }
 
-static int pop(void_queue *queue, void_buffer *buffer) {
+static int push(void_queue *queue, void_buffer *buffer, uint64_t *sequence) {
+	if (void_queue_full(queue, buffer->length))
+		return 0;
+
+	return store(queue, buffer, sequence);
+}
+
+// Moves the delayed buffers that are due into the queue, the queue is locked
+// Due buffers were accepted when they were enqueued, so the limits do not hold them back,
+// only a ring without a free slot does
+static void deliver_due(void_queue *queue) {
+	if (!queue->wheel)
+		return;
+
+	void_wheel_advance(queue->wheel, void_wheel_clock());
+
+	void_buffer *due;
+	while ((due = void_wheel_due(queue->wheel))) {
+		uint64_t sequence;
+
+		if (queue->mode == VOID_QUEUE_RING && queue->count >= queue->size)
+			break;
+
+		if (store(queue, due, &sequence) != 1)
+			break;
+
+		void_wheel_drop_due(queue->wheel);
+	}
+}
+
+static int before(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static int pop(void_queue *queue, void_buffer *buffer, uint64_t *sequence) {
 	if (is_empty(queue)) {
 		void_buffer_invalidate(buffer);
 		return 0;
 	}
 
+	if (queue->journal) {
+		uint64_t popped = void_journal_dequeued(queue->journal);
+		if (sequence)
+			*sequence = popped;
+	}
+
+	void_buffer *slot;
+	if (queue->mode == VOID_QUEUE_GROWABLE) {
+		slot = segment_read_slot(queue);
+	} else {
+		slot = &queue->buffers[queue->readIndex];
+		queue->readIndex = (queue->readIndex+1)%queue->size;
+	}
+
 	queue->count--;
-	void_buffer_move(buffer, &queue->buffers[queue->readIndex]);
-	queue->readIndex = (queue->readIndex+1)%queue->size;
+	void_buffer_move(buffer, slot);
+	queue->bytes -= buffer->length;
+	void_memory_dequeued(buffer->length);
     
     pthread_cond_broadcast(&queue->cond);
     
@@ -177,34 +571,495 @@ void_queue *void_queue_get(const char *name) {
 	return 0;
 }
 
-int void_queue_enqueue(void_queue *queue, void_buffer *buffer, int block) {
-	while (block && is_full(queue)) {
-		pthread_cond_wait(&queue->cond, &queue->lock);
+// SPSC mode
+// The producer only writes tail and the consumer only writes head
+// A side that finds the ring full or empty parks on the queue's condition
+// after raising its waiting flag, the other side checks the flag after
+// publishing its index and wakes it up under the lock
+
+static int spsc_full(void_queue *queue, size_t length) {
+	void_queue_spsc *spsc = queue->spsc;
+	uint64_t tail = spsc->tail;
+
+	if (tail-spsc->cachedHead >= queue->size) {
+		spsc->cachedHead = __atomic_load_n(&spsc->head, __ATOMIC_ACQUIRE);
+		if (tail-spsc->cachedHead >= queue->size)
+			return 1;
+	}
+
+	if (queue->maxBytes && tail != spsc->cachedHead) {
+		size_t bytes = __atomic_load_n(&queue->bytes, __ATOMIC_RELAXED);
+		if (bytes+length > queue->maxBytes)
+			return 1;
+	}
+
+	return over_budget(length);
+}
+
+static int spsc_empty(void_queue *queue) {
+	void_queue_spsc *spsc = queue->spsc;
+	uint64_t head = spsc->head;
+
+	if (head == spsc->cachedTail) {
+		spsc->cachedTail = __atomic_load_n(&spsc->tail, __ATOMIC_ACQUIRE);
+		return head == spsc->cachedTail;
+	}
+
+	return 0;
+}
+
+static void spsc_wake(void_queue *queue, int *waiting) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiting, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&queue->lock);
+		pthread_cond_broadcast(&queue->cond);
+		pthread_mutex_unlock(&queue->lock);
+	}
+}
+
+static int spsc_enqueue(void_queue *queue, void_buffer *buffer, int block, uint64_t *blocked) {
+	void_queue_spsc *spsc = queue->spsc;
+	size_t length = buffer->length;
+	uint64_t waitStart = 0;
+
+	while (spsc_full(queue, length)) {
+		if (!block)
+			return 0;
+
+		if (!waitStart)
+			waitStart = void_trace_clock();
+
+		pthread_mutex_lock(&queue->lock);
+		__atomic_store_n(&spsc->producerWaiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (spsc_full(queue, length)) {
+			// Budget space freed by other queues is not signalled, so recheck it
+			struct timespec recheckTime;
+			deadline(&recheckTime, BUDGET_RECHECK_MS);
+			pthread_cond_timedwait(&queue->cond, &queue->lock, &recheckTime);
+		}
+		__atomic_store_n(&spsc->producerWaiting, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&queue->lock);
 	}
 
-	int result = push(queue, buffer);
+	if (waitStart)
+		*blocked = void_trace_clock()-waitStart;
+
+	uint64_t tail = spsc->tail;
+	__atomic_add_fetch(&queue->bytes, length, __ATOMIC_RELAXED);
+	void_memory_enqueued(length);
+	void_buffer_move(&queue->buffers[tail%queue->size], buffer);
+	__atomic_store_n(&spsc->tail, tail+1, __ATOMIC_RELEASE);
+
+	spsc_wake(queue, &spsc->consumerWaiting);
+
+	return 1;
+}
+
+static int spsc_await(void_queue *queue, int64_t timeout, void_buffer *buffer) {
+	void_queue_spsc *spsc = queue->spsc;
+	struct timespec timeoutTime;
+
+	if (timeout > 0)
+		deadline(&timeoutTime, timeout);
+
+	while (spsc_empty(queue)) {
+		if (!timeout) {
+			void_buffer_invalidate(buffer);
+			return 0;
+		}
+
+		int timedOut = 0;
+		pthread_mutex_lock(&queue->lock);
+		__atomic_store_n(&spsc->consumerWaiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (spsc_empty(queue)) {
+			if (timeout > 0) {
+				timedOut = pthread_cond_timedwait(&queue->cond, &queue->lock, &timeoutTime) == ETIMEDOUT;
+			} else {
+				pthread_cond_wait(&queue->cond, &queue->lock);
+			}
+		}
+		__atomic_store_n(&spsc->consumerWaiting, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&queue->lock);
+
+		if (timedOut)
+			timeout = 0;
+	}
+
+	uint64_t head = spsc->head;
+	void_buffer_move(buffer, &queue->buffers[head%queue->size]);
+	__atomic_sub_fetch(&queue->bytes, buffer->length, __ATOMIC_RELAXED);
+	void_memory_dequeued(buffer->length);
+	__atomic_store_n(&spsc->head, head+1, __ATOMIC_RELEASE);
+
+	spsc_wake(queue, &spsc->producerWaiting);
+
+	return 1;
+}
+
+static int stream_enqueue(void_queue *queue, void_buffer *buffer, int block, uint64_t *blocked);
+static int stream_await(void_queue *queue, int64_t timeout, void_buffer *buffer);
+
+static int locked_enqueue(void_queue *queue, void_buffer *buffer, int block, uint64_t *blocked) {
+	// Buffers that are already due go first
+	deliver_due(queue);
+
+	uint64_t waitStart = 0;
+
+	while (block && void_queue_full(queue, buffer->length)) {
+		if (!waitStart)
+			waitStart = void_trace_clock();
+
+		if (is_full(queue) || over_limit(queue, buffer->length)) {
+			pthread_cond_wait(&queue->cond, &queue->lock);
+		} else {
+			// Only the process wide budget is exceeded
+			struct timespec recheckTime;
+			deadline(&recheckTime, BUDGET_RECHECK_MS);
+			pthread_cond_timedwait(&queue->cond, &queue->lock, &recheckTime);
+		}
+	}
+
+	if (waitStart)
+		*blocked = void_trace_clock()-waitStart;
+
+	uint64_t sequence;
+	int result = push(queue, buffer, &sequence);
 	pthread_cond_broadcast(&queue->cond);
+
+	if (result > 0 && queue->journal && queue->journal->syncInterval == VOID_JOURNAL_SYNC_EACH) {
+		// Consumers and other producers keep going while this waits, the producers that
+		// enqueue in the meantime share the next fdatasync
+		pthread_mutex_unlock(&queue->lock);
+		if (void_journal_wait(queue->journal, sequence) != VOID_SUCCESS)
+			result = VOID_ENOTDURABLE;
+		pthread_mutex_lock(&queue->lock);
+	}
+
 	return result;
 }
 
-int void_queue_await(void_queue *queue, int64_t timeout, void_buffer *buffer) {
+int void_queue_enqueue(void_queue *queue, void_buffer *buffer, int block) {
+	// Timestamps are only taken while tracing, or once a producer has to wait
+	uint64_t start = void_trace_enabled() ? void_trace_clock() : 0;
+	size_t length = buffer->length;
+	uint64_t blocked = 0;
+	int result;
+
+	if (queue->mode == VOID_QUEUE_SPSC)
+		result = spsc_enqueue(queue, buffer, block, &blocked);
+	else if (queue->mode == VOID_QUEUE_STREAM)
+		result = stream_enqueue(queue, buffer, block, &blocked);
+	else
+		result = locked_enqueue(queue, buffer, block, &blocked);
+
+	VOID_PROBE3(enqueue, queue->name, length, blocked);
+
+	if (start)
+		void_trace_complete("queue", "enqueue", queue->name, start, "blockedNs", (int64_t)blocked);
+
+	return result;
+}
+
+static int locked_await(void_queue *queue, int64_t timeout, void_buffer *buffer, uint64_t *sequence) {
     struct timespec timeoutTime;
     
     if (timeout > 0) {
-        clock_gettime(CLOCK_REALTIME, &timeoutTime);
-        timeoutTime.tv_sec += timeout / 1000;
-        timeoutTime.tv_nsec += (timeout % 1000) * 1000000;
+        deadline(&timeoutTime, timeout);
     }
+
+	deliver_due(queue);
     
 	while (is_empty(queue) && timeout) {
-        if (timeout > 0) {
-            pthread_cond_timedwait(&queue->cond, &queue->lock, &timeoutTime);
+		uint64_t next = queue->wheel ? void_wheel_next(queue->wheel) : UINT64_MAX;
+
+		if (next != UINT64_MAX) {
+			// Sleep until the next delayed buffer moves, or until the timeout if it comes first
+			struct timespec wakeTime;
+			uint64_t now = void_wheel_clock();
+			deadline(&wakeTime, next > now ? next-now : 0);
+
+			int timesOut = timeout > 0 && before(&timeoutTime, &wakeTime);
+			int result = pthread_cond_timedwait(&queue->cond, &queue->lock, timesOut ? &timeoutTime : &wakeTime);
+
+			deliver_due(queue);
+
+			if (result == ETIMEDOUT && timesOut)
+				break;
+		} else if (timeout > 0) {
+            if (pthread_cond_timedwait(&queue->cond, &queue->lock, &timeoutTime) == ETIMEDOUT)
+                break;
         } else {
             pthread_cond_wait(&queue->cond, &queue->lock);
         }
 	}
 
-	return pop(queue, buffer);
+	return pop(queue, buffer, sequence);
+}
+
+int void_queue_await(void_queue *queue, int64_t timeout, void_buffer *buffer) {
+	return void_queue_await_sequence(queue, timeout, buffer, NULL);
+}
+
+int void_queue_await_sequence(void_queue *queue, int64_t timeout, void_buffer *buffer, uint64_t *sequence) {
+	uint64_t start = void_trace_enabled() ? void_trace_clock() : 0;
+	int result;
+
+	if (queue->mode == VOID_QUEUE_SPSC)
+		result = spsc_await(queue, timeout, buffer);
+	else if (queue->mode == VOID_QUEUE_STREAM)
+		result = stream_await(queue, timeout, buffer);
+	else
+		result = locked_await(queue, timeout, buffer, sequence);
+
+	VOID_PROBE3(await, queue->name, result, result > 0 ? buffer->length : 0);
+
+	// The event spans the wait, until the consumer woke up with a buffer or timed out
+	if (start)
+		void_trace_complete("queue", "await", queue->name, start, "received", result);
+
+	return result;
+}
+
+int void_queue_enqueue_at(void_queue *queue, void_buffer *buffer, uint64_t deadline) {
+	if (queue->mode == VOID_QUEUE_SPSC || queue->mode == VOID_QUEUE_STREAM)
+		return VOID_EWRONGTYPE;
+
+	if (!queue->wheel) {
+		queue->wheel = malloc(sizeof(void_wheel));
+		if (!queue->wheel)
+			return VOID_ENOMEM;
+		void_wheel_init(queue->wheel, void_wheel_clock());
+	}
+
+	if (void_wheel_insert(queue->wheel, buffer, deadline) != VOID_SUCCESS)
+		return VOID_ENOMEM;
+
+	deliver_due(queue);
+
+	// Waiting consumers sleep until the next deadline they know of, this one may be earlier
+	pthread_cond_broadcast(&queue->cond);
+	return 1;
+}
+
+unsigned int void_queue_delayed(void_queue *queue) {
+	return queue->wheel ? queue->wheel->count : 0;
+}
+
+// Stream mode
+// Positions count bytes since the stream was created, the ring offset is the position modulo the size
+// Producers reserve at streamWrite, consumers read at streamRead, and space is given back
+// at streamFree once every record before it was released
+// Records are committed and released in any order, they are read in the order they were reserved
+
+static stream_header *stream_header_at(void_queue *queue, uint64_t position) {
+	return (stream_header*)((char*)queue->stream->data+position%queue->size);
+}
+
+static size_t stream_stride(size_t length) {
+	return (sizeof(stream_header)+length+STREAM_ALIGN-1) & ~(size_t)(STREAM_ALIGN-1);
+}
+
+// Bytes a record of length bytes takes at streamWrite, including the padding up to the end of the ring
+static size_t stream_needs(void_queue *queue, size_t length) {
+	size_t stride = stream_stride(length);
+	size_t offset = queue->streamWrite%queue->size;
+
+	if (offset+stride > queue->size)
+		return queue->size-offset+stride;
+
+	return stride;
+}
+
+static int stream_fits(void_queue *queue, size_t length) {
+	if (stream_stride(length) > queue->size)
+		return 0;
+
+	return queue->streamWrite+stream_needs(queue, length)-queue->streamFree <= queue->size;
+}
+
+// Gives back the space of released records and padding at the front of the stream
+static void stream_reclaim(void_queue *queue) {
+	while (queue->streamFree < queue->streamRead) {
+		stream_header *header = stream_header_at(queue, queue->streamFree);
+		uint32_t state = header->stride & STREAM_STATE_MASK;
+
+		if (state != STREAM_RELEASED && state != STREAM_SKIP)
+			break;
+
+		queue->streamFree += header->stride & ~STREAM_STATE_MASK;
+	}
+
+	queue->bytes = queue->streamWrite-queue->streamFree;
+}
+
+// Returns the header of a record the view points at, or null if it is not a record of this stream in that state
+static stream_header *stream_record(void_queue *queue, void_buffer *view, uint32_t state) {
+	if (view->type != NORMAL || view->normal.shared != queue->stream)
+		return 0;
+
+	size_t offset = (char*)view->normal.data-(char*)queue->stream->data;
+
+	if (offset < sizeof(stream_header) || offset > queue->size || offset%STREAM_ALIGN)
+		return 0;
+
+	stream_header *header = (stream_header*)((char*)view->normal.data-sizeof(stream_header));
+	return (header->stride & STREAM_STATE_MASK) == state ? header : 0;
+}
+
+int void_queue_reserve(void_queue *queue, size_t length, int block, void_buffer *view) {
+	if (stream_stride(length) > queue->size || length > UINT32_MAX)
+		return VOID_EOUTOFRANGE;
+
+	while (!stream_fits(queue, length)) {
+		if (!block)
+			return 0;
+		pthread_cond_wait(&queue->cond, &queue->lock);
+	}
+
+	size_t stride = stream_stride(length);
+	size_t offset = queue->streamWrite%queue->size;
+
+	if (offset+stride > queue->size) {
+		stream_header *skip = stream_header_at(queue, queue->streamWrite);
+		skip->stride = (queue->size-offset) | STREAM_SKIP;
+		queue->streamWrite += queue->size-offset;
+	}
+
+	stream_header *header = stream_header_at(queue, queue->streamWrite);
+	header->stride = stride | STREAM_RESERVED;
+	header->length = length;
+
+	void_buffer_set_window(view, queue->stream, queue->streamWrite%queue->size+sizeof(stream_header), length, 0);
+
+	queue->streamWrite += stride;
+	queue->bytes = queue->streamWrite-queue->streamFree;
+	return 1;
+}
+
+int void_queue_commit(void_queue *queue, void_buffer *view, size_t length) {
+	stream_header *header = stream_record(queue, view, STREAM_RESERVED);
+
+	if (!header)
+		return VOID_EWRONGTYPE;
+
+	if (length > header->length)
+		return VOID_EOUTOFRANGE;
+
+	header->length = length;
+	header->stride = (header->stride & ~STREAM_STATE_MASK) | STREAM_COMMITTED;
+	void_buffer_invalidate(view);
+
+	queue->count++;
+	pthread_cond_broadcast(&queue->cond);
+	return 1;
+}
+
+// Returns the header of the next record if it was committed, skipping padding
+static stream_header *stream_next(void_queue *queue) {
+	while (queue->streamRead < queue->streamWrite) {
+		stream_header *header = stream_header_at(queue, queue->streamRead);
+		uint32_t state = header->stride & STREAM_STATE_MASK;
+
+		if (state == STREAM_SKIP) {
+			queue->streamRead += header->stride & ~STREAM_STATE_MASK;
+			continue;
+		}
+
+		return state == STREAM_COMMITTED ? header : 0;
+	}
+
+	return 0;
+}
+
+int void_queue_read(void_queue *queue, int64_t timeout, void_buffer *view) {
+	struct timespec timeoutTime;
+	stream_header *header;
+
+	if (timeout > 0)
+		deadline(&timeoutTime, timeout);
+
+	while (!(header = stream_next(queue))) {
+		if (!timeout) {
+			void_buffer_invalidate(view);
+			return 0;
+		}
+
+		if (timeout > 0) {
+			if (pthread_cond_timedwait(&queue->cond, &queue->lock, &timeoutTime) == ETIMEDOUT)
+				timeout = 0;
+		} else {
+			pthread_cond_wait(&queue->cond, &queue->lock);
+		}
+	}
+
+	header->stride = (header->stride & ~STREAM_STATE_MASK) | STREAM_READING;
+	void_buffer_set_window(view, queue->stream, queue->streamRead%queue->size+sizeof(stream_header), header->length, VOID_BUFFER_READONLY);
+
+	queue->streamRead += header->stride & ~STREAM_STATE_MASK;
+	queue->count--;
+	return 1;
+}
+
+int void_queue_release(void_queue *queue, void_buffer *view) {
+	stream_header *header = stream_record(queue, view, STREAM_READING);
+
+	if (!header)
+		return VOID_EWRONGTYPE;
+
+	header->stride = (header->stride & ~STREAM_STATE_MASK) | STREAM_RELEASED;
+	void_buffer_invalidate(view);
+
+	stream_reclaim(queue);
+	pthread_cond_broadcast(&queue->cond);
+	return 1;
+}
+
+// void_queue_enqueue and void_queue_await on a stream copy the buffer into and out of a record
+static int stream_enqueue(void_queue *queue, void_buffer *buffer, int block, uint64_t *blocked) {
+	void_buffer view;
+	void_buffer_init(&view);
+
+	// void_queue_reserve waits itself, it only does when the record does not fit yet
+	uint64_t waitStart = block && !stream_fits(queue, buffer->length) ? void_trace_clock() : 0;
+	int result = void_queue_reserve(queue, buffer->length, block, &view);
+
+	if (waitStart)
+		*blocked = void_trace_clock()-waitStart;
+
+	if (result != 1)
+		return result;
+
+	memcpy(void_buffer_data(&view), void_buffer_data(buffer), buffer->length);
+	void_queue_commit(queue, &view, buffer->length);
+	void_buffer_invalidate(buffer);
+	return 1;
+}
+
+static int stream_await(void_queue *queue, int64_t timeout, void_buffer *buffer) {
+	void_buffer view;
+	void_buffer_init(&view);
+
+	if (!void_queue_read(queue, timeout, &view)) {
+		void_buffer_invalidate(buffer);
+		return 0;
+	}
+
+	if (void_buffer_allocate(buffer, view.length, 0) != VOID_SUCCESS) {
+		// Puts the record back, the queue is still locked so it is the last one read
+		stream_header *header = stream_record(queue, &view, STREAM_READING);
+		header->stride = (header->stride & ~STREAM_STATE_MASK) | STREAM_COMMITTED;
+		queue->streamRead -= header->stride & ~STREAM_STATE_MASK;
+		queue->count++;
+		void_buffer_invalidate(&view);
+		return VOID_ENOMEM;
+	}
+
+	memcpy(void_buffer_data(buffer), void_buffer_data(&view), view.length);
+
+	void_queue_release(queue, &view);
+	return 1;
 }
 
 void void_queue_lock(void_queue *queue) {
@@ -3,26 +3,111 @@
 
 #include "thread_compat.h"
 #include "void_buffer.h"
+#include "void_journal.h"
+#include "void_wheel.h"
 
 #include <stdint.h>
 
+// Returned by enqueue when the buffer is in the queue, but syncing the journal failed
+#define VOID_ENOTDURABLE -6
+
 typedef struct void_queue void_queue;
+typedef struct void_queue_options void_queue_options;
+typedef struct void_queue_segment void_queue_segment;
+typedef struct void_queue_spsc void_queue_spsc;
+
+enum void_queue_mode {
+	// Fixed circular buffer of size slots allocated up front
+	VOID_QUEUE_RING,
+	// Linked list of fixed size ring segments allocated on demand
+	// size caps the number of buffers, 0 for no cap
+	VOID_QUEUE_GROWABLE,
+	// Fixed circular buffer for exactly one producer and one consumer thread
+	// Enqueue and await do not lock unless they have to park
+	VOID_QUEUE_SPSC,
+	// One ring of size bytes that records are written into and read from in place
+	// See void_queue_reserve, enqueue and await copy buffers in and out of records
+	VOID_QUEUE_STREAM
+};
+
+struct void_queue_options {
+	int mode;
+	// Maximum number of bytes parked in the queue, 0 for no limit
+	size_t maxBytes;
+	// Number of slots per segment in growable mode, 0 for the default
+	unsigned int segmentSize;
+	// Directory of a journal that keeps the buffers on disk, null for none
+	// Only growable queues can be journaled, the buffers left in the journal are enqueued again on init
+	const char *journal;
+	// How long enqueued buffers may stay only in memory, see void_journal.h
+	int64_t syncInterval;
+	// Bytes per journal segment file, 0 for the default
+	size_t journalSegmentBytes;
+};
+
+// Ring indices for SPSC mode
+// Each side owns a cache line and only reads the other side's index
+// when its cached copy says the ring is full or empty
+// The parking flags get their own line since they are checked on every operation
+struct void_queue_spsc {
+	// Consumer
+	uint64_t head;
+	uint64_t cachedTail;
+	char consumerPad[VOID_CACHE_LINE-2*sizeof(uint64_t)];
+	// Producer
+	uint64_t tail;
+	uint64_t cachedHead;
+	char producerPad[VOID_CACHE_LINE-2*sizeof(uint64_t)];
+	int consumerWaiting;
+	int producerWaiting;
+	char waitingPad[VOID_CACHE_LINE-2*sizeof(int)];
+};
+
+struct void_queue_segment {
+	void_queue_segment *next;
+	unsigned int readIndex;
+	unsigned int writeIndex;
+	void_buffer buffers[];
+};
 
 struct void_queue {
 	pthread_mutex_t lock;
 	pthread_cond_t cond;
 	unsigned int refcount;
+	int mode;
 	// This buffer is a circular buffer
 	// bufferQueueIndex wraps around
 	unsigned int size;
 	unsigned int count;
 	unsigned int readIndex;
 	unsigned int writeIndex;
+	size_t bytes;
+	size_t maxBytes;
 	void_buffer *buffers;
+	// Growable mode
+	unsigned int segmentSize;
+	void_queue_segment *head;
+	void_queue_segment *tail;
+	// A drained segment kept around so a steady backlog does not allocate
+	void_queue_segment *spare;
+	// SPSC mode
+	void_queue_spsc *spsc;
+	// Stream mode
+	// The ring is shared storage so views into it outlive the queue
+	void_buffer_shared *stream;
+	uint64_t streamWrite;
+	uint64_t streamRead;
+	uint64_t streamFree;
+	// Null unless journaled
+	void_journal *journal;
+	// Delayed buffers, allocated by the first void_queue_enqueue_at
+	void_wheel *wheel;
 	char *name;
 };
 
 int void_queue_init(void_queue *queue, unsigned int size, const char *name);
+// Same as void_queue_init, options may be null for the defaults
+int void_queue_init_options(void_queue *queue, unsigned int size, const char *name, const void_queue_options *options);
 int void_queue_destroy(void_queue *queue);
 
 // Locks globally then checks a dynamically allocated list to see
@@ -30,23 +115,86 @@ int void_queue_destroy(void_queue *queue);
 // If a void_queue does not exists, this returns 0
 void_queue *void_queue_get(const char *name);
 
+// Limits the number of bytes parked in all queues of the process, 0 for no limit
+void void_queue_set_budget(size_t bytes);
+size_t void_queue_get_budget(void);
+
+// Returns non zero if the caller does not have to lock the queue around
+// void_queue_enqueue and void_queue_await (SPSC mode)
+int void_queue_lockfree(const void_queue *queue);
+
+// Returns the number of buffers in the queue
+// Locking queues must be locked
+unsigned int void_queue_count(void_queue *queue);
+
+// Returns non zero if a buffer of length bytes does not fit in the queue
+// A queue always accepts a buffer while it is empty, so a single buffer
+// larger than the byte limits cannot wedge it
+// The queue must be locked
+int void_queue_full(void_queue *queue, size_t length);
+
 // This will create a new buffer object to hold this buffer's data
 // and will invalidate the current buffer
 // If not blocking, it returns 1 if the buffer was successfully
 // inserted, and 0 if not
 // If blocking, it will return 1 if successful
+// A queue is full when its slots are used or the byte limits are reached
 // If an error occurs, the return value will be negative
 // Errors:
 	// ENODATA - Buffer has no data attached to it
 	// ENOMEM - Not enough memory
 	// ELOCKFAIL - Lock operation failed
+	// VOID_EIO - The buffer could not be written to the journal, it was not enqueued
+	// VOID_ENOTDURABLE - The buffer was enqueued, but the journal could not be synced
+	// VOID_EOUTOFRANGE - The buffer is larger than a stream queue can ever hold
+// A journaled queue appends the buffer to its journal, and with a syncInterval of 0 unlocks
+// the queue while it waits for the buffer to reach the disk
+// The queue must be locked, unless void_queue_lockfree says otherwise
 int void_queue_enqueue(void_queue *queue, void_buffer *buffer, int block);
 
+// Moves the buffer into the queue's timing wheel, await sees it once deadline passes
+// deadline is in milliseconds of void_wheel_clock
+// Delayed buffers do not count against the limits of the queue, and are only journaled once they are due
+// Returns 1, or a negative value on errors:
+	// VOID_EWRONGTYPE - SPSC and stream queues cannot delay buffers
+	// VOID_ENOMEM - Not enough memory
+// The queue must be locked
+int void_queue_enqueue_at(void_queue *queue, void_buffer *buffer, uint64_t deadline);
+// Returns the number of delayed buffers that are not in the queue yet
+// The queue must be locked
+unsigned int void_queue_delayed(void_queue *queue);
+
 // Waits for a queue to have a buffer available
+// Delayed buffers become available once they are due, the wait wakes up for the next one
 // If timeout milliseconds pass, this method will return null
 // If an error occurs, this method will return null
 // TODO: Maybe better error codes?
+// A stream returns VOID_ENOMEM if the record could not be copied out, it stays in the stream unread
+// The queue must be locked, unless void_queue_lockfree says otherwise
 int void_queue_await(void_queue *queue, int64_t timeout, void_buffer *buffer);
+// Same as void_queue_await, also returns the journal sequence number of the buffer through sequence
+// Pass it to void_journal_ack once the buffer was handled
+int void_queue_await_sequence(void_queue *queue, int64_t timeout, void_buffer *buffer, uint64_t *sequence);
+
+// Stream mode
+// Records are never copied or allocated one by one, views point into the ring
+// Every reserved record has to be committed and every read record released, the stream stalls at one that is not
+// All of these need the queue to be locked
+
+// Reserves a record of length bytes at the end of the stream and points view at it
+// If blocking, waits for space, otherwise returns 0 if the stream is full
+// Returns 1, or VOID_EOUTOFRANGE if the record can never fit in the stream
+int void_queue_reserve(void_queue *queue, size_t length, int block, void_buffer *view);
+// Hands a reserved record to consumers, cut to length bytes, and invalidates the view
+// Returns 1, VOID_EWRONGTYPE if view is not a reserved record of the queue, or VOID_EOUTOFRANGE if length is larger than the record
+int void_queue_commit(void_queue *queue, void_buffer *view, size_t length);
+// Waits for the next record to be committed and points view at it, read only
+// Records are read in the order they were reserved
+// Returns 1, or 0 if timeout milliseconds passed
+int void_queue_read(void_queue *queue, int64_t timeout, void_buffer *view);
+// Gives the space of a read record back and invalidates the view
+// Returns 1, or VOID_EWRONGTYPE if view is not a record of the queue being read
+int void_queue_release(void_queue *queue, void_buffer *view);
 
 void void_queue_lock(void_queue *queue);
 void void_queue_unlock(void_queue *queue);
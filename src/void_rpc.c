@@ -0,0 +1,107 @@
+#include "void_rpc.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct route route;
+
+struct route {
+	void_queue *queue;
+	uint16_t generation;
+};
+
+// Global Route List
+static pthread_mutex_t grl_lock = PTHREAD_MUTEX_INITIALIZER;
+static route *grl = 0;
+static uint32_t grl_count = 0;
+
+int void_rpc_route_add(void_queue *queue, uint32_t *index, uint16_t *generation) {
+	pthread_mutex_lock(&grl_lock);
+
+	uint32_t i;
+	for (i=0; i<grl_count; i++) {
+		if (!grl[i].queue)
+			break;
+	}
+
+	if (i == grl_count) {
+		uint32_t count = grl_count ? grl_count*2 : 16;
+		route *routes = realloc(grl, sizeof(route)*count);
+
+		if (!routes) {
+			pthread_mutex_unlock(&grl_lock);
+			return VOID_ENOMEM;
+		}
+
+		memset(routes+grl_count, 0, sizeof(route)*(count-grl_count));
+		grl = routes;
+		grl_count = count;
+	}
+
+	void_queue_lock(queue);
+	queue->refcount++;
+	void_queue_unlock(queue);
+
+	grl[i].queue = queue;
+	*index = i;
+	*generation = grl[i].generation;
+
+	pthread_mutex_unlock(&grl_lock);
+	return VOID_SUCCESS;
+}
+
+void void_rpc_route_remove(uint32_t index) {
+	pthread_mutex_lock(&grl_lock);
+
+	void_queue *queue = 0;
+	if (index < grl_count) {
+		queue = grl[index].queue;
+		grl[index].queue = 0;
+		grl[index].generation++;
+	}
+
+	pthread_mutex_unlock(&grl_lock);
+
+	if (queue && void_queue_destroy(queue))
+		free(queue);
+}
+
+void_queue *void_rpc_route_get(uint32_t index, uint16_t generation) {
+	pthread_mutex_lock(&grl_lock);
+
+	void_queue *queue = 0;
+	if (index < grl_count && grl[index].generation == generation) {
+		queue = grl[index].queue;
+	}
+
+	if (queue) {
+		void_queue_lock(queue);
+		queue->refcount++;
+		void_queue_unlock(queue);
+	}
+
+	pthread_mutex_unlock(&grl_lock);
+	return queue;
+}
+
+int void_rpc_stamp(void_buffer *buffer, const void_rpc_trailer *trailer) {
+	size_t length = buffer->length;
+	int err = void_buffer_grow(buffer, length+VOID_RPC_TRAILER);
+
+	if (err != VOID_SUCCESS)
+		return err;
+
+	memcpy((char*)buffer->normal.data+length, trailer, VOID_RPC_TRAILER);
+	return VOID_SUCCESS;
+}
+
+int void_rpc_trailer_read(const void_buffer *buffer, void_rpc_trailer *trailer) {
+	const char *data = void_buffer_data(buffer);
+
+	if (!data || buffer->length < VOID_RPC_TRAILER)
+		return 0;
+
+	memcpy(trailer, data+buffer->length-VOID_RPC_TRAILER, VOID_RPC_TRAILER);
+	return trailer->magic == VOID_RPC_MAGIC;
+}
@@ -0,0 +1,39 @@
+#ifndef VOID_RPC
+#define VOID_RPC
+
+#include "void_queue.h"
+
+#include <stdint.h>
+
+// Requests carry a trailer after their payload that says which client and call the reply belongs to
+// The payload keeps starting at offset 0, and a server that answers with the request buffer
+// leaves the trailer in place, so replying does not copy
+#define VOID_RPC_TRAILER 16
+#define VOID_RPC_MAGIC 0x5652
+
+typedef struct void_rpc_trailer void_rpc_trailer;
+
+struct void_rpc_trailer {
+	uint64_t id;
+	// Index into the route table and the generation of that slot, so a reply
+	// to a client that went away is not delivered to the next client in its slot
+	uint32_t route;
+	uint16_t generation;
+	uint16_t magic;
+};
+
+// Registers a client's reply queue, the route table holds a reference to it
+// Returns VOID_SUCCESS or VOID_ENOMEM
+int void_rpc_route_add(void_queue *queue, uint32_t *route, uint16_t *generation);
+// Unregisters a reply queue and drops the route table's reference to it
+void void_rpc_route_remove(uint32_t route);
+// Returns the reply queue of a route with a new reference, or null if the client went away
+// The caller releases the reference with void_queue_destroy
+void_queue *void_rpc_route_get(uint32_t route, uint16_t generation);
+
+// Appends a trailer to the buffer, growing it
+int void_rpc_stamp(void_buffer *buffer, const void_rpc_trailer *trailer);
+// Reads the trailer of a request or reply buffer, returns 0 if it has none
+int void_rpc_trailer_read(const void_buffer *buffer, void_rpc_trailer *trailer);
+
+#endif
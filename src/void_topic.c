@@ -0,0 +1,314 @@
+#include "void_topic.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Global Topic List
+static pthread_mutex_t gtl_lock = PTHREAD_MUTEX_INITIALIZER;
+static void_topic **gtl = 0;
+static unsigned int gtl_count = 0;
+
+int void_topic_init(void_topic *topic, unsigned int size, const char *name, int policy) {
+	memset(topic, 0, sizeof(void_topic));
+
+	topic->refcount = 1;
+	topic->policy = policy;
+
+	if (pthread_mutex_init(&topic->lock, 0)) {
+		fprintf(stderr, "Could not initialize mutex\n");
+		return 0;
+	}
+
+	if (pthread_cond_init(&topic->cond, 0)) {
+		fprintf(stderr, "Could not initialize condition variable\n");
+		pthread_mutex_destroy(&topic->lock);
+		return 0;
+	}
+
+	topic->size = size;
+	topic->ring = calloc(size ? size : 1, sizeof(void_buffer_shared*));
+
+	if (!topic->ring) {
+		fprintf(stderr, "Could not initialize topic ring\n");
+		pthread_mutex_destroy(&topic->lock);
+		pthread_cond_destroy(&topic->cond);
+		return 0;
+	}
+
+	size_t len = strlen(name);
+	char *copy = malloc(len+1);
+
+	if (!copy) {
+		fprintf(stderr, "Could not initialize name copy\n");
+		pthread_mutex_destroy(&topic->lock);
+		pthread_cond_destroy(&topic->cond);
+		free(topic->ring);
+		return 0;
+	}
+
+	memcpy(copy, name, len+1);
+	topic->name = copy;
+
+	pthread_mutex_lock(&gtl_lock);
+
+	if (!gtl) {
+		gtl_count = 4;
+		gtl = malloc(sizeof(void_topic*)*gtl_count);
+		if (!gtl) abort();
+		memset(gtl, 0, sizeof(void_topic*)*gtl_count);
+	}
+
+	// find a spot in the gtl
+	int found = 0;
+	int i;
+	for (i = 0; i < gtl_count; i++) {
+		if (!gtl[i]) {
+			found = 1;
+			gtl[i] = topic;
+			break;
+		}
+	}
+
+	if (!found) {
+		gtl = realloc(gtl, sizeof(void_topic*)*gtl_count*2);
+		if (!gtl) abort();
+		memset(gtl+gtl_count, 0, sizeof(void_topic*)*gtl_count);
+		gtl[gtl_count] = topic;
+		gtl_count *= 2;
+	}
+
+	pthread_mutex_unlock(&gtl_lock);
+
+	return 1;
+}
+
+int void_topic_destroy(void_topic *topic) {
+	pthread_mutex_lock(&topic->lock);
+	topic->refcount--;
+
+	if (topic->refcount == 0) {
+		pthread_mutex_lock(&gtl_lock);
+		if (gtl) {
+			int i;
+			for (i = 0; i < gtl_count; i++) {
+				if (gtl[i] == topic) {
+					gtl[i] = NULL;
+					break;
+				}
+			}
+		}
+		pthread_mutex_unlock(&gtl_lock);
+
+		unsigned int i;
+		for (i = 0; i < topic->size; i++) {
+			if (topic->ring[i])
+				void_buffer_shared_release(topic->ring[i]);
+		}
+
+		pthread_mutex_unlock(&topic->lock);
+		pthread_mutex_destroy(&topic->lock);
+		pthread_cond_destroy(&topic->cond);
+		free(topic->ring);
+		free(topic->name);
+		return 1;
+	} else {
+		pthread_mutex_unlock(&topic->lock);
+		return 0;
+	}
+}
+
+void_topic *void_topic_get(const char *name) {
+	pthread_mutex_lock(&gtl_lock);
+	if (gtl) {
+		int i;
+		for (i = 0; i < gtl_count; i++) {
+			if (gtl[i] && strcmp(gtl[i]->name, name) == 0) {
+				pthread_mutex_unlock(&gtl_lock);
+				return gtl[i];
+			}
+		}
+	}
+	pthread_mutex_unlock(&gtl_lock);
+
+	return 0;
+}
+
+// Sequence number of the oldest message a connected subscriber still has to read
+static uint64_t slowest(void_topic *topic) {
+	uint64_t seq = topic->writeSeq;
+
+	void_topic_subscriber *subscriber;
+	for (subscriber = topic->subscribers; subscriber; subscriber = subscriber->next) {
+		if (subscriber->connected && subscriber->readSeq < seq)
+			seq = subscriber->readSeq;
+	}
+
+	return seq;
+}
+
+// Applies the drop oldest or disconnect policy to subscribers that would be lapped
+static void make_room(void_topic *topic) {
+	uint64_t oldest = topic->writeSeq-topic->size+1;
+
+	void_topic_subscriber *subscriber;
+	for (subscriber = topic->subscribers; subscriber; subscriber = subscriber->next) {
+		if (subscriber->connected && subscriber->readSeq < oldest) {
+			if (topic->policy == VOID_TOPIC_DISCONNECT) {
+				subscriber->connected = 0;
+			} else {
+				subscriber->dropped += oldest-subscriber->readSeq;
+				subscriber->readSeq = oldest;
+			}
+		}
+	}
+}
+
+int void_topic_publish(void_topic *topic, void_buffer *buffer, int block) {
+	if (buffer->type != NORMAL || void_buffer_window(buffer) || !topic->size)
+		return VOID_EWRONGTYPE;
+
+	// Another buffer sharing the storage could still write to the published message
+	void_buffer_shared *storage = buffer->normal.shared;
+	if (storage && __atomic_load_n(&storage->refcount, __ATOMIC_ACQUIRE) > 1)
+		return VOID_EWRONGTYPE;
+
+	pthread_mutex_lock(&topic->lock);
+
+	while (topic->writeSeq-slowest(topic) >= topic->size) {
+		if (topic->policy != VOID_TOPIC_BLOCK) {
+			make_room(topic);
+			// Subscribers that were skipped ahead or disconnected may be waiting
+			pthread_cond_broadcast(&topic->cond);
+			break;
+		}
+
+		if (!block) {
+			pthread_mutex_unlock(&topic->lock);
+			return 0;
+		}
+
+		pthread_cond_wait(&topic->cond, &topic->lock);
+	}
+
+	void_buffer_shared *shared = void_buffer_share(buffer);
+
+	if (!shared) {
+		pthread_mutex_unlock(&topic->lock);
+		return VOID_ENOMEM;
+	}
+
+	// The ring takes the publisher's reference
+	void_buffer_shared_retain(shared);
+	void_buffer_invalidate(buffer);
+
+	unsigned int slot = topic->writeSeq%topic->size;
+	if (topic->ring[slot])
+		void_buffer_shared_release(topic->ring[slot]);
+	topic->ring[slot] = shared;
+	topic->writeSeq++;
+
+	pthread_cond_broadcast(&topic->cond);
+	pthread_mutex_unlock(&topic->lock);
+
+	return 1;
+}
+
+void void_topic_subscribe(void_topic *topic, void_topic_subscriber *subscriber) {
+	pthread_mutex_lock(&topic->lock);
+
+	subscriber->topic = topic;
+	subscriber->readSeq = topic->writeSeq;
+	subscriber->connected = 1;
+	subscriber->dropped = 0;
+
+	subscriber->prev = 0;
+	subscriber->next = topic->subscribers;
+	if (topic->subscribers)
+		topic->subscribers->prev = subscriber;
+	topic->subscribers = subscriber;
+
+	topic->refcount++;
+
+	pthread_mutex_unlock(&topic->lock);
+}
+
+int void_topic_unsubscribe(void_topic_subscriber *subscriber) {
+	void_topic *topic = subscriber->topic;
+
+	if (!topic)
+		return 0;
+
+	pthread_mutex_lock(&topic->lock);
+
+	if (subscriber->prev)
+		subscriber->prev->next = subscriber->next;
+	else
+		topic->subscribers = subscriber->next;
+	if (subscriber->next)
+		subscriber->next->prev = subscriber->prev;
+
+	subscriber->topic = 0;
+	subscriber->connected = 0;
+
+	// A publisher may be waiting on this subscriber
+	pthread_cond_broadcast(&topic->cond);
+	pthread_mutex_unlock(&topic->lock);
+
+	return void_topic_destroy(topic);
+}
+
+int void_topic_receive(void_topic_subscriber *subscriber, int64_t timeout, void_buffer *buffer) {
+	void_topic *topic = subscriber->topic;
+
+	if (!topic) {
+		void_buffer_invalidate(buffer);
+		return VOID_EDISCONNECTED;
+	}
+
+	struct timespec timeoutTime;
+
+	if (timeout > 0) {
+		clock_gettime(CLOCK_REALTIME, &timeoutTime);
+		timeoutTime.tv_sec += timeout / 1000;
+		timeoutTime.tv_nsec += (timeout % 1000) * 1000000;
+		if (timeoutTime.tv_nsec >= 1000000000) {
+			timeoutTime.tv_sec++;
+			timeoutTime.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&topic->lock);
+
+	while (subscriber->connected && subscriber->readSeq == topic->writeSeq && timeout) {
+		if (timeout > 0) {
+			if (pthread_cond_timedwait(&topic->cond, &topic->lock, &timeoutTime) == ETIMEDOUT)
+				break;
+		} else {
+			pthread_cond_wait(&topic->cond, &topic->lock);
+		}
+	}
+
+	if (!subscriber->connected) {
+		pthread_mutex_unlock(&topic->lock);
+		void_buffer_invalidate(buffer);
+		return VOID_EDISCONNECTED;
+	}
+
+	if (subscriber->readSeq == topic->writeSeq) {
+		pthread_mutex_unlock(&topic->lock);
+		void_buffer_invalidate(buffer);
+		return 0;
+	}
+
+	void_buffer_shared *shared = topic->ring[subscriber->readSeq%topic->size];
+	void_buffer_set_shared(buffer, shared, VOID_BUFFER_READONLY);
+	subscriber->readSeq++;
+
+	// A publisher may be waiting on this subscriber
+	pthread_cond_broadcast(&topic->cond);
+	pthread_mutex_unlock(&topic->lock);
+
+	return 1;
+}
@@ -0,0 +1,80 @@
+#ifndef VOID_TOPIC
+#define VOID_TOPIC
+
+#include "thread_compat.h"
+#include "void_buffer.h"
+
+#include <stdint.h>
+
+#define VOID_EDISCONNECTED -5
+
+typedef struct void_topic void_topic;
+typedef struct void_topic_subscriber void_topic_subscriber;
+
+// What publish does when the ring is full because a subscriber lags behind
+enum void_topic_policy {
+	// Wait for the slowest subscriber (or fail when not blocking)
+	VOID_TOPIC_BLOCK,
+	// Skip the slowest subscribers ahead, they lose the oldest messages
+	VOID_TOPIC_DROP_OLDEST,
+	// Disconnect the slowest subscribers
+	VOID_TOPIC_DISCONNECT
+};
+
+// A broadcast ring
+// Every published buffer is moved into shared, read only storage once
+// and each subscriber reads it through its own cursor
+struct void_topic {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int refcount;
+	int policy;
+	unsigned int size;
+	// Sequence number of the next published message
+	// Message n lives in ring[n % size]
+	uint64_t writeSeq;
+	void_buffer_shared **ring;
+	void_topic_subscriber *subscribers;
+	char *name;
+};
+
+struct void_topic_subscriber {
+	void_topic_subscriber *prev;
+	void_topic_subscriber *next;
+	void_topic *topic;
+	// Sequence number of the next message to receive
+	uint64_t readSeq;
+	int connected;
+	// Messages skipped by the drop oldest policy
+	uint64_t dropped;
+};
+
+int void_topic_init(void_topic *topic, unsigned int size, const char *name, int policy);
+// Drops a reference to the topic, returns 1 if the topic was destroyed
+int void_topic_destroy(void_topic *topic);
+
+// Finds a topic by name, returns 0 if it does not exist
+void_topic *void_topic_get(const char *name);
+
+// Unlike queues, topic functions lock the topic themselves
+
+// Moves the buffer's data into the ring and invalidates the buffer
+// Returns 1 if published, 0 if the ring is full and not blocking
+// Errors:
+	// VOID_EWRONGTYPE - Buffer is not a normal buffer, or other buffers share its storage
+	// VOID_ENOMEM - Not enough memory
+int void_topic_publish(void_topic *topic, void_buffer *buffer, int block);
+
+// Subscribes to messages published from now on
+// The subscriber holds a reference to the topic
+void void_topic_subscribe(void_topic *topic, void_topic_subscriber *subscriber);
+// Returns 1 if this dropped the last reference and destroyed the topic
+int void_topic_unsubscribe(void_topic_subscriber *subscriber);
+
+// Waits for the subscriber's next message and points buffer at it, read only
+// Timeout is in milliseconds, 0 does not wait and a negative timeout waits forever
+// Returns 1 if a message was received, 0 on timeout and
+// VOID_EDISCONNECTED if the subscriber was disconnected
+int void_topic_receive(void_topic_subscriber *subscriber, int64_t timeout, void_buffer *buffer);
+
+#endif
@@ -0,0 +1,294 @@
+#include "thread_compat.h"
+#include "void_trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct trace_ring trace_ring;
+typedef struct trace_name trace_name;
+
+struct trace_ring {
+	trace_ring *next;
+	// Trace the events belong to, rings of an earlier trace are reset by their owner
+	unsigned int generation;
+	unsigned int capacity;
+	// Events recorded in this trace, the newest is at (head-1)%capacity
+	// Only the owner writes it, with a release store after the event
+	uint64_t head;
+	// Thread id in the output, in the order threads first recorded
+	unsigned int thread;
+	// Set when the owner exits, the ring is freed by the next start
+	int exited;
+	void_trace_event *events;
+};
+
+struct trace_name {
+	trace_name *next;
+	char name[];
+};
+
+int void_trace_active = 0;
+
+static pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t ringKey;
+
+// Rings, names and the trace settings change under this lock
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring *rings = 0;
+static unsigned int threads = 0;
+static trace_name *names = 0;
+
+// Read by owners without the lock, generation is stored last
+static unsigned int generation = 0;
+static unsigned int ringEvents = VOID_TRACE_DEFAULT_EVENTS;
+static uint64_t traceStart = 0;
+
+uint64_t void_trace_clock(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec*1000000000+time.tv_nsec;
+}
+
+static void thread_exit(void *ring) {
+	__atomic_store_n(&((trace_ring*)ring)->exited, 1, __ATOMIC_RELEASE);
+}
+
+static void key_create(void) {
+	pthread_key_create(&ringKey, thread_exit);
+}
+
+static trace_ring *ring_new(void) {
+	trace_ring *ring = calloc(1, sizeof(trace_ring));
+
+	if (!ring)
+		return 0;
+
+	// Generation 0 is never current, so the ring is set up by the first record
+	pthread_mutex_lock(&traceLock);
+	ring->thread = ++threads;
+	ring->next = rings;
+	rings = ring;
+	pthread_mutex_unlock(&traceLock);
+
+	pthread_setspecific(ringKey, ring);
+	return ring;
+}
+
+// Returns the slot for the calling thread's next event, 0 if it has no memory for its ring
+static void_trace_event *next_event(trace_ring **ringOut) {
+	pthread_once(&keyOnce, key_create);
+	trace_ring *ring = pthread_getspecific(ringKey);
+
+	if (!ring && !(ring = ring_new()))
+		return 0;
+
+	unsigned int current = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+
+	if (ring->generation != current) {
+		unsigned int capacity = ringEvents;
+
+		if (ring->capacity != capacity) {
+			free(ring->events);
+			ring->events = malloc(sizeof(void_trace_event)*capacity);
+			ring->capacity = ring->events ? capacity : 0;
+		}
+
+		__atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&ring->generation, current, __ATOMIC_RELEASE);
+	}
+
+	if (!ring->capacity)
+		return 0;
+
+	*ringOut = ring;
+	return &ring->events[ring->head%ring->capacity];
+}
+
+static void record(const char *category, const char *name, const char *label, uint64_t start, uint64_t duration, int phase, const char *argName, int64_t arg) {
+	// Trace points check before taking the time, this drops events that raced with stop
+	if (!void_trace_enabled())
+		return;
+
+	trace_ring *ring;
+	void_trace_event *event = next_event(&ring);
+
+	if (!event)
+		return;
+
+	event->start = start;
+	event->duration = duration;
+	event->name = name;
+	event->category = category;
+	event->argName = argName;
+	event->arg = arg;
+	event->phase = phase;
+
+	if (label) {
+		strncpy(event->label, label, VOID_TRACE_LABEL-1);
+		event->label[VOID_TRACE_LABEL-1] = 0;
+	} else {
+		event->label[0] = 0;
+	}
+
+	__atomic_store_n(&ring->head, ring->head+1, __ATOMIC_RELEASE);
+}
+
+void void_trace_complete(const char *category, const char *name, const char *label, uint64_t start, const char *argName, int64_t arg) {
+	uint64_t now = void_trace_clock();
+	record(category, name, label, start, now > start ? now-start : 0, VOID_TRACE_COMPLETE, argName, arg);
+}
+
+void void_trace_instant(const char *category, const char *name, const char *label, const char *argName, int64_t arg) {
+	record(category, name, label, void_trace_clock(), 0, VOID_TRACE_INSTANT, argName, arg);
+}
+
+const char *void_trace_intern(const char *name) {
+	trace_name *entry;
+
+	// Few distinct names are expected, like the trace points of a program
+	pthread_mutex_lock(&traceLock);
+
+	for (entry = names; entry; entry = entry->next) {
+		if (strcmp(entry->name, name) == 0)
+			break;
+	}
+
+	if (!entry) {
+		size_t len = strlen(name);
+		entry = malloc(sizeof(trace_name)+len+1);
+
+		if (entry) {
+			memcpy(entry->name, name, len+1);
+			entry->next = names;
+			names = entry;
+		}
+	}
+
+	pthread_mutex_unlock(&traceLock);
+
+	return entry ? entry->name : 0;
+}
+
+void void_trace_start(unsigned int events) {
+	pthread_mutex_lock(&traceLock);
+
+	// Rings of threads that exited are not written to anymore
+	trace_ring **link = &rings;
+	while (*link) {
+		trace_ring *ring = *link;
+
+		if (__atomic_load_n(&ring->exited, __ATOMIC_ACQUIRE)) {
+			*link = ring->next;
+			free(ring->events);
+			free(ring);
+		} else {
+			link = &ring->next;
+		}
+	}
+
+	ringEvents = events ? events : VOID_TRACE_DEFAULT_EVENTS;
+	traceStart = void_trace_clock();
+	// Skips 0 when it wraps, which new rings start at
+	unsigned int next = generation+1 ? generation+1 : 1;
+	__atomic_store_n(&generation, next, __ATOMIC_RELEASE);
+	__atomic_store_n(&void_trace_active, 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&traceLock);
+}
+
+void void_trace_stop(void) {
+	__atomic_store_n(&void_trace_active, 0, __ATOMIC_RELEASE);
+}
+
+static void write_string(FILE *out, const char *string) {
+	fputc('"', out);
+
+	for (; *string; string++) {
+		unsigned char c = *string;
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+
+	fputc('"', out);
+}
+
+static void write_event(FILE *out, unsigned int thread, void_trace_event *event) {
+	double ts = ((double)event->start-(double)traceStart)/1000;
+
+	fputs("{\"name\":", out);
+	write_string(out, event->name);
+	fputs(",\"cat\":", out);
+	write_string(out, event->category);
+
+	if (event->phase == VOID_TRACE_COMPLETE)
+		fprintf(out, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", ts, (double)event->duration/1000);
+	else
+		fprintf(out, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f", ts);
+
+	fprintf(out, ",\"pid\":%ld,\"tid\":%u,\"args\":{", (long)getpid(), thread);
+
+	int comma = 0;
+	if (event->label[0]) {
+		fputs("\"label\":", out);
+		write_string(out, event->label);
+		comma = 1;
+	}
+
+	if (event->argName) {
+		if (comma)
+			fputc(',', out);
+		write_string(out, event->argName);
+		fprintf(out, ":%lld", (long long)event->arg);
+	}
+
+	fputs("}}", out);
+}
+
+size_t void_trace_write(FILE *out) {
+	size_t written = 0;
+	int first = 1;
+
+	pthread_mutex_lock(&traceLock);
+
+	fputs("{\"traceEvents\":[", out);
+
+	trace_ring *ring;
+	for (ring = rings; ring; ring = ring->next) {
+		if (__atomic_load_n(&ring->generation, __ATOMIC_ACQUIRE) != generation)
+			continue;
+
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		if (!head)
+			continue;
+
+		fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+			first ? "" : ",", (long)getpid(), ring->thread, ring->thread);
+		first = 0;
+
+		// A thread that was recording when the trace stopped may still overwrite the oldest slot of a full ring
+		uint64_t count = head > ring->capacity ? ring->capacity-1 : head;
+		uint64_t i;
+
+		for (i = head-count; i < head; i++) {
+			void_trace_event event = ring->events[i%ring->capacity];
+			event.label[VOID_TRACE_LABEL-1] = 0;
+
+			fputs(",\n", out);
+			write_event(out, ring->thread, &event);
+			written++;
+		}
+	}
+
+	fputs("\n],\"displayTimeUnit\":\"ns\"}\n", out);
+
+	pthread_mutex_unlock(&traceLock);
+
+	return written;
+}
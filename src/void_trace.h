@@ -0,0 +1,75 @@
+#ifndef VOID_TRACE_H
+#define VOID_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Events are recorded into a ring per thread, only the thread that owns a ring writes to it
+// While tracing is stopped, a trace point costs one relaxed load of void_trace_active
+// Rings keep the newest events, older ones are overwritten once a ring is full
+
+#define VOID_TRACE_DEFAULT_EVENTS 16384
+// Labels (queue names, allocation origins) are copied into the event and cut to fit
+#define VOID_TRACE_LABEL 24
+
+typedef struct void_trace_event void_trace_event;
+
+enum void_trace_phase {
+	// Has a duration
+	VOID_TRACE_COMPLETE,
+	VOID_TRACE_INSTANT
+};
+
+struct void_trace_event {
+	// Nanoseconds of CLOCK_MONOTONIC
+	uint64_t start;
+	uint64_t duration;
+	// name, category and argName are never freed, see void_trace_intern
+	const char *name;
+	const char *category;
+	const char *argName;
+	int64_t arg;
+	int phase;
+	char label[VOID_TRACE_LABEL];
+};
+
+extern int void_trace_active;
+
+static inline int void_trace_enabled(void) {
+	return __builtin_expect(__atomic_load_n(&void_trace_active, __ATOMIC_RELAXED), 0);
+}
+
+uint64_t void_trace_clock(void);
+
+// Records an event from start until now, label may be null
+void void_trace_complete(const char *category, const char *name, const char *label, uint64_t start, const char *argName, int64_t arg);
+void void_trace_instant(const char *category, const char *name, const char *label, const char *argName, int64_t arg);
+
+// Returns a copy of name that lives as long as the process, the same copy for equal names
+// Returns null if there was not enough memory
+const char *void_trace_intern(const char *name);
+
+// Starts a new trace, events of earlier traces are dropped
+// events is the size of each thread's ring, 0 for the default
+void void_trace_start(unsigned int events);
+// Stops recording, the events stay until the next start
+void void_trace_stop(void);
+// Writes the events of the last trace as Chrome trace event JSON (chrome://tracing, Perfetto)
+// Returns the number of events written
+size_t void_trace_write(FILE *out);
+
+// USDT probes for perf and bpftrace, built with -DVOID_USDT and sys/sdt.h (systemtap-sdt-dev)
+// They fire whether or not a trace is running, and cost a nop while nothing is attached
+#ifdef VOID_USDT
+#include <sys/sdt.h>
+#define VOID_PROBE1(name, a) DTRACE_PROBE1(void, name, a)
+#define VOID_PROBE2(name, a, b) DTRACE_PROBE2(void, name, a, b)
+#define VOID_PROBE3(name, a, b, c) DTRACE_PROBE3(void, name, a, b, c)
+#else
+// Arguments only computed for a probe are still used, they are optimized out
+#define VOID_PROBE1(name, a) ((void)(a))
+#define VOID_PROBE2(name, a, b) ((void)(a), (void)(b))
+#define VOID_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#endif
+
+#endif
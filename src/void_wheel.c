@@ -0,0 +1,198 @@
+#include "void_wheel.h"
+#include "thread_compat.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+uint64_t void_wheel_clock(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec*1000+time.tv_nsec/1000000;
+}
+
+static void list_append(void_wheel_list *list, void_wheel_timer *timer) {
+	timer->next = 0;
+
+	if (list->tail) {
+		list->tail->next = timer;
+	} else {
+		list->head = timer;
+	}
+
+	list->tail = timer;
+}
+
+static void list_free(void_wheel_list *list) {
+	void_wheel_timer *timer = list->head;
+
+	while (timer) {
+		void_wheel_timer *next = timer->next;
+		void_buffer_invalidate(&timer->buffer);
+		free(timer);
+		timer = next;
+	}
+
+	list->head = list->tail = 0;
+}
+
+// The highest 6 bit group the deadline does not share with now
+static unsigned int level_of(uint64_t now, uint64_t deadline) {
+	unsigned int bit = 63-__builtin_clzll(now ^ deadline);
+	return bit/VOID_WHEEL_BITS;
+}
+
+static unsigned int slot_of(unsigned int level, uint64_t time) {
+	return (time >> (level*VOID_WHEEL_BITS)) & (VOID_WHEEL_SLOTS-1);
+}
+
+// now with the bits of the level and the levels below it cleared
+static uint64_t rotation_start(uint64_t now, unsigned int level) {
+	unsigned int bits = (level+1)*VOID_WHEEL_BITS;
+	return bits >= 64 ? 0 : now & ~((1ULL << bits)-1);
+}
+
+static void place(void_wheel *wheel, void_wheel_timer *timer) {
+	if (timer->deadline <= wheel->now) {
+		list_append(&wheel->due, timer);
+		return;
+	}
+
+	unsigned int level = level_of(wheel->now, timer->deadline);
+	unsigned int slot = slot_of(level, timer->deadline);
+
+	list_append(&wheel->slots[level][slot], timer);
+	wheel->occupied[level] |= 1ULL << slot;
+}
+
+// Start of the first occupied slot after now, or UINT64_MAX
+// Every level only holds slots after its current one, and all of a level's slots
+// start before the next slot of the level above it, so the lowest level with one wins
+static uint64_t next_slot(const void_wheel *wheel) {
+	unsigned int level;
+
+	for (level = 0; level < VOID_WHEEL_LEVELS; level++) {
+		unsigned int current = slot_of(level, wheel->now);
+
+		if (current == VOID_WHEEL_SLOTS-1)
+			continue;
+
+		uint64_t ahead = wheel->occupied[level] & (~0ULL << (current+1));
+
+		if (ahead) {
+			uint64_t slot = __builtin_ctzll(ahead);
+			return rotation_start(wheel->now, level) | (slot << (level*VOID_WHEEL_BITS));
+		}
+	}
+
+	return UINT64_MAX;
+}
+
+void void_wheel_init(void_wheel *wheel, uint64_t now) {
+	memset(wheel, 0, sizeof(void_wheel));
+	wheel->now = now;
+}
+
+void void_wheel_destroy(void_wheel *wheel) {
+	unsigned int level, slot;
+
+	for (level = 0; level < VOID_WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < VOID_WHEEL_SLOTS; slot++) {
+			list_free(&wheel->slots[level][slot]);
+		}
+		wheel->occupied[level] = 0;
+	}
+
+	list_free(&wheel->due);
+	wheel->count = 0;
+}
+
+int void_wheel_insert(void_wheel *wheel, void_buffer *buffer, uint64_t deadline) {
+	void_wheel_timer *timer = malloc(sizeof(void_wheel_timer));
+
+	if (!timer)
+		return VOID_ENOMEM;
+
+	timer->deadline = deadline;
+	void_buffer_init(&timer->buffer);
+	void_buffer_move(&timer->buffer, buffer);
+
+	place(wheel, timer);
+	wheel->count++;
+
+	return VOID_SUCCESS;
+}
+
+void void_wheel_advance(void_wheel *wheel, uint64_t now) {
+	while (wheel->now < now) {
+		uint64_t next = next_slot(wheel);
+
+		if (next > now) {
+			wheel->now = now;
+			return;
+		}
+
+		wheel->now = next;
+
+		// Slots that start now move down, highest level first
+		unsigned int level;
+		for (level = VOID_WHEEL_LEVELS-1; level > 0; level--) {
+			if (next & ((1ULL << (level*VOID_WHEEL_BITS))-1))
+				continue;
+
+			unsigned int slot = slot_of(level, next);
+			if (!(wheel->occupied[level] & (1ULL << slot)))
+				continue;
+
+			void_wheel_timer *timer = wheel->slots[level][slot].head;
+			wheel->slots[level][slot].head = wheel->slots[level][slot].tail = 0;
+			wheel->occupied[level] &= ~(1ULL << slot);
+
+			while (timer) {
+				void_wheel_timer *following = timer->next;
+				place(wheel, timer);
+				timer = following;
+			}
+		}
+
+		// The level 0 slot of now expires
+		unsigned int slot = slot_of(0, next);
+		void_wheel_list *expired = &wheel->slots[0][slot];
+
+		if (expired->head) {
+			if (wheel->due.tail) {
+				wheel->due.tail->next = expired->head;
+			} else {
+				wheel->due.head = expired->head;
+			}
+			wheel->due.tail = expired->tail;
+			expired->head = expired->tail = 0;
+			wheel->occupied[0] &= ~(1ULL << slot);
+		}
+	}
+}
+
+uint64_t void_wheel_next(const void_wheel *wheel) {
+	if (wheel->due.head)
+		return wheel->now;
+
+	return next_slot(wheel);
+}
+
+void_buffer *void_wheel_due(void_wheel *wheel) {
+	return wheel->due.head ? &wheel->due.head->buffer : 0;
+}
+
+void void_wheel_drop_due(void_wheel *wheel) {
+	void_wheel_timer *timer = wheel->due.head;
+
+	if (!timer)
+		return;
+
+	wheel->due.head = timer->next;
+	if (!wheel->due.head)
+		wheel->due.tail = 0;
+
+	void_buffer_invalidate(&timer->buffer);
+	free(timer);
+	wheel->count--;
+}
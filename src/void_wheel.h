@@ -0,0 +1,69 @@
+#ifndef VOID_WHEEL
+#define VOID_WHEEL
+
+#include "void_buffer.h"
+
+#include <stdint.h>
+
+typedef struct void_wheel void_wheel;
+typedef struct void_wheel_timer void_wheel_timer;
+typedef struct void_wheel_list void_wheel_list;
+
+// Each level has 64 slots and covers 64 times the time of the level below it
+// Level 0 slots are one millisecond, 11 levels cover every 64 bit deadline
+#define VOID_WHEEL_BITS 6
+#define VOID_WHEEL_SLOTS (1 << VOID_WHEEL_BITS)
+#define VOID_WHEEL_LEVELS 11
+
+struct void_wheel_timer {
+	void_wheel_timer *next;
+	// Milliseconds on the void_wheel_clock
+	uint64_t deadline;
+	void_buffer buffer;
+};
+
+struct void_wheel_list {
+	void_wheel_timer *head;
+	void_wheel_timer *tail;
+};
+
+// Hierarchical timing wheel of buffers
+// A timer sits at the level of the highest 6 bit group its deadline does not share with now,
+// in the slot of that group, so inserting it is O(1)
+// Once now reaches the start of a slot above level 0, its timers move down to the levels below,
+// each timer moves at most once per level before it expires
+struct void_wheel {
+	// Millisecond the wheel was advanced to, the level 0 slot of now has already expired
+	uint64_t now;
+	// Timers in the slots and the due list
+	unsigned int count;
+	// Bit n is set if slot n of the level holds timers
+	uint64_t occupied[VOID_WHEEL_LEVELS];
+	void_wheel_list slots[VOID_WHEEL_LEVELS][VOID_WHEEL_SLOTS];
+	// Expired timers in the order they expired
+	void_wheel_list due;
+};
+
+// Milliseconds of CLOCK_MONOTONIC, the clock void.clock reads too
+uint64_t void_wheel_clock(void);
+
+void void_wheel_init(void_wheel *wheel, uint64_t now);
+// Frees the timers and invalidates their buffers
+void void_wheel_destroy(void_wheel *wheel);
+
+// Moves the buffer into a timer that expires at deadline, deadlines that already passed are due right away
+// Returns VOID_SUCCESS or VOID_ENOMEM, the buffer is left as it was if memory ran out
+int void_wheel_insert(void_wheel *wheel, void_buffer *buffer, uint64_t deadline);
+// Moves every timer that expires up to now to the due list
+void void_wheel_advance(void_wheel *wheel, uint64_t now);
+// Returns the next millisecond void_wheel_advance has something to do at,
+// now if timers are due and UINT64_MAX if the wheel is empty
+// Timers above level 0 only move down at that time, so it is never later than the next deadline
+uint64_t void_wheel_next(const void_wheel *wheel);
+
+// Returns the buffer of the oldest due timer, or null if none is due
+void_buffer *void_wheel_due(void_wheel *wheel);
+// Frees the oldest due timer, move its buffer out first
+void void_wheel_drop_due(void_wheel *wheel);
+
+#endif
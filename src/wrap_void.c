@@ -2,11 +2,37 @@
 #include <lauxlib.h>
 #include <lualib.h>
 
+#include "thread_compat.h"
+
 extern int lvoid_buffer_open(lua_State *L);
 extern int lvoid_queue_open(lua_State *L);
+extern int lvoid_topic_open(lua_State *L);
+extern int lvoid_map_open(lua_State *L);
+extern int lvoid_pool_open(lua_State *L);
+extern int lvoid_rpc_open(lua_State *L);
+extern int lvoid_serialize_open(lua_State *L);
+extern int lvoid_trace_open(lua_State *L);
+
+// void.clock()
+// Monotonic time in seconds, comparable between threads
+static int lvoid_clock(lua_State *L) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	lua_pushnumber(L, time.tv_sec+time.tv_nsec/1e9);
+	return 1;
+}
 
 int luaopen_void_core(lua_State *L) {
-	lua_createtable(L, 0, 3);
+	lua_createtable(L, 0, 11);
+	// void:table
+
+	lua_pushcfunction(L, lvoid_clock);
+	// clock:function void:table
+	lua_setfield(L, -2, "clock");
+	// void:table
+
+	// Sets void.serialize and void.deserialize
+	lvoid_serialize_open(L);
 	// void:table
 
 	lvoid_buffer_open(L);
@@ -19,6 +45,31 @@ int luaopen_void_core(lua_State *L) {
 	lua_setfield(L, -2, "queue");
 	// void:table
 
+	lvoid_topic_open(L);
+	// void.topic:table void:table
+	lua_setfield(L, -2, "topic");
+	// void:table
+
+	lvoid_map_open(L);
+	// void.map:table void:table
+	lua_setfield(L, -2, "map");
+	// void:table
+
+	lvoid_pool_open(L);
+	// void.pool:table void:table
+	lua_setfield(L, -2, "pool");
+	// void:table
+
+	lvoid_rpc_open(L);
+	// void.rpc:table void:table
+	lua_setfield(L, -2, "rpc");
+	// void:table
+
+	lvoid_trace_open(L);
+	// void.trace:table void:table
+	lua_setfield(L, -2, "trace");
+	// void:table
+
 	return 1;
 	// void:table
 }
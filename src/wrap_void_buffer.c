@@ -2,10 +2,22 @@
 #include <lauxlib.h>
 #include <lualib.h>
 
+#include <limits.h>
 #include <malloc.h>
+#include <stdint.h>
 #include <string.h>
 
+#include "lua_compat.h"
+#include "void_atomic.h"
 #include "void_buffer.h"
+#include "void_hash.h"
+#include "void_memory.h"
+#include "void_pack.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MEMFIND_SSE2 1
+#include <emmintrin.h>
+#endif
 
 #ifdef DEBUG
 #define DEBUG_MSG(...) fprintf(stderr, __VA_ARGS__);
@@ -15,18 +27,68 @@
 
 #define ASSERT(what, ...) if (!(what)) return luaL_error(L, __VA_ARGS__);
 
-static int vb_create(lua_State *L) {
-	size_t length = luaL_checkinteger(L, 1);
-	void *data = malloc(length);
+extern int lvoid_cursor_open(lua_State *L);
 
-	ASSERT(data, "not enough memory for %zu byte allocation", length);
+// Starts memory accounting for a freshly allocated buffer
+// If this allocation is sampled, the current Lua stack trace is recorded with it
+static void vb_track(lua_State *L, void_buffer *buffer, int origin) {
+	void_memory_sample *sample = 0;
+
+	if (void_memory_should_sample()) {
+		luaL_traceback(L, L, NULL, 1);
+		sample = void_memory_sample_add(origin, buffer->length, lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
 
-	memset(data, 0, length);
+	void_buffer_track(buffer, origin, sample);
+}
 
+// Pushes a new tracked buffer that takes ownership of data
+// Used by the other wrappers to hand out buffers
+void_buffer *lvoid_buffer_new(lua_State *L, void *data, size_t length, int origin) {
 	void_buffer *buffer = lua_newuserdata(L, sizeof(void_buffer));
 	void_buffer_init(buffer);
 	void_buffer_set(buffer, data, length);
 
+	vb_track(L, buffer, origin);
+
+	DEBUG_MSG("Allocated %zu bytes for buffer %p\n", length, buffer);
+
+	luaL_setmetatable(L, "void::buffer");
+
+	return buffer;
+}
+
+// Reads a boolean field of an options table, def if the table or field is missing
+static int vb_optboolean(lua_State *L, int arg, const char *name, int def) {
+	if (lua_isnoneornil(L, arg))
+		return def;
+
+	luaL_checktype(L, arg, LUA_TTABLE);
+	lua_getfield(L, arg, name);
+	int value = lua_isnil(L, -1) ? def : lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	return value;
+}
+
+// void.buffer.create(length, [{zero = true, prefault = false}])
+static int vb_create(lua_State *L) {
+	size_t length = luaL_checkinteger(L, 1);
+	int options = 0;
+
+	if (vb_optboolean(L, 2, "zero", 1))
+		options |= VOID_ALLOC_ZERO;
+	if (vb_optboolean(L, 2, "prefault", 0))
+		options |= VOID_ALLOC_PREFAULT;
+
+	void_buffer *buffer = lua_newuserdata(L, sizeof(void_buffer));
+	void_buffer_init(buffer);
+
+	ASSERT(void_buffer_allocate(buffer, length, options) == VOID_SUCCESS, "not enough memory for %zu byte allocation", length);
+
+	vb_track(L, buffer, VOID_ORIGIN_CREATE);
+
 	DEBUG_MSG("Allocated %zu bytes for buffer %p\n", length, buffer);
 
 	luaL_setmetatable(L, "void::buffer");
@@ -49,6 +111,8 @@ static int vb_fromString(lua_State *L) {
 	void_buffer_init(buffer);
 	void_buffer_set(buffer, data, length);
 
+	vb_track(L, buffer, VOID_ORIGIN_FROMSTRING);
+
 	DEBUG_MSG("Allocated %zu bytes for buffer %p\n", length, buffer);
 
 	luaL_setmetatable(L, "void::buffer");
@@ -56,15 +120,38 @@ static int vb_fromString(lua_State *L) {
 	return 1;
 }
 
+// Turns optional i and j arguments into a byte range the way string.sub does
+// i and j are 1 based and inclusive, negative values count back from the end
+// Returns the number of bytes in the range, which may be 0
+static size_t vb_range(lua_State *L, int arg, size_t length, size_t *start) {
+	lua_Integer i = luaL_optinteger(L, arg, 1);
+	lua_Integer j = luaL_optinteger(L, arg+1, -1);
+
+	if (i < 0) i = (lua_Integer)length+i+1;
+	if (j < 0) j = (lua_Integer)length+j+1;
+	if (i < 1) i = 1;
+	if (j > (lua_Integer)length) j = length;
+
+	if (i > j) {
+		*start = 0;
+		return 0;
+	}
+
+	*start = i-1;
+	return j-i+1;
+}
+
+// void.buffer.asString(buffer, [i, [j]])
 static int vb_asString(lua_State *L) {
 	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
 	void *data = void_buffer_data(buffer);
 
 	ASSERT(data, "no data associated with buffer %p", buffer);
 
-	// TODO: Range (Standard Lua I J ranges with wrapping?)
+	size_t start;
+	size_t count = vb_range(L, 2, buffer->length, &start);
 
-	lua_pushlstring(L, (const char*)data, buffer->length);
+	lua_pushlstring(L, (const char*)data+start, count);
 	return 1;
 }
 
@@ -94,31 +181,45 @@ static int vb_type(lua_State *L) {
 	return 1;
 }
 
-// void.buffer.clone(buffer, [i, [j]])
-static int vb_clone(lua_State *L) {
+static int vb_readOnly(lua_State *L) {
 	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
-	ptrdiff_t i = luaL_optinteger(L, 2, 0);
-	ptrdiff_t j = luaL_optinteger(L, 3, -1);
 
-	void *data = void_buffer_data(buffer);
+	lua_pushboolean(L, void_buffer_data(buffer) && !void_buffer_writable(buffer));
+	return 1;
+}
 
-	ASSERT(data, "no data associated with buffer %p", buffer);
+// void.buffer.share(buffer)
+// Returns a second buffer for the same storage, which can be handed to another thread
+static int vb_share(lua_State *L) {
+	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
+
+	ASSERT(void_buffer_data(buffer), "no data associated with buffer %p", buffer);
+	ASSERT(buffer->type == NORMAL, "sharing views is currently not supported");
+
+	void_buffer_shared *shared = void_buffer_share(buffer);
+
+	ASSERT(shared, "not enough memory to share buffer %p", buffer);
 
-	// Lua style range handling
-	if (i < 0) i = buffer->length+i;
-	if (i <= 0) i = 0;
-	if (i >= buffer->length) i = buffer->length-1;
-	i--;
+	void_buffer *newBuffer = lua_newuserdata(L, sizeof(void_buffer));
+	void_buffer_init(newBuffer);
+	// Windows, like stream records, stay windows
+	void_buffer_set_window(newBuffer, shared, (char*)buffer->normal.data-(char*)shared->data, buffer->length,
+		buffer->normal.flags & VOID_BUFFER_READONLY);
 
-	if (j < 0) j = buffer->length+j;
-	if (j <= 0) j = 0;
-	if (j >= buffer->length) j = buffer->length-1;
-	j--;
+	luaL_setmetatable(L, "void::buffer");
 
-	// TODO: Should we output preprocessed too?
-	ASSERT(j >= i, "invalid range for clone (%d %d)", i, j)
+	return 1;
+}
 
-	size_t rangeSize = (j-i)+1;
+// void.buffer.clone(buffer, [i, [j]])
+static int vb_clone(lua_State *L) {
+	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
+	void *data = void_buffer_data(buffer);
+
+	ASSERT(data, "no data associated with buffer %p", buffer);
+
+	size_t i;
+	size_t rangeSize = vb_range(L, 2, buffer->length, &i);
 	void *newData = malloc(rangeSize);
 
 	ASSERT(newData, "not enough memory for %zu byte allocation", rangeSize);
@@ -129,6 +230,8 @@ static int vb_clone(lua_State *L) {
 	void_buffer_init(newBuffer);
 	void_buffer_set(newBuffer, newData, rangeSize);
 
+	vb_track(L, newBuffer, VOID_ORIGIN_CLONE);
+
 	DEBUG_MSG("Allocated %zu bytes for buffer %p\n", rangeSize, newBuffer);
 
 	luaL_setmetatable(L, "void::buffer");
@@ -189,6 +292,8 @@ static int vb_concat(lua_State *L) {
 	void_buffer_init(buffer);
 	void_buffer_set(buffer, data, size);
 
+	vb_track(L, buffer, VOID_ORIGIN_CONCAT);
+
 	DEBUG_MSG("Allocated %zu bytes for buffer %p\n", size, buffer);
 
 	luaL_setmetatable(L, "void::buffer");
@@ -196,6 +301,281 @@ static int vb_concat(lua_State *L) {
 	return 1;
 }
 
+// Checks that offset and length describe bytes inside of a buffer of size bytes
+static int vb_inrange(lua_Integer offset, lua_Integer length, size_t size) {
+	return offset >= 0 && length >= 0 && (size_t)offset <= size && (size_t)length <= size-offset;
+}
+
+// void.buffer.copy(dest, destOffset, source, [sourceOffset = 0, [length]])
+// The ranges may overlap, which makes moving bytes within one buffer possible
+static int vb_copy(lua_State *L) {
+	void_buffer *dest = luaL_checkudata(L, 1, "void::buffer");
+	lua_Integer destOffset = luaL_checkinteger(L, 2);
+	void_buffer *source = luaL_checkudata(L, 3, "void::buffer");
+	lua_Integer sourceOffset = luaL_optinteger(L, 4, 0);
+
+	void *destData = void_buffer_writable(dest);
+	void *sourceData = void_buffer_data(source);
+
+	ASSERT(destData, "no writable data associated with buffer %p", dest);
+	ASSERT(sourceData, "no data associated with buffer %p", source);
+	ASSERT(sourceOffset >= 0 && (size_t)sourceOffset <= source->length, "source offset %d out of range", (int)sourceOffset);
+
+	lua_Integer length = luaL_optinteger(L, 5, source->length-sourceOffset);
+
+	ASSERT(vb_inrange(sourceOffset, length, source->length), "source range out of range (offset: %d, length: %d)", (int)sourceOffset, (int)length);
+	ASSERT(vb_inrange(destOffset, length, dest->length), "destination range out of range (offset: %d, length: %d)", (int)destOffset, (int)length);
+
+	memmove((char*)destData+destOffset, (char*)sourceData+sourceOffset, length);
+
+	return 0;
+}
+
+// void.buffer.fill(buffer, byte, [offset = 0, [length]])
+static int vb_fill(lua_State *L) {
+	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
+	lua_Integer byte = luaL_checkinteger(L, 2);
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+
+	void *data = void_buffer_writable(buffer);
+
+	ASSERT(data, "no writable data associated with buffer %p", buffer);
+	ASSERT(offset >= 0 && (size_t)offset <= buffer->length, "offset %d out of range", (int)offset);
+
+	lua_Integer length = luaL_optinteger(L, 4, buffer->length-offset);
+
+	ASSERT(vb_inrange(offset, length, buffer->length), "range out of range (offset: %d, length: %d)", (int)offset, (int)length);
+
+	memset((char*)data+offset, (int)(byte & 0xFF), length);
+
+	return 0;
+}
+
+// Compares the bytes of two buffers, shorter buffers sort before longer ones with the same prefix
+static int vb_cmp(lua_State *L, int *result) {
+	void_buffer *a = luaL_checkudata(L, 1, "void::buffer");
+	void_buffer *b = luaL_checkudata(L, 2, "void::buffer");
+
+	void *adata = void_buffer_data(a);
+	void *bdata = void_buffer_data(b);
+
+	ASSERT(adata, "no data associated with buffer %p", a);
+	ASSERT(bdata, "no data associated with buffer %p", b);
+
+	int cmp = memcmp(adata, bdata, a->length < b->length ? a->length : b->length);
+
+	if (cmp == 0) {
+		cmp = a->length < b->length ? -1 : a->length > b->length;
+	}
+
+	*result = cmp < 0 ? -1 : cmp > 0;
+	return 0;
+}
+
+// void.buffer.compare(a, b)
+static int vb_compare(lua_State *L) {
+	int result;
+	vb_cmp(L, &result);
+
+	lua_pushinteger(L, result);
+	return 1;
+}
+
+// void.buffer.equals(a, b)
+static int vb_equals(lua_State *L) {
+	void_buffer *a = luaL_checkudata(L, 1, "void::buffer");
+	void_buffer *b = luaL_checkudata(L, 2, "void::buffer");
+
+	// Skip the byte comparison for buffers that can not be equal
+	if (a->type != INVALID && b->type != INVALID && a->length != b->length) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	int result;
+	vb_cmp(L, &result);
+
+	lua_pushboolean(L, result == 0);
+	return 1;
+}
+
+// Finds the first occurrence of needle in haystack
+// Every start position is filtered by comparing the first and the last byte of needle, 16 positions
+// at a time with SSE2 (part of every x86-64 CPU), and memcmp only runs where both of them match
+// The positions left over go through memchr, which the C library vectorizes
+static const char *vb_memfind(const char *haystack, size_t length, const char *needle, size_t needleLength) {
+	if (needleLength == 0) {
+		return haystack;
+	}
+
+	if (needleLength > length) {
+		return 0;
+	}
+
+	size_t last = needleLength-1;
+	size_t positions = length-last;
+	size_t i = 0;
+
+#ifdef MEMFIND_SSE2
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i final = _mm_set1_epi8(needle[last]);
+
+	for (; i+16 <= positions; i += 16) {
+		__m128i firstBytes = _mm_loadu_si128((const __m128i*)(haystack+i));
+		__m128i finalBytes = _mm_loadu_si128((const __m128i*)(haystack+i+last));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firstBytes, first), _mm_cmpeq_epi8(finalBytes, final)));
+
+		while (mask) {
+			const char *candidate = haystack+i+__builtin_ctz(mask);
+
+			if (memcmp(candidate+1, needle+1, last) == 0) {
+				return candidate;
+			}
+
+			mask &= mask-1;
+		}
+	}
+#endif
+
+	while (i < positions) {
+		const char *candidate = memchr(haystack+i, needle[0], positions-i);
+
+		if (!candidate) {
+			return 0;
+		}
+
+		if (candidate[last] == needle[last] && memcmp(candidate+1, needle+1, last) == 0) {
+			return candidate;
+		}
+
+		i = candidate-haystack+1;
+	}
+
+	return 0;
+}
+
+// void.buffer.find(buffer, pattern, [offset = 0])
+// pattern is a string or buffer of bytes matched exactly
+static int vb_find(lua_State *L) {
+	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+
+	const char *needle;
+	size_t needleLength;
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		needle = lua_tolstring(L, 2, &needleLength);
+	} else {
+		void_buffer *pattern = luaL_checkudata(L, 2, "void::buffer");
+		needle = void_buffer_data(pattern);
+		needleLength = pattern->length;
+
+		ASSERT(needle, "no data associated with buffer %p", pattern);
+	}
+
+	const char *data = void_buffer_data(buffer);
+
+	ASSERT(data, "no data associated with buffer %p", buffer);
+	ASSERT(offset >= 0 && (size_t)offset <= buffer->length, "offset %d out of range", (int)offset);
+
+	const char *found = vb_memfind(data+offset, buffer->length-offset, needle, needleLength);
+
+	if (found) {
+		lua_pushinteger(L, found-data);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+// Gets the bytes a checksum function covers
+// (buffer, [offset = 0, [length]]), returns the index of the argument after them
+static int vb_checkbytes(lua_State *L, int arg, const char **data, size_t *length) {
+	void_buffer *buffer = luaL_checkudata(L, arg, "void::buffer");
+	lua_Integer offset = luaL_optinteger(L, arg+1, 0);
+
+	*data = void_buffer_data(buffer);
+
+	ASSERT(*data, "no data associated with buffer %p", buffer);
+	ASSERT(offset >= 0 && (size_t)offset <= buffer->length, "offset %d out of range", (int)offset);
+
+	lua_Integer count = luaL_optinteger(L, arg+2, buffer->length-offset);
+
+	ASSERT(vb_inrange(offset, count, buffer->length), "range out of range (offset: %d, length: %d)", (int)offset, (int)count);
+
+	*data += offset;
+	*length = count;
+	return arg+3;
+}
+
+// void.buffer.crc32c(buffer, [offset = 0, [length, [crc = 0]]])
+// void.buffer.crc32c({buffers...}, [crc = 0])
+static int vb_crc32c(lua_State *L) {
+	uint32_t crc;
+
+	if (lua_istable(L, 1)) {
+		crc = (uint32_t)luaL_optinteger(L, 2, 0);
+		lua_Integer count = luaL_len(L, 1);
+		lua_Integer i;
+
+		for (i=1; i<=count; i++) {
+			const char *data;
+			size_t length;
+
+			lua_rawgeti(L, 1, i);
+			vb_checkbytes(L, lua_gettop(L), &data, &length);
+			crc = void_crc32c(crc, data, length);
+			lua_pop(L, 1);
+		}
+	} else {
+		const char *data;
+		size_t length;
+		int arg = vb_checkbytes(L, 1, &data, &length);
+
+		crc = void_crc32c((uint32_t)luaL_optinteger(L, arg, 0), data, length);
+	}
+
+	lua_pushinteger(L, crc);
+	return 1;
+}
+
+// void.buffer.xxh64(buffer, [offset = 0, [length, [seed = 0]]])
+// void.buffer.xxh64({buffers...}, [seed = 0])
+static int vb_xxh64(lua_State *L) {
+	uint64_t hash;
+
+	if (lua_istable(L, 1)) {
+		void_xxh64_state state;
+		void_xxh64_init(&state, (uint64_t)luaL_optinteger(L, 2, 0));
+
+		lua_Integer count = luaL_len(L, 1);
+		lua_Integer i;
+
+		for (i=1; i<=count; i++) {
+			const char *data;
+			size_t length;
+
+			lua_rawgeti(L, 1, i);
+			vb_checkbytes(L, lua_gettop(L), &data, &length);
+			void_xxh64_update(&state, data, length);
+			lua_pop(L, 1);
+		}
+
+		hash = void_xxh64_digest(&state);
+	} else {
+		const char *data;
+		size_t length;
+		int arg = vb_checkbytes(L, 1, &data, &length);
+
+		hash = void_xxh64(data, length, (uint64_t)luaL_optinteger(L, arg, 0));
+	}
+
+	// Hashes above 2^63 come out as negative integers
+	lua_pushinteger(L, (lua_Integer)hash);
+	return 1;
+}
+
 // TODO: Lua like range calculation (think string.sub)
 static int vb_view(lua_State *L) {
 	void_buffer *source = luaL_checkudata(L, 1, "void::buffer");
@@ -240,6 +620,384 @@ static int vb_shrink(lua_State *L) {
 
 // TODO: vb_grow and vb_shrink
 
+static void vb_pushcounter(lua_State *L, const void_memory_counter *counter) {
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, counter->bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushinteger(L, counter->count);
+	lua_setfield(L, -2, "count");
+	lua_pushinteger(L, counter->totalBytes);
+	lua_setfield(L, -2, "totalBytes");
+	lua_pushinteger(L, counter->totalCount);
+	lua_setfield(L, -2, "totalCount");
+}
+
+// void.buffer.memstats()
+static int vb_memstats(lua_State *L) {
+	void_memory_stats stats;
+	void_memory_stats_get(&stats);
+
+	lua_createtable(L, 0, 6);
+	// stats:table
+
+	lua_pushinteger(L, stats.bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushinteger(L, stats.count);
+	lua_setfield(L, -2, "count");
+	lua_pushinteger(L, stats.peak);
+	lua_setfield(L, -2, "peak");
+
+	lua_createtable(L, 0, 2);
+	lua_pushinteger(L, stats.queuedBytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushinteger(L, stats.queuedCount);
+	lua_setfield(L, -2, "count");
+	lua_setfield(L, -2, "queued");
+
+	lua_createtable(L, 0, VOID_ORIGIN_COUNT-1);
+	// origins:table stats:table
+	int i;
+	for (i=VOID_ORIGIN_NONE+1; i<VOID_ORIGIN_COUNT; i++) {
+		vb_pushcounter(L, &stats.origins[i]);
+		lua_setfield(L, -2, void_memory_origin_names[i]);
+	}
+	lua_setfield(L, -2, "origins");
+	// stats:table
+
+	size_t sampleCount;
+	void_memory_sample *samples = void_memory_sample_snapshot(&sampleCount);
+
+	lua_createtable(L, sampleCount, 0);
+	// samples:table stats:table
+	size_t j;
+	for (j=0; j<sampleCount; j++) {
+		lua_createtable(L, 0, 3);
+		lua_pushstring(L, void_memory_origin_names[samples[j].origin]);
+		lua_setfield(L, -2, "origin");
+		lua_pushinteger(L, samples[j].length);
+		lua_setfield(L, -2, "size");
+		lua_pushstring(L, samples[j].trace ? samples[j].trace : "");
+		lua_setfield(L, -2, "trace");
+		lua_rawseti(L, -2, j+1);
+	}
+	lua_setfield(L, -2, "samples");
+	// stats:table
+
+	void_memory_sample_snapshot_free(samples, sampleCount);
+
+	return 1;
+}
+
+// void.buffer.mapThreshold([bytes])
+// Sets the size where void.buffer.create switches to mapped memory, returns the previous size
+static int vb_mapThreshold(lua_State *L) {
+	lua_pushinteger(L, void_buffer_get_map_threshold());
+
+	if (!lua_isnoneornil(L, 1)) {
+		lua_Integer threshold = luaL_checkinteger(L, 1);
+		ASSERT(threshold >= 0, "map threshold %d out of range", (int)threshold);
+
+		void_buffer_set_map_threshold(threshold);
+	}
+
+	return 1;
+}
+
+// void.buffer.sampling([rate])
+// Records a stack trace for a rate fraction of allocations, returns the previous rate
+static int vb_sampling(lua_State *L) {
+	unsigned int interval = void_memory_get_sample_interval();
+	lua_pushnumber(L, interval ? 1.0/interval : 0.0);
+
+	if (!lua_isnoneornil(L, 1)) {
+		lua_Number rate = luaL_checknumber(L, 1);
+		ASSERT(rate >= 0 && rate <= 1, "sampling rate %f out of range", rate);
+
+		void_memory_set_sample_interval(rate > 0 ? (unsigned int)(1.0/rate+0.5) : 0);
+	}
+
+	return 1;
+}
+
+// Parsed pack formats are cached per Lua state in a registry table keyed by format string
+static const char formatCacheKey = 0;
+// Formats built at runtime could grow the cache forever, so it starts over past this many
+#define FORMAT_CACHE_MAX 256
+
+static const void_pack_format *vb_checkformat(lua_State *L, int index) {
+	size_t fmtLength;
+	const char *fmt = luaL_checklstring(L, index, &fmtLength);
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &formatCacheKey);
+	// cache:table
+	lua_pushvalue(L, index);
+	lua_rawget(L, -2);
+	// format:userdata cache:table
+	void_pack_format *format = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	// cache:table
+
+	if (!format) {
+		char err[128];
+		int count = void_pack_parse(fmt, fmtLength, NULL, err, sizeof(err));
+
+		if (count < 0) {
+			luaL_argerror(L, index, err);
+		}
+
+		lua_rawgeti(L, -1, 0);
+		lua_Integer cached = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+
+		if (cached >= FORMAT_CACHE_MAX) {
+			lua_pop(L, 1);
+			lua_newtable(L);
+			lua_pushvalue(L, -1);
+			lua_rawsetp(L, LUA_REGISTRYINDEX, &formatCacheKey);
+			cached = 0;
+		}
+
+		format = lua_newuserdata(L, sizeof(void_pack_format)+count*sizeof(void_pack_op));
+		void_pack_parse(fmt, fmtLength, format, err, sizeof(err));
+		// format:userdata cache:table
+
+		lua_pushvalue(L, index);
+		lua_insert(L, -2);
+		lua_rawset(L, -3);
+		lua_pushinteger(L, cached+1);
+		lua_rawseti(L, -2, 0);
+		// cache:table
+	}
+
+	// The cache keeps the format alive
+	lua_pop(L, 1);
+	return format;
+}
+
+// void.buffer.pack(buffer, index, format, ...)
+// Returns the index after the last written byte
+static int vb_pack(lua_State *L) {
+	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
+	unsigned char *data = void_buffer_writable(buffer);
+	ASSERT(data, "no writable data associated with buffer %p", buffer)
+
+	lua_Integer index = luaL_checkinteger(L, 2);
+	ASSERT(index >= 0 && index <= buffer->length, "offset %I out of range", index)
+
+	const void_pack_format *format = vb_checkformat(L, 3);
+
+	unsigned char *start = data+index;
+	size_t length = buffer->length-index;
+	size_t position = 0;
+	int arg = 4;
+
+	// Fixed formats are range checked once instead of per operation
+	int checked = format->fixed;
+	ASSERT(!checked || format->size <= length, "format needs %I bytes at offset %I", (lua_Integer)format->size, index)
+
+	unsigned int i;
+	for (i=0; i<format->count; i++) {
+		const void_pack_op *op = &format->ops[i];
+		size_t padding = void_pack_padding(position, op->align);
+		const char *str = NULL;
+		size_t strLength = 0;
+		size_t needed = op->size;
+		unsigned char varint[VOID_PACK_MAXVARINT];
+
+		switch (op->kind) {
+			case VOID_PACK_CHARS:
+				str = luaL_checklstring(L, arg, &strLength);
+				luaL_argcheck(L, strLength <= op->length, arg, "string longer than given size");
+				needed = op->length;
+				break;
+			case VOID_PACK_STRING:
+				str = luaL_checklstring(L, arg, &strLength);
+				luaL_argcheck(L, op->size >= sizeof(size_t) || strLength < (size_t)1 << (op->size*8),
+					arg, "string length does not fit in given size");
+				needed = op->size+strLength;
+				break;
+			case VOID_PACK_ZSTRING:
+				str = luaL_checklstring(L, arg, &strLength);
+				luaL_argcheck(L, strlen(str) == strLength, arg, "string contains zeros");
+				needed = strLength+1;
+				break;
+			case VOID_PACK_VARINT:
+				needed = void_pack_varint(varint, luaL_checkinteger(L, arg));
+				break;
+			case VOID_PACK_ZIGZAG:
+				needed = void_pack_varint(varint, void_zigzag_encode(luaL_checkinteger(L, arg)));
+				break;
+		}
+
+		ASSERT(checked || needed+padding <= length-position, "format out of range at offset %I", (lua_Integer)(index+position))
+
+		memset(start+position, 0, padding);
+		position += padding;
+		unsigned char *dest = start+position;
+
+		switch (op->kind) {
+			case VOID_PACK_INT: {
+				lua_Integer value = luaL_checkinteger(L, arg++);
+				if (op->size < sizeof(lua_Integer)) {
+					lua_Integer limit = (lua_Integer)1 << (op->size*8-1);
+					luaL_argcheck(L, -limit <= value && value < limit, arg-1, "integer overflow");
+				}
+				void_pack_int(dest, value, op->size, op->reverse, value < 0);
+				break;
+			}
+			case VOID_PACK_UINT: {
+				lua_Integer value = luaL_checkinteger(L, arg++);
+				if (op->size < sizeof(lua_Integer)) {
+					luaL_argcheck(L, (uint64_t)value < (uint64_t)1 << (op->size*8), arg-1, "unsigned overflow");
+				}
+				void_pack_int(dest, value, op->size, op->reverse, 0);
+				break;
+			}
+			case VOID_PACK_FLOAT: {
+				float value = luaL_checknumber(L, arg++);
+				void_pack_bytes(dest, (unsigned char*)&value, sizeof(float), op->reverse);
+				break;
+			}
+			case VOID_PACK_DOUBLE: {
+				double value = luaL_checknumber(L, arg++);
+				void_pack_bytes(dest, (unsigned char*)&value, sizeof(double), op->reverse);
+				break;
+			}
+			case VOID_PACK_CHARS:
+				memcpy(dest, str, strLength);
+				memset(dest+strLength, 0, op->length-strLength);
+				arg++;
+				break;
+			case VOID_PACK_STRING:
+				void_pack_int(dest, strLength, op->size, op->reverse, 0);
+				memcpy(dest+op->size, str, strLength);
+				arg++;
+				break;
+			case VOID_PACK_ZSTRING:
+				memcpy(dest, str, strLength+1);
+				arg++;
+				break;
+			case VOID_PACK_PADDING:
+				*dest = 0;
+				break;
+			case VOID_PACK_VARINT:
+			case VOID_PACK_ZIGZAG:
+				memcpy(dest, varint, needed);
+				arg++;
+				break;
+		}
+
+		position += needed;
+	}
+
+	lua_pushinteger(L, index+position);
+	return 1;
+}
+
+// void.buffer.unpack(buffer, index, format)
+// Returns the values followed by the index after the last read byte
+static int vb_unpack(lua_State *L) {
+	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
+	const unsigned char *data = void_buffer_data(buffer);
+	ASSERT(data, "no data associated with buffer %p", buffer)
+
+	lua_Integer index = luaL_checkinteger(L, 2);
+	ASSERT(index >= 0 && index <= buffer->length, "offset %I out of range", index)
+
+	const void_pack_format *format = vb_checkformat(L, 3);
+
+	const unsigned char *start = data+index;
+	size_t length = buffer->length-index;
+	size_t position = 0;
+	int results = 0;
+
+	int checked = format->fixed;
+	ASSERT(!checked || format->size <= length, "format needs %I bytes at offset %I", (lua_Integer)format->size, index)
+
+	luaL_checkstack(L, format->count+1, "too many results");
+
+	unsigned int i;
+	for (i=0; i<format->count; i++) {
+		const void_pack_op *op = &format->ops[i];
+		size_t padding = void_pack_padding(position, op->align);
+		size_t needed = op->kind == VOID_PACK_CHARS ? op->length : op->size;
+
+		ASSERT(checked || needed+padding <= length-position, "format out of range at offset %I", (lua_Integer)(index+position))
+
+		position += padding;
+		const unsigned char *source = start+position;
+		uint64_t value;
+
+		switch (op->kind) {
+			case VOID_PACK_INT:
+			case VOID_PACK_UINT:
+				ASSERT(void_unpack_int(source, op->size, op->reverse, op->kind == VOID_PACK_INT, &value),
+					"%d-byte integer does not fit into Lua Integer", op->size)
+				lua_pushinteger(L, (lua_Integer)value);
+				results++;
+				break;
+			case VOID_PACK_FLOAT: {
+				float number;
+				void_pack_bytes((unsigned char*)&number, source, sizeof(float), op->reverse);
+				lua_pushnumber(L, number);
+				results++;
+				break;
+			}
+			case VOID_PACK_DOUBLE: {
+				double number;
+				void_pack_bytes((unsigned char*)&number, source, sizeof(double), op->reverse);
+				lua_pushnumber(L, number);
+				results++;
+				break;
+			}
+			case VOID_PACK_CHARS:
+				lua_pushlstring(L, (const char*)source, op->length);
+				results++;
+				break;
+			case VOID_PACK_STRING:
+				ASSERT(void_unpack_int(source, op->size, op->reverse, 0, &value) && value <= length-position-op->size,
+					"string out of range at offset %I", (lua_Integer)(index+position))
+				lua_pushlstring(L, (const char*)source+op->size, value);
+				needed = op->size+value;
+				results++;
+				break;
+			case VOID_PACK_ZSTRING: {
+				const unsigned char *end = memchr(source, 0, length-position);
+				ASSERT(end, "unfinished string for format 'z' at offset %I", (lua_Integer)(index+position))
+				lua_pushlstring(L, (const char*)source, end-source);
+				needed = (end-source)+1;
+				results++;
+				break;
+			}
+			case VOID_PACK_VARINT:
+			case VOID_PACK_ZIGZAG:
+				needed = void_unpack_varint(source, length-position, &value);
+				ASSERT(needed, "truncated varint at offset %I", (lua_Integer)(index+position))
+				if (op->kind == VOID_PACK_ZIGZAG)
+					lua_pushinteger(L, void_zigzag_decode(value));
+				else
+					lua_pushinteger(L, (lua_Integer)value);
+				results++;
+				break;
+		}
+
+		position += needed;
+	}
+
+	lua_pushinteger(L, index+position);
+	return results+1;
+}
+
+// void.buffer.packsize(format)
+static int vb_packsize(lua_State *L) {
+	const void_pack_format *format = vb_checkformat(L, 1);
+
+	luaL_argcheck(L, format->fixed, 1, "variable-length format");
+
+	lua_pushinteger(L, format->size);
+	return 1;
+}
+
 #define BUFFER_GETTER(type,reversed,luatype,name) static int vb_get ## name (lua_State *L) { \
 	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer"); \
 	unsigned char *data = void_buffer_data(buffer); \
@@ -271,8 +1029,8 @@ static int vb_shrink(lua_State *L) {
 
 #define BUFFER_SETTER(type,reversed,luatype,name) static int vb_set ## name (lua_State *L) { \
 	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer"); \
-	unsigned char *data = void_buffer_data(buffer); \
-	ASSERT(data, "no data associated with buffer %p", buffer) \
+	unsigned char *data = void_buffer_writable(buffer); \
+	ASSERT(data, "no writable data associated with buffer %p", buffer) \
 	\
 	ptrdiff_t offset = luaL_checkinteger(L, 2); \
 	ASSERT(offset >= 0 && offset+sizeof(type) <= buffer->length, "offset %d out of range", offset) \
@@ -323,6 +1081,188 @@ BUFFER_GETTER_SETTER(int64_t,1,integer,S64RE)
 BUFFER_GETTER_SETTER(float,1,number,F32RE)
 BUFFER_GETTER_SETTER(double,1,number,F64RE)
 
+// Atomics work on naturally aligned 32 and 64 bit integers in native byte order
+// Signed and unsigned types only differ in how values are returned
+static const char *atomicTypes[] = {"u32", "s32", "u64", "s64", NULL};
+static const char *atomicOrderNames[] = {"relaxed", "acquire", "release", "acqRel", "seqCst", NULL};
+static const int atomicOrders[] = {__ATOMIC_RELAXED, __ATOMIC_ACQUIRE, __ATOMIC_RELEASE, __ATOMIC_ACQ_REL, __ATOMIC_SEQ_CST};
+
+// The builtins only honor memory orders that are constants, so every order gets its own call
+#define ATOMIC_ORDER_SWITCH(order, OP) switch (order) { \
+	case __ATOMIC_RELAXED: OP(__ATOMIC_RELAXED); break; \
+	case __ATOMIC_ACQUIRE: OP(__ATOMIC_ACQUIRE); break; \
+	case __ATOMIC_RELEASE: OP(__ATOMIC_RELEASE); break; \
+	case __ATOMIC_ACQ_REL: OP(__ATOMIC_ACQ_REL); break; \
+	default: OP(__ATOMIC_SEQ_CST); break; \
+}
+
+// A failed compare exchange only loads, so it drops the release half of the order
+#define ATOMIC_FAILURE_ORDER(order) ((order) == __ATOMIC_ACQ_REL ? __ATOMIC_ACQUIRE : \
+	(order) == __ATOMIC_RELEASE ? __ATOMIC_RELAXED : (order))
+
+typedef struct vb_atomic {
+	void *address;
+	int wide;
+	int isSigned;
+	int order;
+} vb_atomic;
+
+// Checks the buffer and offset arguments, returns the address of size bytes at offset
+static void *vb_atomicaddress(lua_State *L, int writable, size_t size) {
+	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
+	unsigned char *data = writable ? void_buffer_writable(buffer) : void_buffer_data(buffer);
+
+	if (!data)
+		luaL_error(L, writable ? "no writable data associated with buffer %p" : "no data associated with buffer %p", buffer);
+
+	lua_Integer offset = luaL_checkinteger(L, 2);
+
+	if (!vb_inrange(offset, size, buffer->length))
+		luaL_error(L, "offset %lld out of range", (long long)offset);
+
+	if ((uintptr_t)(data+offset) % size)
+		luaL_error(L, "offset %lld is not aligned to %d bytes", (long long)offset, (int)size);
+
+	return data+offset;
+}
+
+// Checks the buffer, offset, type (at typeArg) and order (after it) arguments
+static void vb_checkatomic(lua_State *L, int writable, int typeArg, vb_atomic *atomic) {
+	int type = luaL_checkoption(L, typeArg, "u32", atomicTypes);
+
+	atomic->wide = type >= 2;
+	atomic->isSigned = type & 1;
+	atomic->order = atomicOrders[luaL_checkoption(L, typeArg+1, "seqCst", atomicOrderNames)];
+	atomic->address = vb_atomicaddress(L, writable, atomic->wide ? 8 : 4);
+}
+
+static void vb_pushatomic(lua_State *L, const vb_atomic *atomic, uint64_t value) {
+	if (atomic->wide) {
+		lua_pushinteger(L, (int64_t)value);
+	} else if (atomic->isSigned) {
+		lua_pushinteger(L, (int32_t)value);
+	} else {
+		lua_pushinteger(L, (uint32_t)value);
+	}
+}
+
+// void.buffer.atomicLoad(buffer, offset, [type = "u32", [order = "seqCst"]])
+static int vb_atomicLoad(lua_State *L) {
+	vb_atomic atomic;
+	vb_checkatomic(L, 0, 3, &atomic);
+	luaL_argcheck(L, atomic.order != __ATOMIC_RELEASE && atomic.order != __ATOMIC_ACQ_REL, 4, "invalid order for a load");
+
+	uint64_t value;
+	if (atomic.order == __ATOMIC_RELAXED) {
+		value = atomic.wide ? __atomic_load_n((uint64_t*)atomic.address, __ATOMIC_RELAXED) : __atomic_load_n((uint32_t*)atomic.address, __ATOMIC_RELAXED);
+	} else if (atomic.order == __ATOMIC_ACQUIRE) {
+		value = atomic.wide ? __atomic_load_n((uint64_t*)atomic.address, __ATOMIC_ACQUIRE) : __atomic_load_n((uint32_t*)atomic.address, __ATOMIC_ACQUIRE);
+	} else {
+		value = atomic.wide ? __atomic_load_n((uint64_t*)atomic.address, __ATOMIC_SEQ_CST) : __atomic_load_n((uint32_t*)atomic.address, __ATOMIC_SEQ_CST);
+	}
+
+	vb_pushatomic(L, &atomic, value);
+	return 1;
+}
+
+// void.buffer.atomicStore(buffer, offset, value, [type = "u32", [order = "seqCst"]])
+static int vb_atomicStore(lua_State *L) {
+	vb_atomic atomic;
+	vb_checkatomic(L, 1, 4, &atomic);
+	luaL_argcheck(L, atomic.order != __ATOMIC_ACQUIRE && atomic.order != __ATOMIC_ACQ_REL, 5, "invalid order for a store");
+	uint64_t value = luaL_checkinteger(L, 3);
+
+	if (atomic.order == __ATOMIC_RELAXED) {
+		if (atomic.wide) __atomic_store_n((uint64_t*)atomic.address, value, __ATOMIC_RELAXED);
+		else __atomic_store_n((uint32_t*)atomic.address, (uint32_t)value, __ATOMIC_RELAXED);
+	} else if (atomic.order == __ATOMIC_RELEASE) {
+		if (atomic.wide) __atomic_store_n((uint64_t*)atomic.address, value, __ATOMIC_RELEASE);
+		else __atomic_store_n((uint32_t*)atomic.address, (uint32_t)value, __ATOMIC_RELEASE);
+	} else {
+		if (atomic.wide) __atomic_store_n((uint64_t*)atomic.address, value, __ATOMIC_SEQ_CST);
+		else __atomic_store_n((uint32_t*)atomic.address, (uint32_t)value, __ATOMIC_SEQ_CST);
+	}
+
+	return 0;
+}
+
+#define ATOMIC_RMW_CALL(builtin, order) previous = atomic.wide ? \
+	builtin((uint64_t*)atomic.address, value, order) : \
+	builtin((uint32_t*)atomic.address, (uint32_t)value, order)
+
+#define ATOMIC_EXCHANGE(order) ATOMIC_RMW_CALL(__atomic_exchange_n, order)
+#define ATOMIC_FETCH_ADD(order) ATOMIC_RMW_CALL(__atomic_fetch_add, order)
+#define ATOMIC_FETCH_AND(order) ATOMIC_RMW_CALL(__atomic_fetch_and, order)
+#define ATOMIC_FETCH_OR(order) ATOMIC_RMW_CALL(__atomic_fetch_or, order)
+
+// Read-modify-write functions that take one value and return the previous one
+// void.buffer.name(buffer, offset, value, [type = "u32", [order = "seqCst"]])
+#define ATOMIC_RMW(name,op) static int vb_ ## name (lua_State *L) { \
+	vb_atomic atomic; \
+	vb_checkatomic(L, 1, 4, &atomic); \
+	uint64_t value = luaL_checkinteger(L, 3); \
+	uint64_t previous; \
+	\
+	ATOMIC_ORDER_SWITCH(atomic.order, op) \
+	\
+	vb_pushatomic(L, &atomic, previous); \
+	return 1; \
+}
+
+ATOMIC_RMW(exchange, ATOMIC_EXCHANGE)
+ATOMIC_RMW(fetchAdd, ATOMIC_FETCH_ADD)
+ATOMIC_RMW(fetchAnd, ATOMIC_FETCH_AND)
+ATOMIC_RMW(fetchOr, ATOMIC_FETCH_OR)
+
+#define ATOMIC_COMPARE_EXCHANGE(order) exchanged = atomic.wide ? \
+	__atomic_compare_exchange_n((uint64_t*)atomic.address, &current, desired, 0, order, ATOMIC_FAILURE_ORDER(order)) : \
+	__atomic_compare_exchange_n((uint32_t*)atomic.address, &current32, (uint32_t)desired, 0, order, ATOMIC_FAILURE_ORDER(order))
+
+// void.buffer.compareExchange(buffer, offset, expected, desired, [type = "u32", [order = "seqCst"]])
+// Returns whether the value was replaced and the value it held
+static int vb_compareExchange(lua_State *L) {
+	vb_atomic atomic;
+	vb_checkatomic(L, 1, 5, &atomic);
+	uint64_t current = luaL_checkinteger(L, 3);
+	uint32_t current32 = (uint32_t)current;
+	uint64_t desired = luaL_checkinteger(L, 4);
+	int exchanged;
+
+	ATOMIC_ORDER_SWITCH(atomic.order, ATOMIC_COMPARE_EXCHANGE)
+
+	lua_pushboolean(L, exchanged);
+	vb_pushatomic(L, &atomic, atomic.wide ? current : current32);
+	return 2;
+}
+
+// void.buffer.wait(buffer, offset, expected, [timeout = -1])
+// Only 32 bit words can be waited on
+static int vb_wait(lua_State *L) {
+	uint32_t *address = vb_atomicaddress(L, 0, 4);
+	uint32_t expected = (uint32_t)luaL_checkinteger(L, 3);
+	int64_t timeout = luaL_optinteger(L, 4, -1);
+
+	if (void_atomic_wait(address, expected, timeout)) {
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+
+	lua_pushboolean(L, 0);
+	lua_pushstring(L, "timeout");
+	return 2;
+}
+
+// void.buffer.wake(buffer, offset, [count])
+static int vb_wake(lua_State *L) {
+	uint32_t *address = vb_atomicaddress(L, 0, 4);
+	lua_Integer count = luaL_optinteger(L, 3, INT_MAX);
+
+	ASSERT(count >= 0, "invalid wake count %lld", (long long)count);
+
+	lua_pushinteger(L, void_atomic_wake(address, count > INT_MAX ? INT_MAX : (int)count));
+	return 1;
+}
+
 #define DEF(name) {"get" #name, vb_get ## name}, {"set" #name, vb_set ## name}
 #if __BYTE_ORDER__ ==  __ORDER_LITTLE_ENDIAN__
 #define DEF_LE(name) {"get" #name "LE", vb_get ## name}, {"set" #name "LE", vb_set ## name}
@@ -338,12 +1278,36 @@ static const luaL_Reg library[] = {
 	{"asString", vb_asString},
 	{"length", vb_length},
 	{"type", vb_type},
+	{"readOnly", vb_readOnly},
 	{"clone", vb_clone},
+	{"share", vb_share},
 	{"concat", vb_concat},
 	{"view", vb_view},
+	{"copy", vb_copy},
+	{"fill", vb_fill},
+	{"compare", vb_compare},
+	{"equals", vb_equals},
+	{"find", vb_find},
+	{"crc32c", vb_crc32c},
+	{"xxh64", vb_xxh64},
 	{"invalidate", vb_invalidate},
     {"grow", vb_grow},
     {"shrink", vb_shrink},
+	{"memstats", vb_memstats},
+	{"sampling", vb_sampling},
+	{"mapThreshold", vb_mapThreshold},
+	{"pack", vb_pack},
+	{"unpack", vb_unpack},
+	{"packsize", vb_packsize},
+	{"atomicLoad", vb_atomicLoad},
+	{"atomicStore", vb_atomicStore},
+	{"exchange", vb_exchange},
+	{"compareExchange", vb_compareExchange},
+	{"fetchAdd", vb_fetchAdd},
+	{"fetchAnd", vb_fetchAnd},
+	{"fetchOr", vb_fetchOr},
+	{"wait", vb_wait},
+	{"wake", vb_wake},
 
 	DEF(U8),
 	DEF(S8),
@@ -405,8 +1369,14 @@ static void vb_make_metatable(lua_State *L) {
 
 int lvoid_buffer_open(lua_State *L) {
 	vb_make_metatable(L);
+
+	lua_newtable(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &formatCacheKey);
+
 	luaL_newlib(L, library);
 	// void.buffer:table
+	lvoid_cursor_open(L);
+	// void.buffer:table
 
 	return 1;
 	// void.buffer:table
@@ -0,0 +1,395 @@
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <string.h>
+
+#include "lua_compat.h"
+#include "void_buffer.h"
+#include "void_pack.h"
+
+#define ASSERT(what, ...) if (!(what)) return luaL_error(L, __VA_ARGS__);
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NATIVE_LITTLE 1
+#else
+#define NATIVE_LITTLE 0
+#endif
+
+// A position inside of a buffer that moves forward as values are read or written
+// The cursor keeps the buffer alive through its user value
+typedef struct vc_cursor vc_cursor;
+
+struct vc_cursor {
+	void_buffer *buffer;
+	// Offsets into the buffer, the cursor can not move past limit
+	size_t position;
+	size_t limit;
+};
+
+enum vc_kind {
+	KIND_UNSIGNED,
+	KIND_SIGNED,
+	KIND_FLOAT
+};
+
+typedef struct vc_type vc_type;
+
+struct vc_type {
+	int kind;
+	unsigned int size;
+	int reverse;
+};
+
+// Parses the type names used by void.struct, like u8, s16le, u32be and f64
+static int vc_parsetype(const char *name, vc_type *type) {
+	switch (name[0]) {
+		case 'u': case 'U': type->kind = KIND_UNSIGNED; break;
+		case 's': case 'S': type->kind = KIND_SIGNED; break;
+		case 'f': case 'F': type->kind = KIND_FLOAT; break;
+		default: return 0;
+	}
+
+	const char *suffix;
+	if (name[1] == '8') {
+		type->size = 1;
+		suffix = name+2;
+	} else if (name[1] && name[2]) {
+		if (name[1] == '1' && name[2] == '6') type->size = 2;
+		else if (name[1] == '3' && name[2] == '2') type->size = 4;
+		else if (name[1] == '6' && name[2] == '4') type->size = 8;
+		else return 0;
+		suffix = name+3;
+	} else {
+		return 0;
+	}
+
+	if (type->kind == KIND_FLOAT && type->size < 4)
+		return 0;
+
+	if (suffix[0] == 0 || ((suffix[0] == 'n' || suffix[0] == 'N') && (suffix[1] == 'e' || suffix[1] == 'E') && !suffix[2])) {
+		type->reverse = 0;
+	} else if (suffix[1] && !suffix[2]) {
+		char a = suffix[0] | 0x20, b = suffix[1] | 0x20;
+		if (a == 'l' && b == 'e') type->reverse = !NATIVE_LITTLE;
+		else if (a == 'b' && b == 'e') type->reverse = NATIVE_LITTLE;
+		else if (a == 'r' && b == 'e') type->reverse = 1;
+		else return 0;
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+static vc_type vc_checktype(lua_State *L, int index) {
+	vc_type type;
+	const char *name = luaL_checkstring(L, index);
+
+	if (!vc_parsetype(name, &type)) {
+		luaL_argerror(L, index, lua_pushfstring(L, "unknown type '%s'", name));
+	}
+
+	return type;
+}
+
+// Returns the cursor's buffer data after checking that size more bytes fit
+static unsigned char *vc_reserve(lua_State *L, vc_cursor *cursor, size_t size, int writable) {
+	unsigned char *data = writable ? void_buffer_writable(cursor->buffer) : void_buffer_data(cursor->buffer);
+
+	if (!data) {
+		luaL_error(L, "no %sdata associated with buffer %p", writable ? "writable " : "", cursor->buffer);
+	}
+
+	// The buffer may have shrunk since the cursor was made
+	size_t limit = cursor->limit < cursor->buffer->length ? cursor->limit : cursor->buffer->length;
+	if (cursor->position > limit || size > limit-cursor->position) {
+		luaL_error(L, "%d bytes at offset %d out of range", (int)size, (int)cursor->position);
+	}
+
+	return data+cursor->position;
+}
+
+static void vc_pushvalue(lua_State *L, const unsigned char *data, vc_type type) {
+	if (type.kind == KIND_FLOAT) {
+		if (type.size == 4) {
+			float value;
+			void_pack_bytes((unsigned char*)&value, data, 4, type.reverse);
+			lua_pushnumber(L, value);
+		} else {
+			double value;
+			void_pack_bytes((unsigned char*)&value, data, 8, type.reverse);
+			lua_pushnumber(L, value);
+		}
+	} else {
+		uint64_t value;
+		void_unpack_int(data, type.size, type.reverse, type.kind == KIND_SIGNED, &value);
+		lua_pushinteger(L, (lua_Integer)value);
+	}
+}
+
+static void vc_tovalue(lua_State *L, int index, unsigned char *data, vc_type type) {
+	if (type.kind == KIND_FLOAT) {
+		if (type.size == 4) {
+			float value = luaL_checknumber(L, index);
+			void_pack_bytes(data, (unsigned char*)&value, 4, type.reverse);
+		} else {
+			double value = luaL_checknumber(L, index);
+			void_pack_bytes(data, (unsigned char*)&value, 8, type.reverse);
+		}
+	} else {
+		lua_Integer value = luaL_checkinteger(L, index);
+		void_pack_int(data, value, type.size, type.reverse, value < 0);
+	}
+}
+
+static int vc_new(lua_State *L, void_buffer *buffer, int bufferIndex, size_t position, size_t limit, const char *metatable) {
+	vc_cursor *cursor = lua_newuserdata(L, sizeof(vc_cursor));
+	cursor->buffer = buffer;
+	cursor->position = position;
+	cursor->limit = limit;
+
+	lua_pushvalue(L, bufferIndex);
+	lua_setuservalue(L, -2);
+
+	luaL_setmetatable(L, metatable);
+	return 1;
+}
+
+static int vc_open(lua_State *L, const char *metatable, int writable) {
+	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
+	lua_Integer offset = luaL_optinteger(L, 2, 0);
+
+	if (writable) {
+		ASSERT(void_buffer_writable(buffer), "no writable data associated with buffer %p", buffer);
+	} else {
+		ASSERT(void_buffer_data(buffer), "no data associated with buffer %p", buffer);
+	}
+	ASSERT(offset >= 0 && offset <= buffer->length, "offset %d out of range", (int)offset);
+
+	return vc_new(L, buffer, 1, offset, buffer->length, metatable);
+}
+
+// void.buffer.reader(buffer, [offset = 0])
+static int vc_reader(lua_State *L) {
+	return vc_open(L, "void::reader", 0);
+}
+
+// void.buffer.writer(buffer, [offset = 0])
+static int vc_writer(lua_State *L) {
+	return vc_open(L, "void::writer", 1);
+}
+
+static vc_cursor *vc_checkcursor(lua_State *L, int index) {
+	vc_cursor *cursor = luaL_testudata(L, index, "void::reader");
+	if (!cursor) {
+		cursor = luaL_checkudata(L, index, "void::writer");
+	}
+	return cursor;
+}
+
+// reader:read(type, ...)
+// Reads one value per type name
+static int vc_read(lua_State *L) {
+	vc_cursor *cursor = luaL_checkudata(L, 1, "void::reader");
+	int count = lua_gettop(L)-1;
+
+	luaL_checkstack(L, count, "too many values to read");
+
+	int i;
+	for (i=2; i<=count+1; i++) {
+		vc_type type = vc_checktype(L, i);
+		vc_pushvalue(L, vc_reserve(L, cursor, type.size, 0), type);
+		cursor->position += type.size;
+	}
+
+	return count;
+}
+
+// reader:u32le() and friends, the type is the closure's upvalue
+static int vc_read_typed(lua_State *L) {
+	vc_cursor *cursor = luaL_checkudata(L, 1, "void::reader");
+	vc_type *type = lua_touserdata(L, lua_upvalueindex(1));
+
+	vc_pushvalue(L, vc_reserve(L, cursor, type->size, 0), *type);
+	cursor->position += type->size;
+
+	return 1;
+}
+
+// writer:write(type, value, ...)
+// Writes type and value pairs
+static int vc_write(lua_State *L) {
+	vc_cursor *cursor = luaL_checkudata(L, 1, "void::writer");
+	int top = lua_gettop(L);
+
+	ASSERT(top % 2 == 1, "write takes type and value pairs");
+
+	int i;
+	for (i=2; i<top; i+=2) {
+		vc_type type = vc_checktype(L, i);
+		vc_tovalue(L, i+1, vc_reserve(L, cursor, type.size, 1), type);
+		cursor->position += type.size;
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+// writer:u32le(value) and friends
+static int vc_write_typed(lua_State *L) {
+	vc_cursor *cursor = luaL_checkudata(L, 1, "void::writer");
+	vc_type *type = lua_touserdata(L, lua_upvalueindex(1));
+
+	vc_tovalue(L, 2, vc_reserve(L, cursor, type->size, 1), *type);
+	cursor->position += type->size;
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+// reader:bytes(n) returns a string, writer:bytes(string) copies it in
+static int vc_bytes(lua_State *L) {
+	vc_cursor *cursor = luaL_testudata(L, 1, "void::writer");
+
+	if (cursor) {
+		size_t length;
+		const char *str = luaL_checklstring(L, 2, &length);
+		memcpy(vc_reserve(L, cursor, length, 1), str, length);
+		cursor->position += length;
+		lua_settop(L, 1);
+		return 1;
+	}
+
+	cursor = luaL_checkudata(L, 1, "void::reader");
+	lua_Integer length = luaL_checkinteger(L, 2);
+	ASSERT(length >= 0, "negative length %d", (int)length);
+
+	lua_pushlstring(L, (const char*)vc_reserve(L, cursor, length, 0), length);
+	cursor->position += length;
+	return 1;
+}
+
+// reader:sub(n)
+// Returns a reader over the next n bytes and skips them
+// The sub reader shares the buffer and does not attach a view to it
+static int vc_sub(lua_State *L) {
+	vc_cursor *cursor = luaL_checkudata(L, 1, "void::reader");
+	lua_Integer length = luaL_checkinteger(L, 2);
+	ASSERT(length >= 0, "negative length %d", (int)length);
+
+	vc_reserve(L, cursor, length, 0);
+
+	lua_getuservalue(L, 1);
+	vc_new(L, cursor->buffer, lua_gettop(L), cursor->position, cursor->position+length, "void::reader");
+	cursor->position += length;
+
+	return 1;
+}
+
+// cursor:skip(n)
+static int vc_skip(lua_State *L) {
+	vc_cursor *cursor = vc_checkcursor(L, 1);
+	lua_Integer length = luaL_checkinteger(L, 2);
+	ASSERT(length >= 0, "negative length %d", (int)length);
+
+	vc_reserve(L, cursor, length, 0);
+	cursor->position += length;
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+// cursor:remaining()
+static int vc_remaining(lua_State *L) {
+	vc_cursor *cursor = vc_checkcursor(L, 1);
+	size_t limit = cursor->limit < cursor->buffer->length ? cursor->limit : cursor->buffer->length;
+
+	lua_pushinteger(L, cursor->position < limit ? limit-cursor->position : 0);
+	return 1;
+}
+
+// cursor:tell()
+// Returns the offset in the buffer
+static int vc_tell(lua_State *L) {
+	vc_cursor *cursor = vc_checkcursor(L, 1);
+
+	lua_pushinteger(L, cursor->position);
+	return 1;
+}
+
+// cursor:buffer()
+static int vc_buffer(lua_State *L) {
+	vc_checkcursor(L, 1);
+
+	lua_getuservalue(L, 1);
+	return 1;
+}
+
+static const luaL_Reg readerMethods[] = {
+	{"read", vc_read},
+	{"bytes", vc_bytes},
+	{"sub", vc_sub},
+	{"skip", vc_skip},
+	{"remaining", vc_remaining},
+	{"tell", vc_tell},
+	{"buffer", vc_buffer},
+	{NULL, NULL}
+};
+
+static const luaL_Reg writerMethods[] = {
+	{"write", vc_write},
+	{"bytes", vc_bytes},
+	{"skip", vc_skip},
+	{"remaining", vc_remaining},
+	{"tell", vc_tell},
+	{"buffer", vc_buffer},
+	{NULL, NULL}
+};
+
+static const char *typeNames[] = {
+	"u8", "s8",
+	"u16", "u16le", "u16be", "s16", "s16le", "s16be",
+	"u32", "u32le", "u32be", "s32", "s32le", "s32be",
+	"u64", "u64le", "u64be", "s64", "s64le", "s64be",
+	"f32", "f32le", "f32be", "f64", "f64le", "f64be",
+	NULL
+};
+
+// Adds one method per type name to the methods table on top of the stack
+static void vc_typed_methods(lua_State *L, lua_CFunction method) {
+	int i;
+	for (i=0; typeNames[i]; i++) {
+		vc_type *type = lua_newuserdata(L, sizeof(vc_type));
+		vc_parsetype(typeNames[i], type);
+		lua_pushcclosure(L, method, 1);
+		lua_setfield(L, -2, typeNames[i]);
+	}
+}
+
+static void vc_make_metatable(lua_State *L, const char *name, const luaL_Reg *methods, lua_CFunction typed) {
+	luaL_newmetatable(L, name);
+	// metatable
+	lua_newtable(L);
+	luaL_setfuncs(L, methods, 0);
+	// methods:table metatable
+	vc_typed_methods(L, typed);
+	lua_setfield(L, -2, "__index");
+	// metatable
+	lua_pop(L, 1);
+	// nothing
+}
+
+// Adds void.buffer.reader and void.buffer.writer to the void.buffer table on top of the stack
+int lvoid_cursor_open(lua_State *L) {
+	vc_make_metatable(L, "void::reader", readerMethods, vc_read_typed);
+	vc_make_metatable(L, "void::writer", writerMethods, vc_write_typed);
+
+	// void.buffer:table
+	lua_pushcfunction(L, vc_reader);
+	lua_setfield(L, -2, "reader");
+	lua_pushcfunction(L, vc_writer);
+	lua_setfield(L, -2, "writer");
+
+	return 0;
+}
@@ -0,0 +1,205 @@
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "void_map.h"
+
+#define ASSERT(what, ...) if (!(what)) return luaL_error(L, __VA_ARGS__);
+
+static void_map *vm_checkmap(lua_State *L, int index) {
+	void_map **mapHolder = luaL_checkudata(L, index, "void::map");
+	luaL_argcheck(L, *mapHolder, index, "map has been destroyed");
+	return *mapHolder;
+}
+
+static void vm_push(lua_State *L, void_map *map) {
+	void_map **mapHolder = lua_newuserdata(L, sizeof(void_map*));
+	*mapHolder = map;
+
+	luaL_setmetatable(L, "void::map");
+}
+
+// void.map.create([name, [options]])
+static int vm_create(lua_State *L) {
+	const char *name = luaL_optstring(L, 1, NULL);
+	lua_Integer stripes = 0;
+	char fmtname[64];
+
+	if (!lua_isnoneornil(L, 2)) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+
+		lua_getfield(L, 2, "stripes");
+		stripes = luaL_optinteger(L, -1, 0);
+		lua_pop(L, 1);
+	}
+
+	ASSERT(stripes >= 0 && stripes <= 65536, "invalid stripe count %lld", (long long)stripes);
+
+	void_map *map = malloc(sizeof(void_map));
+
+	ASSERT(map, "not enough memory to allocate map object");
+
+	if (name == NULL) {
+		snprintf(fmtname, 64, "map%p", (void*)map);
+		name = fmtname;
+	}
+
+	if (!void_map_init(map, stripes, name)) {
+		free(map);
+		ASSERT(false, "not enough memory to allocate map data");
+	}
+
+	vm_push(L, map);
+	lua_pushstring(L, name);
+
+	return 2;
+}
+
+static int vm_destroy(lua_State *L) {
+	void_map **mapHolder = luaL_checkudata(L, 1, "void::map");
+
+	if (*mapHolder) {
+		if (void_map_destroy(*mapHolder)) {
+			free(*mapHolder);
+		}
+
+		*mapHolder = 0;
+	}
+
+	return 0;
+}
+
+static int vm_get(lua_State *L) {
+	const char *name = luaL_checkstring(L, 1);
+
+	void_map *map = void_map_get(name);
+
+	if (!map) {
+		lua_pushnil(L);
+	} else {
+		vm_push(L, map);
+	}
+
+	return 1;
+}
+
+// void.map.put(map, key, buffer)
+static int vm_put(lua_State *L) {
+	void_map *map = vm_checkmap(L, 1);
+	size_t keyLength;
+	const char *key = luaL_checklstring(L, 2, &keyLength);
+	void_buffer *buffer = luaL_checkudata(L, 3, "void::buffer");
+
+	ASSERT(void_buffer_data(buffer), "no data associated with buffer %p", buffer);
+	ASSERT(buffer->type == NORMAL, "putting views is currently not supported");
+
+	int result = void_map_put(map, key, keyLength, buffer);
+
+	ASSERT(result != VOID_EWRONGTYPE, "buffer %p shares its storage with other buffers", buffer);
+	ASSERT(result >= 0, "not enough memory to put buffer %p", buffer);
+
+	lua_pushboolean(L, result);
+	return 1;
+}
+
+// void.map.lookup(map, key, [buffer])
+static int vm_lookup(lua_State *L) {
+	void_map *map = vm_checkmap(L, 1);
+	size_t keyLength;
+	const char *key = luaL_checklstring(L, 2, &keyLength);
+	void_buffer *buffer = lua_isnoneornil(L, 3) ? NULL : luaL_checkudata(L, 3, "void::buffer");
+
+	if (!buffer) {
+		buffer = lua_newuserdata(L, sizeof(void_buffer));
+		void_buffer_init(buffer);
+		luaL_setmetatable(L, "void::buffer");
+	} else {
+		lua_pushvalue(L, 3);
+	}
+
+	if (!void_map_lookup(map, key, keyLength, buffer))
+		lua_pushnil(L);
+
+	return 1;
+}
+
+// void.map.remove(map, key)
+static int vm_remove(lua_State *L) {
+	void_map *map = vm_checkmap(L, 1);
+	size_t keyLength;
+	const char *key = luaL_checklstring(L, 2, &keyLength);
+
+	lua_pushboolean(L, void_map_remove(map, key, keyLength));
+	return 1;
+}
+
+static int vm_count(lua_State *L) {
+	void_map *map = vm_checkmap(L, 1);
+	void_map_stats stats;
+
+	void_map_stats_get(map, &stats);
+
+	lua_pushinteger(L, stats.count);
+	return 1;
+}
+
+static int vm_stats(lua_State *L) {
+	void_map *map = vm_checkmap(L, 1);
+	void_map_stats stats;
+
+	void_map_stats_get(map, &stats);
+
+	lua_createtable(L, 0, 5);
+	lua_pushinteger(L, stats.count);
+	lua_setfield(L, -2, "count");
+	lua_pushinteger(L, map->stripeCount);
+	lua_setfield(L, -2, "stripes");
+	lua_pushinteger(L, stats.keyBytes);
+	lua_setfield(L, -2, "keyBytes");
+	lua_pushinteger(L, stats.valueBytes);
+	lua_setfield(L, -2, "valueBytes");
+	lua_pushinteger(L, stats.tableBytes);
+	lua_setfield(L, -2, "tableBytes");
+
+	return 1;
+}
+
+static const luaL_Reg library[] = {
+	{"create", vm_create},
+	{"destroy", vm_destroy},
+	{"get", vm_get},
+	{"put", vm_put},
+	{"lookup", vm_lookup},
+	{"remove", vm_remove},
+	{"count", vm_count},
+	{"stats", vm_stats},
+	{NULL, NULL}
+};
+
+static const luaL_Reg mapMetatable[] = {
+	{"__gc", vm_destroy},
+	{NULL, NULL}
+};
+
+static void vm_make_metatable(lua_State *L) {
+	luaL_newmetatable(L, "void::map");
+	// void::map:metatable
+	luaL_setfuncs(L, mapMetatable, 0);
+	// void::map:metatable
+	lua_pop(L, 1);
+	// nothing
+}
+
+int lvoid_map_open(lua_State *L) {
+	vm_make_metatable(L);
+	luaL_newlib(L, library);
+	// void.map:table
+
+	return 1;
+	// void.map:table
+}
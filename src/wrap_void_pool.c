@@ -0,0 +1,449 @@
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lua_compat.h"
+#include "void_pool.h"
+#include "void_queue.h"
+
+#ifdef DEBUG
+#define DEBUG_MSG(...) fprintf(stderr, __VA_ARGS__);
+#else
+#define DEBUG_MSG(...)
+#endif
+
+#define ASSERT(what, ...) if (!(what)) return luaL_error(L, __VA_ARGS__);
+
+// Tasks each worker's deque holds by default
+#define DEFAULT_DEPTH 64
+#define ERROR_LENGTH 256
+
+extern int luaopen_void_core(lua_State *L);
+
+typedef struct vp_pool vp_pool;
+typedef struct vp_worker vp_worker;
+
+struct vp_worker {
+	lua_State *L;
+	// Registry reference to the handler returned by the init script
+	int handler;
+	// Protected by the void_pool_worker's lock
+	char lastError[ERROR_LENGTH];
+};
+
+struct vp_pool {
+	void_pool pool;
+	void_queue *replies;
+	char *script;
+	size_t scriptLength;
+	// package.path and package.cpath of the state that made the pool
+	char *path;
+	char *cpath;
+	// First init error, the worker that sets failed writes it
+	int failed;
+	char error[ERROR_LENGTH];
+	vp_worker *workers;
+};
+
+static char *vp_strdup(const char *str) {
+	if (!str)
+		return 0;
+
+	size_t length = strlen(str);
+	char *copy = malloc(length+1);
+
+	if (copy)
+		memcpy(copy, str, length+1);
+
+	return copy;
+}
+
+static void vp_fail(vp_pool *pool, const char *message) {
+	if (__atomic_exchange_n(&pool->failed, 1, __ATOMIC_ACQ_REL) == 0) {
+		snprintf(pool->error, ERROR_LENGTH, "%s", message);
+	}
+}
+
+static void vp_setpath(lua_State *L, const char *name, const char *value) {
+	if (!value)
+		return;
+
+	lua_getglobal(L, "package");
+	lua_pushstring(L, value);
+	lua_setfield(L, -2, name);
+	lua_pop(L, 1);
+}
+
+// Runs on the worker's thread
+// Creates the worker's Lua state and runs the init script, which returns the handler
+static int vp_init(void_pool_worker *worker) {
+	vp_pool *pool = worker->pool->userdata;
+	vp_worker *w = &pool->workers[worker->index];
+	worker->userdata = w;
+
+	lua_State *L = luaL_newstate();
+
+	if (!L) {
+		vp_fail(pool, "not enough memory for worker state");
+		return 1;
+	}
+
+	w->L = L;
+	luaL_openlibs(L);
+	vp_setpath(L, "path", pool->path);
+	vp_setpath(L, "cpath", pool->cpath);
+
+	// The worker shares this library instead of loading it again
+	luaL_requiref(L, "void.core", luaopen_void_core, 0);
+	lua_pop(L, 1);
+
+	if (luaL_loadbuffer(L, pool->script, pool->scriptLength, "=void.pool") != LUA_OK) {
+		vp_fail(pool, lua_tostring(L, -1));
+		return 1;
+	}
+
+	lua_pushinteger(L, worker->index+1);
+	lua_pushinteger(L, worker->pool->size);
+
+	if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+		vp_fail(pool, lua_tostring(L, -1));
+		return 1;
+	}
+
+	if (!lua_isfunction(L, -1)) {
+		vp_fail(pool, "pool init script must return a handler function");
+		return 1;
+	}
+
+	w->handler = luaL_ref(L, LUA_REGISTRYINDEX);
+	return 0;
+}
+
+static void vp_error(void_pool_worker *worker, const char *message) {
+	vp_worker *w = worker->userdata;
+
+	__atomic_add_fetch(&worker->errors, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&worker->lock);
+	snprintf(w->lastError, ERROR_LENGTH, "%s", message ? message : "(error object is not a string)");
+	pthread_mutex_unlock(&worker->lock);
+}
+
+// Calls handler(buffer, workerIndex) and enqueues the buffer it returns into the reply queue
+// The task buffer is invalidated once the handler returns
+static void vp_run(void_pool_worker *worker, void_buffer *task) {
+	vp_pool *pool = worker->pool->userdata;
+	vp_worker *w = worker->userdata;
+	lua_State *L = w->L;
+
+	void_buffer *buffer = lua_newuserdata(L, sizeof(void_buffer));
+	void_buffer_init(buffer);
+	void_buffer_move(buffer, task);
+	luaL_setmetatable(L, "void::buffer");
+	// buffer:userdata
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, w->handler);
+	lua_pushvalue(L, -2);
+	lua_pushinteger(L, worker->index+1);
+	// index:integer buffer:userdata handler:function buffer:userdata
+
+	if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+		vp_error(worker, lua_tostring(L, -1));
+	} else if (!lua_isnil(L, -1)) {
+		void_buffer *reply = luaL_testudata(L, -1, "void::buffer");
+
+		if (!reply || reply->type != NORMAL || !reply->normal.data || void_buffer_window(reply)) {
+			vp_error(worker, "pool handler must return a buffer that is not a view or window");
+		} else {
+			void_queue *queue = pool->replies;
+			int result;
+
+			if (void_queue_lockfree(queue)) {
+				result = void_queue_enqueue(queue, reply, 1);
+			} else {
+				void_queue_lock(queue);
+				result = void_queue_enqueue(queue, reply, 1);
+				void_queue_unlock(queue);
+			}
+
+			if (result != 1)
+				vp_error(worker, "could not enqueue reply");
+		}
+	}
+
+	void_buffer_invalidate(buffer);
+	lua_settop(L, 0);
+}
+
+static void vp_finish(void_pool_worker *worker) {
+	vp_pool *pool = worker->pool->userdata;
+	vp_worker *w = &pool->workers[worker->index];
+
+	if (w->L) {
+		lua_close(w->L);
+		w->L = 0;
+	}
+}
+
+static const void_pool_callbacks callbacks = {vp_init, vp_run, vp_finish};
+
+// Frees everything but the threads, which void_pool_destroy or a failed void_pool_init stopped
+static void vp_free(vp_pool *pool) {
+	if (pool->replies && void_queue_destroy(pool->replies)) {
+		free(pool->replies);
+	}
+
+	free(pool->workers);
+	free(pool->script);
+	free(pool->path);
+	free(pool->cpath);
+	free(pool);
+}
+
+static char *vp_getpath(lua_State *L, const char *name) {
+	lua_getglobal(L, "package");
+	char *path = 0;
+
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, name);
+		path = vp_strdup(lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
+
+	lua_pop(L, 1);
+	return path;
+}
+
+// void.pool.create(size, script, [options])
+static int vp_create(lua_State *L) {
+	lua_Integer size = luaL_checkinteger(L, 1);
+	size_t scriptLength;
+	const char *script = luaL_checklstring(L, 2, &scriptLength);
+	lua_Integer depth = DEFAULT_DEPTH;
+	void_queue *replies = 0;
+
+	ASSERT(size > 0, "pool size must be positive");
+
+	if (!lua_isnoneornil(L, 3)) {
+		luaL_checktype(L, 3, LUA_TTABLE);
+
+		lua_getfield(L, 3, "depth");
+		depth = luaL_optinteger(L, -1, DEFAULT_DEPTH);
+		lua_pop(L, 1);
+
+		lua_getfield(L, 3, "replies");
+		if (!lua_isnil(L, -1)) {
+			void_queue **queueHolder = luaL_checkudata(L, -1, "void::queue");
+			replies = *queueHolder;
+			ASSERT(replies, "replies queue was destroyed");
+		}
+		lua_pop(L, 1);
+	}
+
+	ASSERT(depth > 0, "pool depth must be positive");
+	// Every worker enqueues its replies, an spsc queue only has room for one producer
+	ASSERT(!replies || !void_queue_lockfree(replies) || size == 1, "an spsc replies queue needs a pool of one worker");
+
+	vp_pool *pool = malloc(sizeof(vp_pool));
+	ASSERT(pool, "not enough memory to allocate pool object");
+	memset(pool, 0, sizeof(vp_pool));
+
+	pool->workers = malloc(sizeof(vp_worker)*size);
+	pool->script = malloc(scriptLength);
+	pool->scriptLength = scriptLength;
+	pool->path = vp_getpath(L, "path");
+	pool->cpath = vp_getpath(L, "cpath");
+
+	if (replies) {
+		void_queue_lock(replies);
+		replies->refcount++;
+		void_queue_unlock(replies);
+		pool->replies = replies;
+	} else {
+		char name[64];
+		void_queue_options options;
+		memset(&options, 0, sizeof(void_queue_options));
+		options.mode = VOID_QUEUE_GROWABLE;
+
+		snprintf(name, sizeof(name), "void.pool.%p", (void*)pool);
+		pool->replies = malloc(sizeof(void_queue));
+
+		if (pool->replies && !void_queue_init_options(pool->replies, 0, name, &options)) {
+			free(pool->replies);
+			pool->replies = 0;
+		}
+	}
+
+	if (!pool->workers || !pool->script || !pool->replies) {
+		vp_free(pool);
+		return luaL_error(L, "not enough memory to allocate pool data");
+	}
+
+	memcpy(pool->script, script, scriptLength);
+	memset(pool->workers, 0, sizeof(vp_worker)*size);
+
+	// Created first, so a failed create leaves nothing behind to collect
+	vp_pool **poolHolder = lua_newuserdata(L, sizeof(vp_pool*));
+	*poolHolder = 0;
+	luaL_setmetatable(L, "void::pool");
+
+	int err = void_pool_init(&pool->pool, size, depth, &callbacks, pool);
+
+	if (err != VOID_SUCCESS) {
+		char message[ERROR_LENGTH];
+		snprintf(message, ERROR_LENGTH, "%s", pool->failed ? pool->error : "not enough memory to start pool threads");
+		vp_free(pool);
+		return luaL_error(L, "%s", message);
+	}
+
+	*poolHolder = pool;
+	return 1;
+}
+
+static vp_pool *vp_check(lua_State *L, int arg) {
+	vp_pool **poolHolder = luaL_checkudata(L, arg, "void::pool");
+
+	if (!*poolHolder)
+		luaL_error(L, "pool was destroyed");
+
+	return *poolHolder;
+}
+
+static int vp_destroy(lua_State *L) {
+	vp_pool **poolHolder = luaL_checkudata(L, 1, "void::pool");
+
+	if (*poolHolder) {
+		void_pool_destroy(&(*poolHolder)->pool);
+		vp_free(*poolHolder);
+		*poolHolder = 0;
+	}
+
+	return 0;
+}
+
+static int luaL_optboolean(lua_State *L, int narg, int def) {
+	return lua_isboolean(L, narg) ? lua_toboolean(L, narg) : def;
+}
+
+// void.pool.submit(pool, buffer, [block = false])
+static int vp_submit(lua_State *L) {
+	vp_pool *pool = vp_check(L, 1);
+	void_buffer *buffer = luaL_checkudata(L, 2, "void::buffer");
+	int block = luaL_optboolean(L, 3, 0);
+
+	ASSERT(void_buffer_data(buffer), "no data associated with buffer %p", buffer);
+	ASSERT(buffer->type != VIEW, "submitting views is currently not supported");
+	ASSERT(!void_buffer_window(buffer), "buffer %p is a window into other storage", buffer);
+
+	int result = void_pool_submit(&pool->pool, buffer, block);
+
+	ASSERT(result >= 0, "pool is stopping");
+
+	lua_pushboolean(L, result);
+	return 1;
+}
+
+// void.pool.replies(pool)
+static int vp_replies(lua_State *L) {
+	vp_pool *pool = vp_check(L, 1);
+	void_queue *queue = pool->replies;
+
+	void_queue_lock(queue);
+	queue->refcount++;
+	void_queue_unlock(queue);
+
+	void_queue **queueHolder = lua_newuserdata(L, sizeof(void_queue*));
+	*queueHolder = queue;
+	luaL_setmetatable(L, "void::queue");
+
+	return 1;
+}
+
+// void.pool.stats(pool)
+static int vp_stats(lua_State *L) {
+	vp_pool *pool = vp_check(L, 1);
+	void_pool *p = &pool->pool;
+
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, p->size);
+	lua_setfield(L, -2, "size");
+	lua_pushinteger(L, p->depth);
+	lua_setfield(L, -2, "depth");
+	lua_pushinteger(L, void_pool_pending(p));
+	lua_setfield(L, -2, "pending");
+
+	lua_createtable(L, p->size, 0);
+	unsigned int i;
+	for (i=0; i<p->size; i++) {
+		void_pool_worker *worker = &p->workers[i];
+
+		lua_createtable(L, 0, 6);
+		lua_pushinteger(L, void_pool_worker_queued(worker));
+		lua_setfield(L, -2, "queued");
+		lua_pushinteger(L, __atomic_load_n(&worker->executed, __ATOMIC_RELAXED));
+		lua_setfield(L, -2, "tasks");
+		lua_pushinteger(L, __atomic_load_n(&worker->stolen, __ATOMIC_RELAXED));
+		lua_setfield(L, -2, "stolen");
+		lua_pushinteger(L, __atomic_load_n(&worker->errors, __ATOMIC_RELAXED));
+		lua_setfield(L, -2, "errors");
+		lua_pushnumber(L, __atomic_load_n(&worker->busyNanos, __ATOMIC_RELAXED)/1e9);
+		lua_setfield(L, -2, "busy");
+
+		pthread_mutex_lock(&worker->lock);
+		if (pool->workers[i].lastError[0]) {
+			lua_pushstring(L, pool->workers[i].lastError);
+			lua_setfield(L, -2, "lastError");
+		}
+		pthread_mutex_unlock(&worker->lock);
+
+		lua_rawseti(L, -2, i+1);
+	}
+	lua_setfield(L, -2, "workers");
+
+	return 1;
+}
+
+// void.pool.cores()
+static int vp_cores(lua_State *L) {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	lua_pushinteger(L, cores > 0 ? cores : 1);
+	return 1;
+}
+
+static const luaL_Reg library[] = {
+	{"create", vp_create},
+	{"destroy", vp_destroy},
+	{"submit", vp_submit},
+	{"replies", vp_replies},
+	{"stats", vp_stats},
+	{"cores", vp_cores},
+	{NULL, NULL}
+};
+
+static const luaL_Reg metatable[] = {
+	{"__gc", vp_destroy},
+	{NULL, NULL}
+};
+
+static void vp_make_metatable(lua_State *L) {
+	luaL_newmetatable(L, "void::pool");
+	// void::pool:metatable
+	luaL_setfuncs(L, metatable, 0);
+	// void::pool:metatable
+	lua_pop(L, 1);
+	// nothing
+}
+
+int lvoid_pool_open(lua_State *L) {
+	vp_make_metatable(L);
+	luaL_newlib(L, library);
+	// void.pool:table
+
+	return 1;
+	// void.pool:table
+}
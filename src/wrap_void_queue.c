@@ -2,8 +2,10 @@
 #include <lauxlib.h>
 #include <lualib.h>
 
+#include <limits.h>
 #include <malloc.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
@@ -29,6 +31,19 @@ uint64_t xorshift128plus() {
 	return ( xorshiftSeed[1] = ( s1 ^ s0 ^ ( s1 >> 17 ) ^ ( s0 >> 26 ) ) ) + s0;
 }
 
+// Reads a size option of the options table at index, 0 if it is left out for the default
+// Sizes that are given have to be positive, a negative one would turn into a huge size_t
+static lua_Integer vq_optsize(lua_State *L, int index, const char *name, lua_Integer max) {
+	lua_getfield(L, index, name);
+	int given = !lua_isnil(L, -1);
+	lua_Integer value = luaL_optinteger(L, -1, 0);
+	lua_pop(L, 1);
+
+	ASSERT(!given || (value > 0 && value <= max), "invalid %s %lld", name, (long long)value);
+
+	return value;
+}
+
 static int vq_create(lua_State *L) {
     if (!xorshiftinit) {
         xorshiftinit = true;
@@ -48,6 +63,45 @@ static int vq_create(lua_State *L) {
 	const char *name = luaL_optstring(L, 2, NULL);
     char fmtname[512];
 
+	void_queue_options options;
+	memset(&options, 0, sizeof(void_queue_options));
+
+	if (!lua_isnoneornil(L, 3)) {
+		luaL_checktype(L, 3, LUA_TTABLE);
+
+		lua_getfield(L, 3, "journal");
+		options.journal = luaL_optstring(L, -1, NULL);
+		lua_pop(L, 1);
+
+		lua_getfield(L, 3, "mode");
+		// Journaled queues have to be growable
+		const char *mode = luaL_optstring(L, -1, options.journal ? "growable" : "ring");
+		if (strcmp(mode, "ring") == 0) {
+			options.mode = VOID_QUEUE_RING;
+		} else if (strcmp(mode, "growable") == 0) {
+			options.mode = VOID_QUEUE_GROWABLE;
+		} else if (strcmp(mode, "spsc") == 0) {
+			options.mode = VOID_QUEUE_SPSC;
+		} else if (strcmp(mode, "stream") == 0) {
+			options.mode = VOID_QUEUE_STREAM;
+		} else {
+			ASSERT(false, "unknown queue mode %s", mode);
+		}
+		lua_pop(L, 1);
+
+		options.maxBytes = vq_optsize(L, 3, "maxBytes", PTRDIFF_MAX);
+		options.segmentSize = vq_optsize(L, 3, "segmentSize", UINT_MAX);
+		options.journalSegmentBytes = vq_optsize(L, 3, "journalSegmentBytes", PTRDIFF_MAX);
+
+		lua_getfield(L, 3, "syncInterval");
+		options.syncInterval = luaL_optinteger(L, -1, VOID_JOURNAL_SYNC_EACH);
+		lua_pop(L, 1);
+
+		ASSERT(options.syncInterval >= VOID_JOURNAL_SYNC_NEVER, "invalid syncInterval %lld", (long long)options.syncInterval);
+
+		ASSERT(!options.journal || options.mode == VOID_QUEUE_GROWABLE, "only growable queues can be journaled");
+	}
+
 	void_queue *queue = malloc(sizeof(void_queue));
 
 	ASSERT(queue, "not enough memory to allocate queue object");
@@ -57,8 +111,10 @@ static int vq_create(lua_State *L) {
         name = fmtname;
     }
 
-	if (!void_queue_init(queue, size, name)) {
+	if (!void_queue_init_options(queue, size, name, &options)) {
+		int error = errno;
 		free(queue);
+		ASSERT(!options.journal, "could not open queue journal %s: %s", options.journal, strerror(error));
 		ASSERT(false, "not enough memory to allocate queue data");
 	}
 
@@ -121,37 +177,93 @@ static int vq_enqueue(lua_State *L) {
 	void *data = void_buffer_data(buffer);
 	ASSERT(data, "no data associated with buffer %p", buffer);
 
+	// We need to make a new buffer from this view
+	ASSERT(buffer->type != VIEW, "enqueueing views is currently not supported");
+	ASSERT(!void_buffer_window(buffer), "buffer %p is a window into other storage", buffer);
+
+	if (void_queue_lockfree(queue)) {
+		lua_pushboolean(L, void_queue_enqueue(queue, buffer, block));
+		return 1;
+	}
+
 	// Now lock the queue
 	void_queue_lock(queue);
 
-	if (queue->count >= queue->size && !block) {
-		// Queue is full and we aren't blocking... No reason to
-		// call void_queue_enqueue and do a whole bunch of
-		// buffer stuff
-		lua_pushboolean(L, 0);
-	} else {
-		if (buffer->type == VIEW) {
-			// We need to make a new buffer from this view
-			void_queue_unlock(queue);
-			ASSERT(false, "enqueueing views is currently not supported");
-		}
+	int result = 0;
 
-		lua_pushboolean(L, void_queue_enqueue(queue, buffer, block));
+	// Queue is full and we aren't blocking... No reason to
+	// call void_queue_enqueue and do a whole bunch of
+	// buffer stuff
+	if (block || !void_queue_full(queue, buffer->length))
+		result = void_queue_enqueue(queue, buffer, block);
+
+	void_queue_unlock(queue);
+
+	ASSERT(result != VOID_EIO, "could not write buffer to queue journal");
+
+	// The buffer is in the queue already, so this is not an error a caller could retry
+	if (result == VOID_ENOTDURABLE) {
+		lua_pushboolean(L, 1);
+		lua_pushliteral(L, "not durable");
+		return 2;
 	}
 
+	ASSERT(result != VOID_EOUTOFRANGE, "buffer of %lld bytes does not fit in the stream", (long long)buffer->length);
+	ASSERT(result >= 0, "could not enqueue buffer %p (%d)", buffer, result);
+	lua_pushboolean(L, result);
+
+	return 1;
+}
+
+static int vq_delay(lua_State *L, uint64_t deadline) {
+	void_queue **queueHolder = luaL_checkudata(L, 1, "void::queue");
+	void_queue *queue = *queueHolder;
+	void_buffer *buffer = luaL_checkudata(L, 2, "void::buffer");
+
+	ASSERT(void_buffer_data(buffer), "no data associated with buffer %p", buffer);
+	ASSERT(buffer->type != VIEW, "enqueueing views is currently not supported");
+	ASSERT(!void_buffer_window(buffer), "buffer %p is a window into other storage", buffer);
+	ASSERT(!void_queue_lockfree(queue) && queue->mode != VOID_QUEUE_STREAM, "spsc and stream queues cannot delay buffers");
+
+	void_queue_lock(queue);
+	int result = void_queue_enqueue_at(queue, buffer, deadline);
 	void_queue_unlock(queue);
 
+	ASSERT(result > 0, "not enough memory to delay buffer");
+	lua_pushboolean(L, 1);
+
 	return 1;
 }
 
-static int vq_await(lua_State *L) {
+// void.queue.enqueueAt(queue, buffer, deadline)
+// deadline is in seconds of void.clock
+static int vq_enqueue_at(lua_State *L) {
+	lua_Number deadline = luaL_checknumber(L, 3)*1000;
+
+	if (deadline <= 0)
+		return vq_delay(L, 0);
+
+	// Round up so the buffer never shows up early
+	uint64_t milliseconds = deadline;
+	return vq_delay(L, milliseconds < deadline ? milliseconds+1 : milliseconds);
+}
+
+// void.queue.enqueueAfter(queue, buffer, delay)
+// delay is in milliseconds
+static int vq_enqueue_after(lua_State *L) {
+	lua_Integer delay = luaL_checkinteger(L, 3);
+	ASSERT(delay >= 0, "invalid delay %lld", (long long)delay);
+	return vq_delay(L, void_wheel_clock()+delay);
+}
+
+// Returns the sequence number of the buffer as well if sequence is true and the queue is journaled
+static int vq_await_buffer(lua_State *L, bool sequence) {
 	void_queue **queueHolder = luaL_checkudata(L, 1, "void::queue");
 	void_queue *queue = *queueHolder;
 	int64_t timeout = luaL_optinteger(L, 2, 0);
     void_buffer *buffer = lua_isnoneornil(L, 3) ? NULL : luaL_checkudata(L, 3, "void::buffer");
 
-	// Now lock the queue
-	void_queue_lock(queue);
+	ASSERT(!sequence || queue->journal, "queue is not journaled");
 
     if (!buffer) {
         buffer = lua_newuserdata(L, sizeof(void_buffer));
@@ -161,21 +273,239 @@ static int vq_await(lua_State *L) {
         lua_pushvalue(L, 3);
     }
 
-	void_queue_await(queue, timeout, buffer);
+	if (void_queue_lockfree(queue)) {
+		void_queue_await(queue, timeout, buffer);
+		return 1;
+	}
+
+	// Now lock the queue
+	void_queue_lock(queue);
+
+	uint64_t popped;
+	int result = void_queue_await_sequence(queue, timeout, buffer, &popped);
 
 	void_queue_unlock(queue);
 
+	ASSERT(result != VOID_ENOMEM, "not enough memory to copy a record out of the stream");
+
+	if (!sequence)
+		return 1;
+
+	if (result > 0) {
+		lua_pushinteger(L, popped);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 2;
+}
+
+static int vq_await(lua_State *L) {
+	return vq_await_buffer(L, false);
+}
+
+// void.queue.awaitSequence(queue, [timeout, [buffer]])
+// Same as await, also returns the sequence number that acknowledges the buffer
+static int vq_await_sequence(lua_State *L) {
+	return vq_await_buffer(L, true);
+}
+
+// void.queue.ack(queue, [sequence])
+// Acknowledges a buffer of a journaled queue, or every buffer handed out so far
+static int vq_ack(lua_State *L) {
+	void_queue **queueHolder = luaL_checkudata(L, 1, "void::queue");
+	void_queue *queue = *queueHolder;
+
+	ASSERT(queue->journal, "queue is not journaled");
+
+	if (lua_isnoneornil(L, 2)) {
+		void_journal_ack_all(queue->journal);
+		lua_pushboolean(L, 1);
+	} else {
+		lua_pushboolean(L, void_journal_ack(queue->journal, luaL_checkinteger(L, 2)) == VOID_SUCCESS);
+	}
+
 	return 1;
 }
 
+// void.queue.sync(queue)
+// Writes the buffers and the checkpoint of a journaled queue to disk
+static int vq_sync(lua_State *L) {
+	void_queue **queueHolder = luaL_checkudata(L, 1, "void::queue");
+	void_queue *queue = *queueHolder;
+
+	ASSERT(queue->journal, "queue is not journaled");
+	ASSERT(void_journal_sync(queue->journal) == VOID_SUCCESS, "could not sync queue journal");
+
+	return 0;
+}
+
+// Returns the buffer at arg to point at a record, or a new one if there is none
+static void_buffer *vq_view(lua_State *L, int arg) {
+	void_buffer *view;
+
+	if (lua_isnoneornil(L, arg)) {
+		view = lua_newuserdata(L, sizeof(void_buffer));
+		void_buffer_init(view);
+		luaL_setmetatable(L, "void::buffer");
+	} else {
+		view = luaL_checkudata(L, arg, "void::buffer");
+		lua_pushvalue(L, arg);
+	}
+
+	return view;
+}
+
+static void_queue *vq_checkstream(lua_State *L) {
+	void_queue **queueHolder = luaL_checkudata(L, 1, "void::queue");
+	void_queue *queue = *queueHolder;
+
+	if (queue->mode != VOID_QUEUE_STREAM)
+		luaL_error(L, "queue is not a stream");
+
+	return queue;
+}
+
+// void.queue.reserve(queue, length, [wait, [view]])
+static int vq_reserve(lua_State *L) {
+	void_queue *queue = vq_checkstream(L);
+	lua_Integer length = luaL_checkinteger(L, 2);
+	int block = luaL_optboolean(L, 3, 0);
+
+	ASSERT(length >= 0, "invalid record length %lld", (long long)length);
+
+	void_buffer *view = vq_view(L, 4);
+
+	void_queue_lock(queue);
+	int result = void_queue_reserve(queue, length, block, view);
+	void_queue_unlock(queue);
+
+	ASSERT(result != VOID_EOUTOFRANGE, "record of %lld bytes does not fit in the stream", (long long)length);
+
+	if (!result)
+		lua_pushnil(L);
+
+	return 1;
+}
+
+// void.queue.commit(queue, view, [length])
+static int vq_commit(lua_State *L) {
+	void_queue *queue = vq_checkstream(L);
+	void_buffer *view = luaL_checkudata(L, 2, "void::buffer");
+	lua_Integer length = luaL_optinteger(L, 3, view->length);
+
+	ASSERT(length >= 0, "invalid record length %lld", (long long)length);
+
+	void_queue_lock(queue);
+	int result = void_queue_commit(queue, view, length);
+	void_queue_unlock(queue);
+
+	ASSERT(result != VOID_EWRONGTYPE, "buffer is not a reserved record of the stream");
+	ASSERT(result != VOID_EOUTOFRANGE, "length %lld is larger than the record", (long long)length);
+
+	return 0;
+}
+
+// void.queue.read(queue, [timeout, [view]])
+static int vq_read(lua_State *L) {
+	void_queue *queue = vq_checkstream(L);
+	int64_t timeout = luaL_optinteger(L, 2, 0);
+	void_buffer *view = vq_view(L, 3);
+
+	void_queue_lock(queue);
+	int result = void_queue_read(queue, timeout, view);
+	void_queue_unlock(queue);
+
+	if (!result)
+		lua_pushnil(L);
+
+	return 1;
+}
+
+// void.queue.release(queue, view)
+static int vq_release(lua_State *L) {
+	void_queue *queue = vq_checkstream(L);
+	void_buffer *view = luaL_checkudata(L, 2, "void::buffer");
+
+	void_queue_lock(queue);
+	int result = void_queue_release(queue, view);
+	void_queue_unlock(queue);
+
+	ASSERT(result != VOID_EWRONGTYPE, "buffer is not a record being read from the stream");
+
+	return 0;
+}
+
 static int vq_count(lua_State *L) {
 	void_queue **queueHolder = luaL_checkudata(L, 1, "void::queue");
 	void_queue *queue = *queueHolder;
 
 	void_queue_lock(queue);
-	lua_pushinteger(L, queue->count);
+	lua_pushinteger(L, void_queue_count(queue));
+	void_queue_unlock(queue);
+
+	return 1;
+}
+
+// void.queue.stats(queue)
+static int vq_stats(lua_State *L) {
+	void_queue **queueHolder = luaL_checkudata(L, 1, "void::queue");
+	void_queue *queue = *queueHolder;
+
+	void_queue_lock(queue);
+	unsigned int count = void_queue_count(queue);
+	unsigned int size = queue->size;
+	size_t bytes = __atomic_load_n(&queue->bytes, __ATOMIC_RELAXED);
+	size_t maxBytes = queue->maxBytes;
+	unsigned int delayed = void_queue_delayed(queue);
 	void_queue_unlock(queue);
 
+	lua_createtable(L, 0, 5);
+	lua_pushinteger(L, count);
+	lua_setfield(L, -2, "count");
+	lua_pushinteger(L, size);
+	lua_setfield(L, -2, "size");
+	lua_pushinteger(L, bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushinteger(L, maxBytes);
+	lua_setfield(L, -2, "maxBytes");
+	lua_pushinteger(L, delayed);
+	lua_setfield(L, -2, "delayed");
+
+	if (queue->journal) {
+		void_journal *journal = queue->journal;
+
+		pthread_mutex_lock(&journal->lock);
+		uint64_t written = journal->writeSequence;
+		uint64_t synced = journal->syncedSequence;
+		uint64_t checkpoint = journal->checkpoint;
+		uint64_t syncs = journal->syncs;
+		pthread_mutex_unlock(&journal->lock);
+
+		lua_pushinteger(L, written);
+		lua_setfield(L, -2, "written");
+		lua_pushinteger(L, synced);
+		lua_setfield(L, -2, "synced");
+		lua_pushinteger(L, checkpoint);
+		lua_setfield(L, -2, "checkpoint");
+		lua_pushinteger(L, syncs);
+		lua_setfield(L, -2, "syncs");
+	}
+
+	return 1;
+}
+
+// void.queue.budget([bytes])
+// Limits the bytes parked in all queues of the process, returns the previous limit
+static int vq_budget(lua_State *L) {
+	lua_pushinteger(L, void_queue_get_budget());
+
+	if (!lua_isnoneornil(L, 1)) {
+		lua_Integer bytes = luaL_checkinteger(L, 1);
+		ASSERT(bytes >= 0, "invalid budget %lld", (long long)bytes);
+		void_queue_set_budget(bytes);
+	}
+
 	return 1;
 }
 
@@ -185,7 +515,18 @@ static const luaL_Reg library[] = {
 	{"get", vq_get},
 	{"enqueue", vq_enqueue},
 	{"await", vq_await},
+	{"awaitSequence", vq_await_sequence},
+	{"reserve", vq_reserve},
+	{"commit", vq_commit},
+	{"read", vq_read},
+	{"release", vq_release},
+	{"enqueueAt", vq_enqueue_at},
+	{"enqueueAfter", vq_enqueue_after},
 	{"count", vq_count},
+	{"stats", vq_stats},
+	{"budget", vq_budget},
+	{"ack", vq_ack},
+	{"sync", vq_sync},
 	{NULL, NULL}
 };
 
@@ -0,0 +1,490 @@
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lua_compat.h"
+#include "void_rpc.h"
+
+#ifdef DEBUG
+#define DEBUG_MSG(...) fprintf(stderr, __VA_ARGS__);
+#else
+#define DEBUG_MSG(...)
+#endif
+
+#define ASSERT(what, ...) if (!(what)) return luaL_error(L, __VA_ARGS__);
+
+enum vr_state {
+	PENDING,
+	DONE,
+	// The reply was handed out by wait
+	TAKEN,
+	CANCELLED
+};
+
+typedef struct vr_client vr_client;
+typedef struct vr_future vr_future;
+
+// Owns a reply queue that servers find through the route stamped into requests
+// The uservalue is a table of in flight futures by id
+struct vr_client {
+	void_queue *replies;
+	uint32_t route;
+	uint16_t generation;
+	uint64_t nextId;
+	unsigned int inflight;
+};
+
+// The uservalue is the client, so it stays alive while its futures do
+struct vr_future {
+	uint64_t id;
+	int state;
+	void_buffer reply;
+};
+
+static int64_t vr_now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (int64_t)time.tv_sec*1000+time.tv_nsec/1000000;
+}
+
+static vr_client *vr_checkclient(lua_State *L, int arg) {
+	vr_client *client = luaL_checkudata(L, arg, "void::rpc");
+
+	if (!client->replies)
+		luaL_error(L, "rpc client was destroyed");
+
+	return client;
+}
+
+// void.rpc.client()
+static int vr_client_new(lua_State *L) {
+	vr_client *client = lua_newuserdata(L, sizeof(vr_client));
+	memset(client, 0, sizeof(vr_client));
+	luaL_setmetatable(L, "void::rpc");
+
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+
+	void_queue *queue = malloc(sizeof(void_queue));
+	ASSERT(queue, "not enough memory to allocate reply queue");
+
+	char name[64];
+	void_queue_options options;
+	memset(&options, 0, sizeof(void_queue_options));
+	options.mode = VOID_QUEUE_GROWABLE;
+	snprintf(name, sizeof(name), "void.rpc.%p", (void*)client);
+
+	if (!void_queue_init_options(queue, 0, name, &options)) {
+		free(queue);
+		return luaL_error(L, "not enough memory to allocate reply queue");
+	}
+
+	if (void_rpc_route_add(queue, &client->route, &client->generation) != VOID_SUCCESS) {
+		if (void_queue_destroy(queue))
+			free(queue);
+		return luaL_error(L, "not enough memory to register reply queue");
+	}
+
+	client->replies = queue;
+	return 1;
+}
+
+static int vr_client_destroy(lua_State *L) {
+	vr_client *client = luaL_checkudata(L, 1, "void::rpc");
+
+	if (client->replies) {
+		void_rpc_route_remove(client->route);
+
+		if (void_queue_destroy(client->replies))
+			free(client->replies);
+
+		client->replies = 0;
+	}
+
+	return 0;
+}
+
+// Waits up to timeout milliseconds for one reply and completes its future
+// Replies to cancelled or unknown calls are dropped
+// Returns 1 if a reply arrived
+static int vr_route(lua_State *L, int clientIndex, vr_client *client, int64_t timeout) {
+	void_queue *queue = client->replies;
+	void_buffer buffer;
+	void_buffer_init(&buffer);
+
+	void_queue_lock(queue);
+	void_queue_await(queue, timeout, &buffer);
+	void_queue_unlock(queue);
+
+	if (buffer.type == INVALID)
+		return 0;
+
+	void_rpc_trailer trailer;
+
+	if (!void_rpc_trailer_read(&buffer, &trailer)) {
+		void_buffer_invalidate(&buffer);
+		return 1;
+	}
+
+	void_buffer_shrink(&buffer, buffer.length-VOID_RPC_TRAILER);
+
+	lua_getuservalue(L, clientIndex);
+	lua_rawgeti(L, -1, (lua_Integer)trailer.id);
+	// future:userdata|nil inflight:table
+	vr_future *future = lua_touserdata(L, -1);
+
+	if (future && future->state == PENDING) {
+		void_buffer_move(&future->reply, &buffer);
+		future->state = DONE;
+
+		lua_pushnil(L);
+		lua_rawseti(L, -3, (lua_Integer)trailer.id);
+		client->inflight--;
+	} else {
+		void_buffer_invalidate(&buffer);
+	}
+
+	lua_pop(L, 2);
+	return 1;
+}
+
+// Milliseconds left until deadline, with a negative timeout waiting forever
+static int64_t vr_remaining(int64_t timeout, int64_t deadline) {
+	if (timeout <= 0)
+		return timeout;
+
+	int64_t remaining = deadline-vr_now();
+	return remaining > 0 ? remaining : 0;
+}
+
+// Pushes a buffer with the future's reply
+static void vr_take(lua_State *L, vr_future *future) {
+	void_buffer *buffer = lua_newuserdata(L, sizeof(void_buffer));
+	void_buffer_init(buffer);
+	void_buffer_move(buffer, &future->reply);
+	luaL_setmetatable(L, "void::buffer");
+	future->state = TAKEN;
+}
+
+// void.rpc.call(client, queue, buffer, [block = true])
+static int vr_call(lua_State *L) {
+	vr_client *client = vr_checkclient(L, 1);
+	void_queue **queueHolder = luaL_checkudata(L, 2, "void::queue");
+	void_buffer *buffer = luaL_checkudata(L, 3, "void::buffer");
+	int block = lua_isnoneornil(L, 4) ? 1 : lua_toboolean(L, 4);
+	void_queue *queue = *queueHolder;
+
+	ASSERT(queue, "queue was destroyed");
+	ASSERT(void_buffer_data(buffer), "no data associated with buffer %p", buffer);
+	ASSERT(buffer->type != VIEW, "calling with views is currently not supported");
+	ASSERT(!void_buffer_window(buffer), "buffer %p is a window into other storage", buffer);
+
+	void_rpc_trailer trailer;
+	trailer.id = ++client->nextId;
+	trailer.route = client->route;
+	trailer.generation = client->generation;
+	trailer.magic = VOID_RPC_MAGIC;
+
+	ASSERT(void_rpc_stamp(buffer, &trailer) == VOID_SUCCESS, "not enough memory to stamp request");
+
+	size_t length = buffer->length;
+	int result;
+
+	if (void_queue_lockfree(queue)) {
+		result = void_queue_enqueue(queue, buffer, block);
+	} else {
+		void_queue_lock(queue);
+		result = void_queue_enqueue(queue, buffer, block);
+		void_queue_unlock(queue);
+	}
+
+	// A request that was enqueued but not synced to the journal is still sent
+	if (result != 1 && result != VOID_ENOTDURABLE) {
+		// Leave the caller's buffer like it was
+		if (buffer->type == NORMAL && buffer->length == length)
+			void_buffer_shrink(buffer, length-VOID_RPC_TRAILER);
+
+		lua_pushnil(L);
+		lua_pushstring(L, result == 0 ? "full" : "enqueue failed");
+		return 2;
+	}
+
+	vr_future *future = lua_newuserdata(L, sizeof(vr_future));
+	future->id = trailer.id;
+	future->state = PENDING;
+	void_buffer_init(&future->reply);
+	luaL_setmetatable(L, "void::future");
+
+	lua_pushvalue(L, 1);
+	lua_setuservalue(L, -2);
+
+	lua_getuservalue(L, 1);
+	lua_pushvalue(L, -2);
+	lua_rawseti(L, -2, (lua_Integer)trailer.id);
+	lua_pop(L, 1);
+	client->inflight++;
+
+	return 1;
+}
+
+// Pushes the future's client and returns it
+static vr_client *vr_futureclient(lua_State *L, int arg) {
+	lua_getuservalue(L, arg);
+	vr_client *client = luaL_testudata(L, -1, "void::rpc");
+
+	if (!client || !client->replies)
+		luaL_error(L, "rpc client was destroyed");
+
+	return client;
+}
+
+static vr_future *vr_checkfuture(lua_State *L, int arg) {
+	vr_future *future = luaL_checkudata(L, arg, "void::future");
+
+	if (future->state == TAKEN)
+		luaL_error(L, "reply was already taken");
+	else if (future->state == CANCELLED)
+		luaL_error(L, "call was cancelled");
+
+	return future;
+}
+
+// future:wait([timeout = -1])
+static int vr_wait(lua_State *L) {
+	vr_future *future = vr_checkfuture(L, 1);
+	int64_t timeout = luaL_optinteger(L, 2, -1);
+
+	vr_client *client = vr_futureclient(L, 1);
+	int clientIndex = lua_gettop(L);
+	int64_t deadline = vr_now()+timeout;
+
+	while (future->state == PENDING) {
+		int64_t remaining = vr_remaining(timeout, deadline);
+
+		if (!vr_route(L, clientIndex, client, remaining) && remaining == 0)
+			break;
+	}
+
+	if (future->state != DONE) {
+		lua_pushnil(L);
+		lua_pushstring(L, "timeout");
+		return 2;
+	}
+
+	vr_take(L, future);
+	return 1;
+}
+
+// future:ready()
+static int vr_ready(lua_State *L) {
+	vr_future *future = vr_checkfuture(L, 1);
+
+	if (future->state == PENDING) {
+		vr_client *client = vr_futureclient(L, 1);
+		int clientIndex = lua_gettop(L);
+
+		// Routes whatever already arrived without waiting
+		while (future->state == PENDING && vr_route(L, clientIndex, client, 0));
+	}
+
+	lua_pushboolean(L, future->state == DONE);
+	return 1;
+}
+
+// future:cancel()
+static int vr_cancel(lua_State *L) {
+	vr_future *future = luaL_checkudata(L, 1, "void::future");
+
+	if (future->state == PENDING) {
+		lua_getuservalue(L, 1);
+		vr_client *client = luaL_testudata(L, -1, "void::rpc");
+
+		lua_getuservalue(L, -1);
+		lua_pushnil(L);
+		lua_rawseti(L, -2, (lua_Integer)future->id);
+
+		if (client)
+			client->inflight--;
+	}
+
+	void_buffer_invalidate(&future->reply);
+	future->state = CANCELLED;
+	return 0;
+}
+
+static int vr_future_gc(lua_State *L) {
+	vr_future *future = luaL_checkudata(L, 1, "void::future");
+	void_buffer_invalidate(&future->reply);
+	return 0;
+}
+
+// void.rpc.waitAny(futures, [timeout = -1])
+// All futures have to come from the same client
+static int vr_waitAny(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int64_t timeout = luaL_optinteger(L, 2, -1);
+	lua_Integer count = luaL_len(L, 1);
+	lua_Integer i;
+
+	ASSERT(count > 0, "no futures to wait for");
+
+	vr_client *client = 0;
+	int clientIndex = 0;
+
+	for (i=1; i<=count; i++) {
+		lua_rawgeti(L, 1, i);
+		vr_future *future = luaL_testudata(L, -1, "void::future");
+		ASSERT(future, "bad future at index %d", (int)i);
+
+		lua_getuservalue(L, -1);
+		vr_client *futureClient = lua_touserdata(L, -1);
+
+		if (!client) {
+			client = futureClient;
+			lua_remove(L, -2);
+			clientIndex = lua_gettop(L);
+		} else {
+			ASSERT(futureClient == client, "futures belong to different clients");
+			lua_pop(L, 2);
+		}
+	}
+
+	ASSERT(client && client->replies, "rpc client was destroyed");
+
+	int64_t deadline = vr_now()+timeout;
+
+	for (;;) {
+		for (i=1; i<=count; i++) {
+			lua_rawgeti(L, 1, i);
+			vr_future *future = lua_touserdata(L, -1);
+			lua_pop(L, 1);
+
+			if (future->state == DONE) {
+				lua_pushinteger(L, i);
+				vr_take(L, future);
+				return 2;
+			}
+		}
+
+		int64_t remaining = vr_remaining(timeout, deadline);
+
+		if (!vr_route(L, clientIndex, client, remaining) && remaining == 0)
+			break;
+	}
+
+	lua_pushnil(L);
+	lua_pushstring(L, "timeout");
+	return 2;
+}
+
+// void.rpc.reply(request, [reply = request])
+// Returns false if the client that made the request went away
+static int vr_reply(lua_State *L) {
+	void_buffer *request = luaL_checkudata(L, 1, "void::buffer");
+	void_buffer *reply = lua_isnoneornil(L, 2) ? request : luaL_checkudata(L, 2, "void::buffer");
+
+	void_rpc_trailer trailer;
+	ASSERT(void_rpc_trailer_read(request, &trailer), "buffer is not an rpc request");
+	ASSERT(void_buffer_data(reply), "no data associated with buffer %p", reply);
+	ASSERT(reply->type != VIEW, "replying with views is currently not supported");
+	ASSERT(!void_buffer_window(reply), "buffer %p is a window into other storage", reply);
+
+	void_queue *queue = void_rpc_route_get(trailer.route, trailer.generation);
+
+	if (!queue) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	int result = VOID_SUCCESS;
+
+	if (reply != request)
+		result = void_rpc_stamp(reply, &trailer);
+
+	if (result == VOID_SUCCESS) {
+		void_queue_lock(queue);
+		result = void_queue_enqueue(queue, reply, 1);
+		void_queue_unlock(queue);
+	}
+
+	if (void_queue_destroy(queue))
+		free(queue);
+
+	ASSERT(result == 1, "could not send reply");
+
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+// void.rpc.length(request)
+static int vr_length(lua_State *L) {
+	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
+	void_rpc_trailer trailer;
+
+	ASSERT(void_rpc_trailer_read(buffer, &trailer), "buffer is not an rpc request");
+
+	lua_pushinteger(L, buffer->length-VOID_RPC_TRAILER);
+	return 1;
+}
+
+// void.rpc.inflight(client)
+static int vr_inflight(lua_State *L) {
+	vr_client *client = vr_checkclient(L, 1);
+
+	lua_pushinteger(L, client->inflight);
+	return 1;
+}
+
+static const luaL_Reg library[] = {
+	{"client", vr_client_new},
+	{"destroy", vr_client_destroy},
+	{"call", vr_call},
+	{"waitAny", vr_waitAny},
+	{"reply", vr_reply},
+	{"length", vr_length},
+	{"inflight", vr_inflight},
+	{NULL, NULL}
+};
+
+static const luaL_Reg clientMetatable[] = {
+	{"__gc", vr_client_destroy},
+	{NULL, NULL}
+};
+
+static const luaL_Reg futureMethods[] = {
+	{"wait", vr_wait},
+	{"ready", vr_ready},
+	{"cancel", vr_cancel},
+	{NULL, NULL}
+};
+
+static void vr_make_metatables(lua_State *L) {
+	luaL_newmetatable(L, "void::rpc");
+	// void::rpc:metatable
+	luaL_setfuncs(L, clientMetatable, 0);
+	lua_pop(L, 1);
+	// nothing
+
+	luaL_newmetatable(L, "void::future");
+	// void::future:metatable
+	lua_pushcfunction(L, vr_future_gc);
+	lua_setfield(L, -2, "__gc");
+	luaL_newlib(L, futureMethods);
+	// methods:table void::future:metatable
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+	// nothing
+}
+
+int lvoid_rpc_open(lua_State *L) {
+	vr_make_metatables(L);
+	luaL_newlib(L, library);
+	// void.rpc:table
+
+	return 1;
+	// void.rpc:table
+}
@@ -0,0 +1,404 @@
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <malloc.h>
+#include <string.h>
+
+#include "lua_compat.h"
+#include "void_buffer.h"
+#include "void_memory.h"
+#include "void_pack.h"
+
+#define ASSERT(what, ...) if (!(what)) return luaL_error(L, __VA_ARGS__);
+
+extern void_buffer *lvoid_buffer_new(lua_State *L, void *data, size_t length, int origin);
+
+// Serialized values start with one of these tags
+// Integers are zigzag varints, lengths and counts are varints and floats are little endian doubles
+enum vs_tag {
+	TAG_NIL,
+	TAG_FALSE,
+	TAG_TRUE,
+	TAG_INTEGER,
+	TAG_FLOAT,
+	// Length, bytes
+	TAG_STRING,
+	// Length, bytes, deserialized as a new buffer
+	TAG_BUFFER,
+	// Array count, array values, key value pairs, TAG_END
+	TAG_TABLE,
+	// Index of an earlier table in the order tables were first written
+	TAG_REFERENCE,
+	TAG_END
+};
+
+// Nesting deeper than this is most likely a mistake and would exhaust the C stack
+#define MAX_DEPTH 200
+#define INITIAL_SIZE 64
+
+typedef struct vs_writer vs_writer;
+
+struct vs_writer {
+	lua_State *L;
+	void_buffer *buffer;
+	size_t position;
+	// Stack index of the table that maps tables to their reference index
+	int seen;
+	lua_Integer tables;
+};
+
+// Makes room for size more bytes, growing the buffer geometrically
+static unsigned char *vs_reserve(vs_writer *writer, size_t size) {
+	void_buffer *buffer = writer->buffer;
+
+	if (buffer->length-writer->position < size) {
+		size_t length = buffer->length*2;
+		if (length < writer->position+size) length = writer->position+size;
+		if (length < INITIAL_SIZE) length = INITIAL_SIZE;
+
+		if (void_buffer_grow(buffer, length) != VOID_SUCCESS) {
+			luaL_error(writer->L, "not enough memory to grow buffer to %I bytes", (lua_Integer)length);
+		}
+	}
+
+	return (unsigned char*)void_buffer_data(buffer)+writer->position;
+}
+
+static void vs_write_tag(vs_writer *writer, unsigned char tag) {
+	*vs_reserve(writer, 1) = tag;
+	writer->position++;
+}
+
+static void vs_write_varint(vs_writer *writer, uint64_t value) {
+	writer->position += void_pack_varint(vs_reserve(writer, VOID_PACK_MAXVARINT), value);
+}
+
+static void vs_write_bytes(vs_writer *writer, unsigned char tag, const void *data, size_t length) {
+	unsigned char *dest = vs_reserve(writer, 1+VOID_PACK_MAXVARINT+length);
+	*dest = tag;
+	size_t prefix = 1+void_pack_varint(dest+1, length);
+	memcpy(dest+prefix, data, length);
+	writer->position += prefix+length;
+}
+
+static void vs_write(vs_writer *writer, int index, int depth);
+
+static void vs_write_table(vs_writer *writer, int index, int depth) {
+	lua_State *L = writer->L;
+
+	if (depth > MAX_DEPTH) {
+		luaL_error(L, "table nesting too deep to serialize");
+	}
+
+	// Tables seen before are written as references, which keeps shared tables and cycles intact
+	lua_pushvalue(L, index);
+	lua_rawget(L, writer->seen);
+	if (!lua_isnil(L, -1)) {
+		lua_Integer reference = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		vs_write_tag(writer, TAG_REFERENCE);
+		vs_write_varint(writer, reference);
+		return;
+	}
+	lua_pop(L, 1);
+
+	lua_pushvalue(L, index);
+	lua_pushinteger(L, writer->tables++);
+	lua_rawset(L, writer->seen);
+
+	luaL_checkstack(L, 3, "table nesting too deep to serialize");
+
+	// The array part is written without keys
+	lua_Integer count = lua_rawlen(L, index);
+	vs_write_tag(writer, TAG_TABLE);
+	vs_write_varint(writer, count);
+
+	lua_Integer i;
+	for (i=1; i<=count; i++) {
+		lua_rawgeti(L, index, i);
+		vs_write(writer, lua_gettop(L), depth+1);
+		lua_pop(L, 1);
+	}
+
+	lua_pushnil(L);
+	while (lua_next(L, index)) {
+		// value key
+		if (lua_isinteger(L, -2)) {
+			lua_Integer key = lua_tointeger(L, -2);
+			if (key >= 1 && key <= count) {
+				lua_pop(L, 1);
+				continue;
+			}
+		}
+
+		vs_write(writer, lua_gettop(L)-1, depth+1);
+		vs_write(writer, lua_gettop(L), depth+1);
+		lua_pop(L, 1);
+		// key
+	}
+
+	vs_write_tag(writer, TAG_END);
+}
+
+static void vs_write(vs_writer *writer, int index, int depth) {
+	lua_State *L = writer->L;
+
+	switch (lua_type(L, index)) {
+		case LUA_TNIL:
+			vs_write_tag(writer, TAG_NIL);
+			break;
+		case LUA_TBOOLEAN:
+			vs_write_tag(writer, lua_toboolean(L, index) ? TAG_TRUE : TAG_FALSE);
+			break;
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, index)) {
+				vs_write_tag(writer, TAG_INTEGER);
+				vs_write_varint(writer, void_zigzag_encode(lua_tointeger(L, index)));
+			} else {
+				double value = lua_tonumber(L, index);
+				unsigned char *dest = vs_reserve(writer, 1+sizeof(double));
+				*dest = TAG_FLOAT;
+				void_pack_bytes(dest+1, (unsigned char*)&value, sizeof(double), __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__);
+				writer->position += 1+sizeof(double);
+			}
+			break;
+		case LUA_TSTRING: {
+			size_t length;
+			const char *str = lua_tolstring(L, index, &length);
+			vs_write_bytes(writer, TAG_STRING, str, length);
+			break;
+		}
+		case LUA_TTABLE:
+			vs_write_table(writer, index, depth);
+			break;
+		case LUA_TUSERDATA: {
+			void_buffer *buffer = luaL_testudata(L, index, "void::buffer");
+			if (buffer) {
+				void *data = void_buffer_data(buffer);
+				if (!data) {
+					luaL_error(L, "no data associated with buffer %p", buffer);
+				}
+				if (buffer == writer->buffer) {
+					luaL_error(L, "cannot serialize a buffer into itself");
+				}
+				vs_write_bytes(writer, TAG_BUFFER, data, buffer->length);
+				break;
+			}
+		}
+		// Fall through
+		default:
+			luaL_error(L, "cannot serialize a %s", luaL_typename(L, index));
+	}
+}
+
+// void.serialize(value, [into])
+// Returns the buffer and the number of bytes written to it
+static int vs_serialize(lua_State *L) {
+	luaL_checkany(L, 1);
+	lua_settop(L, 2);
+
+	vs_writer writer;
+	writer.L = L;
+	writer.position = 0;
+	writer.tables = 0;
+
+	int created = lua_isnil(L, 2);
+
+	if (created) {
+		void *data = malloc(INITIAL_SIZE);
+		ASSERT(data, "not enough memory for %d byte allocation", INITIAL_SIZE);
+		writer.buffer = lvoid_buffer_new(L, data, INITIAL_SIZE, VOID_ORIGIN_SERIALIZE);
+		lua_replace(L, 2);
+	} else {
+		writer.buffer = luaL_checkudata(L, 2, "void::buffer");
+		ASSERT(writer.buffer->type == NORMAL && !writer.buffer->normal.shared && void_buffer_writable(writer.buffer),
+			"cannot serialize into buffer %p, it must be a writable buffer that owns its data", writer.buffer);
+	}
+
+	lua_newtable(L);
+	writer.seen = lua_gettop(L);
+
+	vs_write(&writer, 1, 0);
+
+	lua_pop(L, 1);
+
+	// New buffers are trimmed, buffers passed in keep their size so they can be reused
+	if (created) {
+		void_buffer_shrink(writer.buffer, writer.position);
+	}
+
+	lua_pushinteger(L, writer.position);
+	return 2;
+}
+
+typedef struct vs_reader vs_reader;
+
+struct vs_reader {
+	lua_State *L;
+	const unsigned char *data;
+	size_t length;
+	size_t position;
+	// Stack index of the table that maps reference indexes to tables
+	int tables;
+	lua_Integer count;
+};
+
+static void vs_malformed(vs_reader *reader) {
+	luaL_error(reader->L, "malformed serialized data at offset %I", (lua_Integer)reader->position);
+}
+
+static uint64_t vs_read_varint(vs_reader *reader) {
+	uint64_t value;
+	size_t read = void_unpack_varint(reader->data+reader->position, reader->length-reader->position, &value);
+	if (!read) {
+		vs_malformed(reader);
+	}
+	reader->position += read;
+	return value;
+}
+
+// Reads a length and checks that many bytes follow
+static size_t vs_read_length(vs_reader *reader) {
+	uint64_t length = vs_read_varint(reader);
+	if (length > reader->length-reader->position) {
+		vs_malformed(reader);
+	}
+	return length;
+}
+
+static void vs_read(vs_reader *reader, int depth) {
+	lua_State *L = reader->L;
+
+	if (reader->position >= reader->length) {
+		vs_malformed(reader);
+	}
+
+	unsigned char tag = reader->data[reader->position++];
+
+	switch (tag) {
+		case TAG_NIL:
+			lua_pushnil(L);
+			break;
+		case TAG_FALSE:
+		case TAG_TRUE:
+			lua_pushboolean(L, tag == TAG_TRUE);
+			break;
+		case TAG_INTEGER:
+			lua_pushinteger(L, void_zigzag_decode(vs_read_varint(reader)));
+			break;
+		case TAG_FLOAT: {
+			double value;
+			if (reader->length-reader->position < sizeof(double)) {
+				vs_malformed(reader);
+			}
+			void_pack_bytes((unsigned char*)&value, reader->data+reader->position, sizeof(double), __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__);
+			reader->position += sizeof(double);
+			lua_pushnumber(L, value);
+			break;
+		}
+		case TAG_STRING: {
+			size_t length = vs_read_length(reader);
+			lua_pushlstring(L, (const char*)reader->data+reader->position, length);
+			reader->position += length;
+			break;
+		}
+		case TAG_BUFFER: {
+			size_t length = vs_read_length(reader);
+			void *data = malloc(length);
+			if (!data) {
+				luaL_error(L, "not enough memory for %I byte allocation", (lua_Integer)length);
+			}
+			memcpy(data, reader->data+reader->position, length);
+			lvoid_buffer_new(L, data, length, VOID_ORIGIN_SERIALIZE);
+			reader->position += length;
+			break;
+		}
+		case TAG_TABLE: {
+			if (depth > MAX_DEPTH) {
+				luaL_error(L, "table nesting too deep to deserialize");
+			}
+			luaL_checkstack(L, 3, "table nesting too deep to deserialize");
+
+			// Every array value takes up at least one byte
+			uint64_t count = vs_read_length(reader);
+
+			lua_createtable(L, count, 0);
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, reader->tables, reader->count++);
+
+			uint64_t i;
+			for (i=1; i<=count; i++) {
+				vs_read(reader, depth+1);
+				lua_rawseti(L, -2, i);
+			}
+
+			while (1) {
+				if (reader->position >= reader->length) {
+					vs_malformed(reader);
+				}
+				if (reader->data[reader->position] == TAG_END) {
+					reader->position++;
+					break;
+				}
+
+				size_t keyPosition = reader->position;
+				vs_read(reader, depth+1);
+				vs_read(reader, depth+1);
+				if (lua_isnil(L, -2)) {
+					reader->position = keyPosition;
+					vs_malformed(reader);
+				}
+				lua_rawset(L, -3);
+			}
+			break;
+		}
+		case TAG_REFERENCE: {
+			uint64_t reference = vs_read_varint(reader);
+			if (reference >= (uint64_t)reader->count) {
+				vs_malformed(reader);
+			}
+			lua_rawgeti(L, reader->tables, reference);
+			break;
+		}
+		default:
+			reader->position--;
+			vs_malformed(reader);
+	}
+}
+
+// void.deserialize(buffer, [offset])
+// Returns the value and the offset after it
+static int vs_deserialize(lua_State *L) {
+	void_buffer *buffer = luaL_checkudata(L, 1, "void::buffer");
+	lua_Integer offset = luaL_optinteger(L, 2, 0);
+	const unsigned char *data = void_buffer_data(buffer);
+
+	ASSERT(data, "no data associated with buffer %p", buffer);
+	ASSERT(offset >= 0 && offset <= buffer->length, "offset %I out of range", offset);
+
+	vs_reader reader;
+	reader.L = L;
+	reader.data = data;
+	reader.length = buffer->length;
+	reader.position = offset;
+	reader.count = 0;
+
+	lua_newtable(L);
+	reader.tables = lua_gettop(L);
+
+	vs_read(&reader, 0);
+
+	lua_pushinteger(L, reader.position);
+	return 2;
+}
+
+int lvoid_serialize_open(lua_State *L) {
+	// void:table
+	lua_pushcfunction(L, vs_serialize);
+	lua_setfield(L, -2, "serialize");
+	lua_pushcfunction(L, vs_deserialize);
+	lua_setfield(L, -2, "deserialize");
+
+	return 0;
+}
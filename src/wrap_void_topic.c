@@ -0,0 +1,239 @@
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "void_topic.h"
+
+#define ASSERT(what, ...) if (!(what)) return luaL_error(L, __VA_ARGS__);
+
+static const char *policies[] = {"block", "dropOldest", "disconnect", NULL};
+
+static void_topic *vt_checktopic(lua_State *L, int index) {
+	void_topic **topicHolder = luaL_checkudata(L, index, "void::topic");
+	luaL_argcheck(L, *topicHolder, index, "topic has been destroyed");
+	return *topicHolder;
+}
+
+// void.topic.create(size, [name, [options]])
+static int vt_create(lua_State *L) {
+	unsigned int size = luaL_checkinteger(L, 1);
+	const char *name = luaL_optstring(L, 2, NULL);
+	int policy = VOID_TOPIC_BLOCK;
+	char fmtname[64];
+
+	ASSERT(size > 0, "topic size must be positive");
+
+	if (!lua_isnoneornil(L, 3)) {
+		luaL_checktype(L, 3, LUA_TTABLE);
+
+		lua_getfield(L, 3, "policy");
+		if (!lua_isnil(L, -1)) {
+			policy = luaL_checkoption(L, -1, NULL, policies);
+		}
+		lua_pop(L, 1);
+	}
+
+	void_topic *topic = malloc(sizeof(void_topic));
+
+	ASSERT(topic, "not enough memory to allocate topic object");
+
+	if (name == NULL) {
+		snprintf(fmtname, 64, "topic%p", (void*)topic);
+		name = fmtname;
+	}
+
+	if (!void_topic_init(topic, size, name, policy)) {
+		free(topic);
+		ASSERT(false, "not enough memory to allocate topic data");
+	}
+
+	void_topic **topicHolder = lua_newuserdata(L, sizeof(void_topic*));
+	*topicHolder = topic;
+
+	luaL_setmetatable(L, "void::topic");
+	lua_pushstring(L, name);
+
+	return 2;
+}
+
+static int vt_destroy(lua_State *L) {
+	void_topic **topicHolder = luaL_checkudata(L, 1, "void::topic");
+
+	if (*topicHolder) {
+		if (void_topic_destroy(*topicHolder)) {
+			free(*topicHolder);
+		}
+
+		*topicHolder = 0;
+	}
+
+	return 0;
+}
+
+static int vt_get(lua_State *L) {
+	const char *name = luaL_checkstring(L, 1);
+
+	void_topic *topic = void_topic_get(name);
+
+	if (!topic) {
+		lua_pushnil(L);
+	} else {
+		pthread_mutex_lock(&topic->lock);
+		topic->refcount++;
+		pthread_mutex_unlock(&topic->lock);
+
+		void_topic **topicHolder = lua_newuserdata(L, sizeof(void_topic*));
+		*topicHolder = topic;
+
+		luaL_setmetatable(L, "void::topic");
+	}
+
+	return 1;
+}
+
+// void.topic.publish(topic, buffer, [block])
+static int vt_publish(lua_State *L) {
+	void_topic *topic = vt_checktopic(L, 1);
+	void_buffer *buffer = luaL_checkudata(L, 2, "void::buffer");
+	int block = lua_toboolean(L, 3);
+
+	ASSERT(void_buffer_data(buffer), "no data associated with buffer %p", buffer);
+	ASSERT(buffer->type == NORMAL, "publishing views is currently not supported");
+
+	int result = void_topic_publish(topic, buffer, block);
+
+	ASSERT(result != VOID_EWRONGTYPE, "buffer %p shares its storage with other buffers", buffer);
+	ASSERT(result >= 0, "could not publish buffer %p (%d)", buffer, result);
+
+	lua_pushboolean(L, result);
+	return 1;
+}
+
+// void.topic.subscribe(topic)
+static int vt_subscribe(lua_State *L) {
+	void_topic *topic = vt_checktopic(L, 1);
+
+	void_topic_subscriber *subscriber = lua_newuserdata(L, sizeof(void_topic_subscriber));
+	memset(subscriber, 0, sizeof(void_topic_subscriber));
+	void_topic_subscribe(topic, subscriber);
+
+	luaL_setmetatable(L, "void::subscriber");
+
+	return 1;
+}
+
+static int vt_unsubscribe(lua_State *L) {
+	void_topic_subscriber *subscriber = luaL_checkudata(L, 1, "void::subscriber");
+	void_topic *topic = subscriber->topic;
+
+	if (void_topic_unsubscribe(subscriber)) {
+		free(topic);
+	}
+
+	return 0;
+}
+
+// void.topic.receive(subscriber, [timeout, [buffer]])
+static int vt_receive(lua_State *L) {
+	void_topic_subscriber *subscriber = luaL_checkudata(L, 1, "void::subscriber");
+	int64_t timeout = luaL_optinteger(L, 2, 0);
+	void_buffer *buffer = lua_isnoneornil(L, 3) ? NULL : luaL_checkudata(L, 3, "void::buffer");
+
+	if (!buffer) {
+		buffer = lua_newuserdata(L, sizeof(void_buffer));
+		void_buffer_init(buffer);
+		luaL_setmetatable(L, "void::buffer");
+	} else {
+		lua_pushvalue(L, 3);
+	}
+
+	int result = void_topic_receive(subscriber, timeout, buffer);
+
+	if (result == 1) {
+		return 1;
+	}
+
+	lua_pushnil(L);
+	lua_pushstring(L, result == VOID_EDISCONNECTED ? "disconnected" : "timeout");
+	return 2;
+}
+
+// void.topic.stats(subscriber)
+static int vt_stats(lua_State *L) {
+	void_topic_subscriber *subscriber = luaL_checkudata(L, 1, "void::subscriber");
+	void_topic *topic = subscriber->topic;
+
+	uint64_t lag = 0;
+	uint64_t dropped = subscriber->dropped;
+	int connected = 0;
+
+	if (topic) {
+		pthread_mutex_lock(&topic->lock);
+		lag = topic->writeSeq-subscriber->readSeq;
+		dropped = subscriber->dropped;
+		connected = subscriber->connected;
+		pthread_mutex_unlock(&topic->lock);
+	}
+
+	lua_createtable(L, 0, 3);
+	lua_pushinteger(L, lag);
+	lua_setfield(L, -2, "lag");
+	lua_pushinteger(L, dropped);
+	lua_setfield(L, -2, "dropped");
+	lua_pushboolean(L, connected);
+	lua_setfield(L, -2, "connected");
+
+	return 1;
+}
+
+static const luaL_Reg library[] = {
+	{"create", vt_create},
+	{"destroy", vt_destroy},
+	{"get", vt_get},
+	{"publish", vt_publish},
+	{"subscribe", vt_subscribe},
+	{"unsubscribe", vt_unsubscribe},
+	{"receive", vt_receive},
+	{"stats", vt_stats},
+	{NULL, NULL}
+};
+
+static const luaL_Reg topicMetatable[] = {
+	{"__gc", vt_destroy},
+	{NULL, NULL}
+};
+
+static const luaL_Reg subscriberMetatable[] = {
+	{"__gc", vt_unsubscribe},
+	{NULL, NULL}
+};
+
+static void vt_make_metatable(lua_State *L) {
+	luaL_newmetatable(L, "void::topic");
+	// void::topic:metatable
+	luaL_setfuncs(L, topicMetatable, 0);
+	// void::topic:metatable
+	lua_pop(L, 1);
+	// nothing
+
+	luaL_newmetatable(L, "void::subscriber");
+	// void::subscriber:metatable
+	luaL_setfuncs(L, subscriberMetatable, 0);
+	// void::subscriber:metatable
+	lua_pop(L, 1);
+	// nothing
+}
+
+int lvoid_topic_open(lua_State *L) {
+	vt_make_metatable(L);
+	luaL_newlib(L, library);
+	// void.topic:table
+
+	return 1;
+	// void.topic:table
+}
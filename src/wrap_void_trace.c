@@ -0,0 +1,125 @@
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "void_trace.h"
+
+#define ASSERT(what, ...) if (!(what)) return luaL_error(L, __VA_ARGS__);
+
+// void.trace.start([options])
+static int vt_start(lua_State *L) {
+	lua_Integer events = 0;
+
+	if (!lua_isnoneornil(L, 1)) {
+		luaL_checktype(L, 1, LUA_TTABLE);
+
+		lua_getfield(L, 1, "events");
+		events = luaL_optinteger(L, -1, 0);
+		lua_pop(L, 1);
+	}
+
+	ASSERT(events >= 0 && events <= 1<<24, "invalid event count %lld", (long long)events);
+
+	void_trace_start(events);
+	return 0;
+}
+
+// void.trace.stop([path])
+static int vt_stop(lua_State *L) {
+	const char *path = luaL_optstring(L, 1, NULL);
+
+	void_trace_stop();
+
+	if (path) {
+		FILE *out = fopen(path, "w");
+		ASSERT(out, "could not open %s: %s", path, strerror(errno));
+
+		size_t count = void_trace_write(out);
+		int failed = ferror(out);
+
+		ASSERT(fclose(out) == 0 && !failed, "could not write %s", path);
+
+		lua_pushinteger(L, count);
+		return 1;
+	}
+
+	// The JSON goes through a temporary file, its size is not known up front
+	FILE *out = tmpfile();
+	ASSERT(out, "could not create temporary file: %s", strerror(errno));
+
+	size_t count = void_trace_write(out);
+	long length = ftell(out);
+	char *json = length > 0 ? malloc(length) : 0;
+
+	if (!json || fseek(out, 0, SEEK_SET) || fread(json, 1, length, out) != (size_t)length) {
+		free(json);
+		fclose(out);
+		ASSERT(0, "could not read back the trace");
+	}
+
+	fclose(out);
+	lua_pushlstring(L, json, length);
+	free(json);
+	lua_pushinteger(L, count);
+	return 2;
+}
+
+// void.trace.enabled()
+static int vt_enabled(lua_State *L) {
+	lua_pushboolean(L, void_trace_enabled());
+	return 1;
+}
+
+// void.trace.begin()
+// Returns nil while tracing is stopped, so the finish call can be skipped
+static int vt_begin(lua_State *L) {
+	if (!void_trace_enabled())
+		return 0;
+
+	lua_pushinteger(L, void_trace_clock());
+	return 1;
+}
+
+// void.trace.finish(name, start, [label, [value]])
+static int vt_finish(lua_State *L) {
+	const char *name = luaL_checkstring(L, 1);
+	lua_Integer start = luaL_checkinteger(L, 2);
+	const char *label = luaL_optstring(L, 3, NULL);
+	int hasValue = !lua_isnoneornil(L, 4);
+	lua_Integer value = luaL_optinteger(L, 4, 0);
+
+	if (!void_trace_enabled())
+		return 0;
+
+	const char *interned = void_trace_intern(name);
+	ASSERT(interned, "not enough memory to record %s", name);
+
+	void_trace_complete("lua", interned, label, start, hasValue ? "value" : NULL, value);
+	return 0;
+}
+
+static const luaL_Reg library[] = {
+	{"start", vt_start},
+	{"stop", vt_stop},
+	{"enabled", vt_enabled},
+	{"begin", vt_begin},
+	{"finish", vt_finish},
+	{NULL, NULL}
+};
+
+int lvoid_trace_open(lua_State *L) {
+	// The FFI backend reads the flag straight out of memory (see void/ffi.lua)
+	lua_pushlightuserdata(L, &void_trace_active);
+	lua_setfield(L, LUA_REGISTRYINDEX, "void::trace");
+
+	luaL_newlib(L, library);
+	// void.trace:table
+
+	return 1;
+	// void.trace:table
+}
@@ -87,4 +87,364 @@ function suite.test_clone_range()
 	lunatest.assert_equal(void.buffer.asString(copy), strclone)
 end
 
+function suite.test_memstats()
+	local before = void.buffer.memstats()
+	local buffer = void.buffer.create(100)
+	local after = void.buffer.memstats()
+	lunatest.assert_equal(before.bytes+100, after.bytes)
+	lunatest.assert_equal(before.origins.create.count+1, after.origins.create.count)
+	lunatest.assert_gte(after.bytes, after.peak)
+
+	void.buffer.invalidate(buffer)
+	lunatest.assert_equal(before.bytes, void.buffer.memstats().bytes)
+end
+
+function suite.test_memstats_sampling()
+	void.buffer.sampling(1)
+	local buffer = void.buffer.fromString("sampled")
+	void.buffer.sampling(0)
+
+	local found = false
+	for _, sample in ipairs(void.buffer.memstats().samples) do
+		if sample.origin == "fromString" and sample.size == 7 then
+			found = true
+			lunatest.assert_string(sample.trace)
+		end
+	end
+	lunatest.assert_true(found)
+
+	void.buffer.invalidate(buffer)
+	lunatest.assert_equal(#void.buffer.memstats().samples, 0)
+end
+
+function suite.test_pack_unpack()
+	local formats = {
+		{"<i4 >I2 b B", -5, 513, -1, 255},
+		{"!8 B d h j", 1, 0.5, -2, 1234567890123},
+		{"<s1 z c5 x Xi4 f", "size", "zero", "fixed", 1.5},
+		{">i16 I3 =n", -1, 0xABCDEF, 2.25},
+	}
+
+	for _, case in ipairs(formats) do
+		local fmt = case[1]
+		local expected = string.pack(fmt, table.unpack(case, 2))
+		local buffer = void.buffer.create(#expected+4)
+
+		lunatest.assert_equal(void.buffer.pack(buffer, 2, fmt, table.unpack(case, 2)), #expected+2)
+		lunatest.assert_equal(void.buffer.asString(buffer):sub(3, #expected+2), expected)
+
+		local values = table.pack(void.buffer.unpack(buffer, 2, fmt))
+		lunatest.assert_equal(values.n, #case)
+		lunatest.assert_equal(values[values.n], #expected+2)
+		for i=2, #case do
+			lunatest.assert_equal(values[i-1], case[i])
+		end
+	end
+
+	lunatest.assert_equal(void.buffer.packsize("!4 b i4 d"), string.packsize("!4 b i4 d"))
+	lunatest.assert_error(void.buffer.packsize, "s")
+end
+
+function suite.test_pack_varints()
+	local buffer = void.buffer.create(32)
+	-- V is an unsigned LEB128 varint and v a zigzag signed one
+	lunatest.assert_equal(void.buffer.pack(buffer, 0, "V v V v <I2", 300, -2, 0, 63, 7), 7)
+	lunatest.assert_equal(void.buffer.asString(buffer):sub(1, 5), "\xac\x02\x03\x00\x7e")
+
+	local a, b, c, d, e, after = void.buffer.unpack(buffer, 0, "V v V v <I2")
+	lunatest.assert_equal(a, 300)
+	lunatest.assert_equal(b, -2)
+	lunatest.assert_equal(c, 0)
+	lunatest.assert_equal(d, 63)
+	lunatest.assert_equal(e, 7)
+	lunatest.assert_equal(after, 7)
+
+	void.buffer.pack(buffer, 0, "V v", -1, math.mininteger)
+	local big, small = void.buffer.unpack(buffer, 0, "V v")
+	lunatest.assert_equal(big, -1)
+	lunatest.assert_equal(small, math.mininteger)
+
+	lunatest.assert_error(void.buffer.packsize, "V")
+	lunatest.assert_error(void.buffer.pack, void.buffer.create(1), 0, "V", 300)
+	-- The last byte still has its continuation bit set
+	lunatest.assert_error(void.buffer.unpack, void.buffer.fromString "\x80\x80", 0, "V")
+end
+
+function suite.test_pack_errors()
+	local buffer = void.buffer.create(4)
+	lunatest.assert_error(void.buffer.pack, buffer, 0, "i8", 1)
+	lunatest.assert_error(void.buffer.pack, buffer, 0, "s1", "too long")
+	lunatest.assert_error(void.buffer.pack, buffer, 0, "b", 200)
+	lunatest.assert_error(void.buffer.pack, buffer, 0, "q", 1)
+	lunatest.assert_error(void.buffer.unpack, buffer, 3, "I2")
+
+	void.buffer.pack(buffer, 0, "c4", "abcd")
+	lunatest.assert_error(void.buffer.unpack, buffer, 0, "z")
+
+	void.buffer.pack(buffer, 0, "<I2 I2", 0xFFFF, 4)
+	lunatest.assert_error(void.buffer.unpack, buffer, 0, "<s2")
+end
+
+function suite.test_cursors()
+	local buffer = void.buffer.create(32)
+	local writer = void.buffer.writer(buffer)
+	writer:write("u32le", 7, "u16be", 0x0102, "f64", 1.5)
+	writer:s8(-1):bytes("hey")
+	lunatest.assert_equal(writer:tell(), 18)
+	lunatest.assert_equal(writer:remaining(), 14)
+	lunatest.assert_equal(void.buffer.getU8(buffer, 4), 1)
+
+	local reader = void.buffer.reader(buffer)
+	local a, b, c = reader:read("u32le", "u16be", "f64")
+	lunatest.assert_equal(a, 7)
+	lunatest.assert_equal(b, 0x0102)
+	lunatest.assert_equal(c, 1.5)
+	lunatest.assert_equal(reader:s8(), -1)
+	lunatest.assert_equal(reader:bytes(3), "hey")
+	lunatest.assert_equal(reader:remaining(), 14)
+	lunatest.assert_error(function() reader:skip(15) end)
+
+	-- Sub readers stop at their own end
+	reader = void.buffer.reader(buffer, 4)
+	local sub = reader:sub(2)
+	lunatest.assert_equal(reader:tell(), 6)
+	lunatest.assert_equal(sub:u16be(), 0x0102)
+	lunatest.assert_equal(sub:remaining(), 0)
+	lunatest.assert_error(function() sub:u8() end)
+	lunatest.assert_equal(sub:buffer(), buffer)
+
+	lunatest.assert_error(function() reader:read("u24") end)
+
+	void.buffer.invalidate(buffer)
+	lunatest.assert_error(function() reader:u8() end)
+end
+
+function suite.test_ranges()
+	local str = "Hello, World!"
+	local buffer = void.buffer.fromString(str)
+	for _, range in ipairs{{1, -1}, {1, 5}, {-6, -2}, {8}, {0, 3}, {5, 2}, {20, 30}, {-30, 2}} do
+		lunatest.assert_equal(str:sub(range[1], range[2]), void.buffer.asString(buffer, range[1], range[2]))
+		lunatest.assert_equal(str:sub(range[1], range[2]), void.buffer.asString(void.buffer.clone(buffer, range[1], range[2])))
+	end
+end
+
+function suite.test_copy_fill()
+	local buffer = void.buffer.fromString("abcdefgh")
+	local other = void.buffer.fromString("XY")
+
+	void.buffer.copy(buffer, 6, other)
+	lunatest.assert_equal("abcdefXY", void.buffer.asString(buffer))
+
+	-- Overlapping move to the right
+	void.buffer.copy(buffer, 2, buffer, 0, 4)
+	lunatest.assert_equal("ababcdXY", void.buffer.asString(buffer))
+
+	void.buffer.fill(buffer, 0x2E, 1, 3)
+	lunatest.assert_equal("a...cdXY", void.buffer.asString(buffer))
+	void.buffer.fill(buffer, 0x2D, 6)
+	lunatest.assert_equal("a...cd--", void.buffer.asString(buffer))
+
+	lunatest.assert_error(function() void.buffer.copy(buffer, 7, other) end)
+	lunatest.assert_error(function() void.buffer.copy(buffer, 0, other, 1, 2) end)
+	lunatest.assert_error(function() void.buffer.fill(buffer, 0, 4, 5) end)
+end
+
+function suite.test_compare_find()
+	local a = void.buffer.fromString("abc")
+	lunatest.assert_true(void.buffer.equals(a, void.buffer.fromString("abc")))
+	lunatest.assert_false(void.buffer.equals(a, void.buffer.fromString("abcd")))
+	lunatest.assert_equal(0, void.buffer.compare(a, void.buffer.fromString("abc")))
+	lunatest.assert_equal(-1, void.buffer.compare(a, void.buffer.fromString("abd")))
+	lunatest.assert_equal(-1, void.buffer.compare(a, void.buffer.fromString("abcd")))
+	lunatest.assert_equal(1, void.buffer.compare(a, void.buffer.fromString("ab")))
+
+	local buffer = void.buffer.fromString("one\r\ntwo\r\nthree")
+	lunatest.assert_equal(3, void.buffer.find(buffer, "\r\n"))
+	lunatest.assert_equal(8, void.buffer.find(buffer, "\r\n", 4))
+	lunatest.assert_equal(8, void.buffer.find(buffer, void.buffer.fromString("\r\nthree")))
+	lunatest.assert_equal(5, void.buffer.find(buffer, "t", 1))
+	lunatest.assert_nil(void.buffer.find(buffer, "\r\n", 9))
+	lunatest.assert_nil(void.buffer.find(buffer, "four"))
+	lunatest.assert_equal(2, void.buffer.find(buffer, "", 2))
+
+	-- Long enough to go through the 16 byte blocks, with first byte and last byte near misses before the match
+	local long = string.rep("ab-x", 20) .. "abcx" .. string.rep("-", 7)
+	local found = void.buffer.find(void.buffer.fromString(long), "abcx")
+	lunatest.assert_equal(long:find("abcx", 1, true)-1, found)
+	lunatest.assert_equal("abcx", void.buffer.asString(void.buffer.fromString(long), found+1, found+4))
+	lunatest.assert_nil(void.buffer.find(void.buffer.fromString(long), "abcd"))
+	lunatest.assert_equal(long:find("-", 82, true)-1, void.buffer.find(void.buffer.fromString(long), "-", 81))
+end
+
+function suite.test_checksums()
+	local str = "123456789"
+	local buffer = void.buffer.fromString(str)
+	lunatest.assert_equal(void.buffer.crc32c(buffer), 0xE3069283)
+	lunatest.assert_equal(void.buffer.crc32c(void.buffer.fromString("")), 0)
+	lunatest.assert_equal(void.buffer.xxh64(void.buffer.fromString("a")), 0xD24EC4F1A98C6E5B)
+
+	-- Ranges, views and pieces agree with the whole
+	local long = ("Hello, World!"):rep(10)
+	local whole = void.buffer.fromString("--"..long.."--")
+	local crc = void.buffer.crc32c(void.buffer.fromString(long))
+	local hash = void.buffer.xxh64(void.buffer.fromString(long), 0, #long, 5)
+	lunatest.assert_equal(void.buffer.crc32c(whole, 2, #long), crc)
+	lunatest.assert_equal(void.buffer.xxh64(whole, 2, #long, 5), hash)
+	lunatest.assert_equal(void.buffer.crc32c(void.buffer.view(whole, 2, #long)), crc)
+
+	local first, second = void.buffer.fromString(long:sub(1, 50)), void.buffer.fromString(long:sub(51))
+	lunatest.assert_equal(void.buffer.crc32c(second, 0, nil, void.buffer.crc32c(first)), crc)
+	lunatest.assert_equal(void.buffer.crc32c({first, second}), crc)
+	lunatest.assert_equal(void.buffer.xxh64({first, second}, 5), hash)
+
+	lunatest.assert_error(function() void.buffer.crc32c(buffer, 5, 5) end)
+end
+
+function suite.test_mapped()
+	local threshold = void.buffer.mapThreshold(4096)
+	lunatest.assert_gte(0, threshold)
+
+	local buffer = void.buffer.create(8192, {zero = false, prefault = true})
+	lunatest.assert_equal(void.buffer.length(buffer), 8192)
+	void.buffer.fill(buffer, 7)
+	void.buffer.setU32(buffer, 8188, 0xDEADBEEF)
+
+	-- Grows in place or moves without losing data
+	void.buffer.grow(buffer, 1024*1024)
+	lunatest.assert_equal(void.buffer.getU8(buffer, 0), 7)
+	lunatest.assert_equal(void.buffer.getU32(buffer, 8188), 0xDEADBEEF)
+	lunatest.assert_equal(void.buffer.getU8(buffer, 1024*1024-1), 0)
+
+	void.buffer.shrink(buffer, 0)
+	lunatest.assert_equal(void.buffer.length(buffer), 0)
+	void.buffer.grow(buffer, 16)
+	lunatest.assert_equal(void.buffer.getU8(buffer, 0), 7)
+
+	-- Shared storage unmaps once every reader is done with it
+	local topic = void.topic.create(2, "test_mapped")
+	local subscriber = void.topic.subscribe(topic)
+	local mapped = void.buffer.create(4096)
+	void.buffer.setU8(mapped, 4095, 1)
+	void.topic.publish(topic, mapped)
+	lunatest.assert_equal(void.buffer.getU8(void.topic.receive(subscriber), 4095), 1)
+	void.topic.unsubscribe(subscriber)
+	void.topic.destroy(topic)
+
+	lunatest.assert_equal(void.buffer.mapThreshold(threshold), 4096)
+
+	-- Below the threshold zero = false still gives a usable buffer
+	local small = void.buffer.create(64, {zero = false})
+	void.buffer.fill(small, 1)
+	lunatest.assert_equal(void.buffer.getU8(small, 63), 1)
+	lunatest.assert_error(function() void.buffer.create(1, 1) end)
+end
+
+function suite.test_share()
+	local buffer = void.buffer.fromString "shared"
+	local other = void.buffer.share(buffer)
+	void.buffer.setU8(other, 0, ("S"):byte())
+	lunatest.assert_equal(void.buffer.asString(buffer), "Shared")
+
+	-- The storage lives until both buffers are gone
+	void.buffer.invalidate(buffer)
+	lunatest.assert_equal(void.buffer.asString(other), "Shared")
+
+	lunatest.assert_error(function() void.buffer.share(void.buffer.view(other, 1, 2)) end)
+end
+
+function suite.test_atomics()
+	local buffer = void.buffer.create(16)
+
+	void.buffer.atomicStore(buffer, 0, 5)
+	lunatest.assert_equal(void.buffer.atomicLoad(buffer, 0), 5)
+	lunatest.assert_equal(void.buffer.fetchAdd(buffer, 0, 3), 5)
+	lunatest.assert_equal(void.buffer.atomicLoad(buffer, 0, "u32", "acquire"), 8)
+	lunatest.assert_equal(void.buffer.exchange(buffer, 0, 1, "u32", "relaxed"), 8)
+	lunatest.assert_equal(void.buffer.fetchOr(buffer, 0, 6), 1)
+	lunatest.assert_equal(void.buffer.fetchAnd(buffer, 0, 3, "u32", "acqRel"), 7)
+	lunatest.assert_equal(void.buffer.getU32(buffer, 0), 3)
+
+	local exchanged, current = void.buffer.compareExchange(buffer, 0, 3, 10)
+	lunatest.assert_true(exchanged)
+	lunatest.assert_equal(current, 3)
+	exchanged, current = void.buffer.compareExchange(buffer, 0, 3, 20, "u32", "release")
+	lunatest.assert_false(exchanged)
+	lunatest.assert_equal(current, 10)
+
+	-- 32 bit values wrap, the type decides how they come back
+	void.buffer.atomicStore(buffer, 4, -1)
+	lunatest.assert_equal(void.buffer.atomicLoad(buffer, 4), 0xFFFFFFFF)
+	lunatest.assert_equal(void.buffer.atomicLoad(buffer, 4, "s32"), -1)
+	lunatest.assert_equal(void.buffer.fetchAdd(buffer, 4, 1, "s32"), -1)
+	lunatest.assert_equal(void.buffer.atomicLoad(buffer, 4), 0)
+
+	void.buffer.atomicStore(buffer, 8, 1 << 40, "u64", "release")
+	lunatest.assert_equal(void.buffer.fetchAdd(buffer, 8, -1, "s64"), 1 << 40)
+	lunatest.assert_equal(void.buffer.getU64(buffer, 8), (1 << 40)-1)
+
+	lunatest.assert_error(function() void.buffer.atomicLoad(buffer, 2) end)
+	lunatest.assert_error(function() void.buffer.atomicLoad(buffer, 4, "u64") end)
+	lunatest.assert_error(function() void.buffer.atomicLoad(buffer, 16) end)
+	lunatest.assert_error(function() void.buffer.atomicLoad(buffer, 0, "u16") end)
+	lunatest.assert_error(function() void.buffer.atomicLoad(buffer, 0, "u32", "release") end)
+	lunatest.assert_error(function() void.buffer.atomicStore(buffer, 0, 1, "u32", "acquire") end)
+
+	local map = void.map.create()
+	void.map.put(map, "key", void.buffer.create(4))
+	local readOnly = void.map.lookup(map, "key")
+	lunatest.assert_equal(void.buffer.atomicLoad(readOnly, 0), 0)
+	lunatest.assert_error(function() void.buffer.fetchAdd(readOnly, 0, 1) end)
+	void.map.destroy(map)
+end
+
+function suite.test_wait_wake()
+	local buffer = void.buffer.create(8)
+	local start = void.clock()
+	local woken, reason = void.buffer.wait(buffer, 0, 0, 20)
+	lunatest.assert_false(woken)
+	lunatest.assert_equal(reason, "timeout")
+	lunatest.assert_gte(0.019, void.clock()-start)
+	-- The word does not hold expected, so there is nothing to wait for
+	lunatest.assert_true(void.buffer.wait(buffer, 0, 1))
+	lunatest.assert_equal(void.buffer.wake(buffer, 0), 0)
+	lunatest.assert_error(function() void.buffer.wait(buffer, 2, 0, 0) end)
+
+	-- Workers count up the word at 4 and wait on the flag at 0 until the main thread raises it
+	-- share hands every worker the same memory
+	local thread = require "llthreads2"
+	local worker = [[
+		local void = require "void"
+		local queue = void.queue.get "test_wait_wake"
+		local buffer = void.queue.await(queue, -1)
+		void.buffer.fetchAdd(buffer, 4, 1)
+		void.buffer.wake(buffer, 4)
+		while void.buffer.atomicLoad(buffer, 0) == 0 do
+			void.buffer.wait(buffer, 0, 0)
+		end
+		void.buffer.fetchAdd(buffer, 4, 1)
+	]]
+
+	local queue = void.queue.create(4, "test_wait_wake")
+	local workers = {}
+	for i=1, 4 do
+		void.queue.enqueue(queue, void.buffer.share(buffer))
+		workers[i] = thread.new(worker)
+		workers[i]:start()
+	end
+
+	local started = void.buffer.atomicLoad(buffer, 4)
+	while started < 4 do
+		void.buffer.wait(buffer, 4, started)
+		started = void.buffer.atomicLoad(buffer, 4)
+	end
+	void.buffer.atomicStore(buffer, 0, 1)
+	void.buffer.wake(buffer, 0)
+
+	for i=1, 4 do
+		workers[i]:join()
+	end
+	lunatest.assert_equal(void.buffer.atomicLoad(buffer, 4), 8)
+	void.queue.destroy(queue)
+end
+
 return suite
@@ -0,0 +1,158 @@
+local void = require "void"
+
+local suite = {}
+
+function suite.test_put_lookup()
+	local map, name = void.map.create("test_put_lookup")
+	lunatest.assert_userdata(map)
+	lunatest.assert_equal(name, "test_put_lookup")
+
+	local buffer = void.buffer.fromString "value"
+	lunatest.assert_true(void.map.put(map, "key", buffer))
+	lunatest.assert_equal(void.buffer.type(buffer), "invalid")
+
+	local value = void.map.lookup(map, "key")
+	lunatest.assert_equal(void.buffer.asString(value), "value")
+	lunatest.assert_true(void.buffer.readOnly(value))
+	lunatest.assert_error(void.buffer.setU8, value, 0, 0)
+
+	lunatest.assert_nil(void.map.lookup(map, "missing"))
+	-- Keys are byte strings, embedded zeros included
+	void.map.put(map, "a\0b", void.buffer.fromString "zero")
+	lunatest.assert_nil(void.map.lookup(map, "a"))
+	lunatest.assert_equal(void.buffer.asString(void.map.lookup(map, "a\0b")), "zero")
+
+	-- The same map by name
+	local other = void.map.get "test_put_lookup"
+	lunatest.assert_equal(void.buffer.asString(void.map.lookup(other, "key")), "value")
+	lunatest.assert_nil(void.map.get "test_put_lookup_missing")
+	void.map.destroy(other)
+
+	lunatest.assert_error(function()
+		void.map.put(map, "view", void.buffer.view(void.buffer.fromString "abc", 1, 1))
+	end)
+
+	-- A share could still write to the value
+	local shared = void.buffer.fromString "shared"
+	local twin = void.buffer.share(shared)
+	lunatest.assert_error(function() void.map.put(map, "shared", shared) end)
+	lunatest.assert_error(function() void.map.put(map, "lookup", void.map.lookup(map, "key")) end)
+	void.buffer.invalidate(twin)
+	lunatest.assert_true(void.map.put(map, "shared", shared))
+
+	void.map.destroy(map)
+	lunatest.assert_error(function() void.map.lookup(map, "key") end)
+end
+
+function suite.test_replace_remove()
+	local map = void.map.create("test_replace_remove")
+	void.map.put(map, "key", void.buffer.fromString "old")
+	local old = void.map.lookup(map, "key")
+
+	lunatest.assert_false(void.map.put(map, "key", void.buffer.fromString "newer"))
+	lunatest.assert_equal(void.buffer.asString(void.map.lookup(map, "key")), "newer")
+	-- Views taken before keep the value they looked up
+	lunatest.assert_equal(void.buffer.asString(old), "old")
+
+	local stats = void.map.stats(map)
+	lunatest.assert_equal(stats.count, 1)
+	lunatest.assert_equal(stats.keyBytes, 3)
+	lunatest.assert_equal(stats.valueBytes, 5)
+
+	-- A view is reused for the lookup
+	local view = void.buffer.create(0)
+	lunatest.assert_equal(void.map.lookup(map, "key", view), view)
+	lunatest.assert_equal(void.buffer.asString(view), "newer")
+
+	lunatest.assert_true(void.map.remove(map, "key"))
+	lunatest.assert_false(void.map.remove(map, "key"))
+	lunatest.assert_nil(void.map.lookup(map, "key", view))
+	lunatest.assert_equal(void.buffer.type(view), "invalid")
+	lunatest.assert_equal(void.map.count(map), 0)
+	lunatest.assert_equal(void.map.stats(map).valueBytes, 0)
+
+	void.map.destroy(map)
+end
+
+function suite.test_growth()
+	local map = void.map.create("test_growth", {stripes = 3})
+	lunatest.assert_equal(void.map.stats(map).stripes, 4)
+
+	-- Enough keys for every stripe to grow its buckets several times
+	local count = 5000
+	for i=1, count do
+		local buffer = void.buffer.create(4)
+		void.buffer.setU32(buffer, 0, i)
+		lunatest.assert_true(void.map.put(map, "key"..i, buffer))
+	end
+	lunatest.assert_equal(void.map.count(map), count)
+
+	local view = void.buffer.create(0)
+	for i=1, count do
+		void.map.lookup(map, "key"..i, view)
+		lunatest.assert_equal(void.buffer.getU32(view, 0), i)
+	end
+
+	for i=1, count, 2 do
+		void.map.remove(map, "key"..i)
+	end
+	lunatest.assert_equal(void.map.count(map), count/2)
+	lunatest.assert_nil(void.map.lookup(map, "key1"))
+	lunatest.assert_equal(void.buffer.getU32(void.map.lookup(map, "key2"), 0), 2)
+
+	void.map.destroy(map)
+end
+
+function suite.test_threads()
+	local map = void.map.create("test_map_threads")
+	for i=1, 100 do
+		void.map.put(map, "key"..i, void.buffer.fromString(("value %d"):format(i)))
+	end
+
+	-- Every reader looks up every key while the writer replaces the even ones
+	-- and reports what it saw through a queue
+	local reader = [[
+		local void = require "void"
+		local map = void.map.get "test_map_threads"
+		local results = void.queue.get "test_map_threads_results"
+		local view = void.buffer.create(0)
+		local result = "ok"
+		for round=1, 50 do
+			for i=1, 100 do
+				void.map.lookup(map, "key"..i, view)
+				local value = void.buffer.asString(view)
+				if value ~= ("value %d"):format(i) and value ~= ("new %d"):format(i) then
+					result = "key"..i.." has value "..value
+				end
+			end
+		end
+		void.queue.enqueue(results, void.buffer.fromString(result), true)
+		void.map.destroy(map)
+	]]
+
+	local results = void.queue.create(4, "test_map_threads_results")
+	local thread = require "llthreads2"
+	local readers = {}
+	for i=1, 4 do
+		readers[i] = thread.new(reader)
+		readers[i]:start()
+	end
+
+	for i=2, 100, 2 do
+		void.map.put(map, "key"..i, void.buffer.fromString(("new %d"):format(i)))
+	end
+
+	for i=1, 4 do
+		lunatest.assert_equal(void.buffer.asString(void.queue.await(results, 10000)), "ok")
+	end
+	for i=1, 4 do
+		readers[i]:join()
+	end
+	void.queue.destroy(results)
+
+	lunatest.assert_equal(void.buffer.asString(void.map.lookup(map, "key2")), "new 2")
+	lunatest.assert_equal(void.buffer.asString(void.map.lookup(map, "key3")), "value 3")
+	void.map.destroy(map)
+end
+
+return suite
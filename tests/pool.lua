@@ -0,0 +1,110 @@
+local void = require "void"
+
+local suite = {}
+
+local doubler = [[
+	local void = require "void"
+	local index, size = ...
+	return function(buffer, worker)
+		local n = void.buffer.getU32(buffer, 0)
+		if n == 0 then
+			error("zero")
+		end
+		local reply = void.buffer.create(8)
+		void.buffer.setU32(reply, 0, n*2)
+		void.buffer.setU32(reply, 4, worker)
+		return reply
+	end
+]]
+
+function suite.test_results()
+	local pool = void.pool.create(3, doubler, {depth = 4})
+	local replies = void.pool.replies(pool)
+
+	for i=1, 100 do
+		local buffer = void.buffer.create(4)
+		void.buffer.setU32(buffer, 0, i)
+		lunatest.assert_true(void.pool.submit(pool, buffer, true))
+		lunatest.assert_equal(void.buffer.type(buffer), "invalid")
+	end
+
+	local sum = 0
+	for i=1, 100 do
+		local reply = void.queue.await(replies, 5000)
+		lunatest.assert_equal(void.buffer.type(reply), "buffer")
+		sum = sum+void.buffer.getU32(reply, 0)
+		local worker = void.buffer.getU32(reply, 4)
+		lunatest.assert_true(worker >= 1 and worker <= 3)
+	end
+	lunatest.assert_equal(sum, 100*101)
+
+	-- Workers count a task after its reply is queued
+	local stats, tasks
+	local deadline = void.clock()+5
+	repeat
+		stats, tasks = void.pool.stats(pool), 0
+		for _, worker in ipairs(stats.workers) do
+			tasks = tasks+worker.tasks
+			lunatest.assert_gte(0, worker.busy)
+		end
+	until tasks == 100 or void.clock() > deadline
+	lunatest.assert_equal(tasks, 100)
+	lunatest.assert_equal(stats.size, 3)
+	lunatest.assert_equal(stats.depth, 4)
+
+	void.pool.destroy(pool)
+	lunatest.assert_error(function() void.pool.submit(pool, void.buffer.create(4)) end)
+end
+
+function suite.test_errors()
+	lunatest.assert_error(function() void.pool.create(2, "error('broken')") end)
+	lunatest.assert_error(function() void.pool.create(2, "return 1") end)
+	-- Both workers would enqueue on it
+	local spsc = void.queue.create(4, nil, {mode = "spsc"})
+	lunatest.assert_error(function() void.pool.create(2, doubler, {replies = spsc}) end)
+	void.queue.destroy(spsc)
+
+	local pool = void.pool.create(1, doubler)
+	void.pool.submit(pool, void.buffer.create(4), true)
+	local buffer = void.buffer.create(4)
+	void.buffer.setU32(buffer, 0, 1)
+	void.pool.submit(pool, buffer, true)
+
+	-- Replies keep their order with one worker, so the failed task is done once this arrives
+	lunatest.assert_equal(void.buffer.getU32(void.queue.await(void.pool.replies(pool), 5000), 0), 2)
+	local worker = void.pool.stats(pool).workers[1]
+	lunatest.assert_equal(worker.errors, 1)
+	lunatest.assert_match("zero", worker.lastError)
+	void.pool.destroy(pool)
+end
+
+function suite.test_full()
+	local gate, gateName = void.queue.create(4)
+	local pool = void.pool.create(1, ([[
+		local void = require "void"
+		local gate = void.queue.get(%q)
+		return function(buffer)
+			void.queue.await(gate, -1)
+			return buffer
+		end
+	]]):format(gateName), {depth = 1})
+
+	lunatest.assert_true(void.pool.submit(pool, void.buffer.create(1)))
+	-- Wait for the worker to take the first task off its deque
+	local deadline = void.clock()+5
+	while void.pool.stats(pool).pending > 0 and void.clock() < deadline do end
+
+	lunatest.assert_true(void.pool.submit(pool, void.buffer.create(1)))
+	lunatest.assert_false(void.pool.submit(pool, void.buffer.create(1)))
+
+	void.queue.enqueue(gate, void.buffer.create(1))
+	void.queue.enqueue(gate, void.buffer.create(1))
+	local replies = void.pool.replies(pool)
+	lunatest.assert_equal(void.buffer.type(void.queue.await(replies, 5000)), "buffer")
+	lunatest.assert_equal(void.buffer.type(void.queue.await(replies, 5000)), "buffer")
+
+	void.pool.destroy(pool)
+	void.queue.destroy(gate)
+end
+
+return suite
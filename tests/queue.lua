@@ -35,6 +35,354 @@ function suite.test_enqueue_await()
 	lunatest.assert_equal(void.buffer.asString(outbuf), "Hello!")
 end
 
+function suite.test_max_bytes()
+	local queue = void.queue.create(10, "test_max_bytes", {maxBytes = 8})
+	lunatest.assert_true(void.queue.enqueue(queue, void.buffer.create(6)))
+	lunatest.assert_false(void.queue.enqueue(queue, void.buffer.create(6)))
+	lunatest.assert_true(void.queue.enqueue(queue, void.buffer.create(2)))
+
+	local stats = void.queue.stats(queue)
+	lunatest.assert_equal(stats.count, 2)
+	lunatest.assert_equal(stats.bytes, 8)
+	lunatest.assert_equal(stats.maxBytes, 8)
+
+	void.queue.await(queue)
+	lunatest.assert_equal(void.queue.stats(queue).bytes, 2)
+	void.queue.destroy(queue)
+
+	-- An empty queue takes a buffer larger than the limit
+	local big = void.queue.create(10, "test_max_bytes_big", {maxBytes = 8})
+	lunatest.assert_true(void.queue.enqueue(big, void.buffer.create(16)))
+	void.queue.destroy(big)
+
+	-- Sizes that are given have to be positive
+	lunatest.assert_error(function() void.queue.create(10, nil, {maxBytes = -1}) end)
+	lunatest.assert_error(function() void.queue.create(10, nil, {maxBytes = 0}) end)
+	lunatest.assert_error(function() void.queue.create(0, nil, {mode = "growable", segmentSize = -4}) end)
+	lunatest.assert_error(function() void.queue.create(0, nil, {journalSegmentBytes = 0}) end)
+	lunatest.assert_error(function() void.queue.create(0, nil, {syncInterval = -2}) end)
+end
+
+function suite.test_budget()
+	local a = void.queue.create(10, "test_budget_a")
+	local b = void.queue.create(10, "test_budget_b")
+	local queued = void.buffer.memstats().queued.bytes
+	local previous = void.queue.budget(queued+8)
+
+	lunatest.assert_true(void.queue.enqueue(a, void.buffer.create(6)))
+	lunatest.assert_false(void.queue.enqueue(b, void.buffer.create(6)))
+	void.queue.await(a)
+	lunatest.assert_true(void.queue.enqueue(b, void.buffer.create(6)))
+
+	void.queue.budget(previous)
+	void.queue.destroy(a)
+	void.queue.destroy(b)
+end
+
+function suite.test_growable()
+	local queue = void.queue.create(0, "test_growable", {mode = "growable", segmentSize = 4})
+	for i=1, 20 do
+		lunatest.assert_true(void.queue.enqueue(queue, void.buffer.fromString(tostring(i))))
+	end
+	lunatest.assert_equal(void.queue.count(queue), 20)
+	for i=1, 20 do
+		lunatest.assert_equal(void.buffer.asString(void.queue.await(queue)), tostring(i))
+	end
+	lunatest.assert_equal(void.queue.count(queue), 0)
+
+	-- Refill after draining
+	lunatest.assert_true(void.queue.enqueue(queue, void.buffer.fromString("again")))
+	lunatest.assert_equal(void.buffer.asString(void.queue.await(queue)), "again")
+	void.queue.destroy(queue)
+
+	local capped = void.queue.create(2, "test_growable_capped", {mode = "growable"})
+	lunatest.assert_true(void.queue.enqueue(capped, void.buffer.create(1)))
+	lunatest.assert_true(void.queue.enqueue(capped, void.buffer.create(1)))
+	lunatest.assert_false(void.queue.enqueue(capped, void.buffer.create(1)))
+	void.queue.destroy(capped)
+end
+
+function suite.test_spsc()
+	local queue = void.queue.create(2, "test_spsc", {mode = "spsc"})
+	lunatest.assert_true(void.queue.enqueue(queue, void.buffer.fromString "1"))
+	lunatest.assert_true(void.queue.enqueue(queue, void.buffer.fromString "2"))
+	lunatest.assert_false(void.queue.enqueue(queue, void.buffer.fromString "3"))
+	lunatest.assert_equal(void.queue.count(queue), 2)
+
+	lunatest.assert_equal(void.buffer.asString(void.queue.await(queue)), "1")
+	lunatest.assert_equal(void.buffer.asString(void.queue.await(queue)), "2")
+	lunatest.assert_equal(void.buffer.type(void.queue.await(queue, 1)), "invalid")
+	void.queue.destroy(queue)
+end
+
+function suite.test_spsc_thread()
+	local thread = require "llthreads2".new [[
+		local void = require "void"
+		local queue = void.queue.get "spsc_thread_queue"
+		for i=1, 1000 do
+			void.queue.enqueue(queue, void.buffer.fromString(tostring(i)), true)
+		end
+	]]
+
+	local queue = void.queue.create(4, "spsc_thread_queue", {mode = "spsc"})
+	thread:start(false, false)
+	for i=1, 1000 do
+		lunatest.assert_equal(void.buffer.asString(void.queue.await(queue, -1)), tostring(i))
+	end
+
+	thread:join()
+	void.queue.destroy(queue)
+end
+
+function suite.test_stream()
+	local queue = void.queue.create(64, "test_stream", {mode = "stream"})
+
+	local view = void.queue.reserve(queue, 10)
+	lunatest.assert_equal(void.buffer.length(view), 10)
+	void.buffer.pack(view, 0, "c5", "hello")
+	void.queue.commit(queue, view, 5)
+	lunatest.assert_equal(void.buffer.type(view), "invalid")
+	lunatest.assert_equal(void.queue.count(queue), 1)
+
+	view = void.queue.read(queue)
+	lunatest.assert_equal(void.buffer.asString(view), "hello")
+	lunatest.assert_error(function() void.buffer.setU8(view, 0, 1) end)
+	void.queue.release(queue, view)
+	lunatest.assert_nil(void.queue.read(queue))
+
+	-- Records are read in the order they were reserved, whatever order they are committed in
+	local a = void.queue.reserve(queue, 8)
+	local b = void.queue.reserve(queue, 8)
+	void.buffer.fill(a, ("a"):byte())
+	void.buffer.fill(b, ("b"):byte())
+	void.queue.commit(queue, b)
+	lunatest.assert_nil(void.queue.read(queue))
+	void.queue.commit(queue, a)
+	a = void.queue.read(queue)
+	b = void.queue.read(queue)
+	lunatest.assert_equal(void.buffer.asString(a), "aaaaaaaa")
+	lunatest.assert_equal(void.buffer.asString(b), "bbbbbbbb")
+
+	-- Space comes back once every record before it is released
+	lunatest.assert_nil(void.queue.reserve(queue, 40))
+	void.queue.release(queue, b)
+	lunatest.assert_nil(void.queue.reserve(queue, 40))
+	void.queue.release(queue, a)
+	view = void.queue.reserve(queue, 40)
+	lunatest.assert_userdata(view)
+	void.queue.commit(queue, view, 0)
+	void.queue.release(queue, void.queue.read(queue))
+
+	lunatest.assert_error(function() void.queue.reserve(queue, 64) end)
+	lunatest.assert_error(function() void.queue.release(queue, void.buffer.create(8)) end)
+
+	-- Records wrap around the end of the ring, views are reused
+	view = void.buffer.create(0)
+	for i=1, 100 do
+		void.queue.reserve(queue, 20, false, view)
+		void.buffer.setU32(view, 0, i)
+		void.queue.commit(queue, view)
+		void.queue.read(queue, 0, view)
+		lunatest.assert_equal(void.buffer.getU32(view, 0), i)
+		void.queue.release(queue, view)
+	end
+
+	-- enqueue and await copy in and out of records
+	lunatest.assert_true(void.queue.enqueue(queue, void.buffer.fromString("copied")))
+	lunatest.assert_equal(void.buffer.asString(void.queue.await(queue)), "copied")
+	lunatest.assert_equal(void.queue.stats(queue).bytes, 0)
+	lunatest.assert_error(function() void.queue.enqueue(queue, void.buffer.create(64), true) end)
+
+	-- Records and their shares point into the ring, handing them on would keep the record forever
+	local other = void.queue.create(4)
+	view = void.queue.reserve(queue, 8)
+	lunatest.assert_error(function() void.queue.enqueue(other, view) end)
+	lunatest.assert_error(function() void.queue.enqueue(other, void.buffer.share(view)) end)
+	lunatest.assert_error(function() void.queue.enqueue(queue, view) end)
+	void.queue.commit(queue, view)
+	void.queue.release(queue, void.queue.read(queue))
+	lunatest.assert_equal(void.queue.stats(queue).bytes, 0)
+	void.queue.destroy(other)
+	void.queue.destroy(queue)
+end
+
+function suite.test_stream_thread()
+	local thread = require "llthreads2".new [[
+		local void = require "void"
+		local queue = void.queue.get "stream_thread_queue"
+		local view = void.buffer.create(0)
+		for i=1, 1000 do
+			void.queue.reserve(queue, i%50+4, true, view)
+			void.buffer.setU32(view, 0, i)
+			void.queue.commit(queue, view)
+		end
+	]]
+
+	local queue = void.queue.create(256, "stream_thread_queue", {mode = "stream"})
+	thread:start(false, false)
+	local view = void.buffer.create(0)
+	for i=1, 1000 do
+		void.queue.read(queue, -1, view)
+		lunatest.assert_equal(void.buffer.length(view), i%50+4)
+		lunatest.assert_equal(void.buffer.getU32(view, 0), i)
+		void.queue.release(queue, view)
+	end
+
+	thread:join()
+	void.queue.destroy(queue)
+end
+
+function suite.test_delayed()
+	local queue = void.queue.create(4, "test_delayed")
+	local start = void.clock()
+	lunatest.assert_true(void.queue.enqueueAfter(queue, void.buffer.fromString("60"), 60))
+	void.queue.enqueueAfter(queue, void.buffer.fromString("20"), 20)
+	void.queue.enqueueAfter(queue, void.buffer.fromString("40"), 40)
+	-- A deadline that passed already is due right away
+	void.queue.enqueueAt(queue, void.buffer.fromString("now"), start-1)
+
+	lunatest.assert_equal(void.queue.stats(queue).delayed, 3)
+	lunatest.assert_equal(void.buffer.asString(void.queue.await(queue)), "now")
+	lunatest.assert_equal(void.buffer.type(void.queue.await(queue)), "invalid")
+
+	for _, delay in ipairs {20, 40, 60} do
+		lunatest.assert_equal(void.buffer.asString(void.queue.await(queue, -1)), tostring(delay))
+		lunatest.assert_gte(delay/1000-0.001, void.clock()-start)
+	end
+	lunatest.assert_equal(void.queue.stats(queue).delayed, 0)
+
+	-- The timeout still ends the wait when the next buffer is due later
+	void.queue.enqueueAfter(queue, void.buffer.create(1), 1000)
+	lunatest.assert_equal(void.buffer.type(void.queue.await(queue, 10)), "invalid")
+	void.queue.destroy(queue)
+
+	lunatest.assert_error(function()
+		void.queue.enqueueAfter(void.queue.create(2, nil, {mode = "spsc"}), void.buffer.create(1), 1)
+	end)
+end
+
+function suite.test_delayed_many()
+	local queue = void.queue.create(0, "test_delayed_many", {mode = "growable"})
+	local start = void.clock()
+	local count = 2000
+
+	-- Deadlines spread over several level 0 rotations of the timing wheel
+	for i=1, count do
+		local buffer = void.buffer.create(8)
+		local deadline = start+math.random(0, 300)/1000
+		void.buffer.setF64(buffer, 0, deadline)
+		void.queue.enqueueAt(queue, buffer, deadline)
+	end
+
+	local previous = 0
+	for i=1, count do
+		local buffer = void.queue.await(queue, 2000)
+		local deadline = void.buffer.getF64(buffer, 0)
+		lunatest.assert_gte(deadline-0.001, void.clock())
+		lunatest.assert_gte(previous, deadline+0.001)
+		previous = deadline
+	end
+	void.queue.destroy(queue)
+
+	-- A full ring holds due buffers back until there is room
+	local ring = void.queue.create(1, "test_delayed_ring")
+	void.queue.enqueue(ring, void.buffer.fromString("first"))
+	void.queue.enqueueAfter(ring, void.buffer.fromString("second"), 0)
+	lunatest.assert_equal(void.queue.count(ring), 1)
+	lunatest.assert_equal(void.buffer.asString(void.queue.await(ring)), "first")
+	lunatest.assert_equal(void.buffer.asString(void.queue.await(ring)), "second")
+	void.queue.destroy(ring)
+end
+
+-- A fresh directory for a journal, and a function that deletes it with the given segments
+local function journalDirectory()
+	local path = os.tmpname()
+	os.remove(path)
+	return path, function(segments)
+		for _, first in ipairs(segments) do
+			os.remove(("%s/%016x.log"):format(path, first))
+		end
+		os.remove(path.."/checkpoint")
+		os.remove(path)
+	end
+end
+
+function suite.test_journal()
+	local path, remove = journalDirectory()
+	local queue = void.queue.create(0, "test_journal", {journal = path})
+	for i=1, 3 do
+		lunatest.assert_true(void.queue.enqueue(queue, void.buffer.fromString("job "..i)))
+	end
+	lunatest.assert_equal(void.queue.stats(queue).synced, 3)
+
+	-- The first job is handled, the second one is handed out but the process dies before it is done
+	local buffer, sequence = void.queue.awaitSequence(queue)
+	lunatest.assert_equal(void.buffer.asString(buffer), "job 1")
+	lunatest.assert_equal(sequence, 0)
+	lunatest.assert_true(void.queue.ack(queue, sequence))
+	lunatest.assert_false(void.queue.ack(queue, sequence))
+	lunatest.assert_equal(select(2, void.queue.awaitSequence(queue)), 1)
+	void.queue.destroy(queue)
+
+	queue = void.queue.create(0, "test_journal", {journal = path})
+	lunatest.assert_equal(void.queue.count(queue), 2)
+	buffer, sequence = void.queue.awaitSequence(queue)
+	lunatest.assert_equal(void.buffer.asString(buffer), "job 2")
+	lunatest.assert_equal(sequence, 1)
+
+	-- Only one queue can have the journal open
+	lunatest.assert_error(function()
+		void.queue.create(0, "test_journal_twice", {journal = path})
+	end)
+
+	lunatest.assert_true(void.queue.enqueue(queue, void.buffer.fromString("job 4")))
+	lunatest.assert_equal(void.buffer.asString(void.queue.await(queue)), "job 3")
+	lunatest.assert_equal(void.buffer.asString(void.queue.await(queue)), "job 4")
+	void.queue.ack(queue)
+	void.queue.destroy(queue)
+
+	queue = void.queue.create(0, "test_journal", {journal = path})
+	lunatest.assert_equal(void.queue.count(queue), 0)
+	lunatest.assert_equal(void.queue.stats(queue).checkpoint, 4)
+	void.queue.destroy(queue)
+
+	remove {0, 3, 4}
+end
+
+function suite.test_journal_segments()
+	local path, remove = journalDirectory()
+	local options = {journal = path, syncInterval = -1, journalSegmentBytes = 64}
+	local queue = void.queue.create(0, "test_journal_segments", options)
+	for i=1, 6 do
+		void.queue.enqueue(queue, void.buffer.fromString(("%032d"):format(i)))
+	end
+	void.queue.destroy(queue)
+
+	-- A torn write at the end of the journal is cut off
+	local last = io.open(("%s/%016x.log"):format(path, 5), "ab")
+	last:write("torn record")
+	last:close()
+
+	queue = void.queue.create(0, "test_journal_segments", options)
+	lunatest.assert_equal(void.queue.count(queue), 6)
+	for i=1, 6 do
+		lunatest.assert_equal(tonumber(void.buffer.asString(void.queue.await(queue))), i)
+	end
+	lunatest.assert_true(void.queue.enqueue(queue, void.buffer.fromString("after")))
+
+	-- Acknowledged segments are deleted once the checkpoint is saved
+	void.queue.ack(queue)
+	void.queue.sync(queue)
+	lunatest.assert_nil(io.open(("%s/%016x.log"):format(path, 0)))
+	void.queue.destroy(queue)
+
+	queue = void.queue.create(0, "test_journal_segments", options)
+	lunatest.assert_equal(void.buffer.asString(void.queue.await(queue)), "after")
+	void.queue.destroy(queue)
+
+	remove {0, 1, 2, 3, 4, 5, 6, 7}
+end
+
 function suite.test_thread()
 	local thread = require "llthreads2".new [[
 		local void = require "void"
@@ -0,0 +1,91 @@
+local void = require "void"
+
+local suite = {}
+
+-- Answers every request waiting in queue by doubling the u32 at offset 0
+local function serve(queue)
+	while void.queue.count(queue) > 0 do
+		local request = void.queue.await(queue)
+		void.buffer.setU32(request, 0, void.buffer.getU32(request, 0)*2)
+		void.rpc.reply(request)
+	end
+end
+
+local function request(n)
+	local buffer = void.buffer.create(4)
+	void.buffer.setU32(buffer, 0, n)
+	return buffer
+end
+
+function suite.test_call()
+	local queue = void.queue.create(16)
+	local client = void.rpc.client()
+
+	local buffer = request(21)
+	local future = void.rpc.call(client, queue, buffer)
+	lunatest.assert_equal(void.buffer.type(buffer), "invalid")
+	lunatest.assert_false(future:ready())
+	lunatest.assert_equal(void.rpc.inflight(client), 1)
+
+	local received = void.queue.await(queue)
+	lunatest.assert_equal(void.rpc.length(received), 4)
+	-- Replying with a new buffer moves the routing information over
+	lunatest.assert_true(void.rpc.reply(received, request(7)))
+
+	lunatest.assert_true(future:ready())
+	local reply = future:wait()
+	lunatest.assert_equal(void.buffer.length(reply), 4)
+	lunatest.assert_equal(void.buffer.getU32(reply, 0), 7)
+	lunatest.assert_equal(void.rpc.inflight(client), 0)
+	lunatest.assert_error(function() future:wait() end)
+
+	lunatest.assert_error(function() void.rpc.reply(request(1)) end)
+	void.queue.destroy(queue)
+end
+
+function suite.test_out_of_order()
+	local queue = void.queue.create(64)
+	local client = void.rpc.client()
+
+	local futures = {}
+	for i=1, 50 do
+		futures[i] = void.rpc.call(client, queue, request(i))
+	end
+	serve(queue)
+
+	-- Every future gets its own reply whatever order they are waited in
+	for i=50, 1, -1 do
+		lunatest.assert_equal(void.buffer.getU32(futures[i]:wait(1000), 0), i*2)
+	end
+
+	local pending = {}
+	for i=1, 3 do
+		pending[i] = void.rpc.call(client, queue, request(i))
+	end
+	lunatest.assert_nil(void.rpc.waitAny(pending, 10))
+
+	-- Only the second request gets answered
+	void.queue.await(queue)
+	void.rpc.reply(void.queue.await(queue))
+	local index, reply = void.rpc.waitAny(pending, 1000)
+	lunatest.assert_equal(index, 2)
+	lunatest.assert_equal(void.buffer.getU32(reply, 0), 2)
+
+	lunatest.assert_nil(pending[3]:wait(0))
+	pending[3]:cancel()
+	lunatest.assert_error(function() pending[3]:wait() end)
+
+	void.queue.destroy(queue)
+end
+
+function suite.test_client_gone()
+	local queue = void.queue.create(4)
+	local client = void.rpc.client()
+	void.rpc.call(client, queue, request(1))
+	void.rpc.destroy(client)
+
+	lunatest.assert_false(void.rpc.reply(void.queue.await(queue)))
+	void.queue.destroy(queue)
+end
+
+return suite
@@ -0,0 +1,82 @@
+local void = require "void"
+
+local suite = {}
+
+function suite.test_roundtrip()
+	local value = {
+		1, 2.5, "three", true, false,
+		name = "void",
+		nested = {x = -1, y = math.maxinteger, z = math.mininteger},
+		[10] = "sparse",
+		[2.5] = "float key",
+		[false] = 0,
+	}
+
+	local buffer, length = void.serialize(value)
+	lunatest.assert_equal(void.buffer.length(buffer), length)
+
+	local copy, offset = void.deserialize(buffer)
+	lunatest.assert_equal(offset, length)
+	lunatest.assert_equal(#copy, 5)
+	lunatest.assert_equal(copy[1], 1)
+	lunatest.assert_true(math.type(copy[1]) == "integer")
+	lunatest.assert_equal(copy[2], 2.5)
+	lunatest.assert_equal(copy[3], "three")
+	lunatest.assert_true(copy[4])
+	lunatest.assert_false(copy[5])
+	lunatest.assert_equal(copy.name, "void")
+	lunatest.assert_equal(copy.nested.x, -1)
+	lunatest.assert_equal(copy.nested.y, math.maxinteger)
+	lunatest.assert_equal(copy.nested.z, math.mininteger)
+	lunatest.assert_equal(copy[10], "sparse")
+	lunatest.assert_equal(copy[2.5], "float key")
+	lunatest.assert_equal(copy[false], 0)
+
+	lunatest.assert_nil(void.deserialize((void.serialize(nil))))
+	lunatest.assert_equal(void.deserialize((void.serialize("plain"))), "plain")
+end
+
+function suite.test_references()
+	local shared = {}
+	local value = {a = shared, b = shared}
+	value.self = value
+
+	local copy = void.deserialize((void.serialize(value)))
+	lunatest.assert_equal(copy.a, copy.b)
+	lunatest.assert_equal(copy.self, copy)
+end
+
+function suite.test_buffers()
+	local value = {payload = void.buffer.fromString "bytes"}
+	local copy = void.deserialize((void.serialize(value)))
+	lunatest.assert_equal(void.buffer.type(copy.payload), "buffer")
+	lunatest.assert_equal(void.buffer.asString(copy.payload), "bytes")
+end
+
+function suite.test_into()
+	local into = void.buffer.create(4)
+	local buffer, first = void.serialize({1, 2, 3}, into)
+	lunatest.assert_equal(buffer, into)
+
+	-- A longer message grows the buffer, a shorter one reuses it
+	local _, second = void.serialize(("x"):rep(100), into)
+	local grown = void.buffer.length(into)
+	lunatest.assert_gte(second, grown)
+	local _, third = void.serialize(7, into)
+	lunatest.assert_equal(void.buffer.length(into), grown)
+	lunatest.assert_equal(void.deserialize(into), 7)
+	lunatest.assert_equal(select(2, void.deserialize(into)), third)
+end
+
+function suite.test_errors()
+	lunatest.assert_error(void.serialize, print)
+	lunatest.assert_error(void.serialize, {coroutine.create(print)})
+
+	local buffer = (void.serialize({1, 2, {3}}))
+	void.buffer.shrink(buffer, void.buffer.length(buffer)-2)
+	lunatest.assert_error(void.deserialize, buffer)
+
+	lunatest.assert_error(void.deserialize, void.buffer.fromString "\255")
+end
+
+return suite
@@ -0,0 +1,282 @@
+local void = require "void"
+
+local suite = {}
+
+local header = void.struct.create {
+	{"method", "u32"},
+	{"id", "u64"}
+}
+
+local kill = void.struct.create {
+	{"", "inherit", header}
+}
+
+local add = void.struct.create {
+	{"", "inherit", header},
+	{"a", "f64"},
+	{"b", "f64"}
+}
+
+local message = void.struct.variant(header, "method", {[0] = kill, [1] = add})
+
+function suite.test_format()
+	lunatest.assert_equal(header.format, "=I4xxxx=I8")
+	lunatest.assert_nil(void.struct.create({{"at", "void"}}).format)
+end
+
+function suite.test_variant_read_write()
+	local buffer = void.struct.write(message, {method = 1, id = 7, a = 1.5, b = 2})
+	lunatest.assert_equal(void.buffer.length(buffer), add.size)
+
+	local request = void.struct.read(message, buffer)
+	lunatest.assert_equal(request.method, 1)
+	-- read returns only the table, so it can be passed on
+	local requests = {}
+	table.insert(requests, void.struct.read(message, buffer))
+	lunatest.assert_equal(requests[1].id, 7)
+	lunatest.assert_equal(request.id, 7)
+	lunatest.assert_equal(request.a, 1.5)
+	lunatest.assert_equal(request.b, 2)
+
+	-- Unknown tags fall back to the header
+	void.buffer.setU32(buffer, 0, 9)
+	request = void.struct.read(message, buffer)
+	lunatest.assert_equal(request.method, 9)
+	lunatest.assert_nil(request.a)
+end
+
+function suite.test_dispatch()
+	local buffer = void.struct.write(message, {method = 1, id = 7, a = 1.5, b = 2})
+
+	local result = void.struct.dispatch(message, buffer, {
+		[0] = function() return "kill" end,
+		[1] = function(buf, method, id, a, b, nextIndex)
+			lunatest.assert_equal(buf, buffer)
+			lunatest.assert_equal(nextIndex, add.size)
+			return method+id+a+b
+		end
+	})
+	lunatest.assert_equal(result, 11.5)
+
+	void.struct.write(message, buffer, {method = 0, id = 1})
+	lunatest.assert_equal(void.struct.dispatch(message, buffer, {[0] = function() return "kill" end}), "kill")
+
+	void.buffer.setU32(buffer, 0, 9)
+	lunatest.assert_nil(void.struct.dispatch(message, buffer, {}))
+	lunatest.assert_equal(void.struct.dispatch(message, buffer, {default = function(_, method) return method end}), 9)
+end
+
+function suite.test_dispatch_without_format()
+	local marked = void.struct.create {
+		{"method", "u8"},
+		{"at", "void"},
+		{"value", "u16"}
+	}
+	local variant = void.struct.variant(marked, "method", {[2] = marked})
+	local buffer = void.struct.write(marked, {method = 2, value = 300})
+
+	void.struct.dispatch(variant, buffer, {
+		[2] = function(_, method, at, value, nextIndex)
+			lunatest.assert_equal(method, 2)
+			lunatest.assert_equal(at, 8)
+			lunatest.assert_equal(value, 300)
+			lunatest.assert_equal(nextIndex, marked.size)
+		end
+	})
+end
+
+local point = void.struct.create {
+	alignment = 1,
+	{"x", "s16le"},
+	{"y", "s16le"},
+	{"weight", "f32le"}
+}
+
+function suite.test_columns()
+	local columns = {
+		x = {1, 2, 3, 4},
+		y = {-1, -2, -3, -4},
+		weight = {0.5, 1, 1.5, 2}
+	}
+
+	local buffer = void.struct.writeColumns(point, nil, 0, columns)
+	lunatest.assert_equal(void.buffer.length(buffer), 4*point.size)
+	lunatest.assert_equal(void.struct.read(point, buffer, 2*point.size).y, -3)
+
+	local read = void.struct.readColumns(point, buffer, 0, 4)
+	for name, column in pairs(columns) do
+		for i=1, 4 do
+			lunatest.assert_equal(read[name][i], column[i])
+		end
+	end
+
+	-- Reusing the arrays drops values past the new count
+	local x = read.x
+	void.struct.readColumns(point, buffer, point.size, 2, read)
+	lunatest.assert_equal(read.x, x)
+	lunatest.assert_equal(#read.x, 2)
+	lunatest.assert_equal(read.x[1], 2)
+
+	lunatest.assert_equal(#void.struct.readColumn(point, buffer, 0, 3, "weight"), 3)
+end
+
+function suite.test_scan()
+	local buffer = void.struct.writeColumns(point, nil, 0, {
+		x = {1, 2, 3, 4},
+		y = {5, 6, 7, 8},
+		weight = {1, 1, 1, 1}
+	})
+
+	local records = void.struct.scan(point, buffer, 0, 4, "x", ">=", 3)
+	lunatest.assert_equal(#records, 2)
+	lunatest.assert_equal(records[1].y, 7)
+	lunatest.assert_equal(records[2].y, 8)
+
+	records = void.struct.scan(point, buffer, 0, 4, "y", function(y, i) return y == 6 and i == 2 end, records)
+	lunatest.assert_equal(#records, 1)
+	lunatest.assert_equal(records[1].x, 2)
+end
+
+function suite.test_checksum()
+	local framed = void.struct.create {
+		endian = "big",
+		alignment = 1,
+		{"id", "u32"},
+		{"value", "f64"},
+		{"crc", "crc32c"}
+	}
+	lunatest.assert_equal(framed.size, 16)
+
+	local buffer = void.struct.write(framed, {id = 3, value = 0.25})
+	local crc = void.buffer.getU32BE(buffer, 12)
+	lunatest.assert_equal(crc, void.buffer.crc32c(buffer, 0, 12))
+
+	local record = void.struct.read(framed, buffer)
+	lunatest.assert_equal(record.id, 3)
+	lunatest.assert_equal(record.crc, crc)
+
+	void.buffer.setU8(buffer, 5, 0xFF)
+	lunatest.assert_error(function() void.struct.read(framed, buffer) end)
+
+	local records = void.struct.writeColumns(framed, nil, 0, {id = {1, 2}, value = {1, 2}})
+	lunatest.assert_equal(void.struct.read(framed, records, 16).id, 2)
+end
+
+function suite.test_bits()
+	local flags = void.struct.create {
+		{"kind", "u8"},
+		{"level", "bits", 3},
+		{"urgent", "bool"},
+		{"acked", "bool"},
+		{"retries", "bits", 5},
+		{"id", "u32"}
+	}
+	-- The bit fields share one u16 after kind
+	lunatest.assert_equal(flags.layout.level[3], 8)
+	lunatest.assert_equal(flags.layout.retries[3], 8)
+	lunatest.assert_equal(flags.size, 24)
+	lunatest.assert_nil(flags.format)
+
+	local buffer = void.struct.write(flags, {kind = 1, level = 6, urgent = true, acked = false, retries = 17, id = 9})
+	lunatest.assert_equal(void.buffer.getU16(buffer, 8), 6+8+17*32)
+
+	local record = void.struct.read(flags, buffer)
+	lunatest.assert_equal(record.level, 6)
+	lunatest.assert_true(record.urgent)
+	lunatest.assert_false(record.acked)
+	lunatest.assert_equal(record.retries, 17)
+	lunatest.assert_equal(record.id, 9)
+
+	-- Writing one field keeps the other bits of the word
+	void.struct.write(flags, buffer, {urgent = false, acked = true})
+	record = void.struct.read(flags, buffer)
+	lunatest.assert_false(record.urgent)
+	lunatest.assert_true(record.acked)
+	lunatest.assert_equal(record.level, 6)
+	lunatest.assert_equal(record.retries, 17)
+
+	-- Other fields skip false like nil, bit fields take it as 0
+	void.struct.write(flags, buffer, {kind = false, id = false, level = false})
+	record = void.struct.read(flags, buffer)
+	lunatest.assert_equal(record.kind, 1)
+	lunatest.assert_equal(record.id, 9)
+	lunatest.assert_equal(record.level, 0)
+	lunatest.assert_equal(record.retries, 17)
+
+	lunatest.assert_equal(void.struct.readColumn(flags, buffer, 0, 1, "retries")[1], 17)
+	lunatest.assert_error(function() void.struct.create {{"wide", "bits", 33}} end)
+end
+
+function suite.test_varints()
+	local compact = void.struct.create {
+		{"method", "u8"},
+		{"id", "varint"},
+		{"delta", "zigzag"},
+		{"level", "bits", 3},
+		{"urgent", "bool"},
+		{"value", "f32"}
+	}
+	lunatest.assert_true(compact.variable)
+	-- Varints count as one byte
+	lunatest.assert_equal(compact.size, 8)
+
+	local data = {method = 2, id = 300, delta = -3, level = 5, urgent = true, value = 0.5}
+	lunatest.assert_equal(void.struct.length(compact, data), 9)
+
+	local buffer, after = void.struct.writeNext(compact, data)
+	lunatest.assert_equal(void.buffer.length(buffer), 9)
+	lunatest.assert_equal(after, 9)
+
+	local record, index = void.struct.readNext(compact, buffer)
+	lunatest.assert_equal(index, 9)
+	for name, value in pairs(data) do
+		lunatest.assert_equal(record[name], value)
+	end
+
+	-- Records follow each other, offsets are only known while reading
+	local stream = void.buffer.create(64)
+	local position = 0
+	for i=1, 3 do
+		stream, position = void.struct.writeNext(compact, stream, position, {id = i*1000, delta = -i})
+	end
+	position = 0
+	for i=1, 3 do
+		record, position = void.struct.readNext(compact, stream, position)
+		lunatest.assert_equal(record.id, i*1000)
+		lunatest.assert_equal(record.delta, -i)
+		lunatest.assert_false(record.urgent)
+	end
+	lunatest.assert_equal(position, 3*(1+2+1+1+4))
+	lunatest.assert_equal(select("#", void.struct.read(compact, stream)), 1)
+
+	lunatest.assert_error(function() void.struct.readColumns(compact, stream, 0, 3) end)
+	lunatest.assert_error(function() void.struct.create {{"id", "varint"}, {"at", "void"}} end)
+	lunatest.assert_error(function() void.struct.create {alignment = 8, {"id", "varint"}} end)
+end
+
+function suite.test_variant_varints()
+	local compactAdd = void.struct.create {
+		{"", "inherit", header},
+		{"count", "varint"},
+		{"offset", "zigzag"}
+	}
+	local compactMessage = void.struct.variant(header, "method", {[0] = kill, [1] = compactAdd})
+
+	local buffer = void.struct.write(compactMessage, {method = 1, id = 7, count = 200, offset = -70})
+	lunatest.assert_equal(void.buffer.length(buffer), header.size+2+2)
+	lunatest.assert_equal(void.struct.read(compactMessage, buffer).offset, -70)
+
+	local result = void.struct.dispatch(compactMessage, buffer, {
+		[1] = function(buf, method, id, count, offset, nextIndex)
+			lunatest.assert_equal(nextIndex, header.size+4)
+			return method+id+count+offset
+		end
+	})
+	lunatest.assert_equal(result, 1+7+200-70)
+
+	-- Only fields before the first varint have a fixed offset
+	local late = void.struct.create {{"id", "varint"}, {"tag", "u8"}}
+	lunatest.assert_error(function() void.struct.variant(late, "tag", {}) end)
+end
+
+return suite
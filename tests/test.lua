@@ -3,6 +3,13 @@ lunatest = require "lunatest"
 lunatest.suite "require"
 lunatest.suite "buffer"
 lunatest.suite "queue"
+lunatest.suite "topic"
+lunatest.suite "map"
+lunatest.suite "serialize"
+lunatest.suite "struct"
+lunatest.suite "pool"
+lunatest.suite "rpc"
+lunatest.suite "trace"
 
 --[[local void = require "void"
 
@@ -0,0 +1,84 @@
+local void = require "void"
+
+local suite = {}
+
+function suite.test_fan_out()
+	local topic = void.topic.create(4, "test_fan_out")
+	lunatest.assert_userdata(topic)
+	local a = void.topic.subscribe(topic)
+	local b = void.topic.subscribe(topic)
+
+	local buffer = void.buffer.fromString "Hello!"
+	lunatest.assert_true(void.topic.publish(topic, buffer))
+	lunatest.assert_equal(void.buffer.type(buffer), "invalid")
+
+	local bufa = void.topic.receive(a)
+	local bufb = void.topic.receive(b)
+	lunatest.assert_equal(void.buffer.asString(bufa), "Hello!")
+	lunatest.assert_equal(void.buffer.asString(bufb), "Hello!")
+	lunatest.assert_true(void.buffer.readOnly(bufa))
+	lunatest.assert_error(void.buffer.setU8, bufa, 0, 0)
+
+	lunatest.assert_nil(void.topic.receive(a))
+
+	-- A share could still write to the message after it was received
+	local shared = void.buffer.fromString "shared"
+	local twin = void.buffer.share(shared)
+	lunatest.assert_error(function() void.topic.publish(topic, shared) end)
+	void.buffer.invalidate(twin)
+	lunatest.assert_true(void.topic.publish(topic, shared))
+	lunatest.assert_equal(void.buffer.asString(void.topic.receive(a)), "shared")
+	lunatest.assert_equal(void.buffer.asString(void.topic.receive(b)), "shared")
+
+	void.topic.unsubscribe(a)
+	void.topic.unsubscribe(b)
+	void.topic.destroy(topic)
+end
+
+function suite.test_block()
+	local topic = void.topic.create(2, "test_block")
+	local sub = void.topic.subscribe(topic)
+
+	lunatest.assert_true(void.topic.publish(topic, void.buffer.fromString "1"))
+	lunatest.assert_true(void.topic.publish(topic, void.buffer.fromString "2"))
+	lunatest.assert_false(void.topic.publish(topic, void.buffer.fromString "3"))
+
+	lunatest.assert_equal(void.buffer.asString(void.topic.receive(sub)), "1")
+	lunatest.assert_true(void.topic.publish(topic, void.buffer.fromString "3"))
+
+	void.topic.unsubscribe(sub)
+	void.topic.destroy(topic)
+end
+
+function suite.test_drop_oldest()
+	local topic = void.topic.create(2, "test_drop_oldest", {policy = "dropOldest"})
+	local sub = void.topic.subscribe(topic)
+
+	for i=1, 5 do
+		lunatest.assert_true(void.topic.publish(topic, void.buffer.fromString(tostring(i))))
+	end
+
+	lunatest.assert_equal(void.topic.stats(sub).dropped, 3)
+	lunatest.assert_equal(void.buffer.asString(void.topic.receive(sub)), "4")
+	lunatest.assert_equal(void.buffer.asString(void.topic.receive(sub)), "5")
+
+	void.topic.unsubscribe(sub)
+	void.topic.destroy(topic)
+end
+
+function suite.test_disconnect()
+	local topic = void.topic.create(1, "test_disconnect", {policy = "disconnect"})
+	local slow = void.topic.subscribe(topic)
+
+	lunatest.assert_true(void.topic.publish(topic, void.buffer.fromString "1"))
+	lunatest.assert_true(void.topic.publish(topic, void.buffer.fromString "2"))
+
+	local buffer, err = void.topic.receive(slow)
+	lunatest.assert_nil(buffer)
+	lunatest.assert_equal(err, "disconnected")
+
+	void.topic.unsubscribe(slow)
+	void.topic.destroy(topic)
+end
+
+return suite
@@ -0,0 +1,125 @@
+local void = require "void"
+
+local suite = {}
+
+local point = void.struct.create {
+	{"x", "f64"},
+	{"y", "f64"}
+}
+
+function suite.test_trace_points()
+	void.trace.start()
+	lunatest.assert_true(void.trace.enabled())
+
+	local queue = void.queue.create(2, "test_trace_queue")
+	void.queue.enqueue(queue, void.buffer.create(16))
+	lunatest.assert_equal(void.buffer.type(void.queue.await(queue, 0)), "buffer")
+	lunatest.assert_equal(void.buffer.type(void.queue.await(queue, 0)), "invalid")
+	void.queue.destroy(queue)
+
+	local encoded = void.struct.write(point, {x = 1, y = 2})
+	lunatest.assert_equal(void.struct.read(point, encoded).y, 2)
+
+	local start = void.trace.begin()
+	lunatest.assert_number(start)
+	void.trace.finish("custom \"span\"", start, "label", 42)
+
+	local json, count = void.trace.stop()
+	lunatest.assert_false(void.trace.enabled())
+	lunatest.assert_gte(6, count)
+
+	lunatest.assert_match('^{"traceEvents":%[', json)
+	lunatest.assert_match('"name":"enqueue","cat":"queue","ph":"X"', json)
+	lunatest.assert_match('"label":"test_trace_queue","blockedNs":0', json)
+	lunatest.assert_match('"name":"await".-"received":1', json)
+	lunatest.assert_match('"name":"await".-"received":0', json)
+	lunatest.assert_match('"name":"buffer_create","cat":"buffer","ph":"i"', json)
+	lunatest.assert_match('"name":"struct_encode"', json)
+	lunatest.assert_match('"name":"struct_decode"', json)
+	lunatest.assert_match('"name":"custom \\"span\\"".-"label":"label","value":42', json)
+	lunatest.assert_match('"ph":"M"', json)
+
+	-- The events stay until the next start
+	local again = void.trace.stop()
+	lunatest.assert_equal(again, json)
+end
+
+-- Tracing is process wide, a worker that loaded void before the trace started records too
+function suite.test_trace_other_state()
+	local reader = [[
+		local void = require "void"
+		local point = void.struct.create {{"x", "f64"}, {"y", "f64"}}
+		return function(buffer)
+			local reply = void.buffer.create(8)
+			void.buffer.setF64(reply, 0, void.struct.read(point, buffer).y)
+			return reply
+		end
+	]]
+	local pool = void.pool.create(1, reader)
+
+	void.trace.start()
+	lunatest.assert_true(void.pool.submit(pool, void.struct.write(point, {x = 1, y = 2}), true))
+	local reply = void.queue.await(void.pool.replies(pool), 5000)
+	lunatest.assert_equal(void.buffer.getF64(reply, 0), 2)
+
+	local json = void.trace.stop()
+	lunatest.assert_match('"name":"struct_decode"', json)
+	void.pool.destroy(pool)
+end
+
+function suite.test_trace_disabled()
+	void.trace.start()
+	void.trace.stop()
+	lunatest.assert_nil(void.trace.begin())
+
+	local queue = void.queue.create(2, "test_trace_disabled")
+	void.queue.enqueue(queue, void.buffer.create(16))
+	void.queue.await(queue, 0)
+	void.queue.destroy(queue)
+
+	local json, count = void.trace.stop()
+	lunatest.assert_equal(count, 0)
+	lunatest.assert_nil(json:find("test_trace_disabled", 1, true))
+end
+
+function suite.test_trace_blocked()
+	-- A small ring keeps the newest events
+	void.trace.start {events = 4}
+
+	local queue = void.queue.create(1, "test_trace_blocked")
+	void.queue.enqueue(queue, void.buffer.create(1))
+
+	local thread = require "llthreads2"
+	local consumer = thread.new [[
+		local void = require "void"
+		local queue = void.queue.get "test_trace_blocked"
+		local start = void.clock()
+		while void.clock()-start < 0.02 do end
+		void.queue.await(queue, -1)
+		void.queue.destroy(queue)
+	]]
+	consumer:start()
+
+	-- Waits until the consumer made room
+	void.queue.enqueue(queue, void.buffer.create(1), true)
+	consumer:join()
+	void.queue.destroy(queue)
+
+	local path = os.tmpname()
+	lunatest.assert_gte(1, void.trace.stop(path))
+
+	local file = io.open(path)
+	local json = file:read "a"
+	file:close()
+	os.remove(path)
+
+	local blocked = 0
+	for ns in json:gmatch '"label":"test_trace_blocked","blockedNs":(%d+)' do
+		blocked = math.max(blocked, tonumber(ns))
+	end
+	lunatest.assert_gte(10000000, blocked)
+	-- The consumer thread has its own ring
+	lunatest.assert_match('"tid":2', json)
+end
+
+return suite